@@ -20,7 +20,10 @@
 #include "bgen_lib.hpp"
 #include "binarygen_setters.hpp"
 #include "genotype.hpp"
+#include "genotype_cache.hpp"
 #include "reporter.hpp"
+#include <iomanip>
+#include <sstream>
 #include <stdexcept>
 #include <zlib.h>
 
@@ -51,6 +54,8 @@ protected:
     typedef std::vector<std::vector<double>> Data;
     std::vector<genfile::bgen::Context> m_context_map;
     std::vector<genfile::byte_t> m_buffer1, m_buffer2;
+    // intermediate file generated by this run, removed once we are done
+    std::string m_intermediate_file;
     bool m_target_plink = false;
     bool m_ref_plink = false;
     bool m_has_external_sample = false;
@@ -121,12 +126,14 @@ protected:
         assert(m_unfiltered_sample_ct);
         try
         {
+            // this is called by the clumping threads, each of them needs
+            // its own decompression buffers
+            thread_local std::vector<genfile::byte_t> buffer1, buffer2;
             PLINK_generator setter(subset_mask, mainbuf, m_hard_threshold,
                                    m_dose_threshold);
             genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
                 genotype_file, m_genotype_file_names[file_idx] + ".bgen",
-                m_context_map[file_idx], setter, &m_buffer1, &m_buffer2,
-                byte_pos);
+                m_context_map[file_idx], setter, &buffer1, &buffer2, byte_pos);
         }
         catch (...)
         {
@@ -136,18 +143,53 @@ protected:
     }
 
     void count_and_read_genotype(const std::unique_ptr<SNP>&) override;
-    void read_score(std::vector<PRS>& prs_list,
+    size_t dosage_storage_word() const override
+    {
+        return DosageRecord::num_word(m_sample_ct);
+    }
+    /*!
+     * \brief Dosage record of a SNP stored in memory
+     */
+    DosageRecord dosage_record(uintptr_t* genotype) const
+    {
+        // weighted dosages are within the range of the weights
+        const double min =
+            std::min({0.0, m_homcom_weight, m_het_weight, m_homrar_weight});
+        const double max =
+            std::max({0.0, m_homcom_weight, m_het_weight, m_homrar_weight});
+        return DosageRecord(genotype, m_sample_ct, min, max);
+    }
+    void read_score(SamplePRS& prs_list,
                     const std::vector<size_t>::const_iterator& start_idx,
                     const std::vector<size_t>::const_iterator& end_idx,
-                    bool reset_zero) override;
-    void hard_code_score(std::vector<PRS>& prs_list,
+                    bool reset_zero, GenotypeBuffer& buffer) override;
+    void hard_code_score(SamplePRS& prs_list,
                          const std::vector<size_t>::const_iterator& start_idx,
                          const std::vector<size_t>::const_iterator& end_idx,
-                         bool reset_zero);
-    void dosage_score(std::vector<PRS>& prs_list,
+                         bool reset_zero, GenotypeBuffer& buffer);
+    void dosage_score(SamplePRS& prs_list,
                       const std::vector<size_t>::const_iterator& start_idx,
                       const std::vector<size_t>::const_iterator& end_idx,
-                      bool reset_zero);
+                      bool reset_zero, GenotypeBuffer& buffer);
+    /*!
+     * \brief Read and decompress the genotype blocks of the next batch of
+     * SNPs that have to be parsed from the bgen file. The blocks are read in
+     * order, then decompressed by the workers of the buffer's decoder
+     * \param start_idx is the first SNP of the batch
+     * \param end_idx is the end of the SNPs to be scored
+     * \param buffer is the scoring buffer holding the decoder
+     * \return the end of the batch. The i th block of the decoder belongs to
+     * the i th SNP within the batch that has to be parsed
+     */
+    std::vector<size_t>::const_iterator
+    decode_blocks(const std::vector<size_t>::const_iterator& start_idx,
+                  const std::vector<size_t>::const_iterator& end_idx,
+                  GenotypeBuffer& buffer);
+    bool parse_from_file(const std::unique_ptr<SNP>& snp) const
+    {
+        return snp->current_genotype() == nullptr
+               && !(m_hard_coded && m_intermediate);
+    }
 
     /*
      * Different structures use for reading in the bgen info
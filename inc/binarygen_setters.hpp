@@ -5,15 +5,94 @@
 #include "misc.hpp"
 #include "plink_common.hpp"
 #include "storage.hpp"
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 #include <zlib.h>
 
+/*!
+ * \brief Weighted dosages of a SNP stored in memory, such that the SNP can be
+ * scored without parsing the bgen file again. The record starts with the
+ * missing mask of the samples, followed by the dosage of each sample stored
+ * in 16 bits as a multiple of 1 / level_per_unit above min. A bgen
+ * probability with b bits is a multiple of 1 / (2^b - 1), so the dosages are
+ * only kept exactly when 2^b - 1 divides level_per_unit (see exact)
+ */
+class DosageRecord
+{
+public:
+    // 128 * 255, such that 8 bits probabilities are exact and weights up to 2
+    // still fit into 16 bits
+    static constexpr uint32_t level_per_unit = 32640;
+    DosageRecord(uintptr_t* data, const size_t num_sample, const double min,
+                 const double max)
+        : m_missing(data)
+        , m_dosage(reinterpret_cast<uint16_t*>(data
+                                               + BITCT_TO_WORDCT(num_sample)))
+        , m_num_sample(num_sample)
+        , m_min(min)
+        , m_max_level(std::min(std::max(max - min, 0.0) * level_per_unit,
+                               65535.0))
+    {
+    }
+    /*!
+     * \brief Check if dosages derived from probabilities with the given
+     * number of bits are stored without any rounding
+     */
+    static bool exact(const uint32_t bits)
+    {
+        return bits > 0 && bits < 32
+               && level_per_unit % ((uint32_t(1) << bits) - 1) == 0;
+    }
+    /*!
+     * \brief Number of words required to store the record
+     */
+    static size_t num_word(const size_t num_sample)
+    {
+        return BITCT_TO_WORDCT(num_sample)
+               + (num_sample * sizeof(uint16_t) + sizeof(uintptr_t) - 1)
+                     / sizeof(uintptr_t);
+    }
+    size_t num_sample() const { return m_num_sample; }
+    bool missing(const size_t i) const { return IS_SET(m_missing, i); }
+    double dosage(const size_t i) const
+    {
+        return m_min + m_dosage[i] * m_scale;
+    }
+    void clear()
+    {
+        std::fill(m_missing, m_missing + BITCT_TO_WORDCT(m_num_sample), 0);
+    }
+    void set_missing(const size_t i) { SET_BIT(i, m_missing); }
+    /*!
+     * \brief Store the dosage of sample i
+     * \return false if the dosage is outside of [min, max]
+     */
+    bool set_dosage(const size_t i, const double dosage)
+    {
+        const double level = (dosage - m_min) * level_per_unit;
+        // also catch NaN
+        if (!(level > -0.5 && level < m_max_level + 0.5)) return false;
+        m_dosage[i] = static_cast<uint16_t>(
+            std::lround(std::min(std::max(level, 0.0), m_max_level)));
+        return true;
+    }
+
+private:
+    static constexpr double m_scale = 1.0 / level_per_unit;
+    uintptr_t* m_missing;
+    uint16_t* m_dosage;
+    size_t m_num_sample;
+    double m_min;
+    double m_max_level;
+};
+
 // TODO: Use ref MAf for dosage score too
 class PRS_Interpreter
 {
 public:
     virtual ~PRS_Interpreter() {}
-    PRS_Interpreter(std::vector<PRS>* sample_prs,
+    PRS_Interpreter(SamplePRS* sample_prs,
                     std::vector<uintptr_t>* sample_inclusion,
                     MISSING_SCORE missing)
         : m_sample_prs(sample_prs), m_sample_inclusion(sample_inclusion)
@@ -121,9 +200,26 @@ public:
     }
     virtual void process_missing() {}
     virtual void process_centre_missing() {}
+    /*!
+     * \brief Score the SNP from the dosages stored by Dosage_Store instead of
+     * parsing its genotype probabilities. set_stat must be called first
+     */
+    void score_stored(const DosageRecord& record)
+    {
+        initialise(0, 0);
+        m_ploidy = 2;
+        for (size_t i = 0; i < record.num_sample(); ++i)
+        {
+            m_is_missing = record.missing(i);
+            if (!m_is_missing) m_sum = record.dosage(i);
+            add_prs_score(m_prs_sample_i);
+            ++m_prs_sample_i;
+        }
+        finalise();
+    }
 
 protected:
-    std::vector<PRS>* m_sample_prs;
+    SamplePRS* m_sample_prs;
     std::vector<uintptr_t>* m_sample_inclusion;
     std::vector<size_t> m_missing;
     std::vector<double> m_probs;
@@ -136,8 +232,8 @@ protected:
     double m_adj_score = 0.0;
     double m_cal_expected = 0.0;
     uint32_t m_prs_sample_i = 0;
-    size_t m_ploidy = 2;
-    size_t m_miss_count = 0;
+    uint32_t m_ploidy = 2;
+    uint32_t m_miss_count = 0;
     bool m_is_missing = false;
     bool m_phased = false;
     bool m_setzero = false;
@@ -148,8 +244,8 @@ protected:
 class First_PRS : public PRS_Interpreter
 {
 public:
-    First_PRS(std::vector<PRS>* sample_prs,
-              std::vector<uintptr_t>* sample_inclusion, MISSING_SCORE missing)
+    First_PRS(SamplePRS* sample_prs, std::vector<uintptr_t>* sample_inclusion,
+              MISSING_SCORE missing)
         : PRS_Interpreter(sample_prs, sample_inclusion, missing)
     {
     }
@@ -161,8 +257,8 @@ public:
         // assign the PRS
         else
         {
-            (*m_sample_prs)[idx].num_snp = m_ploidy;
-            (*m_sample_prs)[idx].prs = m_sum * m_stat;
+            m_sample_prs->num_snp[idx] = m_ploidy;
+            m_sample_prs->prs[idx] = m_sum * m_stat;
             dose_statistic.push(m_sum);
         }
     }
@@ -173,8 +269,8 @@ public:
         {
             if (cur_idx < m_missing.size() && i == m_missing[cur_idx])
             {
-                (*m_sample_prs)[i].prs = m_miss_score;
-                (*m_sample_prs)[i].num_snp = m_miss_count;
+                m_sample_prs->prs[i] = m_miss_score;
+                m_sample_prs->num_snp[i] = m_miss_count;
                 ++cur_idx;
             }
             else if (m_centre)
@@ -182,7 +278,7 @@ public:
                 // if it is not missing and we want the centre the
                 // score we will need to minus the adjusted score
                 // which was 0 before this run
-                (*m_sample_prs)[i].prs -= m_adj_score;
+                m_sample_prs->prs[i] -= m_adj_score;
             }
         }
     }
@@ -192,16 +288,16 @@ public:
         // information
         for (auto&& idx : m_missing)
         {
-            (*m_sample_prs)[idx].prs = m_miss_score;
-            (*m_sample_prs)[idx].num_snp = m_miss_count;
+            m_sample_prs->prs[idx] = m_miss_score;
+            m_sample_prs->num_snp[idx] = m_miss_count;
         }
     }
 };
 class Add_PRS : public PRS_Interpreter
 {
 public:
-    Add_PRS(std::vector<PRS>* sample_prs,
-            std::vector<uintptr_t>* sample_inclusion, MISSING_SCORE missing)
+    Add_PRS(SamplePRS* sample_prs, std::vector<uintptr_t>* sample_inclusion,
+            MISSING_SCORE missing)
         : PRS_Interpreter(sample_prs, sample_inclusion, missing)
     {
     }
@@ -214,8 +310,8 @@ public:
         else
         {
 
-            (*m_sample_prs)[idx].num_snp += m_ploidy;
-            (*m_sample_prs)[idx].prs += m_sum * m_stat;
+            m_sample_prs->num_snp[idx] += m_ploidy;
+            m_sample_prs->prs[idx] += m_sum * m_stat;
             dose_statistic.push(m_sum);
         }
     }
@@ -226,8 +322,8 @@ public:
         {
             if (cur_idx < m_missing.size() && i == m_missing[cur_idx])
             {
-                (*m_sample_prs)[i].prs += m_miss_score;
-                (*m_sample_prs)[i].num_snp += m_miss_count;
+                m_sample_prs->prs[i] += m_miss_score;
+                m_sample_prs->num_snp[i] += m_miss_count;
                 ++cur_idx;
             }
             else if (m_centre)
@@ -235,7 +331,7 @@ public:
                 // if it is not missing and we want the centre the
                 // score we will need to minus the adjusted score
                 // which was 0 before this run
-                (*m_sample_prs)[i].prs -= m_adj_score;
+                m_sample_prs->prs[i] -= m_adj_score;
             }
         }
     }
@@ -245,12 +341,43 @@ public:
         // information
         for (auto&& idx : m_missing)
         {
-            (*m_sample_prs)[idx].prs += m_miss_score;
-            (*m_sample_prs)[idx].num_snp += m_miss_count;
+            m_sample_prs->prs[idx] += m_miss_score;
+            m_sample_prs->num_snp[idx] += m_miss_count;
         }
     }
 };
 
+/*!
+ * \brief Store the weighted dosages of a SNP into a DosageRecord. The record
+ * is only valid if all samples are diploid and all dosages are within the
+ * range of the record
+ */
+class Dosage_Store : public PRS_Interpreter
+{
+public:
+    Dosage_Store(std::vector<uintptr_t>* sample_inclusion, DosageRecord& record)
+        : PRS_Interpreter(nullptr, sample_inclusion, MISSING_SCORE::SET_ZERO)
+        , m_record(record)
+    {
+        m_record.clear();
+    }
+    virtual ~Dosage_Store() {}
+    void add_prs_score(size_t idx)
+    {
+        m_valid &= (m_ploidy == 2 && idx < m_record.num_sample());
+        if (!m_valid) return;
+        if (m_is_missing) { m_record.set_missing(idx); }
+        else
+        {
+            m_valid = m_record.set_dosage(idx, m_sum);
+        }
+    }
+    bool valid() const { return m_valid; }
+
+private:
+    DosageRecord& m_record;
+    bool m_valid = true;
+};
 
 struct PLINK_generator
 {
@@ -21,8 +21,11 @@
 #include "commander.hpp"
 #include "genotype.hpp"
 #include "misc.hpp"
+#include "prefetch_ring.hpp"
 #include "reporter.hpp"
+#include <array>
 #include <functional>
+#include <thread>
 class BinaryPlink : public Genotype
 {
 public:
@@ -46,6 +49,8 @@ public:
     ~BinaryPlink();
 
 protected:
+    // full path to the bed files, avoid rebuilding the name for every read
+    std::vector<std::string> m_bed_names;
     std::vector<uintptr_t> m_sample_mask;
     std::streampos m_prev_loc = 0;
     std::vector<Sample_ID> gen_sample_vector() override;
@@ -79,7 +84,7 @@ protected:
         auto&& load_target = (m_unfiltered_sample_ct == m_sample_ct)
                                  ? snp_genotype
                                  : m_tmp_genotype.data();
-        m_genotype_file.read(m_genotype_file_names[file_idx] + ".bed", byte_pos,
+        m_genotype_file.read(m_bed_names[file_idx], byte_pos,
                              unfiltered_sample_ct4,
                              reinterpret_cast<char*>(load_target));
         uint32_t homrar_ct = 0;
@@ -138,7 +143,7 @@ protected:
             (m_unfiltered_sample_ct == selected_size) ? genotype : tmp_genotype;
         // now we start reading / parsing the binary from the file
         assert(unfiltered_sample_ct);
-        genotype_file.read(m_genotype_file_names[file_idx] + ".bed", byte_pos,
+        genotype_file.read(m_bed_names[file_idx], byte_pos,
                            unfiltered_sample_ct4,
                            reinterpret_cast<char*>(load_target));
         if (m_unfiltered_sample_ct != selected_size)
@@ -153,11 +158,37 @@ protected:
             genotype[(m_unfiltered_sample_ct - 1) / BITCT2] &= final_mask;
         }
     }
+    /*!
+     * \brief Read the genotype of a target SNP for scoring
+     * \param snp is the SNP to be read
+     * \param genotype_file is the file handle used for reading
+     * \param tmp_genotype is the temporary storage for the raw genotype
+     * \param genotype return the genotype of samples included in the PRS
+     * \param count return the genotype counts (homcom, het, homrar, missing)
+     * of the SNP, which are calculated if they are not available
+     */
+    void read_score_genotype(SNP& snp, FileRead& genotype_file,
+                             uintptr_t* tmp_genotype, uintptr_t* genotype,
+                             std::array<uint32_t, 4>& count);
+    /*!
+     * \brief Merge the records of the SNPs from cur that need to be read
+     * from the file and lie close to each other into one span, and prefetch
+     * it. SNPs within a threshold are sorted by their file location, so
+     * this turns the reads of a threshold into a few large sequential reads
+     * \param cur is the first SNP to be read
+     * \param end is the end of the SNPs to be read
+     * \param genotype_file is the file handle used for reading
+     * \return the end of the SNPs covered by the span
+     */
+    std::vector<size_t>::const_iterator
+    prefetch_span(std::vector<size_t>::const_iterator cur,
+                  const std::vector<size_t>::const_iterator& end,
+                  FileRead& genotype_file);
     virtual void
-    read_score(std::vector<PRS>& prs_list,
+    read_score(SamplePRS& prs_list,
                const std::vector<size_t>::const_iterator& start_idx,
                const std::vector<size_t>::const_iterator& end_idx,
-               bool reset_zero) override;
+               bool reset_zero, GenotypeBuffer& buffer) override;
 
     // modified version of the
     // single_marker_freqs_and_hwe function from PLINK (plink_filter.c)
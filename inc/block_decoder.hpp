@@ -0,0 +1,268 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BLOCK_DECODER_H
+#define BLOCK_DECODER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/*!
+ * \brief zlib decompressor that keeps its inflate state between blocks.
+ * Unlike zlib's uncompress, which allocates and initializes a new state on
+ * every call, the state is only reset before each block
+ */
+class ZlibInflater
+{
+public:
+    ZlibInflater() {}
+    ZlibInflater(const ZlibInflater&) = delete;
+    ZlibInflater& operator=(const ZlibInflater&) = delete;
+    ~ZlibInflater()
+    {
+        if (m_init) inflateEnd(&m_stream);
+    }
+    /*!
+     * \brief Decompress a zlib block
+     * \param begin is the start of the compressed data
+     * \param end is the end of the compressed data
+     * \param dest is the destination, must be large enough to hold the
+     * uncompressed data
+     * \param dest_size is the size of dest
+     * \return the size of the uncompressed data
+     */
+    size_t inflate(const uint8_t* begin, const uint8_t* end, uint8_t* dest,
+                   const size_t dest_size)
+    {
+        const size_t source_size = static_cast<size_t>(end - begin);
+        if (source_size > std::numeric_limits<uInt>::max()
+            || dest_size > std::numeric_limits<uInt>::max())
+        {
+            throw std::runtime_error(
+                "Error: Compressed genotype block is too large");
+        }
+        if (!m_init)
+        {
+            m_stream.zalloc = Z_NULL;
+            m_stream.zfree = Z_NULL;
+            m_stream.opaque = Z_NULL;
+            m_stream.next_in = Z_NULL;
+            m_stream.avail_in = 0;
+            if (inflateInit(&m_stream) != Z_OK)
+            {
+                throw std::runtime_error(
+                    "Error: Cannot initialize zlib decompression");
+            }
+            m_init = true;
+        }
+        else if (inflateReset(&m_stream) != Z_OK)
+        {
+            throw std::runtime_error("Error: Cannot reset zlib decompression");
+        }
+        m_stream.next_in = const_cast<Bytef*>(begin);
+        m_stream.avail_in = static_cast<uInt>(source_size);
+        m_stream.next_out = dest;
+        m_stream.avail_out = static_cast<uInt>(dest_size);
+        if (::inflate(&m_stream, Z_FINISH) != Z_STREAM_END)
+        {
+            throw std::runtime_error(
+                "Error: Cannot decompress genotype block, the file might be "
+                "corrupted");
+        }
+        return dest_size - m_stream.avail_out;
+    }
+
+private:
+    z_stream m_stream;
+    bool m_init = false;
+};
+
+/*!
+ * \brief Decompress a batch of genotype blocks on multiple threads. The
+ * caller reads the compressed blocks into the batch, decodes them and then
+ * parses the decoded blocks in order. Each worker has its own inflater, and
+ * the blocks, inflaters and worker threads are kept between batches such
+ * that their memory and states are reused
+ */
+class BlockDecoder
+{
+public:
+    struct Block
+    {
+        std::vector<uint8_t> compressed;
+        std::vector<uint8_t> data;
+        // index of the file the block was read from
+        size_t file_idx = 0;
+    };
+    // number of blocks read per worker in each batch
+    static constexpr size_t block_per_worker = 4;
+    BlockDecoder() {}
+    BlockDecoder(const BlockDecoder&) = delete;
+    BlockDecoder& operator=(const BlockDecoder&) = delete;
+    ~BlockDecoder()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_cond_job.notify_all();
+        for (auto&& worker : m_workers) worker.join();
+    }
+    /*!
+     * \brief Set the number of threads used for decoding, 1 to decode on the
+     * calling thread only
+     */
+    void set_num_worker(const size_t num_worker)
+    {
+        m_num_worker = std::max<size_t>(1, num_worker);
+    }
+    size_t num_worker() const { return m_num_worker; }
+    /*!
+     * \brief Return the i th block of the batch, the batch grows as required
+     */
+    Block& block(const size_t i)
+    {
+        while (m_blocks.size() <= i)
+        { m_blocks.emplace_back(std::make_unique<Block>()); }
+        return *m_blocks[i];
+    }
+    /*!
+     * \brief Return the inflater of a worker
+     */
+    ZlibInflater& inflater(const size_t worker)
+    {
+        while (m_inflaters.size() <= worker)
+        { m_inflaters.emplace_back(std::make_unique<ZlibInflater>()); }
+        return *m_inflaters[worker];
+    }
+    /*!
+     * \brief Decode the first num_block blocks of the batch. The blocks are
+     * interleaved across the workers, with the first worker being the calling
+     * thread. The other workers are started on the first batch that needs
+     * them and wait for the next batch once done. Exceptions thrown by the
+     * decode function are rethrown once all workers are done
+     * \param num_block is the number of blocks to decode
+     * \param work is the number of compressed bytes of the batch, used to
+     * decide if there is enough work to justify waking up the workers
+     * \param decode is called with each block and the inflater of the worker
+     */
+    template <typename Decode>
+    void decode(const size_t num_block, const size_t work, Decode&& decode)
+    {
+        if (num_block == 0) return;
+        const size_t num_worker =
+            std::min({m_num_worker, num_block,
+                      std::max<size_t>(1, work / min_work_per_worker)});
+        // make sure the blocks and inflaters exist before the workers start
+        block(num_block - 1);
+        inflater(num_worker - 1);
+        std::vector<std::exception_ptr> errors(num_worker, nullptr);
+        auto run = [&](size_t worker) {
+            try
+            {
+                for (size_t i = worker; i < num_block; i += num_worker)
+                { decode(*m_blocks[i], *m_inflaters[worker]); }
+            }
+            catch (...)
+            {
+                errors[worker] = std::current_exception();
+            }
+        };
+        if (num_worker > 1)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_job = run;
+                m_batch_worker = num_worker;
+                m_pending = num_worker - 1;
+                ++m_batch;
+            }
+            // the calling thread is worker 0
+            while (m_workers.size() + 1 < num_worker)
+            {
+                m_workers.emplace_back(&BlockDecoder::loop, this,
+                                       m_workers.size() + 1);
+            }
+            m_cond_job.notify_all();
+        }
+        run(0);
+        if (num_worker > 1)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond_done.wait(lock, [this] { return m_pending == 0; });
+            m_job = nullptr;
+        }
+        for (auto&& error : errors)
+        {
+            if (error) std::rethrow_exception(error);
+        }
+    }
+    // waking up the workers costs a few microseconds, only worth it when
+    // each worker has a reasonable amount of data to decompress
+    static constexpr size_t min_work_per_worker = 1 << 16;
+
+private:
+    void loop(const size_t worker)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // a worker is started during a batch and takes part in it
+        size_t seen_batch = m_batch - 1;
+        while (true)
+        {
+            m_cond_job.wait(
+                lock, [&] { return m_quit || m_batch != seen_batch; });
+            if (m_quit) return;
+            seen_batch = m_batch;
+            // workers beyond the size of the batch sit it out
+            if (worker >= m_batch_worker) continue;
+            lock.unlock();
+            // run doesn't throw, errors are stored for the calling thread
+            m_job(worker);
+            lock.lock();
+            if (--m_pending == 0) m_cond_done.notify_one();
+        }
+    }
+    std::vector<std::unique_ptr<Block>> m_blocks;
+    std::vector<std::unique_ptr<ZlibInflater>> m_inflaters;
+    // worker threads other than the calling thread, worker i + 1 is
+    // m_workers[i]
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_job;
+    std::condition_variable m_cond_done;
+    // decodes the blocks of a worker in the current batch
+    std::function<void(size_t)> m_job;
+    // number of batches handed to the workers, the number of workers of the
+    // current batch and how many of them (besides the caller) are still busy
+    size_t m_batch = 0;
+    size_t m_batch_worker = 0;
+    size_t m_pending = 0;
+    size_t m_num_worker = 1;
+    bool m_quit = false;
+};
+
+#endif // BLOCK_DECODER_H
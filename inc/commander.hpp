@@ -77,6 +77,7 @@ public:
         return !m_clump_info.no_clump || m_prs_info.use_ref_maf;
     }
     bool use_inter() const { return m_allow_inter; }
+    std::string cache_dir() const { return m_cache_dir; }
     std::string delim() const { return m_id_delim; }
     std::string out() const { return m_out_prefix; }
     std::string exclusion_range() const { return m_exclusion_range; }
@@ -103,6 +104,7 @@ protected:
     std::string m_exclusion_range = "";
     std::string m_exclude_file = "";
     std::string m_extract_file = "";
+    std::string m_cache_dir = "";
     std::string m_help_message;
     std::string m_chr_id_formula;
     size_t m_memory = 1e10;
@@ -546,6 +548,7 @@ protected:
 
     inline bool set_memory(const std::string& input)
     {
+        m_provided_memory = true;
         return parse_unit_value(input, "memory", 2, m_memory, true);
     }
     inline bool set_info(const std::string& in)
@@ -633,6 +636,25 @@ protected:
         m_parameter_log["model"] = input;
         return true;
     }
+    inline bool set_clump_ld(const std::string& in)
+    {
+        std::string input = in;
+        misc::to_lower(input);
+        check_duplicate("clump-ld");
+        if (input == "em") { m_clump_info.ld = CLUMP_LD::EM; }
+        else if (input == "dosage")
+        {
+            m_clump_info.ld = CLUMP_LD::DOSAGE;
+        }
+        else
+        {
+            m_error_message.append("Error: Unrecognized LD measure: " + in
+                                   + "!\n");
+            return false;
+        }
+        m_parameter_log["clump-ld"] = input;
+        return true;
+    }
     inline bool set_score(const std::string& in)
     {
         std::string input = in;
@@ -117,6 +117,19 @@ enum class SCORING
     SUM
 };
 
+enum class CLUMP_LD
+{
+    EM = 0,
+    DOSAGE
+};
+
+enum class PERM_MODEL
+{
+    LINEAR = 0,
+    LOGISTIC,
+    SCORE
+};
+
 enum class FILTER_COUNT
 {
     DUP_SNP = 0,
@@ -19,16 +19,23 @@
 #define GENOTYPE_H
 
 #include "IITree.h"
+#include "block_decoder.hpp"
 #include "commander.hpp"
 #include "genotype_pool.hpp"
+#include "ld_kernel.hpp"
+#include "memory_budget.hpp"
 #include "misc.hpp"
 #include "plink_common.hpp"
+#include "prefetch_ring.hpp"
 #include "reporter.hpp"
 #include "snp.hpp"
 #include "storage.hpp"
 #include "thread_queue.hpp"
+#include "work_stealing_queue.hpp"
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cctype>
 #include <cstdio>
@@ -53,6 +60,55 @@
 
 #define MULTIPLEX_LD 1920
 #define MULTIPLEX_2LD (MULTIPLEX_LD * 2)
+/*!
+ * \brief A block of SNPs waiting to be added to the PRS
+ */
+struct PRSBlock
+{
+    // storage of genotypes read from file
+    std::vector<uintptr_t> genotype;
+    std::vector<const uintptr_t*> genotype_ptr;
+    std::vector<size_t> snp_idx;
+    // contribution of each (inverted) genotype code of each SNP
+    std::vector<std::array<double, 4>> geno_score;
+    std::vector<std::array<uint32_t, 4>> geno_count;
+    // byte look up table of each SNP
+    std::vector<double, AlignedAllocator<double>> score_table;
+    std::vector<uint32_t, AlignedAllocator<uint32_t>> count_table;
+    // dense score and SNP count tile of (sample x SNP) used when building the
+    // score matrix
+    Eigen::MatrixXd tile_score;
+    Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic> tile_count;
+    // score and SNP count of the SNPs read by this buffer on every column of
+    // the score matrix, summed over the buffers once all of them are done
+    Eigen::MatrixXd score_matrix;
+    Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic> count_matrix;
+    size_t genotype_size = 0;
+    size_t num_snp = 0;
+};
+
+/*!
+ * \brief Scratch space used for reading in the genotypes during scoring. Each
+ * scoring thread owns one such that they don't share any file handle or
+ * buffer
+ */
+struct GenotypeBuffer
+{
+    FileRead genotype_file;
+    std::vector<uintptr_t> tmp_genotype;
+    PRSBlock prs_block;
+    // buffers for bgen parsing
+    std::vector<uint8_t> buffer1, buffer2;
+    // batch of bgen genotype blocks decompressed ahead of parsing
+    BlockDecoder bgen_decoder;
+    // genotypes and counts (homcom, het, homrar, missing) of the SNPs read
+    // ahead by the prefetch thread, one slot per SNP
+    std::vector<uintptr_t> prefetch_genotype;
+    std::vector<std::array<uint32_t, 4>> prefetch_count;
+    // reader thread of the prefetch, kept between read_score calls
+    PrefetchThread prefetcher;
+};
+
 class Genotype
 {
 public:
@@ -291,7 +347,8 @@ public:
             BITCT_TO_WORDCT(m_unfiltered_sample_ct);
         const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
         m_tmp_genotype.resize(unfiltered_sample_ctv2, 0);
-        m_prs_info.resize(m_sample_ct, PRS());
+        init_score_buffer(1);
+        m_prs_info.resize(m_sample_ct);
         m_sample_include2.resize(unfiltered_sample_ctv2, 0);
         m_founder_include2.resize(unfiltered_sample_ctv2, 0);
         // fill it with the required mask (copy from PLINK2)
@@ -306,12 +363,43 @@ public:
     void clumping(const Clumping& clump_info, Genotype& reference,
                   size_t threads);
     std::vector<std::pair<size_t, size_t>> get_chrom_boundary();
+    /*!
+     * \brief Split the SNPs into segments that can be clumped independently.
+     * Segments are cut between chromosomes and wherever no clumping window
+     * spans the boundary. Runs of overlapping windows longer than
+     * max_segment_snp are further cut at boundaries that no pair of SNPs in
+     * LD crosses. Will reorder m_sort_by_p_index such that SNPs of each
+     * segment are stored consecutively (in p-value order)
+     * \param clump_info contains the clumping thresholds
+     * \param reference is the genotype used for the LD calculation
+     * \param max_segment_snp is the targeted size of the segments, 0 to only
+     * cut at the window gaps
+     * \param threads is the number of threads used to search for the cuts
+     * \return range of each segment on m_sort_by_p_index
+     */
+    std::vector<std::pair<size_t, size_t>>
+    get_clump_segments(const Clumping& clump_info, Genotype& reference,
+                       const size_t max_segment_snp, const size_t threads);
+    /*!
+     * \brief Search for a boundary within [start, end) that no pair of SNPs
+     * in LD crosses, starting from ideal and moving outward. Cutting a
+     * segment at such boundary does not change the clumping result
+     * \return the first SNP after the boundary, 0 if none was found
+     */
+    size_t find_ld_free_cut(const size_t start, const size_t end,
+                            const size_t ideal, const Clumping& clump_info,
+                            Genotype& reference, GenotypePool& pool);
+    /*!
+     * \brief Clump the segments taken from jobs. The genotypes of the window
+     * are stored in the pool shared by all the clumping threads
+     */
     template <typename T>
-    void
-    threaded_clumping(const std::vector<std::pair<size_t, size_t>> snp_range,
-                      const Clumping& clump_info, T& progress_observer,
-                      std::vector<std::atomic<bool>>& remained_snps,
-                      std::atomic<size_t>& num_core, Genotype& reference);
+    void threaded_clumping(WorkStealingQueue<std::pair<size_t, size_t>>& jobs,
+                           const size_t worker, const Clumping& clump_info,
+                           T& progress_observer,
+                           std::vector<std::atomic<bool>>& remained_snps,
+                           std::atomic<size_t>& num_core, GenotypePool& pool,
+                           Genotype& reference);
 
     /*!
      * \brief Before each run of PRSice, we need to reset the in regression
@@ -419,13 +507,22 @@ public:
      * \param i is the sample index
      * \return the PRS
      */
-    inline double calculate_score(const std::vector<PRS>& prs_list,
-                                  size_t i) const
+    inline double calculate_score(const SamplePRS& prs_list, size_t i) const
+    {
+        return calculate_score(prs_list, i, m_mean_score, m_score_sd);
+    }
+    /*!
+     * \brief Same as calculate_score, with the mean and SD used for
+     * standardization returned by the thread safe get_score
+     */
+    inline double calculate_score(const SamplePRS& prs_list, size_t i,
+                                  const double mean_score,
+                                  const double score_sd) const
     {
         if (i >= prs_list.size())
             throw std::out_of_range("Sample name vector out of range");
-        const size_t num_snp = prs_list[i].num_snp;
-        double prs = prs_list[i].prs;
+        const uint32_t num_snp = prs_list.num_snp[i];
+        double prs = prs_list.prs[i];
         double avg = prs;
         if (num_snp == 0) { avg = 0.0; }
         else
@@ -434,9 +531,9 @@ public:
         }
         switch (m_prs_calculation.scoring_method)
         {
-        case SCORING::SUM: return prs_list[i].prs;
+        case SCORING::SUM: return prs;
         case SCORING::STANDARDIZE:
-        case SCORING::CONTROL_STD: return (avg - m_mean_score) / m_score_sd;
+        case SCORING::CONTROL_STD: return (avg - mean_score) / score_sd;
         default:
             // default is avg
             return avg;
@@ -457,7 +554,7 @@ public:
      * \param require_standardize is a boolean representing if we need to
      * calculate the mean and SD
      */
-    void get_null_score(std::vector<PRS>& prs_list, const size_t& set_size,
+    void get_null_score(SamplePRS& prs_list, const size_t& set_size,
                         const size_t& prev_size,
                         std::vector<size_t>& background_list,
                         const bool first_run);
@@ -493,7 +590,14 @@ public:
                          const std::unordered_set<std::string>& dup_index,
                          const std::string& out, const double info_score);
     void build_clump_windows(const unsigned long long& clump_distance);
-    intptr_t cal_avail_memory(const uintptr_t founder_ctv2);
+    /*!
+     * \brief Limit the number of clumping threads such that the windows held
+     * by the threads fit within the memory budget
+     * \param window_byte is the memory required to hold the largest window
+     * \param threads is the number of threads requested
+     * \return the number of threads to use
+     */
+    size_t clump_thread_limit(const size_t window_byte, const size_t threads);
     std::vector<std::vector<size_t>>
     build_membership_matrix(const size_t num_sets,
                             const std::vector<std::string>& region_name,
@@ -506,10 +610,66 @@ public:
     {
         return m_set_thresholds;
     }
+    /*!
+     * \brief Calculate the PRS of the next threshold
+     * \param start_index is the first SNP of the threshold, will be updated to
+     * the first SNP of the next threshold
+     * \param end_index is the end of the region
+     * \param cur_threshold return the current threshold
+     * \param num_snp_included return the number of SNPs included
+     * \param first_run indicate if the PRS should be reset
+     * \param region_idx is the index of the region, used to locate the score
+     * when the score matrix is available
+     * \return false if there are no more threshold
+     */
     bool get_score(std::vector<size_t>::const_iterator& start_index,
                    const std::vector<size_t>::const_iterator& end_index,
                    double& cur_threshold, uint32_t& num_snp_included,
-                   const bool first_run);
+                   const bool first_run, const size_t region_idx = 0);
+    /*!
+     * \brief Thread safe version of get_score for regions held by the score
+     * matrix, see score_loaded. Instead of the internal PRS, the PRS is
+     * written to prs_list, and the mean and SD used for standardization are
+     * returned, such that multiple threads can score different regions
+     * \param prs_list is the PRS of the region
+     * \param mean_score is the mean of the PRS, for standardization
+     * \param score_sd is the SD of the PRS, for standardization
+     * \return false if there are no more threshold
+     */
+    bool get_score(SamplePRS& prs_list, double& mean_score, double& score_sd,
+                   std::vector<size_t>::const_iterator& start_index,
+                   const std::vector<size_t>::const_iterator& end_index,
+                   double& cur_threshold, uint32_t& num_snp_included,
+                   const bool first_run, const size_t region_idx) const;
+    /*!
+     * \brief Make sure the score matrix contains the region, calculating the
+     * score matrix of its chunk if required
+     * \return false if the region is not covered by the score matrix
+     */
+    bool load_score_region(const size_t region_idx);
+    /*!
+     * \brief Check if the score matrix currently holds the region, without
+     * calculating it
+     */
+    bool score_loaded(const size_t region_idx) const
+    {
+        return m_use_score_matrix && region_idx < m_region_chunk.size()
+               && m_region_chunk[region_idx] == m_cur_score_chunk
+               && m_cur_score_chunk < m_score_chunk_region.size();
+    }
+    /*!
+     * \brief Prepare to calculate the PRS of every threshold of every region
+     * with a score matrix. Regions are grouped into chunks whose score matrix
+     * fit within the memory limit. Scores of a chunk are calculated in a
+     * single pass through the genotypes, where each block of SNPs is decoded
+     * into a dense (sample x SNP) dosage tile and multiplied to a sparse (SNP
+     * x (region, threshold)) weight matrix. get_score will then serve the PRS
+     * from the score matrix instead of reading the genotypes again for each
+     * region and phenotype. Only performed for hard coded genotypes
+     * \param num_regions is the number of regions
+     * \return true if the score matrix will be used
+     */
+    bool prepare_score_matrix(const size_t num_regions);
     static bool within_region(const std::vector<IITree<size_t, size_t>>& cr,
                               const size_t chr, const size_t loc)
     {
@@ -563,6 +723,15 @@ public:
         m_intermediate = use;
         return *this;
     }
+    /*!
+     * \brief Keep the intermediate files in dir such that they can be reused
+     * by later runs. Only used by bgen files
+     */
+    Genotype& cache_dir(const std::string& dir)
+    {
+        m_cache_dir = dir;
+        return *this;
+    }
     Genotype& set_prs_instruction(const CalculatePRS& prs)
     {
         m_has_prs_instruction = true;
@@ -655,14 +824,31 @@ protected:
     // vector storing all the genotype files
     // std::vector<Sample> m_sample_names;
     FileRead m_genotype_file;
-    GenotypePool m_genotype_pool;
+    std::unique_ptr<GenotypePool> m_genotype_pool;
     std::vector<std::unique_ptr<SNP>> m_existed_snps;
     std::unordered_map<std::string, size_t> m_existed_snps_index;
     std::unordered_set<std::string> m_sample_selection_list;
     std::unordered_set<std::string> m_snp_selection_list;
     std::vector<std::set<double>> m_set_thresholds;
     std::vector<Sample_ID> m_sample_id;
-    std::vector<PRS> m_prs_info;
+    SamplePRS m_prs_info;
+    // PRS of every (region, threshold), and the column of each threshold
+    // in each region, indexed by the first SNP of the threshold
+    Eigen::MatrixXd m_score_matrix;
+    Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic> m_count_matrix;
+    std::vector<std::unordered_map<size_t, Eigen::Index>> m_score_column;
+    // (SNP x column) weight used when building the score matrix
+    Eigen::SparseMatrix<double, Eigen::RowMajor> m_score_weight;
+    // regions within each chunk of the score matrix, and the chunk of each
+    // region (out of range if the region is not covered)
+    std::vector<std::vector<size_t>> m_score_chunk_region;
+    // memory reserved for the score and count matrix
+    MemoryBudget::Reservation m_score_matrix_memory;
+    std::vector<size_t> m_region_chunk;
+    size_t m_cur_score_chunk = ~size_t(0);
+    // thread local PRS used when scoring with multiple threads
+    std::vector<SamplePRS> m_thread_prs;
+    std::vector<std::unique_ptr<GenotypeBuffer>> m_score_buffer;
     std::vector<std::string> m_genotype_file_names;
     std::vector<char> m_chr_id_symbol;
     std::vector<uintptr_t> m_tmp_genotype;
@@ -685,6 +871,7 @@ protected:
     std::string m_delim;
     std::string m_keep_file;
     std::string m_remove_file;
+    std::string m_cache_dir;
     double m_mean_score = 0.0;
     double m_score_sd = 0.0;
     double m_hard_threshold = 0.0;
@@ -694,6 +881,33 @@ protected:
     double m_homrar_weight = 2;
     size_t m_num_thresholds = 0;
     size_t m_thread = 1; // number of final samples
+    // minimum number of SNPs each scoring thread should process
+    size_t m_min_score_snp_per_thread = 32;
+    // number of clumping segments targeted for each thread when cutting the
+    // runs of overlapping windows
+    size_t m_clump_segment_per_thread = 4;
+    // minimum number of SNPs to be read from file before a scoring thread
+    // hands the reading over to a prefetch thread
+    size_t m_min_prefetch_snp = 64;
+    // number of SNPs the prefetch thread can read ahead of the PRS block
+    size_t m_prefetch_snp = 16;
+    // records of SNPs read for scoring that are at most this many bytes
+    // apart are read together, up to a span of m_max_read_span bytes
+    size_t m_max_read_gap = 1ULL << 16;
+    size_t m_max_read_span = 1ULL << 22;
+    // minimum number of SNPs each thread should process during QC
+    size_t m_min_qc_snp_per_thread = 256;
+    // minimum number of samples required before we use the byte look up
+    // table for PRS calculation, the table cost roughly the same as scoring
+    // 1024 samples to build
+    size_t m_min_sample_for_prs_table = 4096;
+    // number of SNPs added to the PRS of a tile of samples in one pass
+    size_t m_prs_block_snp = 8;
+    // number of samples in each tile, must be a multiple of BITCT2. Keep the
+    // scores and counts of a tile (12 bytes per sample) within L2 cache
+    size_t m_prs_tile_sample = 8192;
+    // maximum memory used by the score matrix
+    size_t m_max_score_matrix_byte = 1ULL << 30;
     size_t m_max_window_size = 0;
     size_t m_num_ambig = 0;
     size_t m_num_maf_filter = 0;
@@ -734,6 +948,9 @@ protected:
     bool m_very_small_thresholds = false;
     bool m_vector_initialized = false;
     bool m_has_chr_id_formula = false;
+    // true when the score matrix is being built / available
+    bool m_build_score_matrix = false;
+    bool m_use_score_matrix = false;
     Reporter* m_reporter = nullptr;
     CalculatePRS m_prs_calculation;
 
@@ -1114,44 +1331,79 @@ protected:
     {
         return false;
     }
+    /*!
+     * \brief Number of SNPs removed by each QC filter
+     */
+    struct QCCount
+    {
+        size_t geno = 0;
+        size_t maf = 0;
+        size_t info = 0;
+        size_t miss = 0;
+    };
+    /*!
+     * \brief Run the QC of all SNPs in genotype, which must be sorted by
+     * their file location. The SNPs are split into contiguous chunks, one per
+     * thread, such that each thread reads its part of the file sequentially
+     * with its own GenotypeBuffer. SNPs that failed the QC are removed and the
+     * filter counts are added to this object once all threads are done
+     * \param genotype contains the SNPs to be filtered
+     * \param qc is called for each SNP with the index of the current thread
+     * (i.e. its buffer in m_score_buffer) and its filter count, and should
+     * return true if the SNP is retained
+     */
+    void parallel_qc(Genotype* genotype,
+                     const std::function<bool(SNP&, size_t, QCCount&)>& qc);
 
+    /*!
+     * \brief Split the genotype of the index SNP into the planes of genotype
+     * 0, 2 and 3 (founder_ctv2 words apart in index_data) in a single pass and
+     * count the founders in each plane
+     */
     void update_index_tot(const uintptr_t founder_ctl2,
                           const uintptr_t founder_ctv2,
-                          const uintptr_t founder_count,
+                          const uintptr_t /*founder_count*/,
                           std::vector<uintptr_t>& index_data,
                           std::vector<uintptr_t>& index_tots,
                           std::vector<uintptr_t>& founder_include2,
                           uintptr_t* index_genotype)
     {
-        // reset the index_data information
         if (index_genotype == nullptr)
         { throw std::runtime_error("Error: Genotype is null!"); }
         assert(index_genotype != nullptr);
-        std::fill(index_data.begin(), index_data.end(), 0);
-        vec_datamask(founder_count, 0, index_genotype, founder_include2.data(),
-                     index_data.data());
-        index_tots[0] = popcount2_longs(index_data.data(), founder_ctl2);
-        vec_datamask(founder_count, 2, index_genotype, founder_include2.data(),
-                     &(index_data[founder_ctv2]));
-        index_tots[1] =
-            popcount2_longs(&(index_data[founder_ctv2]), founder_ctl2);
-        vec_datamask(founder_count, 3, index_genotype, founder_include2.data(),
-                     &(index_data[2 * founder_ctv2]));
-        index_tots[2] =
-            popcount2_longs(&(index_data[2 * founder_ctv2]), founder_ctl2);
+        uintptr_t* plane0 = index_data.data();
+        uintptr_t* plane2 = &(index_data[founder_ctv2]);
+        uintptr_t* plane3 = &(index_data[2 * founder_ctv2]);
+        uintptr_t tot0 = 0, tot2 = 0, tot3 = 0;
+        for (uintptr_t i = 0; i < founder_ctl2; ++i)
+        {
+            const uintptr_t mask = founder_include2[i];
+            const uintptr_t low = index_genotype[i] & mask;
+            const uintptr_t high = (index_genotype[i] >> 1) & mask;
+            plane0[i] = mask & ~(low | high);
+            plane2[i] = high & ~low;
+            plane3[i] = high & low;
+            tot0 += popcount2_long(plane0[i]);
+            tot2 += popcount2_long(plane2[i]);
+            tot3 += popcount2_long(plane3[i]);
+        }
+        for (uintptr_t i = founder_ctl2; i < founder_ctv2; ++i)
+        { plane0[i] = plane2[i] = plane3[i] = 0; }
+        index_tots[0] = tot0;
+        index_tots[1] = tot2;
+        index_tots[2] = tot3;
     }
 
-    double get_r2(const uintptr_t founder_ctl2, const uintptr_t founder_ctv2,
-                  uintptr_t* window_data_ptr,
-                  std::vector<uintptr_t>& index_data,
-                  std::vector<uintptr_t>& index_tots)
+    /*!
+     * \brief Calculate the R2 between the index SNP and a window SNP from
+     * their 3x3 table of joint genotype counts
+     */
+    double get_r2(uint32_t* counts)
     {
-        assert(window_data_ptr != nullptr);
         // is_x is used in PLINK to indicate if the genotype is from the X
         // chromsome, as PRSice ignore any sex chromosome, we can set it as
         // a constant false
         const bool is_x = false;
-        uint32_t counts[18];
         double freq11;
         double freq11_expected;
         double freq1x;
@@ -1159,18 +1411,6 @@ protected:
         double freqx1;
         double freqx2;
         double dxx;
-        // calculate the counts
-        // these counts are then used for calculation of R2. However, I
-        // don't fully understand the algorithm here (copy from PLINK2)
-        genovec_3freq(window_data_ptr, index_data.data(), founder_ctl2,
-                      &(counts[0]), &(counts[1]), &(counts[2]));
-        counts[0] = index_tots[0] - counts[0] - counts[1] - counts[2];
-        genovec_3freq(window_data_ptr, &(index_data[founder_ctv2]),
-                      founder_ctl2, &(counts[3]), &(counts[4]), &(counts[5]));
-        counts[3] = index_tots[1] - counts[3] - counts[4] - counts[5];
-        genovec_3freq(window_data_ptr, &(index_data[2 * founder_ctv2]),
-                      founder_ctl2, &(counts[6]), &(counts[7]), &(counts[8]));
-        counts[6] = index_tots[2] - counts[6] - counts[7] - counts[8];
         if (!em_phase_hethet_nobase(counts, is_x, is_x, &freq1x, &freq2x,
                                     &freqx1, &freqx2, &freq11))
         {
@@ -1193,92 +1433,335 @@ protected:
         return -1;
     }
 
-    void update_sample_prs(PRS& sample_prs, const uint32_t geno,
-                           const std::vector<double>& scores,
-                           const std::vector<size_t>& counts)
-    {
-        sample_prs.num_snp += counts[geno];
-        sample_prs.prs += scores[geno];
-    }
-    void initialize_sample_prs(PRS& sample_prs, const uint32_t geno,
-                               const std::vector<double>& scores,
-                               const std::vector<size_t>& counts)
-    {
-        sample_prs.num_snp = counts[geno];
-        sample_prs.prs = scores[geno];
-    }
-    template <class T>
-    void process_sample_prs(uintptr_t* genotype, std::vector<PRS>& prs_list,
-                            const std::vector<double>& scores,
-                            const std::vector<size_t>& counts, T load_prs)
-    {
-        uintptr_t* lbptr = genotype;
-        uintptr_t byte_block;
-        uint32_t processed_samples;
-        uint32_t sample_idx;
-        uint32_t geno;
-        processed_samples = 0;
-        byte_block = 0;
-        do
+    /*!
+     * \brief Upper bound of the R2 returned by get_r2. The EM only decides
+     * how the double heterozygotes are phased, so the frequency of haplotype
+     * 11 lies between having none and all of them in phase. R2 is convex in
+     * that frequency and is therefore bounded by its value at either end,
+     * widened by the tolerance the EM allows for its roots
+     */
+    static double max_r2(const uint32_t* counts)
+    {
+        const double known11 =
+            static_cast<double>(2 * counts[0] + counts[1] + counts[3]);
+        const double known12 =
+            static_cast<double>(2 * counts[2] + counts[1] + counts[5]);
+        const double known21 =
+            static_cast<double>(2 * counts[6] + counts[3] + counts[7]);
+        const double known22 =
+            static_cast<double>(2 * counts[8] + counts[5] + counts[7]);
+        const double center_ct_d = static_cast<int32_t>(counts[4]);
+        const double twice_tot_recip =
+            1.0
+            / (known11 + known12 + known21 + known22 + 2 * center_ct_d);
+        const double freq11 = known11 * twice_tot_recip;
+        const double half_hethet_share = center_ct_d * twice_tot_recip;
+        const double freq1x =
+            freq11 + known12 * twice_tot_recip + half_hethet_share;
+        const double freqx1 =
+            freq11 + known21 * twice_tot_recip + half_hethet_share;
+        const double freq11_expected = freqx1 * freq1x;
+        const double low =
+            (freq11 - SMALLISH_EPSILON) - freq11_expected;
+        const double high = (freq11 + (half_hethet_share + SMALLISH_EPSILON))
+                            - freq11_expected;
+        return std::max(low * low, high * high)
+               / (freq11_expected * (1.0 - freq1x) * (1.0 - freqx1));
+    }
+
+    /*!
+     * \brief Calculate the squared correlation between the genotype dosages
+     * of the index SNP and a window SNP from their 3x3 table of joint
+     * genotype counts
+     * \return -1 if either SNP is monomorphic
+     */
+    static double get_dosage_r2(const uint32_t* counts)
+    {
+        // dosage 0, 1 and 2 for genotype 0, 2 and 3, any other coding gives
+        // the same correlation
+        int64_t n = 0, sum_x = 0, sum_xx = 0, sum_y = 0, sum_yy = 0,
+                sum_xy = 0;
+        for (int64_t x = 0; x < 3; ++x)
         {
-            // ulii contain the numeric representation of the current
-            // genotype
-            byte_block = ~(*lbptr++);
-            if (processed_samples + BITCT2 > m_unfiltered_sample_ct)
+            for (int64_t y = 0; y < 3; ++y)
             {
-                byte_block &=
-                    (ONELU << ((m_unfiltered_sample_ct & (BITCT2 - 1)) * 2))
-                    - ONELU;
+                const int64_t count = counts[3 * x + y];
+                n += count;
+                sum_x += x * count;
+                sum_xx += x * x * count;
+                sum_y += y * count;
+                sum_yy += y * y * count;
+                sum_xy += x * y * count;
             }
-            // ujj sample index of the current genotype block
-            sample_idx = 0;
-            while (sample_idx < BITCT)
+        }
+        const int64_t var_x = n * sum_xx - sum_x * sum_x;
+        const int64_t var_y = n * sum_yy - sum_y * sum_y;
+        if (var_x == 0 || var_y == 0) return -1;
+        const double cov = static_cast<double>(n * sum_xy - sum_x * sum_y);
+        return (cov / static_cast<double>(var_x))
+               * (cov / static_cast<double>(var_y));
+    }
+
+    double get_r2(const uintptr_t founder_ctl2, const uintptr_t founder_ctv2,
+                  uintptr_t* window_data_ptr,
+                  std::vector<uintptr_t>& index_data,
+                  std::vector<uintptr_t>& index_tots)
+    {
+        assert(window_data_ptr != nullptr);
+        const uintptr_t* window[1] = {window_data_ptr};
+        uint32_t counts[9];
+        uint64_t raw[9];
+        ld_kernel::joint_genotype_counts(index_data.data(), founder_ctv2,
+                                         index_tots.data(), window, 1,
+                                         founder_ctl2, counts, raw);
+        return get_r2(counts);
+    }
+
+    /*!
+     * \brief Add (or assign, if reset is true) the contribution of 4
+     * consecutive samples to their PRS. All pointers must be 16 bytes aligned
+     * \param prs is the score of the first sample
+     * \param num_snp is the SNP count of the first sample
+     * \param score is the score contribution of the 4 samples
+     * \param count is the SNP count contribution of the 4 samples
+     */
+    template <bool reset>
+    static void load_sample_prs(double* prs, uint32_t* num_snp,
+                                const double* score, const uint32_t* count)
+    {
+#ifdef __LP64__
+        VECDTYPE score_lo = _mm_load_pd(score);
+        VECDTYPE score_hi = _mm_load_pd(score + 2);
+        VECITYPE snp_ct =
+            _mm_load_si128(reinterpret_cast<const VECITYPE*>(count));
+        if (!reset)
+        {
+            score_lo = _mm_add_pd(score_lo, _mm_load_pd(prs));
+            score_hi = _mm_add_pd(score_hi, _mm_load_pd(prs + 2));
+            snp_ct = _mm_add_epi32(
+                snp_ct, _mm_load_si128(reinterpret_cast<VECITYPE*>(num_snp)));
+        }
+        _mm_store_pd(prs, score_lo);
+        _mm_store_pd(prs + 2, score_hi);
+        _mm_store_si128(reinterpret_cast<VECITYPE*>(num_snp), snp_ct);
+#else
+        for (size_t k = 0; k < 4; ++k)
+        {
+            prs[k] = reset ? score[k] : prs[k] + score[k];
+            num_snp[k] = reset ? count[k] : num_snp[k] + count[k];
+        }
+#endif
+    }
+    /*!
+     * \brief Calculate the contribution of each (inverted) genotype code of a
+     * SNP to the PRS
+     */
+    static void get_geno_prs(std::array<double, 4>& geno_score,
+                             std::array<uint32_t, 4>& geno_count,
+                             const size_t ploidy, const double stat,
+                             const double adj_score, const double miss_score,
+                             const size_t miss_count,
+                             const double homcom_weight,
+                             const double het_weight,
+                             const double homrar_weight)
+    {
+        geno_score = {homcom_weight * stat - adj_score,
+                      het_weight * stat - adj_score, miss_score,
+                      homrar_weight * stat - adj_score};
+        const uint32_t snp_ct = static_cast<uint32_t>(ploidy);
+        geno_count = {snp_ct, snp_ct, static_cast<uint32_t>(miss_count),
+                      snp_ct};
+    }
+    /*!
+     * \brief Build the look up table containing the contribution of all 4
+     * samples for every possible genotype byte. Genotypes are inverted (~) as
+     * in PLINK
+     * \param score_table must have space for 1024 scores
+     * \param count_table must have space for 1024 counts
+     */
+    static void build_prs_table(const std::array<double, 4>& geno_score,
+                                const std::array<uint32_t, 4>& geno_count,
+                                double* score_table, uint32_t* count_table)
+    {
+        for (uint32_t byte = 0; byte < 256; ++byte)
+        {
+            const uint32_t inverted = ~byte;
+            for (uint32_t k = 0; k < 4; ++k)
             {
-                // go through the whole genotype block
-                // ukk is the current genotype
-                geno = (byte_block >> sample_idx) & 3;
-                // and the sample index can be calculated as uii+(ujj/2)
-                if (processed_samples + (sample_idx / 2) >= m_sample_ct)
-                { break; }
-                auto& sample_prs =
-                    prs_list[processed_samples + (sample_idx / 2)];
-                // now we will get all genotypes (0, 1, 2, 3)
-                (this->*load_prs)(sample_prs, geno, scores, counts);
-                sample_idx += 2;
+                const uint32_t geno = (inverted >> (2 * k)) & 3;
+                score_table[byte * 4 + k] = geno_score[geno];
+                count_table[byte * 4 + k] = geno_count[geno];
             }
-            // uii is the number of samples we have finished so far
-            processed_samples += BITCT2;
-        } while (processed_samples < m_sample_ct);
+        }
+    }
+    /*!
+     * \brief Add (or assign, if reset is true) the contribution of the current
+     * SNP to the PRS of samples within [start, end)
+     * \param genotype is the 2-bit genotype vector of the SNP
+     * \param prs is the score of sample start, must be 16 bytes aligned
+     * \param num_snp is the SNP count of sample start, must be 16 bytes
+     * aligned
+     * \param score_table is the byte look up table of the scores, nullptr if
+     * the samples should be decoded one at a time
+     * \param count_table is the byte look up table of the SNP counts
+     * \param geno_score is the score of each (inverted) genotype code
+     * \param geno_count is the SNP count of each (inverted) genotype code
+     * \param start is the first sample, must be a multiple of 4
+     * \param end is the sample after the last sample
+     */
+    template <bool reset>
+    static void process_sample_prs(const uintptr_t* genotype, double* prs,
+                                   uint32_t* num_snp,
+                                   const double* score_table,
+                                   const uint32_t* count_table,
+                                   const std::array<double, 4>& geno_score,
+                                   const std::array<uint32_t, 4>& geno_count,
+                                   const size_t start, const size_t end)
+    {
+        assert(start % 4 == 0);
+        size_t sample_idx = start;
+        if (score_table != nullptr)
+        {
+            // each byte contains 4 samples, decode them with a single look up
+            const unsigned char* geno_byte =
+                reinterpret_cast<const unsigned char*>(genotype);
+            const size_t start_byte = start / 4;
+            const size_t end_byte = end / 4;
+            for (size_t i = start_byte; i < end_byte; ++i)
+            {
+                const size_t entry = geno_byte[i] * 4u;
+                const size_t offset = (i - start_byte) * 4;
+                load_sample_prs<reset>(prs + offset, num_snp + offset,
+                                       score_table + entry,
+                                       count_table + entry);
+            }
+            sample_idx = end_byte * 4;
+        }
+        for (; sample_idx < end; ++sample_idx)
+        {
+            const uintptr_t geno =
+                (~genotype[sample_idx / BITCT2] >> (2 * (sample_idx % BITCT2)))
+                & 3;
+            const size_t offset = sample_idx - start;
+            if (reset)
+            {
+                prs[offset] = geno_score[geno];
+                num_snp[offset] = geno_count[geno];
+            }
+            else
+            {
+                prs[offset] += geno_score[geno];
+                num_snp[offset] += geno_count[geno];
+            }
+        }
     }
 
-    void read_prs(uintptr_t* genotype, std::vector<PRS>& prs_list,
+    void read_prs(uintptr_t* genotype, SamplePRS& prs_list,
                   const size_t ploidy, const double stat,
                   const double adj_score, const double miss_score,
                   const size_t miss_count, const double homcom_weight,
                   const double het_weight, const double homrar_weight,
                   const bool not_first)
     {
-        std::vector<double> scores = {homcom_weight * stat - adj_score,
-                                      het_weight * stat - adj_score, miss_score,
-                                      homrar_weight * stat - adj_score};
-        std::vector<size_t> counts = {ploidy, ploidy, miss_count, ploidy};
+        std::array<double, 4> geno_score;
+        std::array<uint32_t, 4> geno_count;
+        get_geno_prs(geno_score, geno_count, ploidy, stat, adj_score,
+                     miss_score, miss_count, homcom_weight, het_weight,
+                     homrar_weight);
+        alignas(16) std::array<double, 1024> score_table;
+        alignas(16) std::array<uint32_t, 1024> count_table;
+        const bool use_table = m_sample_ct >= m_min_sample_for_prs_table;
+        if (use_table)
+        {
+            build_prs_table(geno_score, geno_count, score_table.data(),
+                            count_table.data());
+        }
+        const double* score_ptr = use_table ? score_table.data() : nullptr;
         if (not_first)
         {
-            process_sample_prs(genotype, prs_list, scores, counts,
-                               &Genotype::update_sample_prs);
+            process_sample_prs<false>(
+                genotype, prs_list.prs.data(), prs_list.num_snp.data(),
+                score_ptr, count_table.data(), geno_score, geno_count, 0,
+                m_sample_ct);
         }
         else
         {
-            process_sample_prs(genotype, prs_list, scores, counts,
-                               &Genotype::initialize_sample_prs);
+            process_sample_prs<true>(
+                genotype, prs_list.prs.data(), prs_list.num_snp.data(),
+                score_ptr, count_table.data(), geno_score, geno_count, 0,
+                m_sample_ct);
         }
     }
+    /*!
+     * \brief Return the storage for the genotype of the next SNP in the PRS
+     * block, which stays valid until the block is flushed
+     */
+    uintptr_t* prs_block_genotype(GenotypeBuffer& buffer) const
+    {
+        auto&& block = buffer.prs_block;
+        return block.genotype.data() + block.num_snp * block.genotype_size;
+    }
+    /*!
+     * \brief Queue the current SNP into the PRS block, the block will be
+     * added to the PRS once it is full. Parameters are the same as read_prs
+     * except genotype must remain valid until the block is flushed
+     */
+    void add_prs_block(const uintptr_t* genotype, const size_t snp_idx,
+                       SamplePRS& prs_list, GenotypeBuffer& buffer,
+                       const size_t ploidy, const double stat,
+                       const double adj_score, const double miss_score,
+                       const size_t miss_count, const double homcom_weight,
+                       const double het_weight, const double homrar_weight,
+                       bool& not_first);
+    /*!
+     * \brief Add all SNPs within the PRS block to the PRS. Samples are
+     * processed in cache sized tiles, with all SNPs of the block added to a
+     * tile before moving on to the next
+     * \param not_first indicate if the PRS should be added to instead of
+     * reset, will be set to true once any SNP is added
+     */
+    void flush_prs_block(SamplePRS& prs_list, GenotypeBuffer& buffer,
+                         bool& not_first);
+    /*!
+     * \brief Build the byte look up table of each SNP in the block
+     * \return false if the samples should be decoded one at a time instead
+     */
+    bool build_block_prs_table(PRSBlock& block) const;
+    /*!
+     * \brief Add the SNPs within the PRS block to the score matrix of the
+     * block
+     */
+    void flush_score_matrix(PRSBlock& block);
+    /*!
+     * \brief Add (or assign) a column of the score matrix to prs_list
+     */
+    void load_score_column(SamplePRS& prs_list, const Eigen::Index col,
+                           const bool reset) const;
+    /*!
+     * \brief Calculate the score matrix of all regions within the chunk
+     */
+    void build_score_chunk(const size_t chunk);
+    /*!
+     * \brief Check if two SNPs belong to the same threshold
+     */
+    bool same_threshold(const size_t snp_a, const size_t snp_b) const;
+    /*!
+     * \brief Find the end of the threshold starting at start_index
+     */
+    std::vector<size_t>::const_iterator
+    threshold_end(const std::vector<size_t>::const_iterator& start_index,
+                  const std::vector<size_t>::const_iterator& end_index) const;
 
 
     virtual inline void
     count_and_read_genotype(const std::unique_ptr<SNP>& /* snp*/)
     {
     }
+    /*!
+     * \brief Number of words required to store the dosages of a SNP in
+     * memory, 0 if dosages can't be stored
+     */
+    virtual size_t dosage_storage_word() const { return 0; }
     virtual inline void read_genotype(const std::unique_ptr<SNP>& /*snp*/,
                                       const uintptr_t /* selected_size*/,
                                       FileRead& /*genotype_file*/,
@@ -1289,19 +1772,36 @@ protected:
     {
     }
     virtual void
-    read_score(std::vector<PRS>& /*prs_list*/,
+    read_score(SamplePRS& /*prs_list*/,
                const std::vector<size_t>::const_iterator& /*start*/,
                const std::vector<size_t>::const_iterator& /*end*/,
-               bool /*reset_zero*/)
+               bool /*reset_zero*/, GenotypeBuffer& /*buffer*/)
     {
     }
+    /*!
+     * \brief Calculate the PRS of SNPs within [start, end) and store it in
+     * m_prs_info. If multiple threads are allowed, the SNPs will be split
+     * across threads, each accumulating into their own PRS vector, which are
+     * then added to m_prs_info
+     * \param start is the index of the first SNP
+     * \param end is the index after the last SNP
+     * \param reset_zero indicate if we should reset the PRS instead of adding
+     * to it
+     */
     void read_score(const std::vector<size_t>::const_iterator& start,
                     const std::vector<size_t>::const_iterator& end,
-                    bool reset_zero)
+                    bool reset_zero);
+    /*!
+     * \brief Make sure we have at least num_thread scoring buffers
+     * \param num_thread is the number of buffer required
+     */
+    void init_score_buffer(const size_t num_thread);
+    void standardize_prs()
     {
-        read_score(m_prs_info, start, end, reset_zero);
+        standardize_prs(m_prs_info, m_mean_score, m_score_sd);
     }
-    void standardize_prs();
+    void standardize_prs(const SamplePRS& prs_list, double& mean_score,
+                         double& score_sd) const;
     // for loading the sample inclusion / exclusion set
     /*!
      * \brief Function to load in the sample extraction exclusion list
@@ -1334,17 +1834,9 @@ protected:
                 std::unordered_set<std::string>& processed_snps,
                 std::unordered_set<std::string>& duplicated_snps,
                 std::vector<bool>& retain_snp, Genotype* genotype);
-    void shrink_snp_vector(const std::vector<bool>& retain)
-    {
-        m_existed_snps.erase(
-            std::remove_if(m_existed_snps.begin(), m_existed_snps.end(),
-                           [&retain, this](const std::unique_ptr<SNP>& s) {
-                               return !retain[(&s - &*begin(m_existed_snps))];
-                           }),
-            m_existed_snps.end());
-        m_existed_snps.shrink_to_fit();
-    }
-    void shrink_snp_vector(const std::vector<std::atomic<bool>>& retain)
+    // retain can be either a vector<bool> or a vector<std::atomic<bool>>
+    template <typename Flag>
+    void shrink_snp_vector(const std::vector<Flag>& retain)
     {
         m_existed_snps.erase(
             std::remove_if(m_existed_snps.begin(), m_existed_snps.end(),
@@ -1358,19 +1850,20 @@ protected:
                     const uint32_t alt_ct, const uint32_t ref_founder_ct,
                     const uint32_t het_founder_ct,
                     const uint32_t alt_founder_ct, const double geno,
-                    const double maf, uint32_t& missing_founder_ct)
+                    const double maf, uint32_t& missing_founder_ct,
+                    QCCount& count) const
     {
         uint32_t total_alleles = ref_ct + het_ct + alt_ct;
         double cur_geno =
             1.0 - total_alleles / (static_cast<double>(m_sample_ct));
         if (total_alleles == 0)
         {
-            ++m_num_miss_filter;
+            ++count.miss;
             return true;
         }
         if (geno < cur_geno)
         {
-            ++m_num_geno_filter;
+            ++count.geno;
             return true;
         }
 
@@ -1380,7 +1873,7 @@ protected:
             static_cast<uint32_t>(m_founder_ct) - total_founder_alleles;
         if (missing_founder_ct == m_founder_ct)
         {
-            ++m_num_miss_filter;
+            ++count.miss;
             return true;
         }
         double cur_maf =
@@ -1390,7 +1883,7 @@ protected:
         if (alt_founder_ct == total_founder_alleles
             || ref_founder_ct == total_founder_alleles || cur_maf < maf)
         {
-            ++m_num_maf_filter;
+            ++count.maf;
             return true;
         }
         return false;
@@ -0,0 +1,386 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GENOTYPE_CACHE_H
+#define GENOTYPE_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#if defined(__unix__) || defined(__unix) || defined(unix) \
+    || (defined(__APPLE__) && defined(__MACH__))
+#define PRSICE_CACHE_LOCK
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+/*!
+ * \brief Persistent on disk cache of the hard coded genotypes of a bgen file,
+ * such that later runs on the same file can skip the decompression and
+ * parsing of the bgen genotype blocks.
+ *
+ * The cache consists of a data file and an index file. The data file starts
+ * with a header holding the key of the cache, followed by one fixed size
+ * record of plink coded genotypes per SNP, which can be read directly as an
+ * intermediate file. The index file holds one Entry per record, in the same
+ * order, with the counts and the statistics required by the QC. The key
+ * covers the format version, the bgen file (path, size and modification
+ * time) and the settings that change the content of the records (e.g. the
+ * samples included and the hard coding thresholds). Caches of different keys
+ * live in different files, and a cache whose header doesn't match its key is
+ * rebuilt.
+ *
+ * Records are only ever appended, data first, and the number of valid
+ * records is the number of complete entries in the index that also have
+ * their data, so a run that was killed half way leaves a usable cache. On
+ * unix, appends are serialized across processes with an advisory lock on the
+ * index file, such that concurrent runs can share the same cache directory.
+ */
+class GenotypeCache
+{
+public:
+    struct Entry
+    {
+        // position of the genotype block of the SNP in the bgen file
+        uint64_t byte_pos;
+        // hom ref, het, hom alt and missing counts
+        uint32_t count[4];
+        double expected;
+        // MACH and IMPUTE2 info score
+        double info[2];
+    };
+    static_assert(sizeof(Entry) == 48, "Unexpected padding in cache entry");
+    static constexpr uint32_t version = 1;
+    /*!
+     * \brief Open the cache of a bgen file, the cache is created if it
+     * doesn't already exist
+     * \param dir is the directory holding the caches
+     * \param bgen_name is the name of the bgen file
+     * \param setting describes every other settings that affect the records
+     * \param genotype_byte is the size of each genotype record
+     */
+    GenotypeCache(const std::string& dir, const std::string& bgen_name,
+                  const std::string& setting, const size_t genotype_byte)
+        : m_genotype_byte(genotype_byte)
+    {
+        namespace fs = std::filesystem;
+        if (m_genotype_byte == 0)
+        { throw std::runtime_error("Error: Invalid genotype cache record"); }
+        std::error_code ec;
+        const fs::path bgen_path = fs::canonical(bgen_name, ec);
+        if (ec)
+        {
+            throw std::runtime_error("Error: Cannot open bgen file: "
+                                     + bgen_name);
+        }
+        const auto mtime = fs::last_write_time(bgen_path, ec)
+                               .time_since_epoch()
+                               .count();
+        m_key = "version=" + std::to_string(version)
+                + "\nbgen=" + bgen_path.string()
+                + "\nsize=" + std::to_string(fs::file_size(bgen_path, ec))
+                + "\nmtime=" + std::to_string(mtime)
+                + "\nrecord=" + std::to_string(m_genotype_byte) + "\n"
+                + setting;
+        m_header_size = round_up(header_prefix + m_key.size(), 4096);
+        fs::create_directories(dir, ec);
+        if (!fs::is_directory(dir))
+        {
+            throw std::runtime_error("Error: Cannot create cache directory: "
+                                     + dir);
+        }
+        const fs::path prefix =
+            fs::path(dir)
+            / (bgen_path.filename().string() + "." + hash(m_key) + ".inter");
+        m_data_name = prefix.string();
+        m_index_name = m_data_name + ".idx";
+        std::lock_guard<std::mutex> guard(m_mutex);
+        FileLock lock(m_index_name);
+        if (!valid_header())
+        {
+            // new cache, or the file is from an older version / another key
+            std::ofstream data(m_data_name, std::ios::binary | std::ios::trunc);
+            std::ofstream index(m_index_name,
+                                std::ios::binary | std::ios::trunc);
+            std::vector<char> header(m_header_size, 0);
+            std::memcpy(header.data(), magic, sizeof(magic));
+            std::memcpy(header.data() + 8, &version, sizeof(version));
+            const uint64_t key_size = m_key.size();
+            std::memcpy(header.data() + 16, &key_size, sizeof(key_size));
+            std::memcpy(header.data() + header_prefix, m_key.data(),
+                        m_key.size());
+            data.write(header.data(),
+                       static_cast<std::streamsize>(header.size()));
+            if (!data || !index)
+            {
+                throw std::runtime_error("Error: Cannot create cache file: "
+                                         + m_data_name);
+            }
+            return;
+        }
+        const size_t num_entry = num_valid();
+        std::ifstream index(m_index_name, std::ios::binary);
+        std::vector<Entry> entries(num_entry);
+        index.read(reinterpret_cast<char*>(entries.data()),
+                   static_cast<std::streamsize>(num_entry * sizeof(Entry)));
+        if (!index)
+        {
+            throw std::runtime_error("Error: Cannot read cache index: "
+                                     + m_index_name);
+        }
+        m_num_seen = num_entry;
+        m_entries.reserve(num_entry);
+        for (size_t i = 0; i < num_entry; ++i)
+        {
+            m_entries.emplace(entries[i].byte_pos,
+                              std::make_pair(entries[i], data_pos(i)));
+        }
+    }
+    GenotypeCache(const GenotypeCache&) = delete;
+    GenotypeCache& operator=(const GenotypeCache&) = delete;
+    /*!
+     * \brief Name of the data file, which can be read as an intermediate file
+     */
+    const std::string& name() const { return m_data_name; }
+    /*!
+     * \brief Number of SNPs that were found in the cache when it was opened
+     */
+    size_t size() const { return m_entries.size(); }
+    /*!
+     * \brief Look up a SNP that was cached by a previous run. SNPs appended
+     * after the cache was opened are not visible, such that this can be
+     * called from multiple threads while others are appending
+     * \param byte_pos is the position of the SNP in the bgen file
+     * \param entry return the counts and statistics of the SNP
+     * \param genotype_pos return the position of the genotypes in the data
+     * file
+     * \return true if the SNP is cached
+     */
+    bool find(const std::streampos& byte_pos, Entry& entry,
+              std::streampos& genotype_pos) const
+    {
+        auto&& res = m_entries.find(static_cast<uint64_t>(byte_pos));
+        if (res == m_entries.end()) return false;
+        entry = res->second.first;
+        genotype_pos = res->second.second;
+        return true;
+    }
+    /*!
+     * \brief Append a batch of SNPs to the cache. SNPs that are already in
+     * the cache are not appended again
+     * \param entries is the counts and statistics of the SNPs
+     * \param genotypes points to the genotype records of the SNPs, stored
+     * back to back
+     * \param genotype_pos return the position of the genotypes of each SNP in
+     * the data file
+     */
+    void append(const std::vector<Entry>& entries, const void* genotypes,
+                std::vector<std::streampos>& genotype_pos)
+    {
+        genotype_pos.assign(entries.size(), std::streampos(-1));
+        if (entries.empty()) return;
+        std::lock_guard<std::mutex> guard(m_mutex);
+        FileLock lock(m_index_name);
+        // other processes might have appended to the cache since we last
+        // looked, and discard any entry that is left without data
+        const size_t num_entry = num_valid();
+        std::filesystem::resize_file(m_index_name, num_entry * sizeof(Entry));
+        if (num_entry > m_num_seen)
+        {
+            std::vector<Entry> others(num_entry - m_num_seen);
+            std::ifstream index(m_index_name, std::ios::binary);
+            index.seekg(
+                static_cast<std::streamoff>(m_num_seen * sizeof(Entry)));
+            index.read(reinterpret_cast<char*>(others.data()),
+                       static_cast<std::streamsize>(others.size()
+                                                    * sizeof(Entry)));
+            if (!index)
+            {
+                throw std::runtime_error("Error: Cannot read cache index: "
+                                         + m_index_name);
+            }
+            for (size_t i = 0; i < others.size(); ++i)
+            {
+                m_appended.emplace(others[i].byte_pos,
+                                   data_pos(m_num_seen + i));
+            }
+        }
+        // only append SNPs that are not already in the cache, e.g. when
+        // multiple runs on the same file were started at the same time
+        std::vector<Entry> new_entries;
+        std::vector<char> new_genotypes;
+        const char* genotype_ptr = static_cast<const char*>(genotypes);
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            auto&& loaded = m_entries.find(entries[i].byte_pos);
+            auto&& appended = m_appended.find(entries[i].byte_pos);
+            if (loaded != m_entries.end())
+            { genotype_pos[i] = loaded->second.second; }
+            else if (appended != m_appended.end())
+            { genotype_pos[i] = appended->second; }
+            else
+            {
+                genotype_pos[i] = data_pos(num_entry + new_entries.size());
+                m_appended.emplace(entries[i].byte_pos, genotype_pos[i]);
+                new_entries.push_back(entries[i]);
+                new_genotypes.insert(
+                    new_genotypes.end(), genotype_ptr + i * m_genotype_byte,
+                    genotype_ptr + (i + 1) * m_genotype_byte);
+            }
+        }
+        m_num_seen = num_entry + new_entries.size();
+        if (new_entries.empty()) return;
+        std::fstream data(m_data_name,
+                          std::ios::binary | std::ios::in | std::ios::out);
+        data.seekp(static_cast<std::streamoff>(data_pos(num_entry)));
+        data.write(new_genotypes.data(),
+                   static_cast<std::streamsize>(new_genotypes.size()));
+        data.close();
+        // only write the index once the data is in place
+        std::ofstream index(m_index_name, std::ios::binary | std::ios::app);
+        if (data.fail() || !index)
+        {
+            throw std::runtime_error("Error: Cannot write to cache file: "
+                                     + m_data_name);
+        }
+        index.write(reinterpret_cast<const char*>(new_entries.data()),
+                    static_cast<std::streamsize>(new_entries.size()
+                                                 * sizeof(Entry)));
+        index.close();
+        if (index.fail())
+        {
+            throw std::runtime_error("Error: Cannot write to cache file: "
+                                     + m_index_name);
+        }
+    }
+    /*!
+     * \brief FNV-1a hash of the input, in hex
+     */
+    static std::string hash(const std::string& input)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for (auto&& c : input)
+        {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ULL;
+        }
+        char res[17];
+        std::snprintf(res, sizeof(res), "%016llx",
+                      static_cast<unsigned long long>(h));
+        return res;
+    }
+
+private:
+    // exclusive advisory lock of a file across processes, held until the
+    // lock is destroyed
+    class FileLock
+    {
+    public:
+        explicit FileLock(const std::string& name)
+        {
+#ifdef PRSICE_CACHE_LOCK
+            m_fd = open(name.c_str(), O_RDWR | O_CREAT, 0644);
+            if (m_fd == -1 || flock(m_fd, LOCK_EX) != 0)
+            {
+                if (m_fd != -1) close(m_fd);
+                throw std::runtime_error("Error: Cannot lock cache file: "
+                                         + name);
+            }
+#else
+            (void) name;
+#endif
+        }
+        FileLock(const FileLock&) = delete;
+        FileLock& operator=(const FileLock&) = delete;
+        ~FileLock()
+        {
+#ifdef PRSICE_CACHE_LOCK
+            flock(m_fd, LOCK_UN);
+            close(m_fd);
+#endif
+        }
+
+    private:
+        int m_fd = -1;
+    };
+    static constexpr char magic[8] = {'P', 'R', 'S', 'i', 'c', 'e', 'G', 'C'};
+    // magic, version, padding and key size
+    static constexpr size_t header_prefix = 24;
+    // SNPs found when the cache was opened
+    std::unordered_map<uint64_t, std::pair<Entry, std::streampos>> m_entries;
+    // SNPs appended by us or other processes since then
+    std::unordered_map<uint64_t, std::streampos> m_appended;
+    std::mutex m_mutex;
+    std::string m_key;
+    std::string m_data_name;
+    std::string m_index_name;
+    size_t m_genotype_byte;
+    size_t m_header_size;
+    // number of entries in the index that were read or written by us
+    size_t m_num_seen = 0;
+    static size_t round_up(size_t value, size_t multiple)
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+    std::streampos data_pos(size_t idx) const
+    {
+        return static_cast<std::streamoff>(m_header_size
+                                           + idx * m_genotype_byte);
+    }
+    // check the header of the data file was written with our key
+    bool valid_header() const
+    {
+        std::ifstream data(m_data_name, std::ios::binary);
+        if (!data.is_open()) return false;
+        std::vector<char> header(header_prefix + m_key.size());
+        data.read(header.data(), static_cast<std::streamsize>(header.size()));
+        if (!data) return false;
+        uint32_t file_version;
+        uint64_t key_size;
+        std::memcpy(&file_version, header.data() + 8, sizeof(file_version));
+        std::memcpy(&key_size, header.data() + 16, sizeof(key_size));
+        return std::memcmp(header.data(), magic, sizeof(magic)) == 0
+               && file_version == version && key_size == m_key.size()
+               && std::memcmp(header.data() + header_prefix, m_key.data(),
+                              m_key.size())
+                      == 0;
+    }
+    // number of entries in the index that have their genotypes in the data
+    // file, must be called with the file lock held
+    size_t num_valid() const
+    {
+        std::error_code ec;
+        const uintmax_t index_size =
+            std::filesystem::file_size(m_index_name, ec);
+        if (ec) return 0;
+        const uintmax_t data_size = std::filesystem::file_size(m_data_name, ec);
+        if (ec || data_size < m_header_size) return 0;
+        return static_cast<size_t>(
+            std::min<uintmax_t>(index_size / sizeof(Entry),
+                                (data_size - m_header_size) / m_genotype_byte));
+    }
+};
+
+#endif // GENOTYPE_CACHE_H
@@ -1,121 +1,293 @@
 #ifndef GenotypePool_HPP
 #define GenotypePool_HPP
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
+#include <memory>
+#include <memory_budget.hpp>
+#include <mutex>
 #include <plink_common.hpp>
+#include <stdexcept>
+#include <string>
 #include <vector>
 // modified based on https://thinkingeek.com/2017/11/19/simple-memory-pool/
 
 class IndividualGenotype
 {
 private:
-    IndividualGenotype* m_next;
-    uintptr_t* m_geno_start;
+    uintptr_t* m_geno_start = nullptr;
+    // index of the item within the pool
+    uint32_t m_id = 0;
+    // index + 1 of the next free item, 0 if this is the last one
+    std::atomic<uint32_t> m_next {0};
 
 public:
     IndividualGenotype() {}
-    IndividualGenotype(uintptr_t* current)
+    uint32_t get_id() const { return m_id; }
+    void set_id(uint32_t id) { m_id = id; }
+    uint32_t get_next_item() const
     {
-        m_geno_start = current;
-        m_next = nullptr;
+        return m_next.load(std::memory_order_relaxed);
+    }
+    void set_next_item(uint32_t n)
+    {
+        m_next.store(n, std::memory_order_relaxed);
     }
-    IndividualGenotype* get_next_item() const { return m_next; }
-    void set_next_item(IndividualGenotype* n) { m_next = n; }
     void set_start_location(uintptr_t* i) { m_geno_start = i; }
     uintptr_t* get_geno() { return m_geno_start; }
-    // Methods for the storage of the item.
 };
 
-
+/*!
+ * \brief Pool of genotype storage that can be shared by multiple threads.
+ *
+ * The free items form a lock-free (Treiber) stack, whose head carries a tag
+ * that is bumped on every pop to avoid the ABA problem. Items are never
+ * released until the pool is destroyed, so a thread may safely read the next
+ * pointer of an item that was just taken by another thread. The pool only
+ * grows, under a mutex, when the stack is empty, and reserves the memory of
+ * each growth from the memory budget. Threads should go through a Cache to
+ * avoid contending on the head of the stack
+ */
 class GenotypePool
 {
-private:
-    class MemoryPool
+public:
+    /*!
+     * \brief Per-thread magazine of items. Items are taken from and returned
+     * to the shared pool in batches, and are all returned once the cache is
+     * destroyed
+     */
+    class Cache
     {
-        // actual memory storage
-        std::unique_ptr<uintptr_t[]> m_genotypes alignas(alignof(uintptr_t));
-        // std::vector<uintptr_t> m_genotypes alignas(alignof(uintptr_t));
-        // storing the pointer location as a linked list, this allow us to find
-        // the next empty space
-        std::unique_ptr<IndividualGenotype[]> m_genotype_list;
-        // pointer to the next memory storage
-        std::unique_ptr<MemoryPool> m_next;
-
     public:
-        ~MemoryPool() {}
-        MemoryPool(const size_t num_snps, const size_t memory_per_snp)
-            : m_genotypes(new uintptr_t[num_snps * memory_per_snp])
-            , m_genotype_list(new IndividualGenotype[num_snps])
-
+        Cache(GenotypePool& pool, size_t batch_size = 32)
+            : m_pool(pool), m_batch_size(std::max<size_t>(1, batch_size))
         {
-            // m_genotypes.resize(num_snps * memory_per_snp, 0);
-            // initialize the linked list
-            m_genotype_list[0].set_start_location(m_genotypes.get());
-            // m_genotype_list[0].set_start_location(m_genotypes.data());
-            for (size_t i = 1; i < num_snps; ++i)
-            {
-                m_genotype_list[i - 1].set_next_item(&m_genotype_list[i]);
-                m_genotype_list[i].set_start_location(m_genotypes.get()
-                                                      + i * memory_per_snp);
-            }
-            m_genotype_list[num_snps - 1].set_next_item(nullptr);
+            m_items.reserve(2 * m_batch_size);
+            m_batch.reserve(m_batch_size);
         }
-        // return pointer to the start of the linked list, can be used to
-        // appoint to the free list pointer
-        IndividualGenotype* get_genotype_location()
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+        ~Cache() { m_pool.free(m_items); }
+        IndividualGenotype* alloc()
         {
-            return m_genotype_list.get();
+            if (m_items.empty() && m_pool.pop(m_items, m_batch_size) == 0)
+            { return m_pool.alloc(); }
+            IndividualGenotype* item = m_items.back();
+            m_items.pop_back();
+            return item;
         }
-        uintptr_t* get_genotype_storage() { return m_genotypes.get(); }
-        // connect the new memory pool to the current memory pool
-        void set_next_collection(std::unique_ptr<MemoryPool>&& n)
+        void free(IndividualGenotype* t)
         {
-            assert(!m_next);
-            m_next.reset(n.release());
+            if (t == nullptr)
+            { throw std::runtime_error("Error: Can't free null pointer!"); }
+            m_items.push_back(t);
+            if (m_items.size() >= 2 * m_batch_size)
+            {
+                // hand half of the items back so that other threads can
+                // make use of them
+                m_batch.assign(m_items.end()
+                                   - static_cast<std::ptrdiff_t>(m_batch_size),
+                               m_items.end());
+                m_items.resize(m_items.size() - m_batch_size);
+                m_pool.free(m_batch);
+            }
         }
+
+    private:
+        GenotypePool& m_pool;
+        std::vector<IndividualGenotype*> m_items;
+        std::vector<IndividualGenotype*> m_batch;
+        size_t m_batch_size;
     };
-    size_t m_num_snps;
-    size_t m_memory_per_snp;
-    std::unique_ptr<MemoryPool> m_memory_pool;
-    IndividualGenotype* m_free_list;
 
-public:
-    GenotypePool() {};
-    GenotypePool(size_t num_snps, size_t memory_per_snp)
-        : m_num_snps(num_snps)
+    /*!
+     * \brief Construct the pool with room for num_snps items
+     * \param num_snps is the number of items allocated each time the pool
+     *        grows
+     * \param memory_per_snp is the number of words required per item
+     * \param budget is the memory budget the storage is reserved from
+     */
+    GenotypePool(size_t num_snps, size_t memory_per_snp,
+                 MemoryBudget& budget = MemoryBudget::global())
+        : m_slab_size(std::max<size_t>(1, num_snps))
         , m_memory_per_snp(round_up_pow2(memory_per_snp, CACHELINE))
-        , m_memory_pool(new MemoryPool(m_num_snps, m_memory_per_snp))
-        , m_free_list(m_memory_pool->get_genotype_location())
+        , m_slabs(new std::atomic<IndividualGenotype*>[max_slab])
+        , m_budget(budget)
     {
+        for (size_t i = 0; i < max_slab; ++i) m_slabs[i] = nullptr;
+        std::lock_guard<std::mutex> lock(m_grow_mutex);
+        grow();
     }
+    ~GenotypePool() { m_budget.release(byte_used()); }
+    GenotypePool(const GenotypePool&) = delete;
+    GenotypePool& operator=(const GenotypePool&) = delete;
     IndividualGenotype* alloc()
     {
-        if (m_free_list == nullptr)
+        IndividualGenotype* item = pop();
+        while (item == nullptr)
         {
-            std::unique_ptr<MemoryPool> new_pool(
-                new MemoryPool(m_num_snps, m_memory_per_snp));
-            new_pool->set_next_collection(std::move(m_memory_pool));
-            m_memory_pool.reset(new_pool.release());
-            m_free_list = m_memory_pool->get_genotype_location();
+            std::lock_guard<std::mutex> lock(m_grow_mutex);
+            // another thread might have grown the pool while we waited
+            item = pop();
+            if (item == nullptr)
+            {
+                grow();
+                item = pop();
+            }
         }
-        IndividualGenotype* current_item = m_free_list;
-        // Update the free list to the next free item.
-        m_free_list = current_item->get_next_item();
-        // Get the storage for T.
-        assert(current_item != nullptr);
-        return current_item;
+        return item;
     }
     void free(IndividualGenotype* t)
     {
-        // Convert this pointer to T to its enclosing pointer of an item of the
-        // arena.
         if (t == nullptr)
         { throw std::runtime_error("Error: Can't free null pointer!"); }
-        IndividualGenotype* current_item = std::move(t);
-        t = nullptr;
-        // Add the item at the beginning of the free list.
-        current_item->set_next_item(m_free_list);
-        m_free_list = current_item;
+        push(t, t);
+    }
+    /*!
+     * \brief Return a batch of items to the pool with a single update of the
+     * head of the stack
+     */
+    void free(std::vector<IndividualGenotype*>& items)
+    {
+        if (items.empty()) return;
+        for (size_t i = 1; i < items.size(); ++i)
+        { items[i - 1]->set_next_item(items[i]->get_id() + 1); }
+        push(items.front(), items.back());
+        items.clear();
+    }
+    /*!
+     * \brief Take up to n free items without growing the pool
+     * \return the number of items appended to items
+     */
+    size_t pop(std::vector<IndividualGenotype*>& items, size_t n)
+    {
+        size_t num_pop = 0;
+        for (; num_pop < n; ++num_pop)
+        {
+            IndividualGenotype* item = pop();
+            if (item == nullptr) break;
+            items.push_back(item);
+        }
+        return num_pop;
+    }
+    size_t num_item() const
+    {
+        return m_num_item.load(std::memory_order_relaxed);
+    }
+    size_t byte_used() const
+    {
+        return num_item() * m_memory_per_snp * sizeof(uintptr_t);
+    }
+
+private:
+    struct Slab
+    {
+        std::unique_ptr<uintptr_t[]> genotypes;
+        std::unique_ptr<IndividualGenotype[]> items;
+    };
+    static constexpr size_t max_slab = 4096;
+    static constexpr uint64_t id_mask = 0xffffffffULL;
+    static constexpr size_t max_item = std::numeric_limits<uint32_t>::max() - 1;
+    size_t m_slab_size;
+    size_t m_memory_per_snp;
+    // items of each slab, indexed by item id / m_slab_size
+    std::unique_ptr<std::atomic<IndividualGenotype*>[]> m_slabs;
+    std::vector<Slab> m_storage;
+    MemoryBudget& m_budget;
+    std::mutex m_grow_mutex;
+    std::atomic<size_t> m_num_item {0};
+    // tag in the upper 32 bits, id + 1 of the top item in the lower 32 bits
+    std::atomic<uint64_t> m_head {0};
+
+    IndividualGenotype* get_item(uint32_t id) const
+    {
+        return &(m_slabs[id / m_slab_size].load(
+            std::memory_order_acquire)[id % m_slab_size]);
+    }
+    IndividualGenotype* pop()
+    {
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        while (true)
+        {
+            const uint32_t top = static_cast<uint32_t>(head & id_mask);
+            if (top == 0) return nullptr;
+            IndividualGenotype* item = get_item(top - 1);
+            // the item can be taken by another thread in the meantime, in
+            // which case the tag would have changed and the exchange fails
+            const uint64_t next = item->get_next_item();
+            const uint64_t new_head = (((head >> 32) + 1) << 32) | next;
+            if (m_head.compare_exchange_weak(head, new_head,
+                                             std::memory_order_acquire,
+                                             std::memory_order_acquire))
+            { return item; }
+        }
+    }
+    // push the chain of items from first to last, which must already be
+    // linked, to the top of the stack
+    void push(IndividualGenotype* first, IndividualGenotype* last)
+    {
+        uint64_t head = m_head.load(std::memory_order_relaxed);
+        do
+        {
+            last->set_next_item(static_cast<uint32_t>(head & id_mask));
+        } while (!m_head.compare_exchange_weak(
+            head, (head & ~id_mask) | (first->get_id() + 1),
+            std::memory_order_release, std::memory_order_relaxed));
+    }
+    // add a new slab to the pool, must be called with m_grow_mutex held. The
+    // slab is smaller than usual if the budget can't hold a full slab
+    void grow()
+    {
+        const size_t num_item = m_num_item.load(std::memory_order_relaxed);
+        const size_t slab_idx = m_storage.size();
+        const size_t item_byte = m_memory_per_snp * sizeof(uintptr_t);
+        // ids of the slab start at slab_idx * m_slab_size
+        const size_t max_new =
+            max_item - std::min(max_item, slab_idx * m_slab_size);
+        size_t num_new = 0;
+        do
+        {
+            num_new = std::min({m_slab_size, max_new,
+                                m_budget.available() / item_byte});
+        } while (num_new != 0 && !m_budget.try_reserve(num_new * item_byte));
+        if (num_new == 0 || slab_idx >= max_slab)
+        {
+            if (num_new != 0) m_budget.release(num_new * item_byte);
+            throw std::runtime_error(
+                "Error: Not enough memory to store the genotypes. "
+                + std::to_string(num_item) + " variant(s) using "
+                + std::to_string(num_item * item_byte)
+                + " bytes are already stored, please increase --memory");
+        }
+        Slab slab;
+        try
+        {
+            slab.genotypes.reset(new uintptr_t[num_new * m_memory_per_snp]);
+            slab.items.reset(new IndividualGenotype[num_new]);
+        }
+        catch (...)
+        {
+            m_budget.release(num_new * item_byte);
+            throw;
+        }
+        const uint32_t first_id = static_cast<uint32_t>(slab_idx * m_slab_size);
+        for (size_t i = 0; i < num_new; ++i)
+        {
+            slab.items[i].set_id(first_id + static_cast<uint32_t>(i));
+            slab.items[i].set_start_location(slab.genotypes.get()
+                                             + i * m_memory_per_snp);
+            slab.items[i].set_next_item(
+                (i + 1 < num_new) ? first_id + static_cast<uint32_t>(i) + 2
+                                  : 0);
+        }
+        m_slabs[slab_idx].store(slab.items.get(), std::memory_order_release);
+        IndividualGenotype* first = &(slab.items[0]);
+        IndividualGenotype* last = &(slab.items[num_new - 1]);
+        m_storage.push_back(std::move(slab));
+        m_num_item.store(num_item + num_new, std::memory_order_relaxed);
+        push(first, last);
     }
 };
 #endif // GenotypePool_HPP
@@ -3,9 +3,12 @@
 #include "dcdflib.h"
 #include "family.hpp"
 #include <Eigen/Dense>
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 #include <stdexcept>
+// X and Y are referenced instead of copied and must outlive the GLM. This
+// also allows the same GLM to be refitted after the content of X is updated
 template <typename family>
 class GLM
 {
@@ -31,6 +34,7 @@ public:
         , m_maxit(maxit)
         , m_tol(tol)
     {
+        init_workspace();
     }
     GLM(const Eigen::MatrixXd& X, const Eigen::VectorXd& Y, const family& fam,
         double tol = 1e-8, int maxit = 100)
@@ -52,15 +56,24 @@ public:
         , m_tol(tol)
         , m_maxit(maxit)
     {
+        init_workspace();
     }
     virtual ~GLM() {}
+    /*!
+     * \brief Select how the weighted least squares of each iteration is
+     * solved. By default, the Cholesky decomposition of X'WX is used and the
+     * fit only falls back to the pivoting QR of W^{1/2}X if X'WX is (nearly)
+     * singular. The QR is more robust but about twice as slow
+     * \param llt_first is false to always use the QR
+     */
+    void set_llt_first(bool llt_first) { m_llt_first = llt_first; }
 
 
     void init_parms(int type)
     {
         m_type = type;
         m_beta = Eigen::VectorXd::Zero(m_X.cols());
-        m_eta = m_family.link(m_family.initialize(m_Y, m_w));
+        m_eta = m_family.link(m_family.initialize(m_Y, m_weights));
         m_mu = m_family.linkinv(m_eta);
         if (!m_family.validmu(m_mu) && !m_family.valideta(m_eta))
         {
@@ -71,6 +84,27 @@ public:
         update_dev_resids();
         m_rank = m_nvars;
     }
+    /*!
+     * \brief Start IRLS from the given coefficients, e.g. those of a similar
+     * model, which usually needs far fewer iterations than the default start
+     * \param start is the starting coefficients
+     * \return false if the start doesn't give valid fitted values, in which
+     * case init_parms() should be used instead
+     */
+    bool init_parms(const Eigen::VectorXd& start)
+    {
+        m_type = m_llt_first ? 0 : 1;
+        m_converged = false;
+        if (start.rows() != m_nvars || !start.allFinite()) return false;
+        m_beta = start;
+        update_eta();
+        update_mu();
+        if (!m_family.validmu(m_mu) || !m_family.valideta(m_eta))
+            return false;
+        update_dev_resids();
+        m_rank = m_nvars;
+        return std::isfinite(m_dev);
+    }
     void init_parms()
     {
         // while type=2 should in theory be faster in most situation, it seems
@@ -89,9 +123,12 @@ public:
         //        {
         //            m_type = 2;
         //        }
-        m_type = 1;
+        // Cholesky of X'WX is now checked for rank deficiency and falls back
+        // to the QR of W^{1/2}X
+        m_type = m_llt_first ? 0 : 1;
+        m_converged = false;
         m_beta = Eigen::VectorXd::Zero(m_X.cols());
-        m_eta = m_family.link(m_family.initialize(m_Y, m_w));
+        m_eta = m_family.link(m_family.initialize(m_Y, m_weights));
         m_mu = m_family.linkinv(m_eta);
         if (!m_family.validmu(m_mu) && !m_family.valideta(m_eta))
         {
@@ -102,9 +139,18 @@ public:
         update_dev_resids();
         m_rank = m_nvars;
     }
-    int solve(int maxit = 100)
+    /*!
+     * \brief Run IRLS until the deviance converged
+     * \param maxit is the maximum number of iterations
+     * \param num_converged is the number of consecutive iterations that must
+     * meet the convergence criterion. The standard errors use the weights of
+     * the previous iteration, and a fit started close to the optimum can meet
+     * the criterion before those weights are accurate
+     * \return the number of iterations
+     */
+    int solve(int maxit = 100, int num_converged = 1)
     {
-        int i = 0;
+        int i = 0, converged_iter = 0;
         for (; i < maxit; ++i)
         {
             update_var_mu();
@@ -121,7 +167,8 @@ public:
                 throw std::runtime_error("Error: cannot find valid starting "
                                          "values: please specify some");
             }
-            if (converged())
+            converged_iter = converged() ? converged_iter + 1 : 0;
+            if (converged_iter >= num_converged)
             {
                 m_converged = true;
                 break;
@@ -134,6 +181,7 @@ public:
     const Eigen::VectorXd& get_se() const { return m_se; }
     double deviance() const { return m_dev; }
     bool has_converged() const { return m_converged; }
+    bool full_rank() const { return m_rank == m_nvars; }
     double get_r2() const
     {
         double nulldev = m_family.dev_resids_sum(
@@ -151,8 +199,8 @@ public:
     }
 
 private:
-    const Eigen::MatrixXd m_X;
-    const Eigen::VectorXd m_Y;
+    const Eigen::MatrixXd& m_X;
+    const Eigen::VectorXd& m_Y;
     const Eigen::VectorXd m_weights;
     const Eigen::Index m_nvars;
     const Eigen::Index m_nobs;
@@ -171,6 +219,11 @@ private:
     Eigen::VectorXd m_w;
     Eigen::VectorXd m_se;
     Eigen::VectorXd m_effects;
+    // IRLS workspace, sized once such that the iterations don't allocate
+    Eigen::MatrixXd m_XtWX;
+    Eigen::MatrixXd m_WX_block;
+    Eigen::VectorXd m_wz;
+    Eigen::VectorXd m_XtWz;
     // Eigen::VectorXd m_offset;
     double m_dev, m_devold;
     double m_tol = 1e-8;
@@ -178,12 +231,16 @@ private:
     int m_maxit = 100;
     int m_type = 2;
     bool m_converged = false;
+    bool m_llt_first = true;
+    // minimum fraction of the weighted norm of a column that is not
+    // explained by the preceding columns for the Cholesky to be used
+    static constexpr double m_llt_tol = 1e-6;
 
     bool converged() const
     {
         return (std::fabs(m_dev - m_devold) / (0.1 + std::fabs(m_dev)) < m_tol);
     }
-    void update_eta() { m_eta = m_X * m_beta; }
+    void update_eta() { m_eta.noalias() = m_X * m_beta; }
     void update_var_mu() { m_var_mu = m_family.variance(m_mu); }
     void update_mu_eta() { m_mu_eta = m_family.mu_eta(m_eta); }
     void update_mu() { m_mu = m_family.linkinv(m_eta); }
@@ -253,12 +310,52 @@ private:
         m_dev = m_family.dev_resids_sum(m_Y, m_mu, m_weights);
     }
 
-    Eigen::MatrixXd XtWX() const
+    void init_workspace()
+    {
+        // rows of the weighted design formed at a time, about 64KB
+        const Eigen::Index num_var = std::max<Eigen::Index>(1, m_nvars);
+        const Eigen::Index block_rows = std::min<Eigen::Index>(
+            m_nobs, std::max<Eigen::Index>(64, 8192 / num_var));
+        m_XtWX.resize(m_nvars, m_nvars);
+        m_WX_block.resize(block_rows, m_nvars);
+        m_wz.resize(m_nobs);
+        m_XtWz.resize(m_nvars);
+    }
+    /*!
+     * \brief Calculate the lower triangle of X'WX. Only a block of rows of
+     * W^{1/2}X is formed at a time, which stays in cache for the rank update
+     * instead of copying the whole design matrix
+     */
+    void update_XtWX()
     {
-        return Eigen::MatrixXd(m_nvars, m_nvars)
-            .setZero()
-            .selfadjointView<Eigen::Lower>()
-            .rankUpdate((m_w.asDiagonal() * m_X).adjoint());
+        m_XtWX.setZero();
+        const Eigen::Index block_rows = m_WX_block.rows();
+        for (Eigen::Index start = 0; start < m_nobs; start += block_rows)
+        {
+            const Eigen::Index rows = std::min(block_rows, m_nobs - start);
+            m_WX_block.topRows(rows).noalias() =
+                m_w.segment(start, rows).asDiagonal()
+                * m_X.middleRows(start, rows);
+            m_XtWX.selfadjointView<Eigen::Lower>().rankUpdate(
+                m_WX_block.topRows(rows).adjoint());
+        }
+    }
+    /*!
+     * \brief Check if the Cholesky decomposition can be trusted. L_jj^2 is
+     * the weighted norm of column j that is not explained by the preceding
+     * columns, which is compared with the norm of the column such that the
+     * check doesn't depend on the scale of the PRS
+     */
+    bool llt_full_rank() const
+    {
+        if (m_Ch.info() != Eigen::Success) return false;
+        const auto l_diag = m_Ch.matrixLLT().diagonal();
+        for (Eigen::Index i = 0; i < m_nvars; ++i)
+        {
+            if (!(l_diag(i) * l_diag(i) > m_llt_tol * m_XtWX(i, i)))
+                return false;
+        }
+        return true;
     }
     void solve_wls()
     {
@@ -266,20 +363,30 @@ private:
         if (m_type == 0)
         {
             // use LLT
-            m_Ch.compute(static_cast<Eigen::MatrixXd>(XtWX())
-                             .selfadjointView<Eigen::Lower>());
-            m_beta = m_Ch.solve((m_w.asDiagonal() * m_X).adjoint()
-                                * (m_z.array() * m_w.array()).matrix());
+            update_XtWX();
+            m_Ch.compute(m_XtWX);
+            if (llt_full_rank())
+            {
+                m_wz = m_w.array().square() * m_z.array();
+                m_XtWz.noalias() = m_X.adjoint() * m_wz;
+                m_beta = m_Ch.solve(m_XtWz);
+                m_rank = m_nvars;
+                return;
+            }
+            // (nearly) rank deficient, use the rank revealing QR for the rest
+            // of the fit
+            m_type = 1;
         }
-        else if (m_type == 1)
+        if (m_type == 1)
         {
             // use Col QR
             m_PQR.compute(m_w.asDiagonal() * m_X); // decompose the model matrix
             m_Pmat = (m_PQR.colsPermutation());
             m_rank = m_PQR.rank();
+            m_wz = m_z.array() * m_w.array();
             if (m_rank == m_nvars)
             { // full rank case
-                m_beta = m_PQR.solve((m_z.array() * m_w.array()).matrix());
+                m_beta = m_PQR.solve(m_wz);
             }
             else
             {
@@ -287,8 +394,7 @@ private:
                              m_PQR.matrixQR().topLeftCorner(m_rank, m_rank))
                              .triangularView<Eigen::Upper>()
                              .solve(Eigen::MatrixXd::Identity(m_rank, m_rank));
-                m_effects = m_PQR.householderQ().adjoint()
-                            * (m_z.array() * m_w.array()).matrix();
+                m_effects = m_PQR.householderQ().adjoint() * m_wz;
                 m_beta.head(m_rank) = m_Rinv * m_effects.head(m_rank);
                 m_beta = m_Pmat * m_beta;
                 // create fitted values from effects
@@ -298,14 +404,16 @@ private:
         }
         else if (m_type == 2)
         {
-            m_PQR.compute(static_cast<Eigen::MatrixXd>(XtWX())
-                              .selfadjointView<Eigen::Lower>());
+            update_XtWX();
+            m_PQR.compute(static_cast<Eigen::MatrixXd>(
+                m_XtWX.selfadjointView<Eigen::Lower>()));
             m_Pmat = m_PQR.colsPermutation();
             m_rank = m_PQR.rank();
+            m_wz = m_w.array().square() * m_z.array();
+            m_XtWz.noalias() = m_X.adjoint() * m_wz;
             if (m_rank == m_nvars)
             { // full rank case
-                m_beta = m_PQR.solve((m_w.asDiagonal() * m_X).adjoint()
-                                     * (m_z.array() * m_w.array()).matrix());
+                m_beta = m_PQR.solve(m_XtWz);
             }
             else
             {
@@ -314,9 +422,7 @@ private:
                          m_PQR.matrixQR().topLeftCorner(m_rank, m_rank))
                          .triangularView<Eigen::Upper>()
                          .solve(Eigen::MatrixXd::Identity(m_rank, m_rank)));
-                m_effects = m_PQR.householderQ().adjoint()
-                            * (m_w.asDiagonal() * m_X).adjoint()
-                            * (m_z.array() * m_w.array()).matrix();
+                m_effects = m_PQR.householderQ().adjoint() * m_XtWz;
                 m_beta.head(m_rank) = m_Rinv * m_effects.head(m_rank);
                 m_beta = m_Pmat * m_beta;
                 // create fitted values from effects
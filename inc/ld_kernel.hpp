@@ -0,0 +1,90 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LD_KERNEL_H
+#define LD_KERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*!
+ * \brief Kernels counting the joint genotypes of an index SNP against a
+ * window of SNPs, as required by the LD calculation in clumping.
+ *
+ * The index SNP is given as three planes, one for each of the genotype codes
+ * 0, 2 and 3, where a sample has 01 in a plane if it carries that genotype
+ * (i.e. the output of vec_datamask). The window SNPs are in the PLINK 2-bit
+ * encoding.
+ */
+namespace ld_kernel
+{
+/*!
+ * \brief Function adding, for words [start, end) of each window SNP, the
+ * raw counts of plane & low bit, plane & high bit and plane & both bits for
+ * each of the three planes into 9 consecutive entries of raw
+ */
+typedef void (*accumulate_fn)(const uintptr_t* planes, uintptr_t plane_stride,
+                              const uintptr_t* const* window,
+                              size_t num_window, uintptr_t start,
+                              uintptr_t end, uint64_t* raw);
+
+/*!
+ * \brief Generic kernel built on genovec_3freq
+ */
+void accumulate_scalar(const uintptr_t* planes, uintptr_t plane_stride,
+                       const uintptr_t* const* window, size_t num_window,
+                       uintptr_t start, uintptr_t end, uint64_t* raw);
+/*!
+ * \brief Return the AVX2 kernel, or nullptr if it was not compiled in or the
+ * CPU does not support it
+ */
+accumulate_fn get_accumulate_avx2();
+/*!
+ * \brief Return the AVX-512 VPOPCNTDQ kernel, or nullptr if it was not
+ * compiled in or the CPU does not support it
+ */
+accumulate_fn get_accumulate_avx512();
+
+/*!
+ * \brief Return the fastest kernel supported by the running CPU. The choice
+ * is made once on the first call
+ */
+accumulate_fn get_accumulate();
+
+/*!
+ * \brief Fill in the 3x3 table of joint genotype counts between the index SNP
+ * and each of the window SNPs, skipping samples missing in either SNP. The
+ * samples are swept in tiles so that the index planes stay in cache while
+ * the whole window is processed.
+ *
+ * \param planes is the three index planes, plane_stride words apart
+ * \param plane_stride is the distance (in words) between the planes
+ * \param index_tots is the number of samples in each of the planes
+ * \param window contains the genotype of each window SNP
+ * \param num_window is the number of window SNPs
+ * \param word_ct is the number of words per plane
+ * \param counts return 9 counts per window SNP, ordered as index genotype
+ *        (0, 2, 3) by window genotype (0, 2, 3), which is the layout expected
+ *        by em_phase_hethet_nobase
+ * \param raw is a workspace of at least 9 * num_window entries
+ */
+void joint_genotype_counts(const uintptr_t* planes, uintptr_t plane_stride,
+                           const uintptr_t* index_tots,
+                           const uintptr_t* const* window, size_t num_window,
+                           uintptr_t word_ct, uint32_t* counts, uint64_t* raw);
+}
+
+#endif // LD_KERNEL_H
@@ -0,0 +1,178 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#ifdef __APPLE__
+#include <sys/sysctl.h> // sysctl()
+#include <sys/types.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/*!
+ * \brief Accountant of the memory budget given by --memory. Every large
+ * allocation (genotype storage, score matrices, output buffers and
+ * permutation buffers) should first reserve its size from the budget, and
+ * fall back to a slower method that requires less memory if the reservation
+ * fails. Small and short lived allocations are not accounted for.
+ */
+class MemoryBudget
+{
+public:
+    /*!
+     * \brief Bytes reserved from a budget, which are returned to the budget
+     * when the reservation is released or destroyed
+     */
+    class Reservation
+    {
+    public:
+        Reservation() {}
+        Reservation(const Reservation&) = delete;
+        Reservation& operator=(const Reservation&) = delete;
+        Reservation(Reservation&& other) noexcept
+            : m_budget(other.m_budget), m_byte(other.m_byte)
+        {
+            other.m_budget = nullptr;
+            other.m_byte = 0;
+        }
+        Reservation& operator=(Reservation&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                m_budget = other.m_budget;
+                m_byte = other.m_byte;
+                other.m_budget = nullptr;
+                other.m_byte = 0;
+            }
+            return *this;
+        }
+        ~Reservation() { release(); }
+        size_t byte() const { return m_byte; }
+        void release()
+        {
+            if (m_budget != nullptr) m_budget->release(m_byte);
+            m_budget = nullptr;
+            m_byte = 0;
+        }
+
+    private:
+        friend class MemoryBudget;
+        Reservation(MemoryBudget* budget, size_t byte)
+            : m_budget(budget), m_byte(byte)
+        {
+        }
+        MemoryBudget* m_budget = nullptr;
+        size_t m_byte = 0;
+    };
+
+    explicit MemoryBudget(size_t limit = std::numeric_limits<size_t>::max())
+        : m_limit(limit)
+    {
+    }
+    MemoryBudget(const MemoryBudget&) = delete;
+    MemoryBudget& operator=(const MemoryBudget&) = delete;
+    /*!
+     * \brief The budget shared by the whole program. It is unlimited until
+     * set_limit is called
+     */
+    static MemoryBudget& global()
+    {
+        static MemoryBudget budget;
+        return budget;
+    }
+    /*!
+     * \brief Total amount of physical memory in bytes, 0 if it can't be
+     * detected
+     */
+    static size_t physical_memory()
+    {
+#ifdef __APPLE__
+        int32_t mib[2] = {CTL_HW, HW_MEMSIZE};
+        int64_t memory = 0;
+        size_t sztmp = sizeof(int64_t);
+        if (sysctl(mib, 2, &memory, &sztmp, nullptr, 0) != 0) return 0;
+        return static_cast<size_t>(memory);
+#elif defined(_WIN32)
+        MEMORYSTATUSEX memstatus;
+        memstatus.dwLength = sizeof(memstatus);
+        if (!GlobalMemoryStatusEx(&memstatus)) return 0;
+        return static_cast<size_t>(memstatus.ullTotalPhys);
+#else
+        const long num_page = sysconf(_SC_PHYS_PAGES);
+        const long page_size = sysconf(_SC_PAGESIZE);
+        if (num_page <= 0 || page_size <= 0) return 0;
+        return static_cast<size_t>(num_page) * static_cast<size_t>(page_size);
+#endif
+    }
+    /*!
+     * \brief Change the limit. Existing reservations are kept even if they
+     * exceed the new limit
+     */
+    void set_limit(size_t limit) { m_limit.store(limit); }
+    size_t limit() const { return m_limit.load(); }
+    size_t used() const { return m_used.load(); }
+    size_t available() const
+    {
+        const size_t limit = m_limit.load(), used = m_used.load();
+        return (used >= limit) ? 0 : limit - used;
+    }
+    /*!
+     * \brief Reserve byte from the budget
+     * \return false if there isn't enough memory left in the budget
+     */
+    bool try_reserve(size_t byte)
+    {
+        size_t used = m_used.load();
+        do
+        {
+            const size_t limit = m_limit.load();
+            if (used > limit || byte > limit - used) return false;
+        } while (!m_used.compare_exchange_weak(used, used + byte));
+        return true;
+    }
+    /*!
+     * \brief Return byte previously obtained from try_reserve to the budget
+     */
+    void release(size_t byte) { m_used.fetch_sub(byte); }
+    /*!
+     * \brief Reserve byte from the budget, replacing whatever was held by
+     * reservation
+     * \return false if there isn't enough memory left in the budget, in
+     * which case reservation will be empty
+     */
+    bool reserve(size_t byte, Reservation& reservation)
+    {
+        reservation.release();
+        if (!try_reserve(byte)) return false;
+        reservation = Reservation(this, byte);
+        return true;
+    }
+
+private:
+    std::atomic<size_t> m_limit;
+    std::atomic<size_t> m_used {0};
+};
+
+#endif // MEMORY_BUDGET_H
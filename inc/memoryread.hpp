@@ -2,19 +2,131 @@
 #define MEMORYREAD_HPP
 
 #include "misc.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 #include <fstream>
 #include <stdexcept>
 #include <string>
+#include <vector>
+#if defined(__unix__) || defined(__unix) || defined(unix) \
+    || (defined(__APPLE__) && defined(__MACH__))
+#define PRSICE_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-
+/*!
+ * \brief Random access reader for the genotype files. Whenever possible, the
+ * file is memory mapped such that each read is served directly from the page
+ * cache without any seek / read system call. Fall back to ifstream when the
+ * file cannot be mapped
+ */
 class FileRead
 {
 public:
     FileRead() {}
+    /*!
+     * \brief Construct the reader
+     * \param use_map is false to always read through ifstream
+     */
+    explicit FileRead(bool use_map) : m_use_map(use_map) {}
+    FileRead(const FileRead&) = delete;
+    FileRead& operator=(const FileRead&) = delete;
+    ~FileRead() { unmap(); }
+    /*!
+     * \brief Hint the kernel on the expected access pattern of the mapped
+     * file. Sequential will allow aggressive read ahead and early release of
+     * pages that were already read, otherwise default read ahead is used
+     * \param sequential true if the file will be read sequentially
+     */
+    void set_sequential(bool sequential)
+    {
+        m_sequential = sequential;
+        advise();
+    }
+    /*!
+     * \brief Return true if the current file is served from a memory map
+     */
+    bool mapped() const { return m_map != nullptr; }
+    /*!
+     * \brief Tell the reader that the span of the file will be read soon,
+     * usually because it covers the records of several SNPs. The span is
+     * paged in with a single read ahead request when the file is mapped,
+     * otherwise it is read with a single read call and the reads within the
+     * span are served from memory
+     * \param file is the name of the file
+     * \param byte_pos is the start of the span
+     * \param span_size is the size of the span in bytes
+     */
+    void prefetch(const std::string& file, const std::streampos& byte_pos,
+                  const size_t span_size)
+    {
+        if (file != m_file_name) { new_file(file, byte_pos); }
+        m_span_size = 0;
+#ifdef PRSICE_USE_MMAP
+        if (m_map != nullptr || m_fd != -1)
+        {
+            const size_t start = static_cast<size_t>(byte_pos);
+            if (start + span_size > m_map_size) { remap(); }
+            if (m_map == nullptr || start >= m_map_size) return;
+            const size_t page_size =
+                static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            const size_t page_start = start / page_size * page_size;
+            const size_t length =
+                std::min(start + span_size, m_map_size) - page_start;
+            madvise(m_map + page_start, length, MADV_WILLNEED);
+            return;
+        }
+#endif
+        assert(m_input.is_open());
+        if (m_span.size() < span_size) { m_span.resize(span_size); }
+        if (byte_pos != m_offset
+            && !m_input.seekg(byte_pos, std::ios_base::beg))
+        {
+            throw std::runtime_error("Error: Cannot seek within file: "
+                                     + m_file_name);
+        }
+        // the span might go beyond the end of file, in which case only the
+        // part that was read is kept
+        m_input.read(m_span.data(), static_cast<std::streamsize>(span_size));
+        m_span_size = static_cast<size_t>(m_input.gcount());
+        m_span_start = byte_pos;
+        m_input.clear();
+        m_offset = byte_pos + static_cast<std::streamoff>(m_span_size);
+    }
     void read(const std::string& file, const std::streampos& byte_pos,
               const std::streampos read_size, char* result)
     {
         if (file != m_file_name) { new_file(file, byte_pos); }
+#ifdef PRSICE_USE_MMAP
+        if (m_map != nullptr || m_fd != -1)
+        {
+            const size_t start = static_cast<size_t>(byte_pos);
+            const size_t size = static_cast<size_t>(read_size);
+            // the file might have grown since we mapped it (e.g. intermediate
+            // file appended by the reference)
+            if (start + size > m_map_size) { remap(); }
+            if (start + size > m_map_size)
+            {
+                throw std::runtime_error("Error: Cannot read file: "
+                                         + m_file_name);
+            }
+            std::memcpy(result, m_map + start, size);
+            return;
+        }
+#endif
+        const std::streamoff span_offset = byte_pos - m_span_start;
+        if (m_span_size != 0 && span_offset >= 0
+            && span_offset + static_cast<std::streamoff>(read_size)
+                   <= static_cast<std::streamoff>(m_span_size))
+        {
+            std::memcpy(result, m_span.data() + span_offset,
+                        static_cast<size_t>(read_size));
+            return;
+        }
         assert(m_input.is_open());
         if (byte_pos != m_offset
             && !m_input.seekg(byte_pos, std::ios_base::beg))
@@ -33,11 +145,32 @@ private:
     std::ifstream m_input;
     std::string m_file_name;
     std::streampos m_offset;
+    // span of the file read by prefetch when the file isn't mapped
+    std::vector<char> m_span;
+    std::streampos m_span_start;
+    size_t m_span_size = 0;
+    char* m_map = nullptr;
+    size_t m_map_size = 0;
+    int m_fd = -1;
+    bool m_use_map = true;
+    bool m_sequential = false;
     void new_file(const std::string& file, const std::streampos byte_pos)
     {
         m_file_name = file;
         m_offset = byte_pos;
+        m_span_size = 0;
         if (m_input.is_open()) { m_input.close(); }
+        unmap();
+#ifdef PRSICE_USE_MMAP
+        if (m_use_map) { m_fd = open(m_file_name.c_str(), O_RDONLY); }
+        if (m_fd != -1)
+        {
+            remap();
+            if (m_map != nullptr) return;
+            close(m_fd);
+            m_fd = -1;
+        }
+#endif
         m_input.clear();
         m_input.open(m_file_name.c_str(), std::ios::binary);
         if (byte_pos != 0 && !m_input.seekg(byte_pos, std::ios_base::beg))
@@ -46,6 +179,43 @@ private:
                                      + m_file_name);
         }
     }
+    void remap()
+    {
+#ifdef PRSICE_USE_MMAP
+        struct stat file_stat;
+        if (m_fd == -1 || fstat(m_fd, &file_stat) != 0) return;
+        const size_t file_size = static_cast<size_t>(file_stat.st_size);
+        if (m_map != nullptr && file_size == m_map_size) return;
+        if (m_map != nullptr) { munmap(m_map, m_map_size); }
+        m_map = nullptr;
+        m_map_size = 0;
+        // cannot map an empty file
+        if (file_size == 0) return;
+        void* map = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if (map == MAP_FAILED) return;
+        m_map = static_cast<char*>(map);
+        m_map_size = file_size;
+        advise();
+#endif
+    }
+    void advise()
+    {
+#ifdef PRSICE_USE_MMAP
+        if (m_map == nullptr) return;
+        madvise(m_map, m_map_size,
+                m_sequential ? MADV_SEQUENTIAL : MADV_NORMAL);
+#endif
+    }
+    void unmap()
+    {
+#ifdef PRSICE_USE_MMAP
+        if (m_map != nullptr) { munmap(m_map, m_map_size); }
+        if (m_fd != -1) { close(m_fd); }
+#endif
+        m_map = nullptr;
+        m_map_size = 0;
+        m_fd = -1;
+    }
 };
 
 #endif // MEMORYREAD_HPP
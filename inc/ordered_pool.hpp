@@ -0,0 +1,157 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ORDERED_POOL_H
+#define ORDERED_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * \brief Pool of worker threads that stay alive until the pool is destroyed.
+ * Jobs are submitted into a bounded ring of slots, run by whichever worker is
+ * free, and retired by the submitting thread in the order of submission, such
+ * that their results can be merged in order while later jobs are still
+ * running. The pool only keeps track of the slot indices, the input and
+ * output of the slots are owned by the caller. Only the thread that created
+ * the pool may submit and retire jobs
+ */
+class OrderedPool
+{
+public:
+    /*!
+     * \brief Start the workers
+     * \param num_worker is the number of worker threads
+     * \param num_slot is the maximum number of jobs in flight
+     * \param job is called by the workers with the index of the worker and
+     * of the slot to process
+     */
+    OrderedPool(size_t num_worker, size_t num_slot,
+                std::function<void(size_t, size_t)> job)
+        : m_job(std::move(job))
+        , m_done((num_slot == 0) ? 1 : num_slot, false)
+        , m_error(m_done.size(), nullptr)
+    {
+        for (size_t i = 0; i < num_worker; ++i)
+        { m_workers.emplace_back(&OrderedPool::loop, this, i); }
+    }
+    OrderedPool(const OrderedPool&) = delete;
+    OrderedPool& operator=(const OrderedPool&) = delete;
+    /*!
+     * \brief Stop the workers once their current job is done, jobs not yet
+     * started are dropped
+     */
+    ~OrderedPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_cond_job.notify_all();
+        for (auto&& worker : m_workers) worker.join();
+    }
+    size_t num_slot() const { return m_done.size(); }
+    // no job is in flight
+    bool empty() const { return m_submitted == m_retired; }
+    // all slots are in flight, the oldest job must be retired before the
+    // next submit
+    bool full() const { return m_submitted - m_retired == m_done.size(); }
+    /*!
+     * \brief Slot of the next job, whose input should be filled in before
+     * submit. Only valid when the pool is not full
+     */
+    size_t next_slot() const { return m_submitted % m_done.size(); }
+    /*!
+     * \brief Hand the job of next_slot to the workers
+     */
+    void submit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_submitted;
+        }
+        m_cond_job.notify_one();
+    }
+    /*!
+     * \brief Wait for the oldest job in flight to finish. Rethrow the
+     * exception thrown by the job, if any. Must not be called when empty
+     * \return the slot of the job, valid until retire is called
+     */
+    size_t oldest()
+    {
+        const size_t slot = m_retired % m_done.size();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond_done.wait(lock, [this, slot] { return m_done[slot]; });
+        if (m_error[slot]) std::rethrow_exception(m_error[slot]);
+        return slot;
+    }
+    /*!
+     * \brief Free the slot returned by oldest for the next submit
+     */
+    void retire()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done[m_retired % m_done.size()] = false;
+        ++m_retired;
+    }
+
+private:
+    void loop(size_t worker)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_cond_job.wait(
+                lock, [this] { return m_quit || m_started < m_submitted; });
+            if (m_quit) return;
+            const size_t slot = m_started++ % m_done.size();
+            lock.unlock();
+            std::exception_ptr error = nullptr;
+            try
+            {
+                m_job(worker, slot);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+            m_error[slot] = error;
+            m_done[slot] = true;
+            m_cond_done.notify_one();
+        }
+    }
+    std::function<void(size_t, size_t)> m_job;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_cond_job;
+    std::condition_variable m_cond_done;
+    // whether the job of each slot is done, and the exception it threw
+    std::vector<bool> m_done;
+    std::vector<std::exception_ptr> m_error;
+    // total number of jobs submitted, started by a worker and retired
+    size_t m_submitted = 0;
+    size_t m_started = 0;
+    size_t m_retired = 0;
+    bool m_quit = false;
+};
+
+#endif // ORDERED_POOL_H
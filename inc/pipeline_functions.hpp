@@ -57,6 +57,7 @@ inline void initialize_genotype(
         &current_file->keep_nonfounder(commander.nonfounders())
              .keep_ambig(commander.keep_ambig())
              .intermediate(commander.use_inter())
+             .cache_dir(commander.cache_dir())
              .set_prs_instruction(commander.get_prs_instruction())
              .set_weight(commander.get_prs_instruction().genetic_model);
     current_file->parse_chr_id_formula(commander.chr_id_formula());
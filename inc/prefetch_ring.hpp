@@ -0,0 +1,210 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef PREFETCH_RING_H
+#define PREFETCH_RING_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/*!
+ * \brief Bounded ring of slots handed from a single producer thread to a
+ * single consumer thread. The ring only keeps track of the slot indices, the
+ * storage of the slots is owned by the caller. Slots are filled, consumed and
+ * released in order, and a consumed slot stays valid until the consumer
+ * releases it, such that the consumer can hold on to a few slots at a time
+ */
+class PrefetchRing
+{
+public:
+    explicit PrefetchRing(size_t num_slot)
+        : m_num_slot((num_slot == 0) ? 1 : num_slot)
+    {
+    }
+    PrefetchRing(const PrefetchRing&) = delete;
+    PrefetchRing& operator=(const PrefetchRing&) = delete;
+    size_t num_slot() const { return m_num_slot; }
+    /*!
+     * \brief Wait for a free slot to fill (producer)
+     * \param slot return the index of the slot
+     * \return false if the ring was stopped
+     */
+    bool acquire(size_t& slot)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_producer_waiting = true;
+        m_cond_not_full.wait(lock, [this] {
+            return m_stopped || m_produced - m_released < m_num_slot;
+        });
+        m_producer_waiting = false;
+        slot = m_produced % m_num_slot;
+        return !m_stopped;
+    }
+    /*!
+     * \brief Hand the slot obtained from acquire to the consumer (producer)
+     */
+    void publish()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        ++m_produced;
+        if (m_consumer_waiting)
+        {
+            lock.unlock();
+            m_cond_not_empty.notify_one();
+        }
+    }
+    /*!
+     * \brief Wait for the next filled slot (consumer)
+     * \param slot return the index of the slot
+     * \return false if the ring was stopped before the slot was filled
+     */
+    bool next(size_t& slot)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_consumer_waiting = true;
+        m_cond_not_empty.wait(
+            lock, [this] { return m_stopped || m_consumed < m_produced; });
+        m_consumer_waiting = false;
+        if (m_consumed == m_produced) return false;
+        slot = m_consumed % m_num_slot;
+        ++m_consumed;
+        return true;
+    }
+    /*!
+     * \brief Number of slots consumed but not yet released (consumer)
+     */
+    size_t held()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_consumed - m_released;
+    }
+    /*!
+     * \brief Return all consumed slots to the producer (consumer)
+     */
+    void release()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_released == m_consumed) return;
+        m_released = m_consumed;
+        if (m_producer_waiting)
+        {
+            lock.unlock();
+            m_cond_not_full.notify_one();
+        }
+    }
+    /*!
+     * \brief Wake up both sides and stop handing out slots. Slots already
+     * filled can still be consumed
+     */
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopped = true;
+        }
+        m_cond_not_full.notify_all();
+        m_cond_not_empty.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cond_not_full;
+    std::condition_variable m_cond_not_empty;
+    size_t m_num_slot;
+    // total number of slots filled, consumed and released
+    size_t m_produced = 0;
+    size_t m_consumed = 0;
+    size_t m_released = 0;
+    bool m_producer_waiting = false;
+    bool m_consumer_waiting = false;
+    bool m_stopped = false;
+};
+
+/*!
+ * \brief A reader thread that is kept alive between jobs, such that reading
+ * ahead does not start a new thread for every call. Only one job runs at a
+ * time, and the caller must wait for it before handing over the next one
+ */
+class PrefetchThread
+{
+public:
+    PrefetchThread() {}
+    PrefetchThread(const PrefetchThread&) = delete;
+    PrefetchThread& operator=(const PrefetchThread&) = delete;
+    ~PrefetchThread()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_cond.notify_all();
+        if (m_thread.joinable()) m_thread.join();
+    }
+    /*!
+     * \brief Run the job on the reader thread, the thread is started on the
+     * first call. The job must not throw
+     */
+    void run(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = std::move(job);
+            m_busy = true;
+        }
+        if (!m_thread.joinable())
+        { m_thread = std::thread(&PrefetchThread::loop, this); }
+        else
+        {
+            m_cond.notify_all();
+        }
+    }
+    /*!
+     * \brief Wait until the current job is done
+     */
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this] { return !m_busy; });
+    }
+
+private:
+    void loop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_cond.wait(lock, [this] { return m_busy || m_quit; });
+            if (!m_busy) return;
+            auto job = std::move(m_job);
+            lock.unlock();
+            job();
+            lock.lock();
+            m_busy = false;
+            m_cond.notify_all();
+        }
+    }
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::function<void()> m_job;
+    std::thread m_thread;
+    bool m_busy = false;
+    bool m_quit = false;
+};
+
+#endif // PREFETCH_RING_H
@@ -20,7 +20,9 @@
 
 #include "commander.hpp"
 #include "genotype.hpp"
+#include "memory_budget.hpp"
 #include "misc.hpp"
+#include "ordered_pool.hpp"
 #include "plink_common.hpp"
 #include "regression.hpp"
 #include "reporter.hpp"
@@ -36,7 +38,9 @@
 #include <iomanip>
 #include <map>
 #include <math.h>
+#include <memory>
 #include <mutex>
+#include <numeric>
 #include <random>
 #include <stdexcept>
 #include <stdio.h>
@@ -140,6 +144,23 @@ public:
                     std::unique_ptr<std::ostream>& best_score_file,
                     std::unique_ptr<std::ostream>& all_score_file,
                     Genotype& target);
+    /*!
+     * \brief Call run_prsice on every region except the background and the
+     * empty regions. When the regions are held by the score matrix of the
+     * target and neither permutation nor the all score output is required,
+     * the regions are regressed by a pool of threads kept for the whole call,
+     * and their results are written in the order of the regions as soon as
+     * they are ready
+     */
+    void run_regions(const std::vector<std::vector<size_t>>& region_membership,
+                     const std::vector<std::string>& region_names,
+                     const std::string& pheno_name, const double prevalence,
+                     const size_t pheno_idx, const bool all_scores,
+                     const bool has_prevalence,
+                     std::unique_ptr<std::ostream>& prsice_out,
+                     std::unique_ptr<std::ostream>& best_score_file,
+                     std::unique_ptr<std::ostream>& all_score_file,
+                     Genotype& target);
     /*!
      * \brief Before calling this function, the target should have loaded the
      * PRS. Then this function will fill in the m_independent_variable matrix
@@ -300,14 +321,49 @@ protected:
     {
         prsice_summary() {}
         prsice_summary(const prsice_result& res, const std::string& set_name,
-                       const bool has_comp)
-            : result(res), set(set_name), has_competitive(has_comp)
+                       const bool has_comp, const double t_value)
+            : result(res)
+            , set(set_name)
+            , obs_t_value(t_value)
+            , has_competitive(has_comp)
         {
         }
         prsice_result result;
         std::string set;
+        // absolute t of the best threshold before the --score-test refit,
+        // which is on the same scale as the competitive null
+        double obs_t_value = 0.0;
         bool has_competitive;
     };
+    /*!
+     * \brief Result of a region regressed by a region_worker, which is merged
+     * into m_prs_results and m_best_sample_score by the main thread
+     */
+    struct region_result
+    {
+        std::vector<prsice_result> results;
+        std::vector<double> thresholds;
+        std::vector<double> best_sample_score;
+        // result of the best threshold, refitted with --score-test after the
+        // results of all thresholds are written
+        prsice_result best;
+        int best_index = -1;
+    };
+    /*!
+     * \brief Everything a thread needs to regress a region without touching
+     * the members of PRSice, which are only read. The logistic regression
+     * references independent, so the worker must not be moved once created
+     */
+    struct region_worker
+    {
+        Eigen::MatrixXd independent;
+        Regression::ResidualizedLm residualized_lm;
+        Regression::LogisticScoreTest score_test;
+        std::unique_ptr<Regression::WarmStartGlm> logistic;
+        SamplePRS prs;
+        double mean_score = 0.0;
+        double score_sd = 0.0;
+    };
     struct column_file_info
     {
         long long header_length;
@@ -339,7 +395,7 @@ protected:
             (*prsice_out) << "\tNA";
         }
         (*prsice_out) << "\t" << res.p << "\t" << res.coefficient << "\t"
-                      << res.se << "\t" << m_num_snp_included << "\n";
+                      << res.se << "\t" << res.num_snp << "\n";
     }
     // store the number of non-sig, margin sig, and sig pathway & phenotype
     static std::mutex lock_guard;
@@ -353,17 +409,44 @@ protected:
     // 2 for e- (scientific)
     // 3 for exponent (max precision is somewhere around +-e297, so 3 is enough
     const long long m_numeric_width = m_precision + 7;
+    // maximum number of permuted phenotype and memory (in byte) used by each
+    // block of permutation
+    size_t m_max_perm_block = 256;
+    size_t m_max_perm_block_byte = 1ULL << 25;
+    // maximum memory (in byte) used to store the permutation index
+    size_t m_max_perm_index_byte = 1ULL << 30;
+    // number of regions in flight for each thread of run_regions
+    const size_t m_region_per_worker = 4;
     const bool m_binary_trait = true;
     Eigen::MatrixXd m_independent_variables;
     // TODO: Use other method for faster best output
     Eigen::MatrixXd m_fast_best_output;
     Eigen::MatrixXd m_fast_all_output;
+    // memory reserved for the best and all score output
+    MemoryBudget::Reservation m_fast_best_memory;
+    MemoryBudget::Reservation m_fast_all_memory;
     Eigen::VectorXd m_phenotype;
+    // covariates factorized once per quantitative phenotype
+    Regression::ResidualizedLm m_residualized_lm;
+    // logistic regression warm started across thresholds of binary phenotype
+    std::unique_ptr<Regression::WarmStartGlm> m_logistic;
+    // score test of the covariate only logistic model, used by --score-test
+    Regression::LogisticScoreTest m_score_test;
+    // coefficients of the covariate only logistic model
+    Eigen::VectorXd m_null_beta;
     std::unordered_map<std::string, size_t> m_sample_with_phenotypes;
     std::vector<prsice_result> m_prs_results;
     std::vector<prsice_summary> m_prs_summary; // for multiple traits
     std::vector<double> m_perm_result;
     std::vector<double> m_permuted_pheno;
+    // sample index of the first m_num_cached_perm permutations, stored
+    // consecutively
+    std::vector<uint32_t> m_perm_index;
+    MemoryBudget::Reservation m_perm_index_memory;
+    size_t m_num_cached_perm = 0;
+    // state of the random number generator at the start of each block of
+    // permutation, such that any block can be regenerated independently
+    std::vector<std::mt19937> m_perm_block_rng;
     std::vector<double> m_best_sample_score;
     std::vector<size_t> m_matrix_index;
     std::vector<size_t> m_significant_store {0, 0, 0};
@@ -475,6 +558,70 @@ protected:
      * empirical p-value
      */
     void process_permutations();
+    /*!
+     * \brief Absolute t (or score z with --score-test) of the best threshold
+     */
+    double best_t_value() const
+    {
+        if (m_best_index < 0) return 0.0;
+        auto&& best = m_prs_results[static_cast<size_t>(m_best_index)];
+        return std::fabs(best.coefficient / best.se);
+    }
+    /*!
+     * \brief With --score-test, the thresholds are only compared by the score
+     * test. Refit the best threshold with the full logistic regression such
+     * that the reported result of the best threshold is exact
+     */
+    void refit_best();
+    /*!
+     * \brief Refit the logistic regression of the best threshold
+     * \param best_score is the best PRS of all samples
+     * \param independent is the independent matrix used by logistic
+     * \param logistic is the logistic regression
+     * \param thread is the number of thread allowed
+     * \param best is the result to be updated
+     */
+    void refit_logistic(const std::vector<double>& best_score,
+                        Eigen::MatrixXd& independent,
+                        Regression::WarmStartGlm& logistic, const int thread,
+                        prsice_result& best) const;
+    /*!
+     * \brief Regress the phenotype on the PRS in column 1 of independent and
+     * the covariates, using the fastest of the models available
+     */
+    void regress_prs(const Eigen::MatrixXd& independent,
+                     Regression::ResidualizedLm& residualized_lm,
+                     Regression::WarmStartGlm* logistic,
+                     Regression::LogisticScoreTest& score_test,
+                     const int thread, double& p_value, double& r2,
+                     double& r2_adjust, double& coefficient,
+                     double& se) const;
+    /*!
+     * \brief Output the best score of the region and add the best threshold to
+     * the summary, using m_prs_results, m_best_index and m_best_sample_score
+     * \param obs_t_value is best_t_value before the --score-test refit
+     */
+    void store_region_best(const std::vector<std::string>& region_names,
+                           const size_t region_idx,
+                           std::unique_ptr<std::ostream>& best_score_file,
+                           Genotype& target, const double obs_t_value);
+    /*!
+     * \brief Regress every threshold of a region held by the score matrix.
+     * Only reads the members of PRSice and target, such that different
+     * regions can be regressed concurrently by different workers
+     */
+    void regress_region(const std::vector<size_t>& set_snp_idx,
+                        const size_t region_idx, const Genotype& target,
+                        region_worker& worker, region_result& result) const;
+    /*!
+     * \brief Create the region workers, as many as the number of thread and
+     * the memory budget allow
+     * \return false if there isn't enough memory for more than one worker
+     */
+    bool
+    init_region_workers(const Genotype& target,
+                        std::vector<std::unique_ptr<region_worker>>& workers,
+                        MemoryBudget::Reservation& reservation);
 
 
     /*!
@@ -527,34 +674,79 @@ protected:
                                             Eigen::VectorXd& beta,
                                             Eigen::VectorXd& effects);
     /*!
-     * \brief The "producer" for generating the permuted phenotypes
-     * \param q is the queue for contacting the consumers
-     * \param num_consumer is the number of consumer
+     * \brief The worker for generating blocks of permuted phenotypes and
+     * calculating their T-value. Workers take the blocks in turn, and as
+     * every block is regenerated from its own random state, the result
+     * doesn't depend on which worker processed which block
+     * \param next_block is the index of the next block to be processed
+     * \param base is the phenotype vector to be permuted
+     * \param projector is the pre-computed projection matrix. If logistic
+     * regression is used, this will be ignored
+     * \param se is the pre-computed unscaled SE of the PRS coefficient
+     * \param model is the model used to test the permuted phenotype
+     */
+    void consume_null_pheno(std::atomic<size_t>& next_block,
+                            const Eigen::VectorXd& base,
+                            const Eigen::MatrixXd& projector, const double se,
+                            const PERM_MODEL model);
+    /*!
+     * \brief Funtion to perform single threaded permutation
+     * \param base is the phenotype vector to be permuted
+     * \param projector is the pre-computed projection matrix. If logistic
+     * regression is used, this will be ignored
+     * \param se is the pre-computed unscaled SE of the PRS coefficient
+     * \param model is the model used to test the permuted phenotype
      */
-    void gen_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                        size_t num_consumer);
+    void run_null_perm_no_thread(const Eigen::VectorXd& base,
+                                 const Eigen::MatrixXd& projector,
+                                 const double se, const PERM_MODEL model);
     /*!
-     * \brief The "consumer" for calculating the T-value on permuted phenotypes
-     * \param q is the queue where the producer generated the permuted phenotype
-     * \param decomposed is the pre-computed decomposition
-     * \param rank is the pre-computed rank
-     * \param pre_se is the pre-computed SE matrix
-     * \param run_glm is a boolean indicate if we want to run logistic
-     * regression
+     * \brief Fill the block with permuted copies of base. Use the stored
+     * permutation index if the block is cached, otherwise shuffle base again
+     * from the random state stored for the block, which gives the same
+     * permutation as the index
+     * \param base is the phenotype vector to be permuted
+     * \param block_idx is the index of the block
+     * \param block is the resulting N x num_perm matrix
+     * \return the index of the first permutation in this block
      */
-    void consume_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                            const Regress& decomposed, bool run_glm);
+    size_t gen_perm_block(const Eigen::VectorXd& base, const size_t block_idx,
+                          Eigen::MatrixXd& block) const;
     /*!
-     * \brief Funtion to perform single threaded permutation
-     * \param decomposed is the pre-decomposed independent matrix. If run glm is
-     * true, this will be ignored
-     * \param rank is the rank of the decomposition
-     * \param pre_se is the pre-computed SE matrix required for calculating the
-     * final SE
-     * \param run_glm indicate if we want to run GLM instead of using
-     * precomputed matrix
+     * \brief Generate the permutations once per phenotype such that they can
+     * be reused for every threshold and region. The random state at the start
+     * of each block is always stored, and the sample index of as many blocks
+     * as fit into m_max_perm_index_byte and the memory budget are cached
+     */
+    void gen_perm_index();
+    /*!
+     * \brief Calculate the absolute T-value of the PRS coefficient for every
+     * permuted phenotype within the block
+     * \param block is the N x B matrix of permuted phenotypes
+     * \param projector is the pre-computed projection matrix. For the score
+     * test, this is the single row returned by LogisticScoreTest::direction
+     * and the block contains permuted Pearson residuals
+     * \param se is the pre-computed unscaled SE of the PRS coefficient
+     * \param model is the model used to test each column
+     * \param obs_t is the resulting T-values, one per column
+     */
+    void null_perm_block(const Eigen::MatrixXd& block,
+                         const Eigen::MatrixXd& projector, const double se,
+                         const PERM_MODEL model, std::vector<double>& obs_t);
+    /*!
+     * \brief Build the (rank + 1) x N projection matrix from the
+     * decomposition. First row gives the PRS coefficient and the remaining
+     * rows project the phenotype onto the column space of the design matrix
+     * (Q'), such that a whole block of permutation can be solved by one GEMM
+     * \param decomposed is the pre-decomposed independent matrix
+     * \param projector is the resulting projection matrix
+     */
+    void get_perm_projector(const Regress& decomposed,
+                            Eigen::MatrixXd& projector);
+    /*!
+     * \brief Return number of permutation to be processed within each block
      */
-    void run_null_perm_no_thread(const Regress& decomposed, const bool run_glm);
+    size_t perm_block_size() const;
 
     void parse_pheno(const std::string& pheno, std::vector<double>& pheno_store,
                      int& max_pheno_code);
@@ -31,11 +31,164 @@
 #include <stdexcept>
 namespace Regression
 {
+// pass as the thread count to leave the number of threads used by Eigen
+// untouched. Eigen::setNbThreads changes a global setting, so callers that
+// regress from several threads at once set it once beforehand and use this
+constexpr int keep_nb_threads = 0;
 void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
-         double& r2, double& coeff, double& standard_error, int thread = 1);
+         double& r2, double& coeff, double& standard_error, int thread = 1,
+         Eigen::VectorXd* beta = nullptr);
 void fastLm(const Eigen::VectorXd& y, const Eigen::MatrixXd& X, double& p_value,
             double& r2, double& r2_adjust, double& coeff,
             double& standard_error, int thread, bool intercept, int type = 0);
+
+/*!
+ * \brief Linear regression of y on [intercept, x, covariates] where only x
+ * changes between calls, e.g. the PRS of each threshold. By the
+ * Frisch-Waugh-Lovell theorem, the coefficient of x is that of regressing
+ * the covariate residuals of y on the covariate residuals of x. The
+ * covariates are factorized and y is residualized once, such that each call
+ * only needs to project x, which is O(N * covariates) instead of the
+ * O(N * covariates^2) of a new QR. Produces the same statistics as fastLm
+ */
+class ResidualizedLm
+{
+public:
+    ResidualizedLm() {}
+    /*!
+     * \brief Factorize the covariates and residualize the phenotype
+     * \param y is the phenotype
+     * \param cov is the intercept and the covariates
+     */
+    void init(const Eigen::VectorXd& y, const Eigen::MatrixXd& cov);
+    bool ready() const { return m_ready; }
+    void reset() { m_ready = false; }
+    /*!
+     * \brief Regress y on x and the covariates
+     * \return false if x is (nearly) collinear with the covariates, in which
+     * case the rank deficiency should be handled by fastLm instead
+     */
+    bool run(const Eigen::Ref<const Eigen::VectorXd>& x, double& p_value,
+             double& r2, double& r2_adjust, double& coeff,
+             double& standard_error);
+
+private:
+    // orthonormal basis of the column space of the covariates
+    Eigen::MatrixXd m_q;
+    Eigen::VectorXd m_y_resid;
+    Eigen::VectorXd m_x_resid;
+    Eigen::VectorXd m_proj;
+    double m_tss = 0.0;
+    Eigen::Index m_rank = 0;
+    bool m_ready = false;
+};
+
+/*!
+ * \brief Logistic regression of y on x where only the PRS (column 1 of x)
+ * changes between calls. The PRS of consecutive thresholds are highly
+ * correlated, so IRLS starts from the coefficients of the previous fit, or
+ * from the covariate only fit with a PRS coefficient of 0 for the first one.
+ * This usually takes far fewer iterations than the default start, which is
+ * only used when the warm start fails. y and x are referenced and must
+ * outlive the object
+ */
+class WarmStartGlm
+{
+public:
+    WarmStartGlm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x)
+        : m_glm(x, y, m_family)
+    {
+    }
+    /*!
+     * \brief Set the coefficients of the covariate only fit, in the order of
+     * x without the PRS column
+     */
+    void set_null(const Eigen::VectorXd& null_beta);
+    /*!
+     * \brief Start the next fit from the covariate only fit again, e.g. when
+     * moving to another set
+     */
+    void reset() { m_start = m_null_start; }
+    void run(double& p_value, double& r2, double& coeff,
+             double& standard_error, int thread);
+
+private:
+    Binomial m_family;
+    GLM<Binomial> m_glm;
+    Eigen::VectorXd m_start;
+    Eigen::VectorXd m_null_start;
+};
+
+/*!
+ * \brief Score test of adding x to the covariate only logistic model. The
+ * null model is fitted once, after which each x only needs a few weighted
+ * dot products instead of IRLS. With W the working weights and e the
+ * Pearson residuals of the null model, the score statistic is
+ * U = x'(y - mu) = x_w'e with variance V = |x_w|^2, where x_w is W^{1/2}x
+ * residualized on W^{1/2}[intercept, covariates]. coeff = U / V and
+ * se = 1 / sqrt(V) are the one step estimates from the null model, and
+ * r2 is approximated by taking U^2 / V as the reduction in deviance
+ */
+class LogisticScoreTest
+{
+public:
+    LogisticScoreTest() {}
+    /*!
+     * \brief Compute the weights and residuals of the null model
+     * \param y is the phenotype
+     * \param cov is the intercept and the covariates
+     * \param null_beta is the coefficients of the null model
+     */
+    void init(const Eigen::VectorXd& y, const Eigen::MatrixXd& cov,
+              const Eigen::VectorXd& null_beta);
+    bool ready() const { return m_ready; }
+    void reset() { m_ready = false; }
+    /*!
+     * \brief Test x against the null model
+     * \return false if x is (nearly) explained by the covariates, in which
+     * case the full GLM should be used instead
+     */
+    bool run(const Eigen::Ref<const Eigen::VectorXd>& x, double& p_value,
+             double& r2, double& coeff, double& standard_error);
+    /*!
+     * \brief Weighted covariate residual of x scaled to unit norm, such that
+     * its dot product with a vector of Pearson residuals is the score
+     * z-value. Can be called concurrently with different x_w
+     * \return false if x is (nearly) explained by the covariates
+     */
+    bool direction(const Eigen::Ref<const Eigen::VectorXd>& x,
+                   Eigen::VectorXd& x_w) const;
+    /*!
+     * \brief Score z-value of x, 0 if x is (nearly) explained by the
+     * covariates. x_w is the work space of the calling thread
+     */
+    double z_value(const Eigen::Ref<const Eigen::VectorXd>& x,
+                   Eigen::VectorXd& x_w) const
+    {
+        return direction(x, x_w) ? x_w.dot(m_resid) : 0.0;
+    }
+    /*!
+     * \brief Pearson residuals of the null model, (y - mu) / sqrt(W)
+     */
+    const Eigen::VectorXd& residual() const { return m_resid; }
+
+private:
+    /*!
+     * \brief Calculate x_w, return its squared norm or 0 if x is (nearly)
+     * explained by the covariates
+     */
+    double residualize(const Eigen::Ref<const Eigen::VectorXd>& x,
+                       Eigen::VectorXd& x_w) const;
+    // orthonormal basis of the column space of W^{1/2}[intercept, covariates]
+    Eigen::MatrixXd m_q;
+    Eigen::VectorXd m_sqrt_w;
+    Eigen::VectorXd m_resid;
+    Eigen::VectorXd m_x_w;
+    // deviance of the null model and of the intercept only model
+    double m_dev = 0.0;
+    double m_null_dev = 0.0;
+    bool m_ready = false;
+};
 }
 
 #endif /* PRSICE_REGRESSION_H_ */
@@ -455,7 +455,8 @@ public:
         if (m_genotype_storage == nullptr) return nullptr;
         return m_genotype_storage->get_geno();
     }
-    void freed_geno_storage(GenotypePool& pool)
+    template <typename Pool>
+    void freed_geno_storage(Pool& pool)
     {
         pool.free(m_genotype_storage);
         m_genotype_storage = nullptr;
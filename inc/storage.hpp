@@ -19,8 +19,11 @@
 #define PRSICE_INC_STORAGE_HPP_
 #include "enumerators.h"
 #include <Eigen/Dense>
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <memory>
+#include <new>
 #include <random>
 #include <string>
 #include <vector>
@@ -42,11 +45,80 @@ struct Regress
     Eigen::VectorXd se_base;
 };
 
-struct PRS
+/*!
+ * \brief Minimal allocator returning memory aligned to Align bytes, allowing
+ * aligned vector load / store on the PRS arrays
+ */
+template <typename T, size_t Align = 64>
+struct AlignedAllocator
 {
-    double prs;
-    size_t num_snp;
-    PRS() : prs(0.0), num_snp(0) {}
+    using value_type = T;
+    template <typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Align>;
+    };
+    AlignedAllocator() noexcept {}
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Align>&) noexcept
+    {
+    }
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(
+            ::operator new(n * sizeof(T), std::align_val_t(Align)));
+    }
+    void deallocate(T* ptr, size_t) noexcept
+    {
+        ::operator delete(ptr, std::align_val_t(Align));
+    }
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Align>&) const noexcept
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Align>&) const noexcept
+    {
+        return false;
+    }
+};
+
+/*!
+ * \brief PRS of all samples, stored as separated score and SNP count arrays
+ * (structure of arrays) so that they can be streamed and vectorized
+ * independently
+ */
+struct SamplePRS
+{
+    std::vector<double, AlignedAllocator<double>> prs;
+    std::vector<uint32_t, AlignedAllocator<uint32_t>> num_snp;
+    SamplePRS() {}
+    SamplePRS(size_t num_sample) : prs(num_sample, 0.0), num_snp(num_sample, 0)
+    {
+    }
+    size_t size() const { return prs.size(); }
+    void resize(size_t num_sample)
+    {
+        prs.resize(num_sample, 0.0);
+        num_snp.resize(num_sample, 0);
+    }
+    void reset()
+    {
+        std::fill(prs.begin(), prs.end(), 0.0);
+        std::fill(num_snp.begin(), num_snp.end(), 0);
+    }
+    void add(const SamplePRS& other)
+    {
+        assert(other.size() == size());
+        const size_t num_sample = size();
+        double* score = prs.data();
+        uint32_t* count = num_snp.data();
+        const double* other_score = other.prs.data();
+        const uint32_t* other_count = other.num_snp.data();
+        for (size_t i = 0; i < num_sample; ++i) { score[i] += other_score[i]; }
+        for (size_t i = 0; i < num_sample; ++i) { count[i] += other_count[i]; }
+    }
 };
 
 struct Sample_ID
@@ -175,6 +247,7 @@ struct CalculatePRS
     int no_regress = false;
     int non_cumulate = false;
     int use_ref_maf = false;
+    int score_test = false;
 };
 
 struct QCFiltering
@@ -196,6 +269,7 @@ struct Clumping
     double proxy = 0.0;
     double pvalue = 1;
     size_t distance = 250000;
+    CLUMP_LD ld = CLUMP_LD::EM;
     int no_clump = false;
     bool use_proxy = false;
     bool provided_distance = false;
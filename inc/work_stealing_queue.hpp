@@ -0,0 +1,86 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef WORK_STEALING_QUEUE_H
+#define WORK_STEALING_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/*!
+ * \brief Job queue where each worker has its own deque. Workers take jobs
+ * from the front of their own deque and, once it is empty, steal jobs from
+ * the back of the other workers' deques. All jobs should be pushed before
+ * the workers start
+ */
+template <typename T>
+class WorkStealingQueue
+{
+public:
+    WorkStealingQueue(size_t num_worker) : m_queues(num_worker) {}
+    WorkStealingQueue(const WorkStealingQueue&) = delete;
+    WorkStealingQueue& operator=(const WorkStealingQueue&) = delete;
+    size_t num_worker() const { return m_queues.size(); }
+    void push(size_t worker, const T& item)
+    {
+        auto&& queue = m_queues[worker % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(item);
+    }
+    /*!
+     * \brief Get the next job for the worker
+     * \param worker is the index of the worker
+     * \param item return the job
+     * \return false if there are no job left
+     */
+    bool pop(size_t worker, T& item)
+    {
+        const size_t num_worker = m_queues.size();
+        {
+            auto&& queue = m_queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty())
+            {
+                item = std::move(queue.jobs.front());
+                queue.jobs.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < num_worker; ++i)
+        {
+            auto&& queue = m_queues[(worker + i) % num_worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty())
+            {
+                item = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<T> jobs;
+    };
+    std::vector<Queue> m_queues;
+};
+
+#endif
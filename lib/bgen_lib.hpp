@@ -7,6 +7,7 @@
 #ifndef BGEN_REFERENCE_IMPLEMENTATION_HPP
 #define BGEN_REFERENCE_IMPLEMENTATION_HPP
 
+#include "block_decoder.hpp"
 #include "memoryread.hpp"
 #include <cassert>
 #include <cmath>
@@ -351,10 +352,13 @@ namespace bgen
     // input buffer and interprets them as the uncompressed data size, before
     // uncompressing the rest.) Usually bgen files are stored compressed.  If
     // the data is not compressed, this function simply copies the source buffer
-    // to the target buffer.
+    // to the target buffer. zlib blocks are decompressed with the given
+    // inflater, or with an inflater owned by the calling thread if none is
+    // given, such that the inflate state is reused across blocks.
     void uncompress_probability_data(Context const& context,
                                      std::vector<byte_t> const& buffer1,
-                                     std::vector<byte_t>* buffer2);
+                                     std::vector<byte_t>* buffer2,
+                                     ZlibInflater* inflater = nullptr);
 
     // template< typename Setter >
     // parse uncompressed genotype probability data stored in the given buffer.
@@ -422,7 +422,8 @@ namespace bgen
     }
     void uncompress_probability_data(Context const& context,
                                      std::vector<byte_t> const& compressed_data,
-                                     std::vector<byte_t>* buffer)
+                                     std::vector<byte_t>* buffer,
+                                     ZlibInflater* inflater)
     {
         // compressed_data contains the (compressed or uncompressed) probability
         // data.
@@ -443,7 +444,18 @@ namespace bgen
             }
             buffer->resize(uncompressed_data_size);
             if (compressionType == e_ZlibCompression)
-            { zlib_uncompress(begin, end, buffer); }
+            {
+                thread_local ZlibInflater thread_inflater;
+                if (inflater == nullptr) inflater = &thread_inflater;
+                if (inflater->inflate(begin, end, buffer->data(),
+                                      buffer->size())
+                    != uncompressed_data_size)
+                {
+                    throw std::runtime_error(
+                        "Error: Unexpected size of decompressed genotype "
+                        "block");
+                }
+            }
             else if (compressionType == e_ZstdCompression)
             {
                 throw std::runtime_error(
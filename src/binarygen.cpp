@@ -432,26 +432,22 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
                                     Genotype* genotype)
 {
     const std::string intermediate_name = prefix + ".inter";
-    std::vector<bool> retain_snps(genotype->m_existed_snps.size(), false);
-    std::streampos byte_pos, tmp_byte_pos;
-    size_t processed_count = 0;
-    size_t cur_file_idx = 0;
-    size_t retained = 0;
-    uint32_t ref_count = 0;
-    uint32_t het_count = 0;
-    uint32_t alt_count = 0;
-    uint32_t missing_count = 0;
-    // we initialize the plink converter with the sample inclusion vector
-    // and also the tempory genotype vector list. We also provide the hard
-    // coding threshold
-    // TODO: This isn't correct if there are non-founder samples in our datas
-    // and if we account for ref and target, we also need to consider situation
-    // where we use target as reference.
-    PLINK_generator setter(m_calculate_prs.data(), m_tmp_genotype.data(),
-                           m_hard_threshold, m_dose_threshold);
+    // we will only generate the intermediate file if the following happen:
+    // 1. User want to generate the intermediate file
+    // 2. We are dealing with reference file format
+    // 3. We are dealing with target file and there is no reference file
+    // 4. We are dealing with target file and we are expected to use hard
+    // coding
+    const bool gen_inter =
+        m_intermediate
+        && (m_is_ref || !m_expect_reference || (!m_is_ref && m_hard_coded));
+    // keep the intermediate file in the cache directory so that later runs
+    // can skip the parsing of the bgen file
+    const bool use_cache = gen_inter && !m_cache_dir.empty();
     // now consider if we are generating the intermediate file
     std::ofstream inter_out;
-    if (m_intermediate)
+    std::mutex inter_mutex;
+    if (gen_inter && !use_cache)
     {
         auto flag = std::ios::binary;
         if (m_is_ref)
@@ -462,115 +458,272 @@ bool BinaryGen::calc_freq_gen_inter(const QCFiltering& filter_info,
         }
         inter_out.open(intermediate_name.c_str(), flag);
     }
-    // now start processing the bgen file
-    double progress = 0, prev_progress = -1.0;
-    const size_t total_snp = genotype->m_existed_snps.size();
-    for (auto&& snp : genotype->m_existed_snps)
+    const size_t num_bgen = m_genotype_file_names.size();
+    const size_t inter_file_idx = num_bgen;
+    const std::streamsize geno_byte = static_cast<std::streamsize>(
+        m_tmp_genotype.size() * sizeof(uintptr_t));
+    std::vector<std::unique_ptr<GenotypeCache>> caches;
+    if (use_cache)
     {
-        progress = static_cast<double>(processed_count)
-                   / static_cast<double>(total_snp) * 100;
-        if (!m_reporter->unit_testing() && progress - prev_progress > 0.01)
+        // the records depend on the samples included and the thresholds
+        std::ostringstream setting;
+        setting << std::setprecision(17) << "samples="
+                << m_unfiltered_sample_ct << ":"
+                << GenotypeCache::hash(std::string(
+                       reinterpret_cast<const char*>(m_calculate_prs.data()),
+                       m_calculate_prs.size() * sizeof(uintptr_t)))
+                << "\nhard=" << m_hard_threshold
+                << "\ndose=" << m_dose_threshold << "\n";
+        size_t num_cached = 0;
+        for (size_t i = 0; i < num_bgen; ++i)
         {
-            fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%",
-                    progress);
-            prev_progress = progress;
+            // the cache of file i is m_genotype_file_names[num_bgen + i]
+            caches.emplace_back(new GenotypeCache(
+                m_cache_dir, m_genotype_file_names[i] + ".bgen", setting.str(),
+                static_cast<size_t>(geno_byte)));
+            num_cached += caches.back()->size();
+            m_genotype_file_names.push_back(caches.back()->name());
         }
-        snp->get_file_info(cur_file_idx, byte_pos, m_is_ref);
-        // now read in the genotype information
-        genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
-            m_genotype_file, m_genotype_file_names[cur_file_idx] + ".bgen",
-            m_context_map[cur_file_idx], setter, &m_buffer1, &m_buffer2,
-            byte_pos);
-        // no founder, much easier
-        setter.get_count(ref_count, het_count, alt_count, missing_count);
-        ++processed_count;
-        if (filter_snp(ref_count, het_count, alt_count, ref_count, het_count,
-                       alt_count, filter_info.geno, filter_info.maf,
-                       missing_count))
-        { continue; }
-
-        if (setter.info_score(filter_info.info_type) < filter_info.info_score)
+        m_reporter->report(std::to_string(num_cached)
+                           + " variant(s) found in the intermediate cache: "
+                           + m_cache_dir);
+    }
+    // each thread keeps the genotypes of the retained SNPs and write them to
+    // the intermediate file in batches to avoid contending on the file
+    const size_t inter_batch = std::max<size_t>(
+        1, (1ULL << 20) / static_cast<size_t>(std::max<std::streamsize>(
+               1, geno_byte)));
+    const size_t num_thread = std::max<size_t>(1, m_thread);
+    std::vector<std::vector<SNP*>> pending_snps(num_thread);
+    std::vector<std::vector<uintptr_t>> pending_genotypes(num_thread);
+    std::atomic<bool> redirected {false};
+    // read the genotypes of the SNP from the intermediate file from now on
+    auto redirect = [&](SNP& snp, const size_t file_idx,
+                        const std::streampos& byte_pos) {
+        redirected = true;
+        if (!m_is_ref)
         {
-            ++m_num_info_filter;
-            continue;
-        }
-        // if we can reach here, it is not removed
-        snp->set_counts(ref_count, het_count, alt_count, missing_count,
-                        m_is_ref);
-        snp->set_expected(setter.expected(), m_is_ref);
-        ++retained;
-        // we need to -1 because we put processed_count ++ forward
-        // to avoid continue skipping out the addition
-        retain_snps[processed_count - 1] = true;
-        if (m_intermediate
-            && (m_is_ref || !m_expect_reference || (!m_is_ref && m_hard_coded)))
-        {
-            // we will only generate the intermediate file if
-            // the following happen:
-            // 1. User want to generate the intermediate file
-            // 2. We are dealing with reference file format
-            // 3. We are dealing with target file and there is
-            // no reference file
-            // 4. We are dealing with target file and we are
-            // expected to use hard_coding
-            tmp_byte_pos = inter_out.tellp();
-            inter_out.write(reinterpret_cast<char*>(m_tmp_genotype.data()),
-                            m_tmp_genotype.size() * sizeof(uintptr_t));
-            if (!m_is_ref)
+            // target file
+            if (m_hard_coded) { snp.update_file(file_idx, byte_pos, false); }
+            if (!m_expect_reference)
             {
-                // target file
-                if (m_hard_coded)
-                {
-                    m_target_plink = true;
-                    snp->update_file(m_genotype_file_names.size(), tmp_byte_pos,
-                                     false);
-                }
-                if (!m_expect_reference)
-                {
-                    // we don't have reference, so use target as reference
-                    m_ref_plink = true;
-                    snp->update_file(m_genotype_file_names.size(), tmp_byte_pos,
-                                     true);
-                }
+                // we don't have reference, so use target as reference
+                snp.update_file(file_idx, byte_pos, true);
             }
-            else
+        }
+        else
+        {
+            // this is the reference file
+            snp.update_file(file_idx, byte_pos, true);
+        }
+    };
+    auto write_inter = [&](std::vector<SNP*>& snps,
+                           std::vector<uintptr_t>& genotypes) {
+        if (snps.empty()) return;
+        std::lock_guard<std::mutex> lock(inter_mutex);
+        const size_t geno_size = m_tmp_genotype.size();
+        for (size_t i = 0; i < snps.size(); ++i)
+        {
+            const std::streampos tmp_byte_pos = inter_out.tellp();
+            inter_out.write(
+                reinterpret_cast<char*>(genotypes.data() + i * geno_size),
+                geno_byte);
+            redirect(*snps[i], inter_file_idx, tmp_byte_pos);
+        }
+        snps.clear();
+        genotypes.clear();
+    };
+    // every SNP parsed is cached, including those filtered by this run, as
+    // later runs might use different filters. The SNP is null if it was
+    // filtered
+    struct CacheBatch
+    {
+        size_t file_idx = 0;
+        std::vector<GenotypeCache::Entry> entries;
+        std::vector<SNP*> snps;
+        std::vector<uintptr_t> genotypes;
+        std::vector<std::streampos> genotype_pos;
+    };
+    std::vector<CacheBatch> pending_cache(use_cache ? num_thread : 0);
+    auto write_cache = [&](CacheBatch& batch) {
+        if (batch.entries.empty()) return;
+        caches[batch.file_idx]->append(batch.entries, batch.genotypes.data(),
+                                       batch.genotype_pos);
+        for (size_t i = 0; i < batch.snps.size(); ++i)
+        {
+            if (batch.snps[i] == nullptr) continue;
+            redirect(*batch.snps[i], num_bgen + batch.file_idx,
+                     batch.genotype_pos[i]);
+        }
+        batch.entries.clear();
+        batch.snps.clear();
+        batch.genotypes.clear();
+    };
+    parallel_qc(genotype, [&](SNP& snp, size_t thread_idx, QCCount& count) {
+        auto&& buffer = *m_score_buffer[thread_idx];
+        std::streampos byte_pos, cache_pos;
+        size_t cur_file_idx = 0;
+        uint32_t ref_count = 0;
+        uint32_t het_count = 0;
+        uint32_t alt_count = 0;
+        uint32_t missing_count = 0;
+        double expected = 0.0, info_score = 0.0;
+        GenotypeCache::Entry entry;
+        snp.get_file_info(cur_file_idx, byte_pos, m_is_ref);
+        const bool cached =
+            use_cache
+            && caches[cur_file_idx]->find(byte_pos, entry, cache_pos);
+        if (cached)
+        {
+            ref_count = entry.count[0];
+            het_count = entry.count[1];
+            alt_count = entry.count[2];
+            missing_count = entry.count[3];
+            expected = entry.expected;
+            info_score =
+                entry.info[(filter_info.info_type == INFO::MACH) ? 0 : 1];
+        }
+        else
+        {
+            // we initialize the plink converter with the sample inclusion
+            // vector and also the tempory genotype vector list. We also
+            // provide the hard coding threshold
+            // TODO: This isn't correct if there are non-founder samples in our
+            // datas and if we account for ref and target, we also need to
+            // consider situation where we use target as reference.
+            PLINK_generator setter(m_calculate_prs.data(),
+                                   buffer.tmp_genotype.data(),
+                                   m_hard_threshold, m_dose_threshold);
+            // now read in the genotype information
+            genfile::bgen::read_and_parse_genotype_data_block<PLINK_generator>(
+                buffer.genotype_file,
+                m_genotype_file_names[cur_file_idx] + ".bgen",
+                m_context_map[cur_file_idx], setter, &buffer.buffer1,
+                &buffer.buffer2, byte_pos);
+            // no founder, much easier
+            setter.get_count(ref_count, het_count, alt_count, missing_count);
+            expected = setter.expected();
+            info_score = setter.info_score(filter_info.info_type);
+            if (use_cache)
             {
-                // this is the reference file
-                m_ref_plink = true;
-                snp->update_file(m_genotype_file_names.size(), tmp_byte_pos,
-                                 true);
+                entry.byte_pos = static_cast<uint64_t>(byte_pos);
+                entry.count[0] = ref_count;
+                entry.count[1] = het_count;
+                entry.count[2] = alt_count;
+                entry.count[3] = missing_count;
+                entry.expected = expected;
+                entry.info[0] = setter.info_score(INFO::MACH);
+                entry.info[1] = setter.info_score(INFO::IMPUTE2);
             }
         }
+        bool retained = !filter_snp(ref_count, het_count, alt_count, ref_count,
+                                    het_count, alt_count, filter_info.geno,
+                                    filter_info.maf, missing_count, count);
+        if (retained && info_score < filter_info.info_score)
+        {
+            ++count.info;
+            retained = false;
+        }
+        if (use_cache && !cached)
+        {
+            auto&& batch = pending_cache[thread_idx];
+            if (batch.file_idx != cur_file_idx) write_cache(batch);
+            batch.file_idx = cur_file_idx;
+            batch.entries.push_back(entry);
+            batch.snps.push_back(retained ? &snp : nullptr);
+            batch.genotypes.insert(batch.genotypes.end(),
+                                   buffer.tmp_genotype.begin(),
+                                   buffer.tmp_genotype.end());
+            if (batch.entries.size() >= inter_batch) write_cache(batch);
+        }
+        if (!retained) return false;
+        // if we can reach here, it is not removed
+        snp.set_counts(ref_count, het_count, alt_count, missing_count,
+                       m_is_ref);
+        snp.set_expected(expected, m_is_ref);
+        if (cached) { redirect(snp, num_bgen + cur_file_idx, cache_pos); }
+        else if (gen_inter && !use_cache)
+        {
+            auto&& snps = pending_snps[thread_idx];
+            auto&& genotypes = pending_genotypes[thread_idx];
+            snps.push_back(&snp);
+            genotypes.insert(genotypes.end(), buffer.tmp_genotype.begin(),
+                             buffer.tmp_genotype.end());
+            if (snps.size() >= inter_batch) write_inter(snps, genotypes);
+        }
+        return true;
+    });
+    if (gen_inter)
+    {
+        // write out the remaining genotypes in the order of the threads
+        for (size_t i = 0; i < pending_snps.size(); ++i)
+        { write_inter(pending_snps[i], pending_genotypes[i]); }
+        for (auto&& batch : pending_cache) write_cache(batch);
+        if (redirected)
+        {
+            // the target is used as reference if we don't have reference
+            if (m_is_ref || !m_expect_reference) m_ref_plink = true;
+            if (!m_is_ref && m_hard_coded) m_target_plink = true;
+        }
+        if (!use_cache)
+        {
+            // update our genotype file
+            inter_out.close();
+            m_genotype_file_names.push_back(intermediate_name);
+            if (redirected) m_intermediate_file = intermediate_name;
+        }
     }
-    if (m_intermediate
-        && (m_is_ref || (!m_is_ref && m_hard_coded) || !m_expect_reference))
-    { // update our genotype file
-        inter_out.close();
-        m_genotype_file_names.push_back(intermediate_name);
-    }
-    if (!m_reporter->unit_testing())
-        fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%\n", 100.0);
-    // now update the vector
-    if (retained != genotype->m_existed_snps.size())
-    { genotype->shrink_snp_vector(retain_snps); }
     return true;
 }
 
 BinaryGen::~BinaryGen()
 {
-    if (m_target_plink || m_ref_plink)
+    // if we have constructed the intermediate file, we should remove it to
+    // save space (plus that file isn't of any useful format and can't be used
+    // by any other problem). Intermediate files in the cache directory are
+    // kept for later runs
+    if (!m_intermediate_file.empty())
+    { std::remove(m_intermediate_file.c_str()); }
+}
+
+std::vector<size_t>::const_iterator
+BinaryGen::decode_blocks(const std::vector<size_t>::const_iterator& start_idx,
+                         const std::vector<size_t>::const_iterator& end_idx,
+                         GenotypeBuffer& buffer)
+{
+    auto&& decoder = buffer.bgen_decoder;
+    const size_t max_block =
+        decoder.num_worker() * BlockDecoder::block_per_worker;
+    size_t num_block = 0, work = 0;
+    auto cur_idx = start_idx;
+    // the file reader isn't thread safe, so the blocks are read here and only
+    // the decompression is done by the workers
+    for (; cur_idx != end_idx && num_block < max_block; ++cur_idx)
     {
-        // if we have constructed the intermediate file, we should remove it
-        // to save space (plus that file isn't of any useful format and
-        // can't be used by any other problem nor can it be reused)
-        std::remove(m_genotype_file_names.back().c_str());
+        auto&& snp = m_existed_snps[(*cur_idx)];
+        if (!parse_from_file(snp)) continue;
+        auto [file_idx, byte_pos] = snp->get_file_info(m_is_ref);
+        auto&& block = decoder.block(num_block++);
+        block.file_idx = file_idx;
+        genfile::bgen::read_genotype_data_block(
+            buffer.genotype_file, m_genotype_file_names[file_idx] + ".bgen",
+            m_context_map[file_idx], &block.compressed, byte_pos);
+        work += block.compressed.size();
     }
+    decoder.decode(num_block, work,
+                   [this](BlockDecoder::Block& block, ZlibInflater& inflater) {
+                       genfile::bgen::uncompress_probability_data(
+                           m_context_map[block.file_idx], block.compressed,
+                           &block.data, &inflater);
+                   });
+    return cur_idx;
 }
 
 void BinaryGen::dosage_score(
-    std::vector<PRS>& prs_list,
+    SamplePRS& prs_list,
     const std::vector<size_t>::const_iterator& start_idx,
-    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero)
+    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero,
+    GenotypeBuffer& buffer)
 {
     // currently, use_ref_maf doesn't work on bgen dosage file
     // main reason is we need expected value instead of
@@ -592,20 +745,31 @@ void BinaryGen::dosage_score(
                                              m_prs_calculation.missing_score);
     }
     std::vector<size_t>::const_iterator cur_idx = start_idx;
-    size_t file_idx;
-    std::streampos byte_pos;
+    std::vector<size_t>::const_iterator batch_end = start_idx;
+    size_t block_idx = 0;
     for (; cur_idx != end_idx; ++cur_idx)
     {
+        if (cur_idx == batch_end)
+        {
+            batch_end = decode_blocks(cur_idx, end_idx, buffer);
+            block_idx = 0;
+        }
         auto&& snp = m_existed_snps[(*cur_idx)];
-        std::tie(file_idx, byte_pos) = snp->get_file_info(m_is_ref);
-        // if the file name differ, or the file isn't open, we will open it
-        auto&& context = m_context_map[file_idx];
         setter->set_stat(snp->stat(), m_homcom_weight, m_het_weight,
                          m_homrar_weight, snp->is_flipped());
-        // start performing the parsing
-        genfile::bgen::read_and_parse_genotype_data_block<PRS_Interpreter>(
-            m_genotype_file, m_genotype_file_names[file_idx] + ".bgen", context,
-            *setter, &m_buffer1, &m_buffer2, byte_pos);
+        auto&& genotype = snp->current_genotype();
+        if (genotype != nullptr)
+        {
+            // dosages were stored in memory
+            setter->score_stored(dosage_record(genotype));
+        }
+        else
+        {
+            auto&& block = buffer.bgen_decoder.block(block_idx++);
+            genfile::bgen::parse_probability_data(
+                block.data.data(), block.data.data() + block.data.size(),
+                m_context_map[block.file_idx], *setter);
+        }
         if (!not_first)
         {
             setter.reset(new Add_PRS(&prs_list, &m_calculate_prs,
@@ -618,9 +782,10 @@ void BinaryGen::dosage_score(
 
 
 void BinaryGen::hard_code_score(
-    std::vector<PRS>& prs_list,
+    SamplePRS& prs_list,
     const std::vector<size_t>::const_iterator& start_idx,
-    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero)
+    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero,
+    GenotypeBuffer& buffer)
 {
     // genotype counts
     uint32_t homrar_ct = 0;
@@ -642,13 +807,19 @@ void BinaryGen::hard_code_score(
     // check if we need to reset the sample's PRS
     bool not_first = !reset_zero;
     double stat, maf, adj_score, miss_score;
-    genfile::bgen::Context context;
-    PLINK_generator setter(m_calculate_prs.data(), m_tmp_genotype.data(),
+    PLINK_generator setter(m_calculate_prs.data(), buffer.tmp_genotype.data(),
                            m_hard_threshold, m_dose_threshold);
     std::vector<size_t>::const_iterator cur_idx = start_idx;
+    std::vector<size_t>::const_iterator batch_end = start_idx;
+    size_t block_idx = 0;
     uintptr_t* genotype_ptr;
     for (; cur_idx != end_idx; ++cur_idx)
     {
+        if (cur_idx == batch_end)
+        {
+            batch_end = decode_blocks(cur_idx, end_idx, buffer);
+            block_idx = 0;
+        }
         auto&& cur_snp = m_existed_snps[(*cur_idx)];
         if (cur_snp->current_genotype() == nullptr)
         {
@@ -666,19 +837,17 @@ void BinaryGen::hard_code_score(
                 // read in the genotype information to the genotype vector
                 const uintptr_t unfiltered_sample_ct4 =
                     (m_unfiltered_sample_ct + 3) / 4;
-                m_genotype_file.read(
-                    m_genotype_file_names[idx], byte_pos, unfiltered_sample_ct4,
-                    reinterpret_cast<char*>(m_tmp_genotype.data()));
+                buffer.genotype_file.read(
+                    m_genotype_file_names[idx], byte_pos,
+                    unfiltered_sample_ct4,
+                    reinterpret_cast<char*>(buffer.tmp_genotype.data()));
             }
             else
             {
-                // now read in the genotype information
-                context = m_context_map[idx];
-                // start performing the parsing
-                genfile::bgen::read_and_parse_genotype_data_block<
-                    PLINK_generator>(
-                    m_genotype_file, m_genotype_file_names[idx] + ".bgen",
-                    context, setter, &m_buffer1, &m_buffer2, byte_pos);
+                auto&& block = buffer.bgen_decoder.block(block_idx++);
+                genfile::bgen::parse_probability_data(
+                    block.data.data(), block.data.data() + block.data.size(),
+                    m_context_map[block.file_idx], setter);
                 if (!m_prs_calculation.use_ref_maf)
                 {
                     setter.get_count(homcom_ct, het_ct, homrar_ct, missing_ct);
@@ -695,7 +864,10 @@ void BinaryGen::hard_code_score(
                     }
                 }
             }
-            genotype_ptr = m_tmp_genotype.data();
+            // keep a copy as tmp_genotype will be overwritten by the next SNP
+            genotype_ptr = prs_block_genotype(buffer);
+            std::copy(buffer.tmp_genotype.begin(), buffer.tmp_genotype.end(),
+                      genotype_ptr);
         }
         else
         {
@@ -720,20 +892,55 @@ void BinaryGen::hard_code_score(
         if (is_centre) { adj_score = ploidy * stat * maf; }
         miss_score = 0;
         if (mean_impute) { miss_score = ploidy * stat * maf; }
-        read_prs(genotype_ptr, prs_list, ploidy, stat, adj_score, miss_score,
-                 miss_count, homcom_weight, het_weight, homrar_weight,
-                 not_first);
-        not_first = true;
+        add_prs_block(genotype_ptr, *cur_idx, prs_list, buffer, ploidy, stat,
+                      adj_score, miss_score, miss_count, homcom_weight,
+                      het_weight, homrar_weight, not_first);
     }
+    flush_prs_block(prs_list, buffer, not_first);
 }
 
 void BinaryGen::count_and_read_genotype(const std::unique_ptr<SNP>& snp)
 {
     auto [file_idx, byte_pos] = snp->get_file_info(false);
     auto&& genotype = snp->current_genotype();
-    // load into memory is useless for dosage score
-    if (!m_hard_coded) return;
-
+    if (!m_hard_coded)
+    {
+        // store the weighted dosages of the SNP
+        auto&& context = m_context_map[file_idx];
+        genfile::bgen::read_genotype_data_block(
+            m_genotype_file, m_genotype_file_names[file_idx] + ".bgen",
+            context, &m_buffer1, byte_pos);
+        genfile::bgen::uncompress_probability_data(context, m_buffer1,
+                                                   &m_buffer2);
+        // the record can't hold the probabilities of every bit depth exactly
+        bool stored = false;
+        if ((context.flags & genfile::bgen::e_Layout)
+            == genfile::bgen::e_Layout2)
+        {
+            const genfile::bgen::v12::GenotypeDataBlock pack(
+                context, m_buffer2.data(), m_buffer2.data() + m_buffer2.size());
+            stored = DosageRecord::exact(pack.bits);
+        }
+        if (stored)
+        {
+            DosageRecord record = dosage_record(genotype);
+            Dosage_Store setter(&m_calculate_prs, record);
+            setter.set_stat(snp->stat(), m_homcom_weight, m_het_weight,
+                            m_homrar_weight, snp->is_flipped());
+            genfile::bgen::parse_probability_data<PRS_Interpreter>(
+                m_buffer2.data(), m_buffer2.data() + m_buffer2.size(), context,
+                setter);
+            stored = setter.valid();
+        }
+        if (!stored)
+        {
+            // fall back to parse the SNP during scoring, which can't be done
+            // by multiple permutation threads at once
+            snp->freed_geno_storage(*m_genotype_pool);
+            m_genotype_stored = false;
+        }
+        return;
+    }
     if (m_intermediate)
     {
         // this is the intermediate
@@ -762,15 +969,15 @@ void BinaryGen::count_and_read_genotype(const std::unique_ptr<SNP>& snp)
     }
 }
 
-void BinaryGen::read_score(std::vector<PRS>& prs_list,
+void BinaryGen::read_score(SamplePRS& prs_list,
                            const std::vector<size_t>::const_iterator& start_idx,
                            const std::vector<size_t>::const_iterator& end_idx,
-                           bool reset_zero)
+                           bool reset_zero, GenotypeBuffer& buffer)
 {
     if (m_hard_coded)
-    { hard_code_score(prs_list, start_idx, end_idx, reset_zero); }
+    { hard_code_score(prs_list, start_idx, end_idx, reset_zero, buffer); }
     else
     {
-        dosage_score(prs_list, start_idx, end_idx, reset_zero);
+        dosage_score(prs_list, start_idx, end_idx, reset_zero, buffer);
     }
 }
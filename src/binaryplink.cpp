@@ -25,6 +25,8 @@ BinaryPlink::BinaryPlink(const GenoFile& geno, const Phenotype& pheno,
     { m_sample_file = m_genotype_file_names.front() + ".fam"; }
     m_reporter->report(message);
     m_hard_coded = true; // technically true
+    for (auto&& prefix : m_genotype_file_names)
+    { m_bed_names.push_back(prefix + ".bed"); }
 }
 
 std::unordered_set<std::string>
@@ -100,61 +102,38 @@ bool BinaryPlink::calc_freq_gen_inter(const QCFiltering& filter_info,
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
     const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
     const uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
-    const size_t total_snp = genotype->m_existed_snps.size();
-    std::vector<bool> retain_snps(total_snp, false);
-    double progress = 0.0, prev_progress = -1.0;
-    std::streampos byte_pos;
-    size_t processed_count = 0;
-    size_t retained = 0;
-    size_t cur_file_idx = 0;
-    uint32_t ref_count = 0;
-    uint32_t het_count = 0;
-    uint32_t alt_count = 0;
-    uint32_t ref_founder_count = 0;
-    uint32_t het_founder_count = 0;
-    uint32_t alt_founder_count = 0;
-    uint32_t missing_founder_ct = 0;
-    // initialize the sample inclusion mask
-    for (auto&& snp : genotype->m_existed_snps)
-    {
-        progress = static_cast<double>(processed_count)
-                   / static_cast<double>(total_snp) * 100;
-        if (!m_reporter->unit_testing() && !m_reporter->unit_testing()
-            && progress - prev_progress > 0.01)
-        {
-            fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%",
-                    progress);
-            prev_progress = progress;
-        }
-        snp->get_file_info(cur_file_idx, byte_pos, m_is_ref);
-        m_genotype_file.read(m_genotype_file_names[cur_file_idx] + ".bed",
-                             byte_pos,
-                             static_cast<long long>(unfiltered_sample_ct4),
-                             reinterpret_cast<char*>(m_tmp_genotype.data()));
+    parallel_qc(genotype, [&](SNP& snp, size_t thread_idx, QCCount& count) {
+        auto&& buffer = *m_score_buffer[thread_idx];
+        std::streampos byte_pos;
+        size_t cur_file_idx = 0;
+        uint32_t ref_count = 0;
+        uint32_t het_count = 0;
+        uint32_t alt_count = 0;
+        uint32_t ref_founder_count = 0;
+        uint32_t het_founder_count = 0;
+        uint32_t alt_founder_count = 0;
+        uint32_t missing_founder_ct = 0;
+        snp.get_file_info(cur_file_idx, byte_pos, m_is_ref);
+        buffer.genotype_file.read(
+            m_bed_names[cur_file_idx], byte_pos,
+            static_cast<long long>(unfiltered_sample_ct4),
+            reinterpret_cast<char*>(buffer.tmp_genotype.data()));
         // calculate the MAF using PLINK2 function (take into account of founder
         // status)
         single_marker_freqs_and_hwe(
-            unfiltered_sample_ctv2, m_tmp_genotype.data(),
+            unfiltered_sample_ctv2, buffer.tmp_genotype.data(),
             m_sample_include2.data(), m_founder_include2.data(), m_sample_ct,
             &ref_count, &het_count, &alt_count, m_founder_ct,
             &ref_founder_count, &het_founder_count, &alt_founder_count);
-        ++processed_count;
         if (filter_snp(ref_count, het_count, alt_count, ref_founder_count,
                        het_founder_count, alt_founder_count, filter_info.geno,
-                       filter_info.maf, missing_founder_ct))
-        { continue; }
+                       filter_info.maf, missing_founder_ct, count))
+        { return false; }
         // if we can reach here, it is not removed
-        snp->set_counts(ref_founder_count, het_founder_count, alt_founder_count,
-                        missing_founder_ct, m_is_ref);
-        ++retained;
-        // we need to -1 because we put processed_count ++ forward
-        // to avoid continue skipping out the addition
-        retain_snps[processed_count - 1] = true;
-    }
-    if (!m_reporter->unit_testing())
-        fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%\n", 100.0);
-    // now update the vector
-    if (retained != total_snp) { genotype->shrink_snp_vector(retain_snps); }
+        snp.set_counts(ref_founder_count, het_founder_count, alt_founder_count,
+                       missing_founder_ct, m_is_ref);
+        return true;
+    });
     return true;
 }
 
@@ -358,25 +337,100 @@ void BinaryPlink::check_bed(const std::string& bed_name, size_t num_marker,
 }
 
 BinaryPlink::~BinaryPlink() {}
-void BinaryPlink::read_score(
-    std::vector<PRS>& prs_list,
-    const std::vector<size_t>::const_iterator& start_idx,
-    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero)
+void BinaryPlink::read_score_genotype(SNP& snp, FileRead& genotype_file,
+                                      uintptr_t* tmp_genotype,
+                                      uintptr_t* genotype,
+                                      std::array<uint32_t, 4>& count)
 {
     // for removing unwanted bytes from the end of the genotype vector
     const uintptr_t final_mask =
         get_final_mask(static_cast<uint32_t>(m_sample_ct));
-    // this is use for initialize the array sizes
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
     const uintptr_t unfiltered_sample_ct4 = (m_unfiltered_sample_ct + 3) / 4;
     const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
+    auto [file_idx, byte_pos] = snp.get_file_info(false);
+    genotype_file.read(m_bed_names[file_idx], byte_pos, unfiltered_sample_ct4,
+                       reinterpret_cast<char*>(tmp_genotype));
+    if (!snp.get_counts(count[0], count[1], count[2], count[3],
+                        m_prs_calculation.use_ref_maf))
+    {
+        // we need to calculate the MA
+        // if we want to use reference, we will always have calculated
+        // the MAF
+        uint32_t ll_ct, lh_ct, hh_ct;
+        single_marker_freqs_and_hwe(
+            unfiltered_sample_ctv2, tmp_genotype, m_sample_include2.data(),
+            m_founder_include2.data(), m_sample_ct, &ll_ct, &lh_ct, &hh_ct,
+            m_founder_ct, &count[0], &count[1], &count[2]);
+        const uint32_t tmp_total = (count[0] + count[1] + count[2]);
+        assert(m_founder_ct >= tmp_total);
+        count[3] = static_cast<uint32_t>(m_founder_ct) - tmp_total;
+        snp.set_counts(count[0], count[1], count[2], count[3], false);
+    }
+    if (m_unfiltered_sample_ct != m_sample_ct)
+    {
+        copy_quaterarr_nonempty_subset(
+            tmp_genotype, m_calculate_prs.data(),
+            static_cast<uint32_t>(m_unfiltered_sample_ct),
+            static_cast<uint32_t>(m_sample_ct), genotype);
+    }
+    else
+    {
+        std::copy(tmp_genotype, tmp_genotype + unfiltered_sample_ctv2,
+                  genotype);
+        genotype[(m_unfiltered_sample_ct - 1) / BITCT2] &= final_mask;
+    }
+}
+
+std::vector<size_t>::const_iterator
+BinaryPlink::prefetch_span(std::vector<size_t>::const_iterator cur,
+                           const std::vector<size_t>::const_iterator& end,
+                           FileRead& genotype_file)
+{
+    const std::streamoff record_size =
+        static_cast<std::streamoff>((m_unfiltered_sample_ct + 3) / 4);
+    const std::streamoff max_gap = static_cast<std::streamoff>(m_max_read_gap);
+    const std::streamoff max_span =
+        static_cast<std::streamoff>(m_max_read_span);
+    auto [file_idx, span_start] = m_existed_snps[(*cur)]->get_file_info(false);
+    std::streampos span_end = span_start + record_size;
+    size_t num_record = 1;
+    for (++cur; cur != end; ++cur)
+    {
+        auto&& snp = m_existed_snps[(*cur)];
+        // genotypes stored in memory are not read
+        if (snp->current_genotype() != nullptr) continue;
+        auto [cur_file_idx, byte_pos] = snp->get_file_info(false);
+        if (cur_file_idx != file_idx || byte_pos - span_end < 0
+            || byte_pos - span_end > max_gap
+            || byte_pos + record_size - span_start > max_span)
+        { break; }
+        span_end = byte_pos + record_size;
+        ++num_record;
+    }
+    // a single record is simply read when required
+    if (num_record > 1)
+    {
+        genotype_file.prefetch(m_bed_names[file_idx], span_start,
+                               static_cast<size_t>(span_end - span_start));
+    }
+    return cur;
+}
 
+void BinaryPlink::read_score(
+    SamplePRS& prs_list,
+    const std::vector<size_t>::const_iterator& start_idx,
+    const std::vector<size_t>::const_iterator& end_idx, bool reset_zero,
+    GenotypeBuffer& buffer)
+{
+    const size_t genotype_size = buffer.prs_block.genotype_size;
     // for storing the count of each observation
-    uint32_t homrar_ct = 0;
-    uint32_t missing_ct = 0;
-    uint32_t het_ct = 0;
-    uint32_t homcom_ct = 0;
+    std::array<uint32_t, 4> count;
+    uint32_t& homcom_ct = count[0];
+    uint32_t& het_ct = count[1];
+    uint32_t& homrar_ct = count[2];
+    uint32_t& missing_ct = count[3];
     // currently hard code ploidy to 2. Will keep it this way unil we know how
     // to properly handly non-diploid chromosomes in human and other organisms
     const size_t ploidy = 2;
@@ -394,82 +448,135 @@ void BinaryPlink::read_score(
     // the PRS to zero instead of addint it up
     bool not_first = !reset_zero;
     double stat, maf, adj_score, miss_score;
-    std::vector<uintptr_t> genotype(unfiltered_sample_ctl * 2, 0);
     std::vector<size_t>::const_iterator cur_idx = start_idx;
     uintptr_t* genotype_ptr;
-    for (; cur_idx != end_idx; ++cur_idx)
+    // when there are enough SNPs to be read from the file, hand the reading
+    // over to a prefetch thread such that the I/O overlaps with the scoring.
+    // The prefetch thread reads the SNPs in the same order into the slots of
+    // the ring, and a slot is released once its block is added to the PRS.
+    // The thread is owned by the buffer and reused by every call
+    const size_t num_read = static_cast<size_t>(
+        std::count_if(start_idx, end_idx, [this](const size_t idx) {
+            return m_existed_snps[idx]->current_genotype() == nullptr;
+        }));
+    const bool prefetch = num_read >= m_min_prefetch_snp;
+    PrefetchRing ring(buffer.prs_block.genotype_ptr.size() + m_prefetch_snp);
+    std::exception_ptr prefetch_error = nullptr;
+    if (prefetch)
     {
-        auto&& cur_snp = m_existed_snps[(*cur_idx)];
-        if (cur_snp->current_genotype() == nullptr)
-        {
-            auto [file_idx, byte_pos] = cur_snp->get_file_info(false);
-            m_genotype_file.read(
-                m_genotype_file_names[file_idx] + ".bed", byte_pos,
-                unfiltered_sample_ct4,
-                reinterpret_cast<char*>(m_tmp_genotype.data()));
-            if (!cur_snp->get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
-                                     m_prs_calculation.use_ref_maf))
+        buffer.prefetch_genotype.resize(ring.num_slot() * genotype_size, 0);
+        buffer.prefetch_count.resize(ring.num_slot());
+        buffer.prefetcher.run([&]() {
+            try
             {
-                // we need to calculate the MA
-                // if we want to use reference, we will always have calculated
-                // the MAF
-                uint32_t ll_ct, lh_ct, hh_ct;
-                uint32_t tmp_total = 0;
-                single_marker_freqs_and_hwe(
-                    unfiltered_sample_ctv2, m_tmp_genotype.data(),
-                    m_sample_include2.data(), m_founder_include2.data(),
-                    m_sample_ct, &ll_ct, &lh_ct, &hh_ct, m_founder_ct,
-                    &homcom_ct, &het_ct, &homrar_ct);
-                tmp_total = (homcom_ct + het_ct + homrar_ct);
-                assert(m_founder_ct >= tmp_total);
-                missing_ct = m_founder_ct - tmp_total;
-                cur_snp->set_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
-                                    false);
+                size_t slot;
+                auto span_end = start_idx;
+                for (auto idx = start_idx; idx != end_idx; ++idx)
+                {
+                    auto&& snp = m_existed_snps[(*idx)];
+                    if (snp->current_genotype() != nullptr) continue;
+                    if (idx >= span_end)
+                    {
+                        span_end =
+                            prefetch_span(idx, end_idx, buffer.genotype_file);
+                    }
+                    if (!ring.acquire(slot)) break;
+                    read_score_genotype(
+                        *snp, buffer.genotype_file,
+                        buffer.tmp_genotype.data(),
+                        &(buffer.prefetch_genotype[slot * genotype_size]),
+                        buffer.prefetch_count[slot]);
+                    ring.publish();
+                }
             }
-            if (m_unfiltered_sample_ct != m_sample_ct)
+            catch (...)
             {
-                copy_quaterarr_nonempty_subset(
-                    m_tmp_genotype.data(), m_calculate_prs.data(),
-                    static_cast<uint32_t>(m_unfiltered_sample_ct),
-                    static_cast<uint32_t>(m_sample_ct), genotype.data());
+                prefetch_error = std::current_exception();
+                ring.stop();
+            }
+        });
+    }
+    try
+    {
+        size_t slot;
+        auto span_end = start_idx;
+        for (; cur_idx != end_idx; ++cur_idx)
+        {
+            // slots of the previous block are no longer used
+            if (prefetch && buffer.prs_block.num_snp == 0) ring.release();
+            auto&& cur_snp = m_existed_snps[(*cur_idx)];
+            if (cur_snp->current_genotype() == nullptr)
+            {
+                if (!prefetch)
+                {
+                    if (cur_idx >= span_end)
+                    {
+                        span_end = prefetch_span(cur_idx, end_idx,
+                                                 buffer.genotype_file);
+                    }
+                    // decode into the PRS block, which is kept until the
+                    // block is added to the PRS
+                    genotype_ptr = prs_block_genotype(buffer);
+                    read_score_genotype(*cur_snp, buffer.genotype_file,
+                                        buffer.tmp_genotype.data(),
+                                        genotype_ptr, count);
+                }
+                else
+                {
+                    // all slots are held by the current block, add it to the
+                    // PRS so that the prefetch thread can continue
+                    if (ring.held() == ring.num_slot())
+                    {
+                        flush_prs_block(prs_list, buffer, not_first);
+                        ring.release();
+                    }
+                    // stopped only when the prefetch thread failed
+                    if (!ring.next(slot)) break;
+                    genotype_ptr =
+                        &(buffer.prefetch_genotype[slot * genotype_size]);
+                    count = buffer.prefetch_count[slot];
+                }
             }
             else
             {
-                genotype = m_tmp_genotype;
-                genotype[(m_unfiltered_sample_ct - 1) / BITCT2] &= final_mask;
+                genotype_ptr = cur_snp->current_genotype();
+                cur_snp->get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
+                                    m_prs_calculation.use_ref_maf);
             }
-            genotype_ptr = genotype.data();
-        }
-        else
-        {
-            genotype_ptr = cur_snp->current_genotype();
-            cur_snp->get_counts(homcom_ct, het_ct, homrar_ct, missing_ct,
-                                m_prs_calculation.use_ref_maf);
-        }
-        if (m_founder_ct == missing_ct)
-        {
-            // problematic snp
-            cur_snp->invalid();
-            continue;
+            if (m_founder_ct == missing_ct)
+            {
+                // problematic snp
+                cur_snp->invalid();
+                continue;
+            }
+            homcom_weight = m_homcom_weight;
+            het_weight = m_het_weight;
+            homrar_weight = m_homrar_weight;
+            if (cur_snp->is_flipped())
+            { std::swap(homcom_weight, homrar_weight); }
+            maf = 1.0
+                  - static_cast<double>(homcom_weight * homcom_ct
+                                        + het_ct * het_weight
+                                        + homrar_weight * homrar_ct)
+                        / (static_cast<double>((homcom_ct + het_ct + homrar_ct)
+                                               * ploidy));
+            stat = cur_snp->stat();
+            adj_score = 0;
+            if (is_centre) { adj_score = ploidy * stat * maf; }
+            miss_score = 0;
+            if (mean_impute) { miss_score = ploidy * stat * maf; }
+            add_prs_block(genotype_ptr, *cur_idx, prs_list, buffer, ploidy,
+                          stat, adj_score, miss_score, miss_count,
+                          homcom_weight, het_weight, homrar_weight, not_first);
         }
-        homcom_weight = m_homcom_weight;
-        het_weight = m_het_weight;
-        homrar_weight = m_homrar_weight;
-        if (cur_snp->is_flipped()) { std::swap(homcom_weight, homrar_weight); }
-        maf = 1.0
-              - static_cast<double>(homcom_weight * homcom_ct
-                                    + het_ct * het_weight
-                                    + homrar_weight * homrar_ct)
-                    / (static_cast<double>((homcom_ct + het_ct + homrar_ct)
-                                           * ploidy));
-        stat = cur_snp->stat();
-        adj_score = 0;
-        if (is_centre) { adj_score = ploidy * stat * maf; }
-        miss_score = 0;
-        if (mean_impute) { miss_score = ploidy * stat * maf; }
-        read_prs(genotype_ptr, prs_list, ploidy, stat, adj_score, miss_score,
-                 miss_count, homcom_weight, het_weight, homrar_weight,
-                 not_first);
-        not_first = true;
+        flush_prs_block(prs_list, buffer, not_first);
+    }
+    catch (...)
+    {
+        ring.stop();
+        if (prefetch) buffer.prefetcher.wait();
+        throw;
     }
+    if (prefetch) buffer.prefetcher.wait();
+    if (prefetch_error) std::rethrow_exception(prefetch_error);
 }
@@ -105,6 +105,7 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"nonfounders", no_argument, &m_include_nonfounders, 1},
         {"or", no_argument, &m_base_info.is_or, 1},
         {"print-snp", no_argument, &m_print_snp, 1},
+        {"score-test", no_argument, &m_prs_info.score_test, 1},
         {"ultra", no_argument, &m_ultra_aggressive, 1},
         {"use-ref-maf", no_argument, &m_prs_info.use_ref_maf, 1},
         // long flags, need to work on them
@@ -118,9 +119,11 @@ bool Commander::init(int argc, char* argv[], bool& early_termination,
         {"base-maf", required_argument, nullptr, 0},
         {"binary-target", required_argument, nullptr, 0},
         {"bp", required_argument, nullptr, 0},
+        {"cache-dir", required_argument, nullptr, 0},
         {"chr", required_argument, nullptr, 0},
         {"chr-id", required_argument, nullptr, 0},
         {"clump-kb", required_argument, nullptr, 0},
+        {"clump-ld", required_argument, nullptr, 0},
         {"clump-p", required_argument, nullptr, 0},
         {"clump-r2", required_argument, nullptr, 0},
         {"cov-factor", required_argument, nullptr, 0},
@@ -214,6 +217,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                     !parse_binary_vector(optarg, command, m_pheno_info.binary);
             else if (command == "bp")
                 set_string(optarg, command, +BASE_INDEX::BP);
+            else if (command == "cache-dir")
+                set_string(optarg, command, m_cache_dir);
             else if (command == "chr")
                 set_string(optarg, command, +BASE_INDEX::CHR);
             else if (command == "chr-id")
@@ -224,6 +229,8 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
                                            m_clump_info.distance);
                 m_clump_info.provided_distance = true;
             }
+            else if (command == "clump-ld")
+                error |= !set_clump_ld(optarg);
             else if (command == "clump-p")
                 error |=
                     !set_numeric<double>(optarg, command, m_clump_info.pvalue);
@@ -431,6 +438,7 @@ bool Commander::parse_command(int argc, char* argv[], const char* optString,
     if (m_prs_info.non_cumulate) m_parameter_log["non-cumulate"] = "";
     if (m_print_all_scores) m_parameter_log["all-score"] = "";
     if (m_print_snp) m_parameter_log["print-snp"] = "";
+    if (m_prs_info.score_test) m_parameter_log["score-test"] = "";
     if (m_base_info.is_beta) m_parameter_log["beta"] = "";
     if (m_base_info.is_or) m_parameter_log["or"] = "";
     if (m_target.hard_coded) m_parameter_log["hard"] = "";
@@ -683,6 +691,12 @@ void Commander::set_help_message()
           "PRS construction.\n"
           "                            Default is to use dosage instead of "
           "hard coding\n"
+          "    --cache-dir             Keep the intermediate files in this "
+          "directory and\n"
+          "                            reuse them in later runs on the same "
+          "bgen file,\n"
+          "                            samples and thresholds. Implies "
+          "--allow-inter\n"
           // clumping
           "\nClumping:\n"
           "    --clump-kb              The distance for clumping in kb\n"
@@ -693,6 +707,14 @@ void Commander::set_help_message()
           "                            Default: "
         + misc::to_string(m_clump_info.r2)
         + " (1mb for PRSet)\n"
+          "    --clump-ld              Measure of LD used for clumping. "
+          "Either em, the\n"
+          "                            haplotype r2 estimated by EM as in "
+          "PLINK, or dosage,\n"
+          "                            the squared correlation of the "
+          "genotype dosages,\n"
+          "                            which is faster to compute. Default: "
+          "em\n"
           "    --clump-p               The p-value threshold use for "
           "clumping.\n"
           "                            Default: "
@@ -986,6 +1008,16 @@ void Commander::set_help_message()
           "                            \"Base\" will be presented with all "
           "entries\n"
           "                            marked as Y\n"
+          "    --score-test            Use the score test of the covariate "
+          "only\n"
+          "                            logistic model for binary phenotypes. "
+          "Only the\n"
+          "                            best threshold is refitted with the "
+          "full\n"
+          "                            logistic regression. Together with\n"
+          "                            --logit-perm, this makes logistic "
+          "permutation\n"
+          "                            feasible\n"
           "    --seed          | -s    Seed used for permutation. If not "
           "provided,\n"
           "                            system time will be used as seed. When "
@@ -1007,7 +1039,8 @@ void Commander::set_help_message()
           "                            drastically speed up PRSice and PRSet "
           "at the expense\n"
           "                            of higher memory consumption.\n"
-          "                            Has no effect for dosage score\n"
+          "                            Dosages are stored with 16 bits "
+          "precision\n"
           "    --x-range               Range of SNPs to be excluded from the "
           "whole\n"
           "                            analysis. It can either be a single bed "
@@ -1912,6 +1945,11 @@ bool Commander::misc_check()
         m_error_message.append("Warning: Permutation not required, "
                                "--logit-perm has no effect\n");
     }
+    if (m_prs_info.no_regress && m_prs_info.score_test)
+    {
+        m_error_message.append("Warning: Regression not required, "
+                               "--score-test has no effect\n");
+    }
     // for no regress, we will alway print the scores (otherwise no point
     // running PRSice)
     if (m_prs_info.no_regress) m_print_all_scores = true;
@@ -1930,6 +1968,7 @@ bool Commander::misc_check()
             "Error: Cannot use reference MAF for missingness "
             "imputation if reference file isn't used\n");
     }
+    if (!m_cache_dir.empty()) m_allow_inter = true;
     if (m_allow_inter)
     {
         if ((m_target.type != "bgen"
@@ -1955,12 +1994,6 @@ bool Commander::misc_check()
             "phenotype provided. As regression isn't performed, we will not "
             "utilize any of the phenotype information\n");
     }
-    if (m_target.type == "bgen" && !m_target.hard_coded && m_ultra_aggressive)
-    {
-        m_error_message.append("Warning: --ultra does not work with none "
-                               "hard-coded bgen file. Will disable it\n");
-        m_ultra_aggressive = false;
-    }
     return !error;
 }
 
@@ -942,11 +942,99 @@ bool Genotype::perform_freqs_and_inter(const QCFiltering& filter_info,
                 return t1->get_byte_pos(m_is_ref) < t2->get_byte_pos(m_is_ref);
             }
             else
-                return t1->get_file_idx(m_is_ref) == t2->get_file_idx(m_is_ref);
+                return t1->get_file_idx(m_is_ref) < t2->get_file_idx(m_is_ref);
         });
+    // SNPs are now sorted by their file location
     return calc_freq_gen_inter(filter_info, prefix, genotype);
 }
 
+void Genotype::parallel_qc(
+    Genotype* genotype,
+    const std::function<bool(SNP&, size_t, QCCount&)>& qc)
+{
+    auto&& snps = genotype->m_existed_snps;
+    const size_t total_snp = snps.size();
+    // only use multiple threads if each of them has enough work to do
+    const size_t num_thread = std::max<size_t>(
+        1, std::min(m_thread, total_snp / m_min_qc_snp_per_thread));
+    init_score_buffer(num_thread);
+    std::vector<std::atomic<bool>> retain_snps(total_snp);
+    std::vector<QCCount> counts(num_thread);
+    std::vector<std::exception_ptr> errors(num_thread, nullptr);
+    std::atomic<size_t> processed(0);
+    const bool report = !m_reporter->unit_testing();
+    auto qc_chunk = [&](size_t thread_idx, size_t start, size_t end) {
+        auto&& buffer = *m_score_buffer[thread_idx];
+        double progress = 0.0, prev_progress = -1.0;
+        try
+        {
+            buffer.genotype_file.set_sequential(true);
+            for (size_t i = start; i < end; ++i)
+            {
+                // only the calling thread reports the progress
+                if (thread_idx == 0 && report)
+                {
+                    progress = static_cast<double>(processed.load(
+                                   std::memory_order_relaxed))
+                               / static_cast<double>(total_snp) * 100;
+                    if (progress - prev_progress > 0.01)
+                    {
+                        fprintf(stderr,
+                                "\rCalculating allele frequencies: %03.2f%%",
+                                progress);
+                        prev_progress = progress;
+                    }
+                }
+                const bool retain =
+                    qc(*snps[i], thread_idx, counts[thread_idx]);
+                retain_snps[i].store(retain, std::memory_order_relaxed);
+                processed.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        catch (...)
+        {
+            errors[thread_idx] = std::current_exception();
+        }
+        buffer.genotype_file.set_sequential(false);
+    };
+    // split the SNPs into contiguous chunks, the first chunk is processed by
+    // the current thread
+    const size_t job_per_thread = total_snp / num_thread;
+    const size_t remain = total_snp % num_thread;
+    std::vector<std::thread> workers;
+    size_t chunk_start = 0, first_end = 0;
+    for (size_t i_thread = 0; i_thread < num_thread; ++i_thread)
+    {
+        const size_t chunk_end =
+            chunk_start + job_per_thread + (i_thread < remain);
+        if (i_thread == 0) { first_end = chunk_end; }
+        else
+        {
+            workers.emplace_back(qc_chunk, i_thread, chunk_start, chunk_end);
+        }
+        chunk_start = chunk_end;
+    }
+    qc_chunk(0, 0, first_end);
+    for (auto&& worker : workers) worker.join();
+    for (auto&& error : errors)
+    {
+        if (error) std::rethrow_exception(error);
+    }
+    if (report)
+        fprintf(stderr, "\rCalculating allele frequencies: %03.2f%%\n", 100.0);
+    size_t retained = 0;
+    for (auto&& count : counts)
+    {
+        m_num_geno_filter += count.geno;
+        m_num_maf_filter += count.maf;
+        m_num_info_filter += count.info;
+        m_num_miss_filter += count.miss;
+    }
+    for (auto&& retain : retain_snps) { retained += retain.load(); }
+    // now update the vector
+    if (retained != total_snp) { genotype->shrink_snp_vector(retain_snps); }
+}
+
 void Genotype::calc_freqs_and_intermediate(const QCFiltering& filter_info,
                                            const std::string& prefix,
                                            bool verbose, Genotype* target)
@@ -1085,86 +1173,32 @@ void Genotype::load_snps(
 
 
 Genotype::~Genotype() {}
-intptr_t Genotype::cal_avail_memory(const uintptr_t founder_ctv2)
+size_t Genotype::clump_thread_limit(const size_t window_byte,
+                                   const size_t threads)
 {
-#ifdef __APPLE__
-    int32_t mib[2];
-    size_t sztmp;
-#endif
-    int64_t llxx;
-    intptr_t default_alloc_mb;
-    intptr_t malloc_size_mb = 0;
-#ifdef __APPLE__
-    mib[0] = CTL_HW;
-    mib[1] = HW_MEMSIZE;
-    llxx = 0;
-
-    sztmp = sizeof(int64_t);
-    sysctl(mib, 2, &llxx, &sztmp, nullptr, 0);
-    llxx /= 1048576;
-#else
-#ifdef _WIN32
-    MEMORYSTATUSEX memstatus;
-    memstatus.dwLength = sizeof(memstatus);
-    GlobalMemoryStatusEx(&memstatus);
-    llxx = memstatus.ullTotalPhys / 1048576;
-#else
-    llxx = ((uint64_t) sysconf(_SC_PHYS_PAGES))
-           * ((size_t) sysconf(_SC_PAGESIZE)) / 1048576;
-#endif
-#endif
-    if (!llxx) { default_alloc_mb = BIGSTACK_DEFAULT_MB; }
-    else if (llxx < (BIGSTACK_MIN_MB * 2))
-    {
-        default_alloc_mb = BIGSTACK_MIN_MB;
-    }
-    else
-    {
-        default_alloc_mb = llxx / 2;
-    }
-    if (!malloc_size_mb) { malloc_size_mb = default_alloc_mb; }
-    else if (malloc_size_mb < BIGSTACK_MIN_MB)
-    {
-        malloc_size_mb = BIGSTACK_MIN_MB;
-    }
-#ifndef __LP64__
-    if (malloc_size_mb > 2047) { malloc_size_mb = 2047; }
-#endif
-
-    // m_max_window_size represent the maximum number of SNPs required for any
-    // one window
-
-    // calculate the maximum amount of memory required (the thing is, we can't
-    // do the analysis if we don't have this amount as the largest region will
-    // fail. So should I call this maximum amount of memory required or minimum
-    // amount of memory required?
-    malloc_size_mb = (static_cast<uintptr_t>(m_max_window_size) + 1)
-                         * founder_ctv2 * sizeof(intptr_t) / 1048576
-                     + 1;
-    std::string message = "";
-    if (llxx)
+    const size_t available = MemoryBudget::global().available();
+    const size_t mb = 1048576;
+    if (available < window_byte)
     {
-        // we have detected the memory, but need to check if that's enough
-        if (malloc_size_mb > llxx)
-        {
-            throw std::runtime_error(
-                "Error: Insufficient memory for clumping! Require "
-                + misc::to_string(malloc_size_mb) + " MB but detected only "
-                + misc::to_string(llxx) + " MB");
-        }
-        else
-        {
-            message = misc::to_string(llxx) + " MB RAM detected; reserving "
-                      + misc::to_string(malloc_size_mb) + " MB for clumping\n";
-        }
+        m_reporter->report(
+            "Warning: The largest clumping window requires "
+            + misc::to_string(window_byte / mb + 1) + " MB but only "
+            + misc::to_string(available / mb)
+            + " MB is available. Clumping will fail if there are too many "
+              "SNPs to clump within the window. Will use 1 thread for "
+              "clumping\n");
+        return 1;
     }
-    else
+    const size_t max_thread = available / window_byte;
+    if (max_thread < threads)
     {
-        message = "Failed to calculate system memory. Attemping to reserve"
-                  + misc::to_string(malloc_size_mb) + " MB for clumping\n";
+        m_reporter->report("Only " + misc::to_string(available / mb)
+                           + " MB is available, will use "
+                           + misc::to_string(max_thread)
+                           + " thread(s) for clumping\n");
+        return max_thread;
     }
-    m_reporter->report(message);
-    return malloc_size_mb;
+    return threads;
 }
 std::vector<std::pair<size_t, size_t>> Genotype::get_chrom_boundary()
 {
@@ -1188,6 +1222,252 @@ std::vector<std::pair<size_t, size_t>> Genotype::get_chrom_boundary()
 
     return chrom_bound;
 }
+size_t Genotype::find_ld_free_cut(const size_t start, const size_t end,
+                                  const size_t ideal,
+                                  const Clumping& clump_info,
+                                  Genotype& reference, GenotypePool& pool)
+{
+    const double min_r2 = clump_info.use_proxy
+                              ? std::min(clump_info.proxy, clump_info.r2)
+                              : clump_info.r2;
+    const bool use_dosage_r2 = (clump_info.ld == CLUMP_LD::DOSAGE);
+    const uint32_t founder_ctv3 =
+        BITCT_TO_ALIGNED_WORDCT(static_cast<uint32_t>(reference.m_founder_ct));
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(reference.m_founder_ct);
+    const uint32_t founder_ctsplit = 3 * founder_ctv3;
+    const uintptr_t founder_ctv2 =
+        QUATERCT_TO_ALIGNED_WORDCT(reference.m_founder_ct);
+    std::vector<uintptr_t> index_data(3 * founder_ctsplit + founder_ctv3);
+    std::vector<uintptr_t> index_tots(6);
+    std::vector<uintptr_t> founder_include2(founder_ctv2, 0);
+    fill_quatervec_55(static_cast<uint32_t>(reference.m_founder_ct),
+                      founder_include2.data());
+    std::vector<const uintptr_t*> window_geno;
+    std::vector<uint32_t> window_counts;
+    std::vector<uint64_t> window_raw;
+    FileRead genotype_file;
+    GenotypePool::Cache genotype_pool(pool);
+    // genotypes of the SNPs whose windows cross any of the candidates, read
+    // the first time they are required
+    const size_t first_snp = m_existed_snps[start]->low_bound();
+    size_t last_snp = end;
+    for (size_t i = first_snp; i < end; ++i)
+    { last_snp = std::max(last_snp, m_existed_snps[i]->up_bound()); }
+    std::vector<IndividualGenotype*> loaded(last_snp - first_snp, nullptr);
+    IndividualGenotype* tmp_genotype = nullptr;
+    auto genotype = [&](const size_t snp_idx) {
+        auto&& geno = loaded[snp_idx - first_snp];
+        if (geno == nullptr)
+        {
+            geno = genotype_pool.alloc();
+            reference.read_genotype(m_existed_snps[snp_idx],
+                                    reference.m_founder_ct, genotype_file,
+                                    tmp_genotype->get_geno(), geno->get_geno(),
+                                    reference.m_sample_for_ld.data(), true);
+        }
+        return geno->get_geno();
+    };
+    auto ld_free = [&](const size_t cut) {
+        // start from the SNPs closest to the boundary, which are the most
+        // likely to be in LD with those on the other side
+        for (size_t i = cut; i-- > m_existed_snps[cut]->low_bound();)
+        {
+            auto&& snp = m_existed_snps[i];
+            if (snp->p_value() > clump_info.pvalue) continue;
+            window_geno.clear();
+            for (size_t j = cut; j < snp->up_bound(); ++j)
+            {
+                if (m_existed_snps[j]->p_value() > clump_info.pvalue) continue;
+                window_geno.push_back(genotype(j));
+            }
+            if (window_geno.empty()) continue;
+            update_index_tot(founder_ctl2, founder_ctv2, reference.m_founder_ct,
+                             index_data, index_tots, founder_include2,
+                             genotype(i));
+            if (window_counts.size() < 9 * window_geno.size())
+            {
+                window_counts.resize(9 * window_geno.size());
+                window_raw.resize(9 * window_geno.size());
+            }
+            ld_kernel::joint_genotype_counts(
+                index_data.data(), founder_ctv2, index_tots.data(),
+                window_geno.data(), window_geno.size(), founder_ctl2,
+                window_counts.data(), window_raw.data());
+            for (size_t k = 0; k < window_geno.size(); ++k)
+            {
+                uint32_t* counts = &(window_counts[9 * k]);
+                double r2 = 0;
+                if (use_dosage_r2) { r2 = get_dosage_r2(counts); }
+                else if (max_r2(counts) < min_r2)
+                {
+                    continue;
+                }
+                else
+                {
+                    r2 = get_r2(counts);
+                }
+                if (r2 >= min_r2) return false;
+            }
+        }
+        return true;
+    };
+    size_t cut = 0;
+    try
+    {
+        tmp_genotype = genotype_pool.alloc();
+        for (size_t step = 0;
+             cut == 0 && (ideal + step < end || ideal >= start + step); ++step)
+        {
+            if (ideal + step < end && ld_free(ideal + step))
+            { cut = ideal + step; }
+            else if (step != 0 && ideal >= start + step
+                     && ld_free(ideal - step))
+            {
+                cut = ideal - step;
+            }
+        }
+    }
+    catch (const std::runtime_error&)
+    {
+        // the memory budget can't hold the genotypes around the boundary,
+        // leave the run uncut. Problems with the genotype file will be
+        // reported by the clumping itself
+        cut = 0;
+    }
+    for (auto&& geno : loaded)
+    {
+        if (geno != nullptr) genotype_pool.free(geno);
+    }
+    if (tmp_genotype != nullptr) genotype_pool.free(tmp_genotype);
+    return cut;
+}
+
+std::vector<std::pair<size_t, size_t>>
+Genotype::get_clump_segments(const Clumping& clump_info, Genotype& reference,
+                             const size_t max_segment_snp, const size_t threads)
+{
+    const size_t num_snp = m_existed_snps.size();
+    // cut the SNPs (in coordinate order) into segments whenever no clumping
+    // window span across the boundary. SNPs from different segments can never
+    // clump each other, so segments can be clumped independently
+    std::vector<size_t> segment_begin;
+    size_t reach = 0;
+    for (size_t i = 0; i < num_snp; ++i)
+    {
+        auto&& snp = m_existed_snps[i];
+        if (i == 0 || snp->chr() != m_existed_snps[i - 1]->chr()
+            || (reach <= i && snp->low_bound() >= i))
+        { segment_begin.push_back(i); }
+        reach = std::max(reach, snp->up_bound());
+    }
+    // a dense chromosome can be one long run of overlapping windows, so cut
+    // the long runs at evenly spaced boundaries where no SNP is in LD with
+    // any SNP across the boundary. Each cut is searched within half a piece
+    // (and at most one window) of its ideal position so that the searches
+    // don't overlap
+    struct CutSearch
+    {
+        size_t start, end, ideal;
+    };
+    std::vector<CutSearch> searches;
+    for (size_t i = 0; max_segment_snp != 0 && i < segment_begin.size(); ++i)
+    {
+        const size_t run_begin = segment_begin[i];
+        const size_t run_end =
+            (i + 1 == segment_begin.size()) ? num_snp : segment_begin[i + 1];
+        const size_t run_size = run_end - run_begin;
+        if (run_size <= max_segment_snp) continue;
+        const size_t num_piece =
+            (run_size + max_segment_snp - 1) / max_segment_snp;
+        const size_t radius =
+            std::min(run_size / num_piece / 2, m_max_window_size);
+        for (size_t piece = 1; piece < num_piece; ++piece)
+        {
+            const size_t ideal = run_begin + run_size * piece / num_piece;
+            searches.push_back(
+                {std::max(run_begin + 1, ideal - radius),
+                 std::min(run_end, ideal + radius + 1), ideal});
+        }
+    }
+    std::vector<size_t> ld_cut(searches.size(), 0);
+    if (!searches.empty())
+    {
+        const uintptr_t unfiltered_sample_ctv2 =
+            2 * BITCT_TO_WORDCT(reference.m_unfiltered_sample_ct);
+        GenotypePool genotype_pool(m_max_window_size + 1,
+                                   unfiltered_sample_ctv2);
+        std::atomic<size_t> next_search = 0;
+        auto search_cuts = [&]() {
+            for (size_t i = next_search++; i < searches.size();
+                 i = next_search++)
+            {
+                ld_cut[i] = find_ld_free_cut(
+                    searches[i].start, searches[i].end, searches[i].ideal,
+                    clump_info, reference, genotype_pool);
+            }
+        };
+        const size_t num_worker = std::min(threads, searches.size());
+        if (num_worker <= 1) { search_cuts(); }
+        else
+        {
+            std::vector<std::exception_ptr> errors(num_worker, nullptr);
+            std::vector<std::thread> workers;
+            for (size_t i_thread = 0; i_thread < num_worker; ++i_thread)
+            {
+                workers.push_back(std::thread([&, i_thread]() {
+                    try
+                    {
+                        search_cuts();
+                    }
+                    catch (...)
+                    {
+                        errors[i_thread] = std::current_exception();
+                    }
+                }));
+            }
+            for (auto&& worker : workers) worker.join();
+            for (auto&& error : errors)
+            {
+                if (error) std::rethrow_exception(error);
+            }
+        }
+    }
+    for (auto&& cut : ld_cut)
+    {
+        if (cut != 0) segment_begin.push_back(cut);
+    }
+    // neighbouring searches can settle on the same boundary
+    std::sort(segment_begin.begin(), segment_begin.end());
+    segment_begin.erase(
+        std::unique(segment_begin.begin(), segment_begin.end()),
+        segment_begin.end());
+    const size_t num_segment = segment_begin.size();
+    std::vector<size_t> segment(num_snp, 0);
+    for (size_t i = 0; i < num_segment; ++i)
+    {
+        const size_t segment_end =
+            (i + 1 == num_segment) ? num_snp : segment_begin[i + 1];
+        for (size_t j = segment_begin[i]; j < segment_end; ++j)
+        { segment[j] = i; }
+    }
+    // group m_sort_by_p_index by segment while keeping the p-value order
+    // within each segment
+    std::vector<size_t> segment_start(num_segment + 1, 0);
+    for (auto&& idx : m_sort_by_p_index) { ++segment_start[segment[idx] + 1]; }
+    for (size_t i = 0; i < num_segment; ++i)
+    { segment_start[i + 1] += segment_start[i]; }
+    std::vector<size_t> sorted_index(m_sort_by_p_index.size());
+    std::vector<size_t> offset(segment_start.begin(), segment_start.end() - 1);
+    for (auto&& idx : m_sort_by_p_index)
+    { sorted_index[offset[segment[idx]]++] = idx; }
+    m_sort_by_p_index.swap(sorted_index);
+    std::vector<std::pair<size_t, size_t>> segment_range;
+    segment_range.reserve(num_segment);
+    for (size_t i = 0; i < num_segment; ++i)
+    { segment_range.emplace_back(segment_start[i], segment_start[i + 1]); }
+    return segment_range;
+}
+
 void Genotype::clumping(const Clumping& clump_info, Genotype& reference,
                         size_t threads)
 {
@@ -1196,42 +1476,80 @@ void Genotype::clumping(const Clumping& clump_info, Genotype& reference,
     for (auto&& s : remain_snps) { s = false; }
     std::atomic<size_t> num_core = 0;
     using range = std::pair<size_t, size_t>;
-    // get boundaries
-    std::vector<range> snp_range = get_chrom_boundary();
+    // get independent segments, largest first so that the small segments can
+    // be used to balance the load at the end
+    // each thread holds at most one window (plus a temporary storage) at
+    // any time, so only run as many threads as the budget can hold
+    const uintptr_t unfiltered_sample_ctv2 =
+        2 * BITCT_TO_WORDCT(reference.m_unfiltered_sample_ct);
+    const size_t window_byte =
+        (m_max_window_size + 2)
+        * round_up_pow2(unfiltered_sample_ctv2, CACHELINE) * sizeof(uintptr_t);
+    threads = clump_thread_limit(window_byte, std::max<size_t>(1, threads));
+    // only cut the runs of overlapping windows when there are threads to
+    // share them
+    const size_t num_piece = threads * m_clump_segment_per_thread;
+    const size_t max_segment_snp =
+        (threads == 1)
+            ? 0
+            : (m_existed_snps.size() + num_piece - 1) / num_piece;
+    std::vector<range> snp_range =
+        get_clump_segments(clump_info, reference, max_segment_snp, threads);
+    std::stable_sort(snp_range.begin(), snp_range.end(),
+                     [](const range& a, const range& b) {
+                         return a.second - a.first > b.second - b.first;
+                     });
+    const size_t largest_segment =
+        snp_range.empty() ? 0
+                          : snp_range.front().second - snp_range.front().first;
+    m_reporter->report("Clumping " + misc::to_string(snp_range.size())
+                       + " independent segment(s), the largest has "
+                       + misc::to_string(largest_segment) + " variant(s)");
+    threads = std::max<size_t>(1, std::min(threads, snp_range.size()));
+    WorkStealingQueue<range> jobs(threads);
+    for (size_t i = 0; i < snp_range.size(); ++i)
+    { jobs.push(i % threads, snp_range[i]); }
+    // all threads share one pool, which only grows when the windows held at
+    // the same time do not fit
+    GenotypePool genotype_pool(m_max_window_size + 1, unfiltered_sample_ctv2);
     if (threads == 1)
     {
         dummy_reporter progress_reporter(m_existed_snps.size(),
                                          !m_reporter->unit_testing());
-        threaded_clumping(snp_range, clump_info, progress_reporter, remain_snps,
-                          num_core, reference);
+        threaded_clumping(jobs, 0, clump_info, progress_reporter, remain_snps,
+                          num_core, genotype_pool, reference);
     }
     else
     {
-        if (threads > m_autosome_ct) { threads = m_autosome_ct; }
         Thread_Queue<size_t> progress_observer;
         std::thread observer(&Genotype::clump_progress_observer, this,
                              std::ref(progress_observer), m_existed_snps.size(),
                              threads, !m_reporter->unit_testing());
+        std::vector<std::exception_ptr> errors(threads, nullptr);
         std::vector<std::thread> subjects;
-        size_t job_per_thread = snp_range.size() / static_cast<size_t>(threads);
-        int remain = static_cast<int>(static_cast<size_t>(snp_range.size())
-                                      % static_cast<size_t>(threads));
-        size_t job_start = 0;
         for (size_t i_thread = 0; i_thread < threads; ++i_thread)
         {
-            std::vector<range> job_sets(snp_range.begin() + job_start,
-                                        snp_range.begin() + job_start
-                                            + job_per_thread + (remain > 0));
-            subjects.push_back(
-                std::thread(&Genotype::threaded_clumping<Thread_Queue<size_t>>,
-                            this, job_sets, std::cref(clump_info),
-                            std::ref(progress_observer), std::ref(remain_snps),
-                            std::ref(num_core), std::ref(reference)));
-            job_start += job_per_thread + (remain > 0);
-            remain--;
+            subjects.push_back(std::thread([&, i_thread]() {
+                try
+                {
+                    threaded_clumping(jobs, i_thread, clump_info,
+                                      progress_observer, remain_snps, num_core,
+                                      genotype_pool, reference);
+                }
+                catch (...)
+                {
+                    errors[i_thread] = std::current_exception();
+                    // otherwise the observer will wait for this thread forever
+                    progress_observer.completed();
+                }
+            }));
         }
         observer.join();
         for (auto&& thread : subjects) thread.join();
+        for (auto&& error : errors)
+        {
+            if (error) std::rethrow_exception(error);
+        }
     }
     if (!m_reporter->unit_testing())
     { fprintf(stderr, "\rClumping Progress: %03.2f%%\n", 100.0); }
@@ -1266,23 +1584,21 @@ void Genotype::clump_progress_observer(Thread_Queue<size_t>& progress_observer,
 
 template <typename T>
 void Genotype::threaded_clumping(
-    const std::vector<std::pair<size_t, size_t>> snp_range,
+    WorkStealingQueue<std::pair<size_t, size_t>>& jobs, const size_t worker,
     const Clumping& clump_info, T& progress_observer,
     std::vector<std::atomic<bool>>& remain_snps, std::atomic<size_t>& num_core,
-    Genotype& reference)
+    GenotypePool& pool, Genotype& reference)
 {
     const double min_r2 = clump_info.use_proxy
                               ? std::min(clump_info.proxy, clump_info.r2)
                               : clump_info.r2;
+    const bool use_dosage_r2 = (clump_info.ld == CLUMP_LD::DOSAGE);
     const uint32_t founder_ctv3 =
         BITCT_TO_ALIGNED_WORDCT(static_cast<uint32_t>(reference.m_founder_ct));
     const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(reference.m_founder_ct);
     const uint32_t founder_ctsplit = 3 * founder_ctv3;
     const uintptr_t founder_ctv2 =
         QUATERCT_TO_ALIGNED_WORDCT(reference.m_founder_ct);
-    const uintptr_t unfiltered_sample_ctl =
-        BITCT_TO_WORDCT(reference.m_unfiltered_sample_ct);
-    const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
     std::vector<uintptr_t> index_data(3 * founder_ctsplit + founder_ctv3);
     std::vector<uintptr_t> index_tots(6);
 
@@ -1290,35 +1606,75 @@ void Genotype::threaded_clumping(
     fill_quatervec_55(static_cast<uint32_t>(reference.m_founder_ct),
                       founder_include2.data());
 
-    // available memory size
-    // can set number to way higher with ultra (e.g. all SNPs)
-    size_t num_snp_in_chr = 0;
-    size_t max_snp_in_chr = 0;
-    // only reserves the max amount of SNPs required for all chromosome involved
-    for (auto&& range : snp_range)
-    { num_snp_in_chr += std::get<1>(range) - std::get<0>(range); }
-    const auto max_size = m_max_window_size > static_cast<size_t>(std::floor(static_cast<double>(num_snp_in_chr) * 0.01))
-                              ? m_max_window_size
-                              : static_cast<size_t>(std::floor(static_cast<double>(num_snp_in_chr) * 0.01));
-    GenotypePool genotype_pool(max_size + 1, unfiltered_sample_ctv2);
+    // items are taken from the shared pool in batches
+    GenotypePool::Cache genotype_pool(pool);
     auto tmp_genotype = genotype_pool.alloc();
     double r2 = -1;
     FileRead genotype_file;
+    // report progress roughly every 0.1% of all SNPs
+    const size_t progress_step =
+        std::max<size_t>(1, m_existed_snps.size() / 1000);
     size_t num_processed = 0, prev_processed = 0;
-    double local_progress = 0.0, prev_progress = 0.0;
     size_t local_num_core = 0;
     auto&& sample_for_ld = reference.m_sample_for_ld.data();
-    for (auto&& range : snp_range)
-    {
+    std::vector<size_t> window_idx;
+    std::vector<const uintptr_t*> window_geno;
+    std::vector<uint32_t> window_counts;
+    std::vector<uint64_t> window_raw;
+    // SNPs of the current segment whose genotypes were loaded by this thread
+    std::vector<size_t> loaded_snps;
+    size_t clump_start_idx = 0, clump_end_idx = 0;
+    // once the memory budget is used up, drop the genotypes of SNPs outside
+    // the current window. They will be read again when they are required
+    auto alloc_genotype = [&](const size_t snp_idx) {
+        loaded_snps.push_back(snp_idx);
+        try
+        {
+            return genotype_pool.alloc();
+        }
+        catch (const std::runtime_error&)
+        {
+            size_t num_kept = 0, num_dropped = 0;
+            for (auto&& idx : loaded_snps)
+            {
+                auto&& snp = m_existed_snps[idx];
+                if (snp->current_genotype() == nullptr) continue;
+                if (idx >= clump_start_idx && idx < clump_end_idx)
+                { loaded_snps[num_kept++] = idx; }
+                else
+                {
+                    snp->freed_geno_storage(genotype_pool);
+                    ++num_dropped;
+                }
+            }
+            loaded_snps.resize(num_kept);
+            loaded_snps.push_back(snp_idx);
+            if (num_dropped == 0) throw;
+            return genotype_pool.alloc();
+        }
+    };
+    std::pair<size_t, size_t> range;
+    while (jobs.pop(worker, range))
+    {
+        // all genotypes are freed by the end of each segment
+        loaded_snps.clear();
+        // the segment covers consecutive SNPs. Windows are clipped to it as
+        // no SNP is in LD across a cut, and the SNPs on the other side can
+        // be clumped by another thread at the same time
+        auto&& [segment_first, segment_last] = std::minmax_element(
+            m_sort_by_p_index.begin()
+                + static_cast<std::ptrdiff_t>(std::get<0>(range)),
+            m_sort_by_p_index.begin()
+                + static_cast<std::ptrdiff_t>(std::get<1>(range)));
+        const size_t segment_begin = *segment_first;
+        const size_t segment_end = *segment_last + 1;
         for (size_t i_snp = std::get<0>(range); i_snp < std::get<1>(range);
              ++i_snp)
         {
-            local_progress = static_cast<double>(num_processed - num_snp_in_chr)
-                             / static_cast<double>(num_snp_in_chr);
-            if (local_progress - prev_progress > 0.01)
+            ++num_processed;
+            if (num_processed - prev_processed >= progress_step)
             {
                 progress_observer.emplace(num_processed - prev_processed);
-                prev_progress = num_processed;
                 prev_processed = num_processed;
             }
 
@@ -1327,8 +1683,8 @@ void Genotype::threaded_clumping(
             auto&& core_snp = m_existed_snps[core_snp_idx];
             if (core_snp->clumped() || core_snp->p_value() > clump_info.pvalue)
             { continue; }
-            const size_t clump_start_idx = core_snp->low_bound();
-            const size_t clump_end_idx = core_snp->up_bound();
+            clump_start_idx = std::max(core_snp->low_bound(), segment_begin);
+            clump_end_idx = std::min(core_snp->up_bound(), segment_end);
             // the reason this is a two part process is so that we can reduce
             // the number of fseek
             for (size_t clump_idx = clump_start_idx; clump_idx < core_snp_idx;
@@ -1341,7 +1697,7 @@ void Genotype::threaded_clumping(
                 if (clump_snp->current_genotype() == nullptr)
                 {
                     // store clump SNP's genotype into our genotype pool
-                    clump_snp->set_genotype_storage(genotype_pool.alloc());
+                    clump_snp->set_genotype_storage(alloc_genotype(clump_idx));
                     reference.read_genotype(
                         clump_snp, reference.m_founder_ct, genotype_file,
                         tmp_genotype->get_geno(), clump_snp->current_genotype(),
@@ -1351,68 +1707,80 @@ void Genotype::threaded_clumping(
             if (core_snp->current_genotype() == nullptr)
             {
                 // store core SNP's genotype into our genotype pool
-                core_snp->set_genotype_storage(genotype_pool.alloc());
+                core_snp->set_genotype_storage(alloc_genotype(core_snp_idx));
                 reference.read_genotype(core_snp, reference.m_founder_ct,
                                         genotype_file, tmp_genotype->get_geno(),
                                         core_snp->current_genotype(),
                                         sample_for_ld, true);
             }
+            // read in the SNPs that come after the index SNP in the file
+            for (size_t clump_idx = core_snp_idx + 1; clump_idx < clump_end_idx;
+                 ++clump_idx)
+            {
+                auto&& clump_snp = m_existed_snps[clump_idx];
+                if (clump_snp->clumped()
+                    || clump_snp->p_value() > clump_info.pvalue)
+                    continue;
+                if (clump_snp->current_genotype() == nullptr)
+                {
+                    // store clump SNP's genotype into our genotype pool
+                    clump_snp->set_genotype_storage(alloc_genotype(clump_idx));
+                    reference.read_genotype(
+                        clump_snp, reference.m_founder_ct, genotype_file,
+                        tmp_genotype->get_geno(), clump_snp->current_genotype(),
+                        sample_for_ld, true);
+                }
+            }
             update_index_tot(founder_ctl2, founder_ctv2, reference.m_founder_ct,
                              index_data, index_tots, founder_include2,
                              core_snp->current_genotype());
             // free core SNP's genotype form the genotype pool as we will no
             // longer need it. (it will never be clumped by another SNP)
             core_snp->freed_geno_storage(genotype_pool);
-
-            for (size_t clump_idx = clump_start_idx; clump_idx < core_snp_idx;
+            // count the joint genotypes against the whole window in one sweep
+            window_idx.clear();
+            window_geno.clear();
+            for (size_t clump_idx = clump_start_idx; clump_idx < clump_end_idx;
                  ++clump_idx)
             {
+                if (clump_idx == core_snp_idx) continue;
                 auto&& clump_snp = m_existed_snps[clump_idx];
                 if (clump_snp->clumped()
                     || clump_snp->p_value() > clump_info.pvalue)
                 { continue; }
-                r2 = get_r2(founder_ctl2, founder_ctv2,
-                            clump_snp->current_genotype(), index_data,
-                            index_tots);
-
-                if (r2 >= min_r2)
-                {
-                    core_snp->clump(clump_snp, r2, clump_info.use_proxy,
-                                    clump_info.proxy);
-                    // remove SNP's genotype data from the genotype pool if it
-                    // is clumped out
-                    if (clump_snp->clumped())
-                    { clump_snp->freed_geno_storage(genotype_pool); }
-                }
+                window_idx.push_back(clump_idx);
+                window_geno.push_back(clump_snp->current_genotype());
             }
-            // now we can read the SNPs that come after the index SNP in the
-            // file
-            for (size_t clump_idx = core_snp_idx + 1; clump_idx < clump_end_idx;
-                 ++clump_idx)
+            if (window_counts.size() < 9 * window_idx.size())
             {
-                auto&& clump_snp = m_existed_snps[clump_idx];
-                if (clump_snp->clumped()
-                    || clump_snp->p_value() > clump_info.pvalue)
+                window_counts.resize(9 * window_idx.size());
+                window_raw.resize(9 * window_idx.size());
+            }
+            ld_kernel::joint_genotype_counts(
+                index_data.data(), founder_ctv2, index_tots.data(),
+                window_geno.data(), window_geno.size(), founder_ctl2,
+                window_counts.data(), window_raw.data());
+            for (size_t i = 0; i < window_idx.size(); ++i)
+            {
+                auto&& clump_snp = m_existed_snps[window_idx[i]];
+                uint32_t* counts = &(window_counts[9 * i]);
+                if (use_dosage_r2) { r2 = get_dosage_r2(counts); }
+                else if (max_r2(counts) < min_r2)
+                {
+                    // no phasing of the double heterozygotes can reach the
+                    // threshold, so the EM can be skipped
                     continue;
-                if (clump_snp->current_genotype() == nullptr)
+                }
+                else
                 {
-                    // store clump SNP's genotype into our genotype pool
-                    clump_snp->set_genotype_storage(genotype_pool.alloc());
-                    reference.read_genotype(
-                        clump_snp, reference.m_founder_ct, genotype_file,
-                        tmp_genotype->get_geno(), clump_snp->current_genotype(),
-                        sample_for_ld, true);
+                    r2 = get_r2(counts);
                 }
-                r2 = get_r2(founder_ctl2, founder_ctv2,
-                            clump_snp->current_genotype(), index_data,
-                            index_tots);
-
                 if (r2 >= min_r2)
                 {
-                    // remove SNP's genotype data from the genotype pool if it
-                    // is clumped out
                     core_snp->clump(clump_snp, r2, clump_info.use_proxy,
                                     clump_info.proxy);
+                    // remove SNP's genotype data from the genotype pool if it
+                    // is clumped out
                     if (clump_snp->clumped())
                     { clump_snp->freed_geno_storage(genotype_pool); }
                 }
@@ -1420,13 +1788,13 @@ void Genotype::threaded_clumping(
             core_snp->set_clumped();
             // we set the remain_core to true so that we will keep it at the end
             remain_snps[core_snp_idx] = true;
-            ++num_processed;
             ++local_num_core;
         }
         // in theory, by the time we reached here, genotype_pool should be empty
         // as all SNPs should either be clumped out or are index
     }
 
+    progress_observer.emplace(num_processed - prev_processed);
     progress_observer.completed();
     num_core += local_num_core;
     genotype_pool.free(tmp_genotype);
@@ -1615,29 +1983,29 @@ Genotype::build_membership_matrix(const size_t num_sets,
     return region_membership;
 }
 
-void Genotype::standardize_prs()
+void Genotype::standardize_prs(const SamplePRS& prs_list, double& mean_score,
+                               double& score_sd) const
 {
     misc::RunningStat rs;
-    const size_t num_prs = m_prs_info.size();
+    const size_t num_prs = prs_list.size();
     for (size_t i = 0; i < num_prs; ++i)
     {
         // only standardize using samples that are selected and have valid pheno
         if (!IS_SET(m_calculate_prs, i) || !m_sample_id[i].in_regression
             || IS_SET(m_exclude_from_std, i))
             continue;
-        if (m_prs_info[i].num_snp == 0) { rs.push(0.0); }
+        if (prs_list.num_snp[i] == 0) { rs.push(0.0); }
         else
         {
-            rs.push(m_prs_info[i].prs
-                    / static_cast<double>(m_prs_info[i].num_snp));
+            rs.push(prs_list.prs[i] / static_cast<double>(prs_list.num_snp[i]));
         }
     }
-    m_mean_score = rs.mean();
-    m_score_sd = rs.sd();
+    mean_score = rs.mean();
+    score_sd = rs.sd();
 }
 
-void Genotype::get_null_score(std::vector<PRS>& prs_list,
-                              const size_t& set_size, const size_t& prev_size,
+void Genotype::get_null_score(SamplePRS& prs_list, const size_t& set_size,
+                              const size_t& prev_size,
                               std::vector<size_t>& background_list,
                               const bool first_run)
 {
@@ -1652,23 +2020,496 @@ void Genotype::get_null_score(std::vector<PRS>& prs_list,
     std::vector<size_t>::iterator select_end = background_list.begin();
     std::advance(select_end, static_cast<long>(set_size));
     std::sort(select_start, select_end);
-    read_score(prs_list, select_start, select_end, first_run);
+    read_score(prs_list, select_start, select_end, first_run,
+               *m_score_buffer.front());
     if (m_prs_calculation.scoring_method == SCORING::STANDARDIZE
         || m_prs_calculation.scoring_method == SCORING::CONTROL_STD)
     { standardize_prs(); }
 }
+void Genotype::init_score_buffer(const size_t num_thread)
+{
+    const uintptr_t unfiltered_sample_ctv2 =
+        2 * BITCT_TO_WORDCT(m_unfiltered_sample_ct);
+    while (m_score_buffer.size() < num_thread)
+    {
+        m_score_buffer.emplace_back(std::make_unique<GenotypeBuffer>());
+        auto&& buffer = *m_score_buffer.back();
+        buffer.tmp_genotype.resize(unfiltered_sample_ctv2, 0);
+        auto&& block = buffer.prs_block;
+        block.genotype_size = unfiltered_sample_ctv2;
+        block.genotype.resize(m_prs_block_snp * unfiltered_sample_ctv2, 0);
+        block.genotype_ptr.resize(m_prs_block_snp, nullptr);
+        block.geno_score.resize(m_prs_block_snp);
+        block.geno_count.resize(m_prs_block_snp);
+        block.snp_idx.resize(m_prs_block_snp);
+    }
+}
+
+void Genotype::add_prs_block(const uintptr_t* genotype, const size_t snp_idx,
+                             SamplePRS& prs_list, GenotypeBuffer& buffer,
+                             const size_t ploidy, const double stat,
+                             const double adj_score, const double miss_score,
+                             const size_t miss_count,
+                             const double homcom_weight,
+                             const double het_weight,
+                             const double homrar_weight, bool& not_first)
+{
+    auto&& block = buffer.prs_block;
+    const size_t idx = block.num_snp;
+    block.genotype_ptr[idx] = genotype;
+    block.snp_idx[idx] = snp_idx;
+    get_geno_prs(block.geno_score[idx], block.geno_count[idx], ploidy, stat,
+                 adj_score, miss_score, miss_count, homcom_weight, het_weight,
+                 homrar_weight);
+    ++block.num_snp;
+    if (block.num_snp == block.genotype_ptr.size())
+    { flush_prs_block(prs_list, buffer, not_first); }
+}
+
+bool Genotype::build_block_prs_table(PRSBlock& block) const
+{
+    if (m_sample_ct < m_min_sample_for_prs_table) return false;
+    block.score_table.resize(block.genotype_ptr.size() * 1024);
+    block.count_table.resize(block.genotype_ptr.size() * 1024);
+    for (size_t i_snp = 0; i_snp < block.num_snp; ++i_snp)
+    {
+        build_prs_table(block.geno_score[i_snp], block.geno_count[i_snp],
+                        &block.score_table[i_snp * 1024],
+                        &block.count_table[i_snp * 1024]);
+    }
+    return true;
+}
+
+void Genotype::flush_prs_block(SamplePRS& prs_list, GenotypeBuffer& buffer,
+                               bool& not_first)
+{
+    auto&& block = buffer.prs_block;
+    if (block.num_snp == 0) return;
+    if (m_build_score_matrix)
+    {
+        flush_score_matrix(block);
+        block.num_snp = 0;
+        return;
+    }
+    const bool use_table = build_block_prs_table(block);
+    for (size_t start = 0; start < m_sample_ct; start += m_prs_tile_sample)
+    {
+        const size_t end = std::min(m_sample_ct, start + m_prs_tile_sample);
+        double* prs = prs_list.prs.data() + start;
+        uint32_t* num_snp = prs_list.num_snp.data() + start;
+        for (size_t i_snp = 0; i_snp < block.num_snp; ++i_snp)
+        {
+            const double* score_table =
+                use_table ? &block.score_table[i_snp * 1024] : nullptr;
+            const uint32_t* count_table =
+                use_table ? &block.count_table[i_snp * 1024] : nullptr;
+            if (i_snp == 0 && !not_first)
+            {
+                process_sample_prs<true>(block.genotype_ptr[i_snp], prs,
+                                         num_snp, score_table, count_table,
+                                         block.geno_score[i_snp],
+                                         block.geno_count[i_snp], start, end);
+            }
+            else
+            {
+                process_sample_prs<false>(block.genotype_ptr[i_snp], prs,
+                                          num_snp, score_table, count_table,
+                                          block.geno_score[i_snp],
+                                          block.geno_count[i_snp], start, end);
+            }
+        }
+    }
+    not_first = true;
+    block.num_snp = 0;
+}
+
+void Genotype::flush_score_matrix(PRSBlock& block)
+{
+    const bool use_table = build_block_prs_table(block);
+    const Eigen::Index num_snp = static_cast<Eigen::Index>(block.num_snp);
+    // weight of each SNP of the block on each (region, threshold) column. The
+    // effect size is already included in the dosage tile
+    std::vector<Eigen::Triplet<double>> triplets;
+    using WeightIterator =
+        Eigen::SparseMatrix<double, Eigen::RowMajor>::InnerIterator;
+    for (size_t i_snp = 0; i_snp < block.num_snp; ++i_snp)
+    {
+        const Eigen::Index snp_idx =
+            static_cast<Eigen::Index>(block.snp_idx[i_snp]);
+        for (WeightIterator it(m_score_weight, snp_idx); it; ++it)
+        {
+            triplets.emplace_back(static_cast<Eigen::Index>(i_snp), it.col(),
+                                  it.value());
+        }
+    }
+    Eigen::SparseMatrix<double> weight(num_snp, m_score_weight.cols());
+    weight.setFromTriplets(triplets.begin(), triplets.end());
+    const Eigen::SparseMatrix<uint32_t> count_weight = weight.cast<uint32_t>();
+    const Eigen::Index tile_size = static_cast<Eigen::Index>(m_prs_tile_sample);
+    block.tile_score.resize(tile_size, num_snp);
+    block.tile_count.resize(tile_size, num_snp);
+    for (size_t start = 0; start < m_sample_ct; start += m_prs_tile_sample)
+    {
+        const size_t end = std::min(m_sample_ct, start + m_prs_tile_sample);
+        // decode the dosage of all SNPs in the block
+        for (size_t i_snp = 0; i_snp < block.num_snp; ++i_snp)
+        {
+            const Eigen::Index col = static_cast<Eigen::Index>(i_snp);
+            process_sample_prs<true>(
+                block.genotype_ptr[i_snp], block.tile_score.col(col).data(),
+                block.tile_count.col(col).data(),
+                use_table ? &block.score_table[i_snp * 1024] : nullptr,
+                use_table ? &block.count_table[i_snp * 1024] : nullptr,
+                block.geno_score[i_snp], block.geno_count[i_snp], start, end);
+        }
+        const Eigen::Index row = static_cast<Eigen::Index>(start);
+        const Eigen::Index num_row = static_cast<Eigen::Index>(end - start);
+        block.score_matrix.middleRows(row, num_row).noalias() +=
+            block.tile_score.topRows(num_row) * weight;
+        block.count_matrix.middleRows(row, num_row).noalias() +=
+            block.tile_count.topRows(num_row) * count_weight;
+    }
+}
+
+bool Genotype::same_threshold(const size_t snp_a, const size_t snp_b) const
+{
+    // when we have very small thresholds, we use the p-value as the
+    // indicator
+    if (m_very_small_thresholds)
+    {
+        return misc::logically_equal(m_existed_snps[snp_a]->p_value(),
+                                     m_existed_snps[snp_b]->p_value());
+    }
+    return m_existed_snps[snp_a]->category()
+           == m_existed_snps[snp_b]->category();
+}
+
+std::vector<size_t>::const_iterator
+Genotype::threshold_end(const std::vector<size_t>::const_iterator& start_index,
+                        const std::vector<size_t>::const_iterator& end_index)
+    const
+{
+    std::vector<size_t>::const_iterator region_end = start_index;
+    for (; region_end != end_index; ++region_end)
+    {
+        if (!same_threshold(*start_index, *region_end)) { break; }
+    }
+    return region_end;
+}
+
+bool Genotype::prepare_score_matrix(const size_t num_regions)
+{
+    m_use_score_matrix = false;
+    m_cur_score_chunk = ~size_t(0);
+    m_score_matrix_memory.release();
+    // bgen dosages are scored through the parser callbacks
+    if (!m_hard_coded || m_existed_snps.empty() || m_sample_ct == 0)
+        return false;
+    // count the number of thresholds in each region
+    std::vector<size_t> num_threshold(num_regions, 0);
+    std::vector<size_t> prev_snp(num_regions, 0);
+    for (size_t i_snp = 0; i_snp < m_existed_snps.size(); ++i_snp)
+    {
+        auto&& flags = m_existed_snps[i_snp]->get_flag();
+        for (size_t i_region = 0; i_region < num_regions; ++i_region)
+        {
+            if (!IS_SET(flags.data(), i_region)) continue;
+            if (num_threshold[i_region] == 0
+                || !same_threshold(prev_snp[i_region], i_snp))
+            { ++num_threshold[i_region]; }
+            prev_snp[i_region] = i_snp;
+        }
+    }
+    // group consecutive regions into chunks whose score matrix fit within
+    // the memory limit. Regions too large for the score matrix will be read
+    // directly. Background region (index 1) is never scored directly
+    const size_t col_byte = m_sample_ct * (sizeof(double) + sizeof(uint32_t));
+    const size_t max_col =
+        std::min(m_max_score_matrix_byte, MemoryBudget::global().available())
+        / col_byte;
+    m_region_chunk.assign(num_regions, ~size_t(0));
+    m_score_chunk_region.clear();
+    size_t chunk_col = 0, max_chunk_col = 0;
+    for (size_t i_region = 0; i_region < num_regions; ++i_region)
+    {
+        if (i_region == 1 || num_threshold[i_region] == 0
+            || num_threshold[i_region] > max_col)
+            continue;
+        if (m_score_chunk_region.empty()
+            || chunk_col + num_threshold[i_region] > max_col)
+        {
+            m_score_chunk_region.emplace_back();
+            chunk_col = 0;
+        }
+        m_score_chunk_region.back().push_back(i_region);
+        m_region_chunk[i_region] = m_score_chunk_region.size() - 1;
+        chunk_col += num_threshold[i_region];
+        max_chunk_col = std::max(max_chunk_col, chunk_col);
+    }
+    // hold the memory of the largest chunk for as long as the matrix is used
+    m_use_score_matrix =
+        !m_score_chunk_region.empty()
+        && MemoryBudget::global().reserve(max_chunk_col * col_byte,
+                                          m_score_matrix_memory);
+    return m_use_score_matrix;
+}
+
+void Genotype::build_score_chunk(const size_t chunk)
+{
+    auto&& regions = m_score_chunk_region[chunk];
+    const size_t num_regions = m_region_chunk.size();
+    // assign a column to every threshold of every region of this chunk, with
+    // membership taken from the SNP flags so that each SNP is only read once
+    // and scattered to all regions it belongs to
+    std::vector<Eigen::Triplet<double>> triplets;
+    std::vector<size_t> snp_idx;
+    std::vector<Eigen::Index> cur_col(num_regions, -1);
+    std::vector<size_t> prev_snp(num_regions, 0);
+    m_score_column.assign(num_regions, {});
+    Eigen::Index num_col = 0;
+    for (size_t i_snp = 0; i_snp < m_existed_snps.size(); ++i_snp)
+    {
+        auto&& flags = m_existed_snps[i_snp]->get_flag();
+        bool used = false;
+        for (auto&& i_region : regions)
+        {
+            if (!IS_SET(flags.data(), i_region)) continue;
+            if (cur_col[i_region] == -1
+                || !same_threshold(prev_snp[i_region], i_snp))
+            {
+                cur_col[i_region] = num_col++;
+                m_score_column[i_region][i_snp] = cur_col[i_region];
+            }
+            prev_snp[i_region] = i_snp;
+            triplets.emplace_back(static_cast<Eigen::Index>(i_snp),
+                                  cur_col[i_region], 1.0);
+            used = true;
+        }
+        if (used) snp_idx.push_back(i_snp);
+    }
+    m_score_weight.resize(static_cast<Eigen::Index>(m_existed_snps.size()),
+                          num_col);
+    m_score_weight.setFromTriplets(triplets.begin(), triplets.end());
+    triplets.clear();
+    const Eigen::Index num_sample = static_cast<Eigen::Index>(m_sample_ct);
+    // each thread reads a contiguous part of the SNPs into its own score
+    // matrix, so every additional thread needs a copy of the matrix
+    const size_t num_snp = snp_idx.size();
+    const size_t matrix_byte = m_sample_ct * static_cast<size_t>(num_col)
+                               * (sizeof(double) + sizeof(uint32_t));
+    size_t num_thread = std::max<size_t>(
+        1, std::min(static_cast<size_t>(std::max(1, m_prs_calculation.thread)),
+                    num_snp / m_min_score_snp_per_thread));
+    if (num_thread > 1 && matrix_byte != 0)
+    {
+        num_thread = std::min(
+            num_thread, 1 + MemoryBudget::global().available() / matrix_byte);
+    }
+    MemoryBudget::Reservation thread_matrix_memory;
+    if (num_thread > 1
+        && !MemoryBudget::global().reserve((num_thread - 1) * matrix_byte,
+                                           thread_matrix_memory))
+    { num_thread = 1; }
+    init_score_buffer(num_thread);
+    m_score_matrix.resize(0, 0);
+    m_count_matrix.resize(0, 0);
+    // idle threads can still help with decompressing the genotypes
+    const size_t num_decoder =
+        (num_thread == 1)
+            ? static_cast<size_t>(std::max(1, m_prs_calculation.thread))
+            : 1;
+    for (size_t i = 0; i < num_thread; ++i)
+    {
+        auto&& block = m_score_buffer[i]->prs_block;
+        block.score_matrix.setZero(num_sample, num_col);
+        block.count_matrix.setZero(num_sample, num_col);
+        m_score_buffer[i]->bgen_decoder.set_num_worker(num_decoder);
+    }
+    m_cur_score_chunk = ~size_t(0);
+    m_build_score_matrix = true;
+    std::vector<std::exception_ptr> errors(num_thread, nullptr);
+    // the PRS list is not used when building the score matrix
+    auto score_chunk = [this, &errors](size_t thread_idx,
+                                       std::vector<size_t>::const_iterator s,
+                                       std::vector<size_t>::const_iterator e) {
+        try
+        {
+            read_score(m_prs_info, s, e, false, *m_score_buffer[thread_idx]);
+        }
+        catch (...)
+        {
+            errors[thread_idx] = std::current_exception();
+        }
+    };
+    const size_t job_per_thread = num_snp / num_thread;
+    const size_t remain = num_snp % num_thread;
+    std::vector<std::thread> workers;
+    auto chunk_start = snp_idx.cbegin();
+    std::vector<size_t>::const_iterator first_end;
+    for (size_t i_thread = 0; i_thread < num_thread; ++i_thread)
+    {
+        auto chunk_end = chunk_start;
+        std::advance(chunk_end, static_cast<std::ptrdiff_t>(
+                                    job_per_thread + (i_thread < remain)));
+        if (i_thread == 0) { first_end = chunk_end; }
+        else
+        {
+            workers.emplace_back(score_chunk, i_thread, chunk_start, chunk_end);
+        }
+        chunk_start = chunk_end;
+    }
+    score_chunk(0, snp_idx.cbegin(), first_end);
+    for (auto&& worker : workers) worker.join();
+    m_build_score_matrix = false;
+    for (auto&& error : errors)
+    {
+        if (error) std::rethrow_exception(error);
+    }
+    // the matrix of the first thread becomes the score matrix
+    auto&& first_block = m_score_buffer.front()->prs_block;
+    m_score_matrix.swap(first_block.score_matrix);
+    m_count_matrix.swap(first_block.count_matrix);
+    for (size_t i = 1; i < num_thread; ++i)
+    {
+        auto&& block = m_score_buffer[i]->prs_block;
+        m_score_matrix += block.score_matrix;
+        m_count_matrix += block.count_matrix;
+        block.score_matrix.resize(0, 0);
+        block.count_matrix.resize(0, 0);
+    }
+    m_score_weight = Eigen::SparseMatrix<double, Eigen::RowMajor>();
+    m_cur_score_chunk = chunk;
+}
+
+bool Genotype::load_score_region(const size_t region_idx)
+{
+    if (!m_use_score_matrix || region_idx >= m_region_chunk.size())
+        return false;
+    const size_t chunk = m_region_chunk[region_idx];
+    if (chunk >= m_score_chunk_region.size()) return false;
+    if (chunk != m_cur_score_chunk) build_score_chunk(chunk);
+    return true;
+}
+
+void Genotype::load_score_column(SamplePRS& prs_list, const Eigen::Index col,
+                                 const bool reset) const
+{
+    const size_t num_sample = prs_list.size();
+    double* prs = prs_list.prs.data();
+    uint32_t* num_snp = prs_list.num_snp.data();
+    const double* score = m_score_matrix.col(col).data();
+    const uint32_t* count = m_count_matrix.col(col).data();
+    if (reset)
+    {
+        std::copy(score, score + num_sample, prs);
+        std::copy(count, count + num_sample, num_snp);
+        return;
+    }
+    for (size_t i = 0; i < num_sample; ++i) { prs[i] += score[i]; }
+    for (size_t i = 0; i < num_sample; ++i) { num_snp[i] += count[i]; }
+}
+
+void Genotype::read_score(const std::vector<size_t>::const_iterator& start,
+                          const std::vector<size_t>::const_iterator& end,
+                          bool reset_zero)
+{
+    const size_t num_snp = static_cast<size_t>(std::distance(start, end));
+    // only use multiple threads if each of them has enough work to do
+    const size_t num_thread = std::max<size_t>(
+        1, std::min(static_cast<size_t>(std::max(1, m_prs_calculation.thread)),
+                    num_snp / m_min_score_snp_per_thread));
+    init_score_buffer(num_thread);
+    if (num_thread == 1)
+    {
+        // too few SNPs to split, but the idle threads can still help with
+        // decompressing the genotypes
+        auto&& buffer = *m_score_buffer.front();
+        buffer.bgen_decoder.set_num_worker(
+            static_cast<size_t>(std::max(1, m_prs_calculation.thread)));
+        read_score(m_prs_info, start, end, reset_zero, buffer);
+        return;
+    }
+    for (size_t i = 0; i < num_thread; ++i)
+    { m_score_buffer[i]->bgen_decoder.set_num_worker(1); }
+    // reset here instead of within read_score, as the first chunk might not
+    // contain any valid SNP
+    if (reset_zero) { m_prs_info.reset(); }
+    m_thread_prs.resize(num_thread - 1);
+    std::vector<std::exception_ptr> errors(num_thread, nullptr);
+    auto score_chunk = [this, &errors](size_t thread_idx,
+                                       SamplePRS& prs_list,
+                                       std::vector<size_t>::const_iterator s,
+                                       std::vector<size_t>::const_iterator e) {
+        try
+        {
+            read_score(prs_list, s, e, false, *m_score_buffer[thread_idx]);
+        }
+        catch (...)
+        {
+            errors[thread_idx] = std::current_exception();
+        }
+    };
+    // split the SNPs into contiguous chunks, the first chunk is processed by
+    // the current thread
+    const size_t job_per_thread = num_snp / num_thread;
+    const size_t remain = num_snp % num_thread;
+    std::vector<std::thread> workers;
+    auto chunk_start = start;
+    std::vector<size_t>::const_iterator first_end;
+    for (size_t i_thread = 0; i_thread < num_thread; ++i_thread)
+    {
+        auto chunk_end = chunk_start;
+        std::advance(chunk_end, static_cast<std::ptrdiff_t>(
+                                    job_per_thread + (i_thread < remain)));
+        if (i_thread == 0) { first_end = chunk_end; }
+        else
+        {
+            auto&& local_prs = m_thread_prs[i_thread - 1];
+            local_prs.resize(m_prs_info.size());
+            local_prs.reset();
+            workers.emplace_back(score_chunk, i_thread, std::ref(local_prs),
+                                 chunk_start, chunk_end);
+        }
+        chunk_start = chunk_end;
+    }
+    score_chunk(0, m_prs_info, start, first_end);
+    for (auto&& worker : workers) worker.join();
+    for (auto&& error : errors)
+    {
+        if (error) std::rethrow_exception(error);
+    }
+    for (auto&& local_prs : m_thread_prs) { m_prs_info.add(local_prs); }
+}
+
 void Genotype::load_genotype_to_memory()
 {
-    // don't reserve memory if we don't need to run hard coding
-    if (!m_hard_coded) { return; }
-    m_genotype_stored = true;
     // this is use for initialize the array sizes
     const uintptr_t unfiltered_sample_ctl =
         BITCT_TO_WORDCT(m_unfiltered_sample_ct);
     const uintptr_t unfiltered_sample_ctv2 = 2 * unfiltered_sample_ctl;
+    const size_t memory_per_snp =
+        m_hard_coded ? unfiltered_sample_ctv2 : dosage_storage_word();
+    // don't reserve memory if the dosages can't be stored
+    if (memory_per_snp == 0) { return; }
+    // genotypes not stored in memory are read from the file when required,
+    // so it is safe to skip this if they don't fit within the budget
+    const size_t required_byte = m_existed_snps.size()
+                                 * round_up_pow2(memory_per_snp, CACHELINE)
+                                 * sizeof(uintptr_t);
+    if (required_byte > MemoryBudget::global().available())
+    {
+        m_reporter->report(
+            "Warning: Require "
+            + misc::to_string(required_byte / 1048576 + 1)
+            + " MB to store all genotypes into memory but only "
+            + misc::to_string(MemoryBudget::global().available() / 1048576)
+            + " MB is available. Will read the genotypes from file instead\n");
+        return;
+    }
+    m_genotype_stored = true;
     std::streampos cur_line;
-    m_genotype_pool =
-        GenotypePool(m_existed_snps.size(), unfiltered_sample_ctv2);
+    m_genotype_pool.reset(
+        new GenotypePool(m_existed_snps.size(), memory_per_snp));
     std::sort(
         begin(m_existed_snps), end(m_existed_snps),
         [](const std::unique_ptr<SNP>& t1, const std::unique_ptr<SNP>& t2) {
@@ -1677,54 +2518,44 @@ void Genotype::load_genotype_to_memory()
             else
                 return t1->get_file_idx() < t2->get_file_idx();
         });
+    m_genotype_file.set_sequential(true);
     for (auto&& snp : m_existed_snps)
     {
-        snp->set_genotype_storage(m_genotype_pool.alloc());
+        snp->set_genotype_storage(m_genotype_pool->alloc());
         this->count_and_read_genotype(snp);
     }
+    m_genotype_file.set_sequential(false);
 }
 
 
 bool Genotype::get_score(std::vector<size_t>::const_iterator& start_index,
                          const std::vector<size_t>::const_iterator& end_index,
                          double& cur_threshold, uint32_t& num_snp_included,
-                         const bool first_run)
+                         const bool first_run, const size_t region_idx)
 {
+    if (load_score_region(region_idx))
+    {
+        return get_score(m_prs_info, m_mean_score, m_score_sd, start_index,
+                         end_index, cur_threshold, num_snp_included, first_run,
+                         region_idx);
+    }
     // if there are no SNPs or we are at the end
     if (m_existed_snps.size() == 0 || start_index == end_index
         || (*start_index) == m_existed_snps.size())
         return false;
     // reset number of SNPs if we don't need cumulative PRS
     if (m_prs_calculation.non_cumulate) num_snp_included = 0;
-    std::vector<size_t>::const_iterator region_end = start_index;
-    if (!m_very_small_thresholds)
-    {
-        unsigned long long cur_category =
-            m_existed_snps[(*start_index)]->category();
-        cur_threshold = m_existed_snps[(*start_index)]->get_threshold();
-        for (; region_end != end_index; ++region_end)
-        {
-            if (m_existed_snps[(*region_end)]->category() != cur_category)
-            { break; }
-            ++num_snp_included;
-        }
-    }
-    else
-    {
-        // when we have very small thresholds, we use the p-value as the
-        // indicator
-        auto cur_pvalue = m_existed_snps[(*start_index)]->p_value();
-        cur_threshold = cur_pvalue;
-        for (; region_end != end_index; ++region_end)
-        {
-            if (!misc::logically_equal(m_existed_snps[(*region_end)]->p_value(),
-                                       cur_pvalue))
-            { break; }
-            ++num_snp_included;
-        }
-    }
-    read_score(start_index, region_end,
-               (m_prs_calculation.non_cumulate || first_run));
+    // when we have very small thresholds, we use the p-value as the
+    // indicator
+    cur_threshold = m_very_small_thresholds
+                        ? m_existed_snps[(*start_index)]->p_value()
+                        : m_existed_snps[(*start_index)]->get_threshold();
+    std::vector<size_t>::const_iterator region_end =
+        threshold_end(start_index, end_index);
+    num_snp_included +=
+        static_cast<uint32_t>(std::distance(start_index, region_end));
+    const bool reset = (m_prs_calculation.non_cumulate || first_run);
+    read_score(start_index, region_end, reset);
     // update the current index
     start_index = region_end;
     // if ((*start_index) == 0) return -1;
@@ -1734,6 +2565,40 @@ bool Genotype::get_score(std::vector<size_t>::const_iterator& start_index,
     return true;
 }
 
+bool Genotype::get_score(SamplePRS& prs_list, double& mean_score,
+                         double& score_sd,
+                         std::vector<size_t>::const_iterator& start_index,
+                         const std::vector<size_t>::const_iterator& end_index,
+                         double& cur_threshold, uint32_t& num_snp_included,
+                         const bool first_run, const size_t region_idx) const
+{
+    if (m_existed_snps.size() == 0 || start_index == end_index
+        || (*start_index) == m_existed_snps.size())
+        return false;
+    if (!score_loaded(region_idx))
+    {
+        throw std::runtime_error(
+            "Error: Region is not held by the score matrix. This should "
+            "not happen, please report this bug");
+    }
+    if (m_prs_calculation.non_cumulate) num_snp_included = 0;
+    cur_threshold = m_very_small_thresholds
+                        ? m_existed_snps[(*start_index)]->p_value()
+                        : m_existed_snps[(*start_index)]->get_threshold();
+    std::vector<size_t>::const_iterator region_end =
+        threshold_end(start_index, end_index);
+    num_snp_included +=
+        static_cast<uint32_t>(std::distance(start_index, region_end));
+    const bool reset = (m_prs_calculation.non_cumulate || first_run);
+    load_score_column(prs_list, m_score_column[region_idx].at(*start_index),
+                      reset);
+    start_index = region_end;
+    if (m_prs_calculation.scoring_method == SCORING::STANDARDIZE
+        || m_prs_calculation.scoring_method == SCORING::CONTROL_STD)
+    { standardize_prs(prs_list, mean_score, score_sd); }
+    return true;
+}
+
 /**
  * DON'T TOUCH AREA
  *
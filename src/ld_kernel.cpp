@@ -0,0 +1,88 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "ld_kernel.hpp"
+#include "plink_common.hpp"
+#include <algorithm>
+
+namespace ld_kernel
+{
+// number of words swept per tile, the three index planes of a tile take
+// 11KB and stay in L1 while the window SNPs stream through. This is a
+// multiple of the 24 words handled per iteration of the AVX2 kernel and
+// keeps the tiles aligned for the SSE2 loads of genovec_3freq
+static const uintptr_t tile_word_ct = 480;
+
+void accumulate_scalar(const uintptr_t* planes, uintptr_t plane_stride,
+                       const uintptr_t* const* window, size_t num_window,
+                       uintptr_t start, uintptr_t end, uint64_t* raw)
+{
+    uint32_t missing, het, homset;
+    for (size_t i_snp = 0; i_snp < num_window; ++i_snp)
+    {
+        uint64_t* cur_raw = &(raw[9 * i_snp]);
+        for (size_t k = 0; k < 3; ++k)
+        {
+            genovec_3freq(&(window[i_snp][start]),
+                          &(planes[k * plane_stride + start]), end - start,
+                          &missing, &het, &homset);
+            cur_raw[3 * k] += missing + homset;
+            cur_raw[3 * k + 1] += het + homset;
+            cur_raw[3 * k + 2] += homset;
+        }
+    }
+}
+
+accumulate_fn get_accumulate()
+{
+    static const accumulate_fn accumulate = []() {
+        if (get_accumulate_avx512() != nullptr) return get_accumulate_avx512();
+        if (get_accumulate_avx2() != nullptr) return get_accumulate_avx2();
+        return accumulate_scalar;
+    }();
+    return accumulate;
+}
+
+void joint_genotype_counts(const uintptr_t* planes, uintptr_t plane_stride,
+                           const uintptr_t* index_tots,
+                           const uintptr_t* const* window, size_t num_window,
+                           uintptr_t word_ct, uint32_t* counts, uint64_t* raw)
+{
+    const accumulate_fn accumulate = get_accumulate();
+    std::fill(raw, raw + 9 * num_window, 0);
+    for (uintptr_t start = 0; start < word_ct; start += tile_word_ct)
+    {
+        accumulate(planes, plane_stride, window, num_window, start,
+                   std::min(start + tile_word_ct, word_ct), raw);
+    }
+    // low bit is set for 01 (missing) and 11, high bit for 10 and 11
+    for (size_t i_snp = 0; i_snp < num_window; ++i_snp)
+    {
+        const uint64_t* cur_raw = &(raw[9 * i_snp]);
+        uint32_t* cur_counts = &(counts[9 * i_snp]);
+        for (size_t k = 0; k < 3; ++k)
+        {
+            const uint64_t low = cur_raw[3 * k];
+            const uint64_t high = cur_raw[3 * k + 1];
+            const uint64_t both = cur_raw[3 * k + 2];
+            cur_counts[3 * k] =
+                static_cast<uint32_t>(index_tots[k] - low - high + both);
+            cur_counts[3 * k + 1] = static_cast<uint32_t>(high - both);
+            cur_counts[3 * k + 2] = static_cast<uint32_t>(both);
+        }
+    }
+}
+}
@@ -0,0 +1,145 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// This file is compiled with -mavx2 on x86 and the kernel is only handed
+// out when the CPU supports it. Only C headers should be included here so
+// that no inline function compiled with AVX2 can leak into the rest of the
+// program.
+#include "ld_kernel.hpp"
+
+#if defined(__AVX2__) && defined(__LP64__)
+#include "x86/avx2.h"
+
+namespace ld_kernel
+{
+namespace
+{
+inline simde__m256i load(const uintptr_t* ptr)
+{
+    return simde_mm256_loadu_si256(reinterpret_cast<const simde__m256i*>(ptr));
+}
+
+// sum adjacent fields of width shift into fields of twice the width
+template <int shift>
+inline simde__m256i fold(const simde__m256i& v, const simde__m256i& mask)
+{
+    return simde_mm256_add_epi64(
+        simde_mm256_and_si256(v, mask),
+        simde_mm256_and_si256(simde_mm256_srli_epi64(v, shift), mask));
+}
+
+// AVX2 version of count_3freq_1920b: the masked low bit, high bit and both
+// bits of 3 vectors are summed within their 2-bit fields, then widened to 4
+// and 8 bits before they are added to the byte accumulators. words
+// [start, end) are counted, where end - start is a multiple of 24
+void count_3freq_avx2(const uintptr_t* geno, const uintptr_t* plane,
+                      uintptr_t start, uintptr_t end, uint64_t* raw)
+{
+    const simde__m256i m2 = simde_mm256_set1_epi64x(0x3333333333333333LL);
+    const simde__m256i m4 = simde_mm256_set1_epi64x(0x0f0f0f0f0f0f0f0fLL);
+    const simde__m256i zero = simde_mm256_setzero_si256();
+    simde__m256i total_low = zero, total_high = zero, total_both = zero;
+    uintptr_t i = start;
+    while (i < end)
+    {
+        // each iteration adds at most 24 to a byte, so flush every 10
+        const uintptr_t block_end = (end - i > 240) ? i + 240 : end;
+        simde__m256i acc_low = zero, acc_high = zero, acc_both = zero;
+        for (; i < block_end; i += 24)
+        {
+            simde__m256i low4 = zero, high4 = zero, both4 = zero;
+            for (uintptr_t half = 0; half < 24; half += 12)
+            {
+                simde__m256i low2 = zero, high2 = zero, both2 = zero;
+                for (uintptr_t j = half; j < half + 12; j += 4)
+                {
+                    const simde__m256i cur = load(&(geno[i + j]));
+                    const simde__m256i mask = load(&(plane[i + j]));
+                    const simde__m256i high = simde_mm256_and_si256(
+                        mask, simde_mm256_srli_epi64(cur, 1));
+                    low2 = simde_mm256_add_epi64(
+                        low2, simde_mm256_and_si256(mask, cur));
+                    high2 = simde_mm256_add_epi64(high2, high);
+                    both2 = simde_mm256_add_epi64(
+                        both2, simde_mm256_and_si256(high, cur));
+                }
+                low4 = simde_mm256_add_epi64(low4, fold<2>(low2, m2));
+                high4 = simde_mm256_add_epi64(high4, fold<2>(high2, m2));
+                both4 = simde_mm256_add_epi64(both4, fold<2>(both2, m2));
+            }
+            acc_low = simde_mm256_add_epi64(acc_low, fold<4>(low4, m4));
+            acc_high = simde_mm256_add_epi64(acc_high, fold<4>(high4, m4));
+            acc_both = simde_mm256_add_epi64(acc_both, fold<4>(both4, m4));
+        }
+        total_low = simde_mm256_add_epi64(total_low,
+                                          simde_mm256_sad_epu8(acc_low, zero));
+        total_high = simde_mm256_add_epi64(
+            total_high, simde_mm256_sad_epu8(acc_high, zero));
+        total_both = simde_mm256_add_epi64(
+            total_both, simde_mm256_sad_epu8(acc_both, zero));
+    }
+    const simde__m256i* totals[3] = {&total_low, &total_high, &total_both};
+    for (size_t j = 0; j < 3; ++j)
+    {
+        uint64_t lanes[4];
+        simde_mm256_storeu_si256(reinterpret_cast<simde__m256i*>(lanes),
+                                 *totals[j]);
+        raw[j] += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+}
+
+void accumulate_avx2(const uintptr_t* planes, uintptr_t plane_stride,
+                     const uintptr_t* const* window, size_t num_window,
+                     uintptr_t start, uintptr_t end, uint64_t* raw)
+{
+    const uintptr_t vec_end = start + (end - start) / 24 * 24;
+    for (size_t i_snp = 0; i_snp < num_window; ++i_snp)
+    {
+        const uintptr_t* geno = window[i_snp];
+        uint64_t* cur_raw = &(raw[9 * i_snp]);
+        // the window SNP stays in L1 while it is counted against each plane
+        for (size_t k = 0; k < 3; ++k)
+        {
+            const uintptr_t* plane = &(planes[k * plane_stride]);
+            if (vec_end != start)
+            {
+                count_3freq_avx2(geno, plane, start, vec_end,
+                                 &(cur_raw[3 * k]));
+            }
+            for (uintptr_t i = vec_end; i < end; ++i)
+            {
+                const uint64_t high = plane[i] & (geno[i] >> 1);
+                cur_raw[3 * k] += __builtin_popcountll(plane[i] & geno[i]);
+                cur_raw[3 * k + 1] += __builtin_popcountll(high);
+                cur_raw[3 * k + 2] += __builtin_popcountll(high & geno[i]);
+            }
+        }
+    }
+}
+}
+
+accumulate_fn get_accumulate_avx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? accumulate_avx2 : nullptr;
+}
+}
+#else
+namespace ld_kernel
+{
+accumulate_fn get_accumulate_avx2() { return nullptr; }
+}
+#endif
@@ -0,0 +1,138 @@
+// This file is part of PRSice-2, copyright (C) 2016-2019
+// Shing Wan Choi, Paul F. O’Reilly
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// This file is compiled with -mavx512f -mavx512vpopcntdq when the compiler
+// supports it and the kernel is only handed out when the CPU does. The
+// bundled simde does not provide VPOPCNTQ, so the native intrinsics are used
+// instead. As with the AVX2 kernel, only C headers should be included here.
+#include "ld_kernel.hpp"
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__) && defined(__LP64__)
+#include <immintrin.h>
+
+namespace ld_kernel
+{
+namespace
+{
+// the masked shift avoids a spurious uninitialized warning from the
+// undefined source operand of _mm512_srli_epi64 in gcc
+inline __m512i shift_right(const __m512i& v)
+{
+    return _mm512_maskz_srli_epi64(static_cast<__mmask8>(0xff), v, 1);
+}
+
+inline __m512i shift_left(const __m512i& v)
+{
+    return _mm512_maskz_slli_epi64(static_cast<__mmask8>(0xff), v, 1);
+}
+
+void accumulate_avx512(const uintptr_t* planes, uintptr_t plane_stride,
+                       const uintptr_t* const* window, size_t num_window,
+                       uintptr_t start, uintptr_t end, uint64_t* raw)
+{
+    const __m512i five = _mm512_set1_epi64(0x5555555555555555LL);
+    const uintptr_t pair_end = start + (end - start) / 16 * 16;
+    for (size_t i_snp = 0; i_snp < num_window; ++i_snp)
+    {
+        const uintptr_t* geno = window[i_snp];
+        __m512i acc[9];
+        for (size_t j = 0; j < 9; ++j) acc[j] = _mm512_setzero_si512();
+        // all products only use the even bits, so the products of two
+        // vectors are packed into one before the popcount
+        for (uintptr_t i = start; i < pair_end; i += 16)
+        {
+            const __m512i cur1 = _mm512_loadu_si512(&(geno[i]));
+            const __m512i cur2 = _mm512_loadu_si512(&(geno[i + 8]));
+            const __m512i low1 = _mm512_and_si512(cur1, five);
+            const __m512i low2 = _mm512_and_si512(cur2, five);
+            const __m512i high1 = _mm512_and_si512(shift_right(cur1), five);
+            const __m512i high2 = _mm512_and_si512(shift_right(cur2), five);
+            const __m512i both1 = _mm512_and_si512(low1, high1);
+            const __m512i both2 = _mm512_and_si512(low2, high2);
+            for (size_t k = 0; k < 3; ++k)
+            {
+                const uintptr_t* plane = &(planes[k * plane_stride + i]);
+                const __m512i plane1 = _mm512_loadu_si512(plane);
+                const __m512i plane2 = _mm512_loadu_si512(plane + 8);
+                acc[3 * k] = _mm512_add_epi64(
+                    acc[3 * k],
+                    _mm512_popcnt_epi64(_mm512_or_si512(
+                        _mm512_and_si512(plane1, low1),
+                        shift_left(_mm512_and_si512(plane2, low2)))));
+                acc[3 * k + 1] = _mm512_add_epi64(
+                    acc[3 * k + 1],
+                    _mm512_popcnt_epi64(_mm512_or_si512(
+                        _mm512_and_si512(plane1, high1),
+                        shift_left(_mm512_and_si512(plane2, high2)))));
+                acc[3 * k + 2] = _mm512_add_epi64(
+                    acc[3 * k + 2],
+                    _mm512_popcnt_epi64(_mm512_or_si512(
+                        _mm512_and_si512(plane1, both1),
+                        shift_left(_mm512_and_si512(plane2, both2)))));
+            }
+        }
+        // masked loads take care of the remaining partial vectors
+        for (uintptr_t i = pair_end; i < end; i += 8)
+        {
+            const __mmask8 mask = (end - i >= 8)
+                                      ? static_cast<__mmask8>(0xff)
+                                      : static_cast<__mmask8>(
+                                          (1u << (end - i)) - 1);
+            const __m512i cur = _mm512_maskz_loadu_epi64(mask, &(geno[i]));
+            const __m512i low = _mm512_and_si512(cur, five);
+            const __m512i high = _mm512_and_si512(shift_right(cur), five);
+            const __m512i both = _mm512_and_si512(low, high);
+            for (size_t k = 0; k < 3; ++k)
+            {
+                const __m512i plane = _mm512_maskz_loadu_epi64(
+                    mask, &(planes[k * plane_stride + i]));
+                acc[3 * k] = _mm512_add_epi64(
+                    acc[3 * k],
+                    _mm512_popcnt_epi64(_mm512_and_si512(plane, low)));
+                acc[3 * k + 1] = _mm512_add_epi64(
+                    acc[3 * k + 1],
+                    _mm512_popcnt_epi64(_mm512_and_si512(plane, high)));
+                acc[3 * k + 2] = _mm512_add_epi64(
+                    acc[3 * k + 2],
+                    _mm512_popcnt_epi64(_mm512_and_si512(plane, both)));
+            }
+        }
+        uint64_t* cur_raw = &(raw[9 * i_snp]);
+        for (size_t j = 0; j < 9; ++j)
+        {
+            uint64_t lanes[8];
+            _mm512_storeu_si512(lanes, acc[j]);
+            for (size_t lane = 0; lane < 8; ++lane) cur_raw[j] += lanes[lane];
+        }
+    }
+}
+}
+
+accumulate_fn get_accumulate_avx512()
+{
+    __builtin_cpu_init();
+    return (__builtin_cpu_supports("avx512f")
+            && __builtin_cpu_supports("avx512vpopcntdq"))
+               ? accumulate_avx512
+               : nullptr;
+}
+}
+#else
+namespace ld_kernel
+{
+accumulate_fn get_accumulate_avx512() { return nullptr; }
+}
+#endif
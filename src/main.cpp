@@ -20,6 +20,7 @@
 #include "commander.hpp"
 #include "genotype.hpp"
 #include "genotypefactory.hpp"
+#include "memory_budget.hpp"
 #include "pipeline_functions.hpp"
 #include "plink_common.hpp"
 #include "prsice.hpp"
@@ -28,6 +29,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -55,6 +57,12 @@ int main(int argc, char* argv[])
         {
             return -1; // all error messages should have printed
         }
+        // all large allocations are reserved from this budget. Use the
+        // physical memory unless --memory is provided
+        const size_t physical_memory = MemoryBudget::physical_memory();
+        MemoryBudget::global().set_limit(commander.max_memory(
+            physical_memory == 0 ? std::numeric_limits<size_t>::max()
+                                 : physical_memory));
         // parse the exclusion range and put it into the exclusion object
         // Generate the exclusion region
         std::vector<IITree<size_t, size_t>> exclusion_regions;
@@ -143,6 +151,11 @@ int main(int argc, char* argv[])
 
             const auto [max_fid, max_iid] = target_file->get_max_id_length();
             const size_t num_pheno = pheno_info.pheno_col_idx.size();
+            // when the same scores are required by multiple regions or
+            // phenotypes, calculate them in one pass of the genotypes per
+            // chunk of regions
+            if (num_regions > 2 || num_pheno > 1)
+            { target_file->prepare_score_matrix(num_regions); }
             // prsice and summary file will be per run
             // all score and best file will be per phenotype
             // this is mainly because of the size of the file and the way we
@@ -219,17 +232,10 @@ int main(int argc, char* argv[])
                 }
                 // go through each region
                 fprintf(stderr, "\nStart Processing\n");
-                for (size_t i_region = 0; i_region < num_regions; ++i_region)
-                {
-                    // always skip background region and empty regions
-                    if (i_region == 1 || region_membership[i_region].empty())
-                        continue;
-                    prsice.run_prsice(region_membership[i_region], region_names,
-                                      pheno_name, prevalence, i_pheno, i_region,
-                                      commander.all_scores(), has_prevalence,
-                                      prsice_out, best_file, all_score_file,
-                                      *target_file);
-                }
+                prsice.run_regions(region_membership, region_names, pheno_name,
+                                   prevalence, i_pheno, commander.all_scores(),
+                                   has_prevalence, prsice_out, best_file,
+                                   all_score_file, *target_file);
                 prsice.print_progress(true);
                 if (!no_regress)
                 {
@@ -76,8 +76,10 @@ void PRSice::consume_prs(
     const Eigen::Index num_regress_sample =
         static_cast<Eigen::Index>(m_matrix_index.size());
     Eigen::MatrixXd independent;
-    Eigen::VectorXd prs, beta, effects;
-    if (m_perm_info.logit_perm && m_binary_trait)
+    Eigen::VectorXd prs, beta, effects, direction;
+    // with --score-test, only the covariates need to be fitted
+    const bool score_test = m_perm_info.logit_perm && m_score_test.ready();
+    if (m_perm_info.logit_perm && m_binary_trait && !score_test)
         independent = m_independent_variables;
     // to avoid false sharing and frequent lock, we wil first store all
     // permutation results within a temporary vector
@@ -91,19 +93,28 @@ void PRSice::consume_prs(
     {
         // update the independent variable matrix with the new PRS
 
-        if (m_binary_trait && m_perm_info.logit_perm)
+        if (m_binary_trait && m_perm_info.logit_perm && !score_test)
         {
             independent.col(1) = Eigen::Map<Eigen::VectorXd>(
                 std::get<0>(prs_info).data(), num_regress_sample);
             Regression::glm(m_phenotype, independent, obs_p, r2, coefficient,
-                            standard_error, 1);
+                            standard_error, Regression::keep_nb_threads);
         }
         else
         {
             prs = Eigen::Map<Eigen::VectorXd>(std::get<0>(prs_info).data(),
                                               num_regress_sample);
-            std::tie(coefficient, standard_error) =
-                get_coeff_se(decomposed, decomposed.YCov, prs, beta, effects);
+            if (score_test)
+            {
+                // z-value has an unit standard error
+                coefficient = m_score_test.z_value(prs, direction);
+                standard_error = 1.0;
+            }
+            else
+            {
+                std::tie(coefficient, standard_error) = get_coeff_se(
+                    decomposed, decomposed.YCov, prs, beta, effects);
+            }
         }
         double t_value = std::fabs(coefficient / standard_error);
         auto&& index = set_index[std::get<1>(prs_info)];
@@ -164,12 +175,14 @@ void PRSice::subject_set_perm(T& progress_observer, Genotype& target,
         static_cast<Eigen::Index>(m_matrix_index.size());
     double coefficient, standard_error, r2, obs_p, t_value;
     Eigen::VectorXd prs = Eigen::VectorXd::Zero(num_sample);
-    Eigen::VectorXd beta, effects;
+    Eigen::VectorXd beta, effects, direction;
     Eigen::MatrixXd independent;
-    if (m_perm_info.logit_perm && m_binary_trait)
-    { independent = m_independent_variables; }
+    const bool score_test = m_perm_info.logit_perm && m_score_test.ready();
+    const bool run_glm =
+        m_perm_info.logit_perm && m_binary_trait && !score_test;
+    if (run_glm) { independent = m_independent_variables; }
     // each thread should have their own cur_prs to ensure thread safety
-    std::vector<PRS> cur_prs(target.num_sample());
+    SamplePRS cur_prs(target.num_sample());
     bool first_run = true;
     std::mt19937 g(seed);
     size_t processed = 0;
@@ -187,7 +200,7 @@ void PRSice::subject_set_perm(T& progress_observer, Genotype& target,
                                   background, first_run);
             first_run = false;
             prev_size = set_size.first;
-            if (m_perm_info.logit_perm && m_binary_trait)
+            if (run_glm)
             {
                 for (Eigen::Index sample_id = 0; sample_id < num_sample;
                      ++sample_id)
@@ -196,8 +209,9 @@ void PRSice::subject_set_perm(T& progress_observer, Genotype& target,
                     independent(sample_id, 1) =
                         target.calculate_score(cur_prs, idx);
                 }
-                Regression::glm(m_phenotype, m_independent_variables, obs_p, r2,
-                                coefficient, standard_error, 1);
+                Regression::glm(m_phenotype, independent, obs_p, r2,
+                                coefficient, standard_error,
+                                Regression::keep_nb_threads);
             }
             else
             {
@@ -207,8 +221,17 @@ void PRSice::subject_set_perm(T& progress_observer, Genotype& target,
                     size_t idx = m_matrix_index[static_cast<size_t>(sample_id)];
                     prs(sample_id) = target.calculate_score(cur_prs, idx);
                 }
-                std::tie(coefficient, standard_error) = get_coeff_se(
-                    decomposed, decomposed.YCov, prs, beta, effects);
+                if (score_test)
+                {
+                    // z-value has an unit standard error
+                    coefficient = m_score_test.z_value(prs, direction);
+                    standard_error = 1.0;
+                }
+                else
+                {
+                    std::tie(coefficient, standard_error) = get_coeff_se(
+                        decomposed, decomposed.YCov, prs, beta, effects);
+                }
             }
 
             progress_observer.emplace(1);
@@ -247,7 +270,7 @@ void PRSice::print_set_warning()
             "significantly"
             " speed up the permutation\n\n");
     }
-    else
+    else if (!m_score_test.ready())
     {
         m_reporter->report("Warning: Using --logit-perm will be "
                            "ridiculously slow\n");
@@ -297,7 +320,7 @@ void PRSice::run_competitive(
         set_index[res.num_snp].push_back(cur_set_index);
         ++cur_set_index;
         if (res.num_snp > max_set_size) max_set_size = res.num_snp;
-        obs_t_value.push_back(std::fabs(res.coefficient / res.se));
+        obs_t_value.push_back(m_prs_summary[i].obs_t_value);
     }
     // set_perm_res stores number of perm where a more sig result is
     // obtained
@@ -320,40 +343,43 @@ void PRSice::run_competitive(
         static_cast<uintptr_t>(m_independent_variables.rows());
     // This is a rough estimate, we might be using more memory than
     // indicated here
-    const uintptr_t basic_memory_required_per_thread =
-        m_perm_info.logit_perm ? (
-            4 * num_regress_sample + 2ULL * static_cast<unsigned long long>(p)
-            + 1ULL + num_regress_sample * static_cast<unsigned long long>(p))
-                               : num_regress_sample;
-
-    for (; num_thread > 0; --num_thread)
+    uintptr_t basic_memory_required_per_thread = num_regress_sample;
+    if (m_perm_info.logit_perm && m_score_test.ready())
     {
-        std::unique_ptr<double[]> bigstack = nullptr;
-        try
-        {
-            bigstack =
-                std::make_unique<double[]>(basic_memory_required_per_thread
-                                           * static_cast<size_t>(num_thread));
-            bigstack.reset();
-            break;
-        }
-        catch (const std::bad_alloc&)
-        {
-        }
+        // the PRS and its weighted covariate residual
+        basic_memory_required_per_thread = 2 * num_regress_sample;
+    }
+    else if (m_perm_info.logit_perm)
+    {
+        basic_memory_required_per_thread =
+            4 * num_regress_sample + 2ULL * static_cast<unsigned long long>(p)
+            + 1ULL + num_regress_sample * static_cast<unsigned long long>(p);
     }
-    if (num_thread == 0)
+
+    // use fewer threads if the buffers of all threads don't fit within the
+    // memory budget
+    const size_t byte_per_thread =
+        basic_memory_required_per_thread * sizeof(double);
+    num_thread = static_cast<int>(std::min<size_t>(
+        static_cast<size_t>(num_thread),
+        MemoryBudget::global().available() / byte_per_thread));
+    MemoryBudget::Reservation perm_memory;
+    if (num_thread == 0
+        || !MemoryBudget::global().reserve(
+            byte_per_thread * static_cast<size_t>(num_thread), perm_memory))
     {
         fprintf(stderr, "\n");
         throw std::runtime_error(
             "Error: Not enough memory left for permutation. "
             "Minimum require memory = "
-            + std::to_string(basic_memory_required_per_thread / 1048576)
-            + " Mb");
+            + std::to_string(byte_per_thread / 1048576 + 1) + " Mb");
     }
     m_reporter->report("Running permutation with " + misc::to_string(num_thread)
                        + " threads");
     size_t ran_perm = 0;
-
+    // every permutation is fitted on a single thread, the workers leave the
+    // global Eigen setting alone
+    Eigen::setNbThreads(1);
     // count total number of permutation to run
     m_total_competitive_process =
         set_index.size() * m_perm_info.num_permutation;
@@ -183,9 +183,16 @@ void PRSice::init_matrix(const Phenotype& pheno_info, const std::string& delim,
     if (m_binary_trait && m_prs_info.scoring_method == SCORING::CONTROL_STD)
         set_std_exclusion_flag(delim, ignore_fid, target);
     m_matrix_index = get_matrix_idx(delim, ignore_fid, target);
+    m_residualized_lm.reset();
+    m_logistic.reset();
+    m_score_test.reset();
     if (no_regress) return;
     double null_r2_adjust = 0.0;
     bool has_covariate = m_independent_variables.cols() > 2;
+    // coefficients of the intercept and covariates, used as the starting
+    // point of the logistic regressions
+    Eigen::VectorXd null_beta = Eigen::VectorXd::Constant(
+        1, std::log(m_phenotype.mean() / (1.0 - m_phenotype.mean())));
     if (has_covariate)
     {
         auto n_thread = m_prs_info.thread;
@@ -201,7 +208,7 @@ void PRSice::init_matrix(const Phenotype& pheno_info, const std::string& delim,
                                 m_independent_variables.rows(),
                                 m_independent_variables.cols() - 1),
                             m_null_p, m_null_r2, m_null_coeff, m_null_se,
-                            n_thread);
+                            n_thread, &null_beta);
         }
         else
         {
@@ -215,7 +222,27 @@ void PRSice::init_matrix(const Phenotype& pheno_info, const std::string& delim,
                                m_null_coeff, m_null_se, n_thread, true);
         }
     }
+    // only the PRS column changes between thresholds, so the intercept and
+    // covariates can be factorized once for the phenotype
+    const Eigen::Index num_col = m_independent_variables.cols();
+    Eigen::MatrixXd cov(m_independent_variables.rows(), num_col - 1);
+    cov.col(0) = m_independent_variables.col(0);
+    cov.rightCols(num_col - 2) = m_independent_variables.rightCols(num_col - 2);
+    if (m_binary_trait)
+    {
+        m_logistic = std::make_unique<Regression::WarmStartGlm>(
+            m_phenotype, m_independent_variables);
+        m_logistic->set_null(null_beta);
+        m_null_beta = null_beta;
+        if (m_prs_info.score_test)
+        { m_score_test.init(m_phenotype, cov, null_beta); }
+    }
+    else
+    {
+        m_residualized_lm.init(m_phenotype, cov);
+    }
     m_best_sample_score.resize(target.num_sample());
+    if (m_perm_info.run_perm) gen_perm_index();
 }
 
 void PRSice::parse_pheno(const std::string& pheno,
@@ -971,6 +998,8 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
     Eigen::initParallel();
     Eigen::setNbThreads(m_prs_info.thread);
     reset_result_containers(target, region_idx);
+    // the PRS of different sets are unrelated
+    if (m_logistic) m_logistic->reset();
     size_t prs_result_idx = 0;
     double cur_threshold = 0.0;
     print_progress();
@@ -982,7 +1011,7 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
         std::tie(top, bot) = lee_adjustment_factor(prevalence);
     }
     while (target.get_score(start, set_snp_idx.cend(), cur_threshold,
-                            m_num_snp_included, first_run))
+                            m_num_snp_included, first_run, region_idx))
     {
         ++m_analysis_done;
         print_progress();
@@ -1008,7 +1037,24 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
         first_run = false;
     }
 
-    if (m_quick_best && !no_regress)
+    // we need to process the permutation result if permutation is required
+    if (m_perm_info.run_perm) process_permutations();
+    // after the empirical p-value, which compares the score tests
+    const double obs_t_value = best_t_value();
+    if (!no_regress) refit_best();
+    if (!no_regress)
+    {
+        store_region_best(region_names, region_idx, best_score_file, target,
+                          obs_t_value);
+    }
+}
+
+void PRSice::store_region_best(const std::vector<std::string>& region_names,
+                               const size_t region_idx,
+                               std::unique_ptr<std::ostream>& best_score_file,
+                               Genotype& target, const double obs_t_value)
+{
+    if (m_quick_best)
     {
         // if we can, store all best score in a matrix and output once to speed
         // things up
@@ -1017,21 +1063,19 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
                 m_best_sample_score.data(),
                 static_cast<Eigen::Index>(m_best_sample_score.size()));
     }
-    else if (!no_regress)
+    else
     {
         slow_print_best(best_score_file, target);
     }
-    // we need to process the permutation result if permutation is required
-    if (m_perm_info.run_perm) process_permutations();
-
-    if (!no_regress && !(m_best_index < 0))
+    if (!(m_best_index < 0))
     {
         m_has_best_for_print[region_idx] = true;
         // postpone summary output until we have finished competitive
         // permutation
         auto&& best_info = m_prs_results[static_cast<size_t>(m_best_index)];
-        m_prs_summary.push_back(prsice_summary(
-            best_info, region_names[region_idx], (region_idx == 0)));
+        m_prs_summary.push_back(prsice_summary(best_info,
+                                               region_names[region_idx],
+                                               (region_idx == 0), obs_t_value));
         if (best_info.p > 0.1)
             ++m_significant_store[0];
         else if (best_info.p > 1e-5)
@@ -1042,6 +1086,226 @@ void PRSice::run_prsice(const std::vector<size_t>& set_snp_idx,
 }
 
 
+void PRSice::run_regions(
+    const std::vector<std::vector<size_t>>& region_membership,
+    const std::vector<std::string>& region_names, const std::string& pheno_name,
+    const double prevalence, const size_t pheno_idx, const bool all_scores,
+    const bool has_prevalence, std::unique_ptr<std::ostream>& prsice_out,
+    std::unique_ptr<std::ostream>& best_score_file,
+    std::unique_ptr<std::ostream>& all_score_file, Genotype& target)
+{
+    const size_t num_regions = region_membership.size();
+    // permutation and the all score output are processed threshold by
+    // threshold, and are left to run_prsice
+    bool parallel = !m_prs_info.no_regress && !m_perm_info.run_perm
+                    && !(all_scores && pheno_idx == 0) && m_prs_info.thread > 1
+                    && num_regions > 2;
+    std::vector<std::unique_ptr<region_worker>> workers;
+    MemoryBudget::Reservation worker_memory;
+    // the region and result of each slot of the pool
+    std::vector<size_t> slot_region;
+    std::vector<region_result> results;
+    // declared last, such that the workers are stopped before anything they
+    // use is destroyed
+    std::unique_ptr<OrderedPool> pool;
+    double top = 1, bot = 0;
+    if (prevalence <= 1.0)
+    {
+        std::tie(top, bot) = lee_adjustment_factor(prevalence);
+    }
+    // output the oldest region of the pool, as if the regions were run one by
+    // one
+    auto merge_oldest = [&]() {
+        const size_t slot = pool->oldest();
+        const size_t region_idx = slot_region[slot];
+        auto&& result = results[slot];
+        m_prs_results.swap(result.results);
+        m_best_sample_score.swap(result.best_sample_score);
+        m_best_index = result.best_index;
+        for (size_t i_thres = 0; i_thres < result.thresholds.size(); ++i_thres)
+        {
+            ++m_analysis_done;
+            print_progress();
+            print_prsice_output(m_prs_results[i_thres], pheno_name,
+                                region_names[region_idx],
+                                result.thresholds[i_thres], top, bot,
+                                has_prevalence, prsice_out);
+        }
+        const double obs_t_value = best_t_value();
+        if (m_best_index >= 0)
+        { m_prs_results[static_cast<size_t>(m_best_index)] = result.best; }
+        store_region_best(region_names, region_idx, best_score_file, target,
+                          obs_t_value);
+        pool->retire();
+    };
+    // the score matrix and the members of PRSice must not change while the
+    // workers are regressing
+    auto drain = [&]() {
+        while (pool && !pool->empty()) merge_oldest();
+    };
+    for (size_t i_region = 0; i_region < num_regions; ++i_region)
+    {
+        // always skip background region and empty regions
+        if (i_region == 1 || region_membership[i_region].empty()) continue;
+        if (parallel && !target.score_loaded(i_region))
+        {
+            drain();
+            target.load_score_region(i_region);
+        }
+        if (parallel && workers.empty() && target.score_loaded(i_region))
+        {
+            parallel = init_region_workers(target, workers, worker_memory);
+            if (parallel)
+            {
+                const size_t num_slot = workers.size() * m_region_per_worker;
+                slot_region.resize(num_slot);
+                results.resize(num_slot);
+                pool = std::make_unique<OrderedPool>(
+                    workers.size(), num_slot,
+                    [&](size_t i_worker, size_t slot) {
+                        regress_region(region_membership[slot_region[slot]],
+                                       slot_region[slot], target,
+                                       *workers[i_worker], results[slot]);
+                    });
+            }
+        }
+        if (!parallel || !target.score_loaded(i_region))
+        {
+            drain();
+            run_prsice(region_membership[i_region], region_names, pheno_name,
+                       prevalence, pheno_idx, i_region, all_scores,
+                       has_prevalence, prsice_out, best_score_file,
+                       all_score_file, target);
+            continue;
+        }
+        if (pool->empty())
+        {
+            // each worker runs its regressions on a single thread, the
+            // workers leave the global Eigen setting alone
+            print_progress();
+            Eigen::setNbThreads(1);
+        }
+        else if (pool->full())
+        {
+            merge_oldest();
+        }
+        slot_region[pool->next_slot()] = i_region;
+        pool->submit();
+    }
+    drain();
+}
+
+bool PRSice::init_region_workers(
+    const Genotype& target,
+    std::vector<std::unique_ptr<region_worker>>& workers,
+    MemoryBudget::Reservation& reservation)
+{
+    const size_t num_sample = target.num_sample();
+    const size_t num_regress_sample = m_matrix_index.size();
+    const size_t p = static_cast<size_t>(m_independent_variables.cols());
+    // the independent matrix and the factorization of the covariates, the
+    // IRLS work space of the logistic regression, and the PRS and best score
+    // of all samples
+    const size_t byte_per_worker =
+        (3 * p + 4) * num_regress_sample * sizeof(double)
+        + num_sample * (2 * sizeof(double) + sizeof(uint32_t))
+        + m_region_per_worker * num_sample * sizeof(double);
+    const size_t num_worker = std::min<size_t>(
+        static_cast<size_t>(m_prs_info.thread),
+        MemoryBudget::global().available() / byte_per_worker);
+    if (num_worker < 2
+        || !MemoryBudget::global().reserve(byte_per_worker * num_worker,
+                                           reservation))
+    { return false; }
+    for (size_t i = 0; i < num_worker; ++i)
+    {
+        workers.emplace_back(std::make_unique<region_worker>());
+        auto&& worker = *workers.back();
+        worker.independent = m_independent_variables;
+        worker.residualized_lm = m_residualized_lm;
+        worker.score_test = m_score_test;
+        if (m_logistic)
+        {
+            worker.logistic = std::make_unique<Regression::WarmStartGlm>(
+                m_phenotype, worker.independent);
+            worker.logistic->set_null(m_null_beta);
+        }
+        worker.prs.resize(num_sample);
+    }
+    m_reporter->report("Regress regions with "
+                       + misc::to_string(num_worker) + " threads");
+    return true;
+}
+
+void PRSice::regress_region(const std::vector<size_t>& set_snp_idx,
+                            const size_t region_idx, const Genotype& target,
+                            region_worker& worker,
+                            region_result& result) const
+{
+    const size_t num_sample = target.num_sample();
+    const size_t num_regress_samples = m_matrix_index.size();
+    result.results.assign(target.num_threshold(region_idx), prsice_result());
+    result.thresholds.clear();
+    result.best_sample_score.assign(num_sample, 0);
+    result.best_index = -1;
+    // the PRS of different sets are unrelated
+    if (worker.logistic) worker.logistic->reset();
+    size_t prs_result_idx = 0;
+    double cur_threshold = 0.0;
+    uint32_t num_snp_included = 0;
+    bool first_run = true;
+    std::vector<size_t>::const_iterator start = set_snp_idx.begin();
+    while (target.get_score(worker.prs, worker.mean_score, worker.score_sd,
+                            start, set_snp_idx.cend(), cur_threshold,
+                            num_snp_included, first_run, region_idx))
+    {
+        result.thresholds.push_back(cur_threshold);
+        first_run = false;
+        // same as regress_score, on the PRS and model of the worker
+        if (num_snp_included == result.results[prs_result_idx].num_snp
+            && !m_prs_info.non_cumulate)
+        {
+            ++prs_result_idx;
+            continue;
+        }
+        for (size_t sample_id = 0; sample_id < num_regress_samples;
+             ++sample_id)
+        {
+            worker.independent(static_cast<Eigen::Index>(sample_id), 1) =
+                target.calculate_score(worker.prs, m_matrix_index[sample_id],
+                                       worker.mean_score, worker.score_sd);
+        }
+        double r2 = 0.0, r2_adjust = 0.0, p_value = 0.0, coefficient = 0.0,
+               se = 0.0;
+        regress_prs(worker.independent, worker.residualized_lm,
+                    worker.logistic.get(), worker.score_test,
+                    Regression::keep_nb_threads, p_value, r2, r2_adjust,
+                    coefficient, se);
+        if (prs_result_idx == 0 || result.best_index < 0
+            || result.results[static_cast<size_t>(result.best_index)].r2 < r2)
+        {
+            result.best_index = static_cast<int>(prs_result_idx);
+            for (size_t s = 0; s < num_sample; ++s)
+            {
+                result.best_sample_score[s] = target.calculate_score(
+                    worker.prs, s, worker.mean_score, worker.score_sd);
+            }
+        }
+        result.results[prs_result_idx] =
+            prsice_result(cur_threshold, r2, r2_adjust, coefficient, p_value,
+                          -1, se, -1, num_snp_included);
+        ++prs_result_idx;
+    }
+    if (result.best_index < 0) return;
+    result.best = result.results[static_cast<size_t>(result.best_index)];
+    if (worker.score_test.ready() && worker.logistic)
+    {
+        refit_logistic(result.best_sample_score, worker.independent,
+                       *worker.logistic, Regression::keep_nb_threads,
+                       result.best);
+    }
+}
+
 void PRSice::slow_print_best(std::unique_ptr<std::ostream>& best_file,
                              Genotype& target)
 {
@@ -1139,28 +1403,8 @@ void PRSice::regress_score(Genotype& target, const double threshold,
             target.calculate_score(m_matrix_index[sample_id]);
     }
 
-    if (m_binary_trait)
-    {
-        try
-        {
-            Regression::glm(m_phenotype, m_independent_variables, p_value, r2,
-                            coefficient, se, thread);
-        }
-        catch (const std::runtime_error& error)
-        {
-            fprintf(stderr, "Error: GLM model did not converge!\n");
-            fprintf(stderr,
-                    "       This is usually caused by small sample\n"
-                    "       size or caused by problem in the input file\n");
-            fprintf(stderr, "Error: %s\n", error.what());
-        }
-    }
-    else
-    {
-        // we can run the linear regression
-        Regression::fastLm(m_phenotype, m_independent_variables, p_value, r2,
-                           r2_adjust, coefficient, se, thread, true);
-    }
+    regress_prs(m_independent_variables, m_residualized_lm, m_logistic.get(),
+                m_score_test, thread, p_value, r2, r2_adjust, coefficient, se);
     // If this is the best r2, then we will add it
     int best_index = m_best_index;
     if (prs_result_idx == 0 || best_index < 0
@@ -1182,13 +1426,58 @@ void PRSice::regress_score(Genotype& target, const double threshold,
 }
 
 
+void PRSice::regress_prs(const Eigen::MatrixXd& independent,
+                         Regression::ResidualizedLm& residualized_lm,
+                         Regression::WarmStartGlm* logistic,
+                         Regression::LogisticScoreTest& score_test,
+                         const int thread, double& p_value, double& r2,
+                         double& r2_adjust, double& coefficient,
+                         double& se) const
+{
+    if (m_binary_trait)
+    {
+        try
+        {
+            // the score test is only an approximation, the best threshold
+            // is refitted by refit_best
+            if (!score_test.ready()
+                || !score_test.run(independent.col(1), p_value, r2,
+                                   coefficient, se))
+            {
+                if (logistic)
+                { logistic->run(p_value, r2, coefficient, se, thread); }
+                else
+                {
+                    Regression::glm(m_phenotype, independent, p_value, r2,
+                                    coefficient, se, thread);
+                }
+            }
+        }
+        catch (const std::runtime_error& error)
+        {
+            fprintf(stderr, "Error: GLM model did not converge!\n");
+            fprintf(stderr,
+                    "       This is usually caused by small sample\n"
+                    "       size or caused by problem in the input file\n");
+            fprintf(stderr, "Error: %s\n", error.what());
+        }
+    }
+    else if (!residualized_lm.ready()
+             || !residualized_lm.run(independent.col(1), p_value, r2,
+                                     r2_adjust, coefficient, se))
+    {
+        // we can run the linear regression
+        Regression::fastLm(m_phenotype, independent, p_value, r2, r2_adjust,
+                           coefficient, se, thread, true);
+    }
+}
+
 void PRSice::process_permutations()
 {
     // can't generate an empirical p-value if there is no observed p-value
     if (m_best_index == -1) return;
     size_t best_index = static_cast<size_t>(m_best_index);
-    const double best_t = std::fabs(m_prs_results[best_index].coefficient
-                                    / m_prs_results[best_index].se);
+    const double best_t = best_t_value();
     const auto num_better =
         std::count_if(m_perm_result.begin(), m_perm_result.end(),
                       [&best_t](double t) { return t > best_t; });
@@ -1196,6 +1485,47 @@ void PRSice::process_permutations()
         (num_better + 1.0) / (m_perm_info.num_permutation + 1.0);
 }
 
+void PRSice::refit_best()
+{
+    if (!m_score_test.ready() || !m_logistic || m_best_index < 0) return;
+    refit_logistic(m_best_sample_score, m_independent_variables, *m_logistic,
+                   m_prs_info.thread,
+                   m_prs_results[static_cast<size_t>(m_best_index)]);
+}
+
+void PRSice::refit_logistic(const std::vector<double>& best_score,
+                            Eigen::MatrixXd& independent,
+                            Regression::WarmStartGlm& logistic,
+                            const int thread, prsice_result& best) const
+{
+    const size_t num_regress_samples = m_matrix_index.size();
+    for (size_t sample_id = 0; sample_id < num_regress_samples; ++sample_id)
+    {
+        independent(static_cast<Eigen::Index>(sample_id), 1) =
+            best_score[m_matrix_index[sample_id]];
+    }
+    double r2 = 0.0, p_value = 0.0, coefficient = 0.0, se = 0.0;
+    logistic.reset();
+    try
+    {
+        logistic.run(p_value, r2, coefficient, se, thread);
+    }
+    catch (const std::runtime_error& error)
+    {
+        // keep the score test result
+        fprintf(stderr, "Error: GLM model did not converge!\n");
+        fprintf(stderr,
+                "       This is usually caused by small sample\n"
+                "       size or caused by problem in the input file\n");
+        fprintf(stderr, "Error: %s\n", error.what());
+        return;
+    }
+    best.r2 = r2;
+    best.p = p_value;
+    best.coefficient = coefficient;
+    best.se = se;
+}
+
 void PRSice::pre_decompose_matrix(const Eigen::MatrixXd& compute_target,
                                   Regress& decomposed)
 {
@@ -1214,110 +1544,263 @@ void PRSice::pre_decompose_matrix(const Eigen::MatrixXd& compute_target,
     get_se_matrix(p, decomposed);
 }
 
-void PRSice::run_null_perm_no_thread(const Regress& decomposed,
-                                     const bool run_glm)
+size_t PRSice::perm_block_size() const
+{
+    // bound the size of each block such that we still have BLAS-3 throughput
+    // on large sample without holding too many copy of the phenotype
+    const size_t num_regress_sample =
+        std::max<size_t>(1, static_cast<size_t>(m_phenotype.rows()));
+    const size_t max_block = std::max<size_t>(
+        1, m_max_perm_block_byte / (num_regress_sample * sizeof(double)));
+    return std::max<size_t>(
+        1, std::min({max_block, m_max_perm_block, m_perm_info.num_permutation}));
+}
+
+void PRSice::get_perm_projector(const Regress& decomposed,
+                                Eigen::MatrixXd& projector)
 {
+    const Eigen::Index rank = decomposed.rank;
+    const Eigen::Index num_regress_sample = m_independent_variables.rows();
+    // thin Q, only keep the first rank columns
+    const Eigen::MatrixXd q_thin =
+        decomposed.PQR.householderQ()
+        * Eigen::MatrixXd::Identity(num_regress_sample, rank);
+    projector.resize(rank + 1, num_regress_sample);
+    projector.bottomRows(rank) = q_thin.transpose();
+    // beta = Pmat * [R^-1 Q' y; NaN], so we only need the row of R^-1 that
+    // is mapped to the PRS coefficient
+    Eigen::Index prs_idx = 0;
+    const auto& indices = decomposed.Pmat.indices();
+    while (prs_idx < indices.size() && indices(prs_idx) != 1) ++prs_idx;
+    if (prs_idx >= rank)
+    {
+        // PRS is not estimable
+        projector.row(0).setConstant(std::numeric_limits<double>::quiet_NaN());
+        return;
+    }
+    const Eigen::MatrixXd rinv =
+        decomposed.PQR.matrixQR()
+            .topLeftCorner(rank, rank)
+            .triangularView<Eigen::Upper>()
+            .solve(Eigen::MatrixXd::Identity(rank, rank));
+    projector.row(0) = rinv.row(prs_idx) * q_thin.transpose();
+}
+
+void PRSice::gen_perm_index()
+{
+    std::vector<uint32_t>().swap(m_perm_index);
+    m_perm_index_memory.release();
+    m_num_cached_perm = 0;
+    m_perm_block_rng.clear();
+    const size_t num_regress_sample = static_cast<size_t>(m_phenotype.rows());
+    const size_t num_perm = m_perm_info.num_permutation;
+    const size_t block_size = perm_block_size();
+    if (num_regress_sample == 0
+        || num_regress_sample > std::numeric_limits<uint32_t>::max())
+        return;
+    // cache the index of as many whole blocks as fit into our memory limit,
+    // the remaining blocks are regenerated from their random state
+    const size_t perm_byte = num_regress_sample * sizeof(uint32_t);
+    size_t num_cached =
+        std::min({num_perm, m_max_perm_index_byte / perm_byte,
+                  MemoryBudget::global().available() / perm_byte});
+    if (num_cached < num_perm) num_cached -= num_cached % block_size;
+    if (num_cached != 0
+        && MemoryBudget::global().reserve(num_cached * perm_byte,
+                                          m_perm_index_memory))
+    {
+        m_num_cached_perm = num_cached;
+        m_perm_index.resize(num_cached * num_regress_sample);
+    }
+    // shuffling the index with the same random sequence gives the same
+    // permutation as shuffling the phenotype itself
     std::mt19937 rand_gen {m_perm_info.seed};
-    // we want to count the number of samples included in the analysis
-    const Eigen::Index num_regress_sample = m_phenotype.rows();
-    Eigen::VectorXd perm_pheno = m_phenotype;
-    size_t processed = 0;
-    double coefficient, standard_error, r2, obs_p;
-    double obs_t = -1;
-    Eigen::VectorXd beta, effects;
-    while (processed < m_perm_info.num_permutation)
-    {
-        // re-copy perm_pheno to ensure that given the same seed, single thread
-        // will return the same answer as multiple thread
-        perm_pheno = m_phenotype;
-        std::shuffle(perm_pheno.data(), perm_pheno.data() + num_regress_sample,
-                     rand_gen);
-        ++m_analysis_done;
-        print_progress();
-        if (run_glm)
+    std::vector<uint32_t> scratch(num_regress_sample);
+    for (size_t i = 0; i < num_perm; ++i)
+    {
+        if (i % block_size == 0) m_perm_block_rng.push_back(rand_gen);
+        auto&& start = (i < m_num_cached_perm)
+                           ? m_perm_index.begin()
+                                 + static_cast<std::ptrdiff_t>(
+                                     i * num_regress_sample)
+                           : scratch.begin();
+        auto&& end = start + static_cast<std::ptrdiff_t>(num_regress_sample);
+        std::iota(start, end, 0);
+        std::shuffle(start, end, rand_gen);
+    }
+}
+
+size_t PRSice::gen_perm_block(const Eigen::VectorXd& base,
+                              const size_t block_idx,
+                              Eigen::MatrixXd& block) const
+{
+    const size_t block_size = perm_block_size();
+    const size_t start = block_idx * block_size;
+    const size_t num_perm =
+        std::min(block_size, m_perm_info.num_permutation - start);
+    const Eigen::Index num_regress_sample = base.rows();
+    block.resize(num_regress_sample, static_cast<Eigen::Index>(num_perm));
+    if (start < m_num_cached_perm)
+    {
+        for (Eigen::Index i = 0; i < block.cols(); ++i)
         {
-            Regression::glm(perm_pheno, m_independent_variables, obs_p, r2,
-                            coefficient, standard_error, 1);
+            const uint32_t* idx =
+                m_perm_index.data()
+                + (start + static_cast<size_t>(i))
+                      * static_cast<size_t>(num_regress_sample);
+            for (Eigen::Index j = 0; j < num_regress_sample; ++j)
+            { block(j, i) = base(idx[j]); }
         }
-        else
+        return start;
+    }
+    std::mt19937 rand_gen = m_perm_block_rng[block_idx];
+    for (Eigen::Index i = 0; i < block.cols(); ++i)
+    {
+        // always shuffle from a fresh copy to ensure that given the same
+        // seed, we will get the same answer regardless of the block size
+        // and number of thread
+        block.col(i) = base;
+        std::shuffle(block.col(i).data(),
+                     block.col(i).data() + num_regress_sample, rand_gen);
+    }
+    return start;
+}
+
+void PRSice::null_perm_block(const Eigen::MatrixXd& block,
+                             const Eigen::MatrixXd& projector, const double se,
+                             const PERM_MODEL model, std::vector<double>& obs_t)
+{
+    const Eigen::Index num_perm = block.cols();
+    obs_t.resize(static_cast<size_t>(num_perm));
+    if (model == PERM_MODEL::LOGISTIC)
+    {
+        double coefficient, standard_error, r2, obs_p;
+        for (Eigen::Index i = 0; i < num_perm; ++i)
         {
-            std::tie(coefficient, standard_error) = get_coeff_se(
-                decomposed, m_independent_variables, perm_pheno, beta, effects);
+            Regression::glm(block.col(i), m_independent_variables, obs_p, r2,
+                            coefficient, standard_error,
+                            Regression::keep_nb_threads);
+            obs_t[static_cast<size_t>(i)] =
+                std::fabs(coefficient / standard_error);
         }
-        obs_t = std::fabs(coefficient / standard_error);
-        m_perm_result[processed] = std::max(obs_t, m_perm_result[processed]);
-        ++processed;
+        return;
+    }
+    if (model == PERM_MODEL::SCORE)
+    {
+        // the score z-value of each column of permuted residuals
+        const Eigen::VectorXd z = (projector * block).transpose();
+        for (Eigen::Index i = 0; i < num_perm; ++i)
+        { obs_t[static_cast<size_t>(i)] = std::fabs(z(i)); }
+        return;
+    }
+    const Eigen::Index rank = projector.rows() - 1;
+    const double df = static_cast<double>(m_independent_variables.rows()
+                                          - m_independent_variables.cols());
+    // one GEMM give us the PRS coefficient (first row) and Q'y (remaining
+    // rows) for the whole block. As Q is orthonormal, the residual sum of
+    // square is simply y'y - |Q'y|^2
+    const Eigen::MatrixXd proj = projector * block;
+    for (Eigen::Index i = 0; i < num_perm; ++i)
+    {
+        const double rss =
+            std::max(0.0, block.col(i).squaredNorm()
+                              - proj.col(i).tail(rank).squaredNorm());
+        const double standard_error = std::sqrt(rss / df) * se;
+        obs_t[static_cast<size_t>(i)] =
+            std::fabs(proj(0, i) / standard_error);
+    }
+}
+
+void PRSice::run_null_perm_no_thread(const Eigen::VectorXd& base,
+                                     const Eigen::MatrixXd& projector,
+                                     const double se, const PERM_MODEL model)
+{
+    Eigen::MatrixXd perm_block;
+    std::vector<double> obs_t;
+    for (size_t i_block = 0; i_block < m_perm_block_rng.size(); ++i_block)
+    {
+        const size_t start = gen_perm_block(base, i_block, perm_block);
+        null_perm_block(perm_block, projector, se, model, obs_t);
+        for (size_t i = 0; i < obs_t.size(); ++i)
+        {
+            m_perm_result[start + i] =
+                std::max(obs_t[i], m_perm_result[start + i]);
+        }
+        m_analysis_done += obs_t.size();
+        print_progress();
     }
 }
+
 void PRSice::permutation(const int n_thread)
 {
-    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> perm_matrix(
-        m_phenotype.rows());
     Eigen::setNbThreads(n_thread);
     // logit_perm can only be true if it is binary trait and user used the
     // --logit-perm flag
     // can always do the following if
     // 1. QT trait (!is_binary)
     // 2. Not require logit perm
-    Regress decomposed;
-    bool run_glm = true;
+    Eigen::MatrixXd projector;
+    Eigen::VectorXd base;
+    double se = 0;
+    PERM_MODEL model = PERM_MODEL::LOGISTIC;
     if (!m_binary_trait || !m_perm_info.logit_perm)
     {
+        Regress decomposed;
         pre_decompose_matrix(m_independent_variables, decomposed);
-        run_glm = false;
+        get_perm_projector(decomposed, projector);
+        se = decomposed.se(1);
+        model = PERM_MODEL::LINEAR;
+        // intercept is always included in the model, so we can center the
+        // phenotype for the linear model, which doesn't change the result but
+        // avoid cancellation when calculating the residual sum of square
+        base = (m_phenotype.array() - m_phenotype.mean()).matrix();
+    }
+    else if (m_score_test.ready())
+    {
+        // permute the Pearson residuals of the covariate only model instead
+        // of the phenotype, such that the null model never need to be
+        // refitted. A PRS explained by the covariates has no signal
+        Eigen::VectorXd direction;
+        if (!m_score_test.direction(m_independent_variables.col(1),
+                                    direction))
+        { direction.setZero(m_phenotype.rows()); }
+        projector = direction.transpose();
+        model = PERM_MODEL::SCORE;
+        base = m_score_test.residual();
     }
+    else
+    {
+        base = m_phenotype;
+    }
+    // the null models are fitted on a single thread each, set once here as
+    // the consumers leave the global Eigen setting alone
+    Eigen::setNbThreads(1);
     if (n_thread == 1)
     {
         // we will run the single thread function to reduce overhead
-        run_null_perm_no_thread(decomposed, run_glm);
+        run_null_perm_no_thread(base, projector, se, model);
     }
     else
     {
-        Thread_Queue<std::pair<Eigen::VectorXd, size_t>> set_perm_queue;
-        std::thread producer(&PRSice::gen_null_pheno, this,
-                             std::ref(set_perm_queue), n_thread - 1);
+        // each worker generates its own blocks, so all threads can be used
+        std::atomic<size_t> next_block(0);
         std::vector<std::thread> consume_store;
-        // we have used one thread as the producer, therefore we need to
-        // reduce the number of available thread by 1
-        for (int i = 0; i < n_thread - 1; ++i)
+        for (int i = 0; i < n_thread; ++i)
         {
-            consume_store.push_back(std::thread(
-                &PRSice::consume_null_pheno, this, std::ref(set_perm_queue),
-                std::cref(decomposed), run_glm));
+            consume_store.push_back(
+                std::thread(&PRSice::consume_null_pheno, this,
+                            std::ref(next_block), std::cref(base),
+                            std::cref(projector), se, model));
         }
         // wait for all the threads to complete their job
-        producer.join();
         for (auto&& consume : consume_store) consume.join();
     }
 }
 
-void PRSice::gen_null_pheno(Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-                            size_t num_consumer)
-{
-    size_t processed = 0;
-    std::mt19937 rand_gen {m_perm_info.seed};
-    Eigen::setNbThreads(1);
-    const Eigen::Index num_regress_sample = m_phenotype.rows();
-    Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic> perm_matrix(
-        m_phenotype.rows());
-
-    while (processed < m_perm_info.num_permutation)
-    {
-        // TODO: Might want a thread safe memory pool heres
-        Eigen::VectorXd null_pheno = m_phenotype;
-        std::shuffle(null_pheno.data(), null_pheno.data() + num_regress_sample,
-                     rand_gen);
-        q.emplace(std::make_pair(null_pheno, processed), num_consumer);
-        ++m_analysis_done;
-        print_progress();
-        ++processed;
-    }
-    q.completed();
-}
-
-void PRSice::consume_null_pheno(
-    Thread_Queue<std::pair<Eigen::VectorXd, size_t>>& q,
-    const Regress& decomposed, bool run_glm)
+void PRSice::consume_null_pheno(std::atomic<size_t>& next_block,
+                                const Eigen::VectorXd& base,
+                                const Eigen::MatrixXd& projector,
+                                const double se, const PERM_MODEL model)
 {
     // to avoid false sharing, all consumer will first store their
     // permutation result in their own vector and only update the master
@@ -1328,26 +1811,22 @@ void PRSice::consume_null_pheno(
     // supposed to mimic re-running PRSice N times with different
     // permutation
     std::vector<size_t> temp_index;
-    Eigen::VectorXd beta, effects;
-    std::pair<Eigen::VectorXd, size_t> input;
-    double coefficient, standard_error, r2, obs_p;
-    double obs_t = -1;
-    while (!q.pop(input))
-    {
-        if (run_glm)
-        {
-            Regression::glm(std::get<0>(input), m_independent_variables, obs_p,
-                            r2, coefficient, standard_error, 1);
-        }
-        else
+    std::vector<double> obs_t;
+    Eigen::MatrixXd perm_block;
+    const size_t num_block = m_perm_block_rng.size();
+    for (size_t i_block = next_block++; i_block < num_block;
+         i_block = next_block++)
+    {
+        const size_t start = gen_perm_block(base, i_block, perm_block);
+        null_perm_block(perm_block, projector, se, model, obs_t);
+        for (size_t i = 0; i < obs_t.size(); ++i)
         {
-            std::tie(coefficient, standard_error) =
-                get_coeff_se(decomposed, m_independent_variables,
-                             std::get<0>(input), beta, effects);
+            temp_store.push_back(obs_t[i]);
+            temp_index.push_back(start + i);
         }
-        obs_t = std::fabs(coefficient / standard_error);
-        temp_store.push_back(obs_t);
-        temp_index.push_back(std::get<1>(input));
+        std::lock_guard<std::mutex> lock(lock_guard);
+        m_analysis_done += obs_t.size();
+        print_progress();
     }
     std::lock_guard<std::mutex> lock(lock_guard);
     for (size_t i = 0; i < temp_store.size(); ++i)
@@ -1378,14 +1857,16 @@ void PRSice::prep_best_output(
         }
         (*best_file) << "\n";
     }
-    try
+    if (MemoryBudget::global().reserve(
+            num_samples * region_name.size() * sizeof(double),
+            m_fast_best_memory))
     {
         m_fast_best_output =
             Eigen::MatrixXd::Zero(num_samples, region_name.size());
         m_quick_best = true;
         m_has_best_for_print.resize(region_name.size(), false);
     }
-    catch (...)
+    else
     {
         m_reporter->report(
             "Warning: Not enough memory to store all best scores "
@@ -1485,13 +1966,14 @@ void PRSice::prep_all_score_output(
 
     (*all_score_file) << "\n";
 
-    try
+    if (MemoryBudget::global().reserve(
+            num_samples * num_all_col * sizeof(double), m_fast_all_memory))
     {
         m_fast_all_output = Eigen::MatrixXd::Zero(num_samples, num_all_col);
         m_quick_all = true;
         m_has_best_for_print.resize(region_name.size(), false);
     }
-    catch (...)
+    else
     {
         m_reporter->report(
             "Warning: Not enough memory to store all scores "
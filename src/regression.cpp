@@ -21,22 +21,24 @@ namespace Regression
 // This is an unsafe version of R's glm.fit
 // unsafe as in I have skipped some of the checking
 void glm(const Eigen::VectorXd& y, const Eigen::MatrixXd& x, double& p_value,
-         double& r2, double& coeff, double& standard_error, int thread)
+         double& r2, double& coeff, double& standard_error, int thread,
+         Eigen::VectorXd* beta)
 {
     Binomial family = Binomial();
-    Eigen::setNbThreads(thread);
+    if (thread != keep_nb_threads) Eigen::setNbThreads(thread);
     GLM<Binomial> run_glm(x, y, family);
     run_glm.init_parms();
     run_glm.solve();
     r2 = run_glm.get_r2();
     run_glm.get_stat(1, p_value, coeff, standard_error);
+    if (beta != nullptr) { *beta = run_glm.get_beta(); }
 }
 
 void fastLm(const Eigen::VectorXd& y, const Eigen::MatrixXd& X, double& p_value,
             double& r2, double& r2_adjust, double& coeff,
             double& standard_error, int thread, bool intercept, int type)
 {
-    Eigen::setNbThreads(thread);
+    if (thread != keep_nb_threads) Eigen::setNbThreads(thread);
     Eigen::Index n = X.rows();
     if (n != y.rows()) { throw std::runtime_error("Error: Size mismatch"); }
     lm ans;
@@ -66,4 +68,154 @@ void fastLm(const Eigen::VectorXd& y, const Eigen::MatrixXd& X, double& p_value,
     p_value = misc::calc_tprob(tval, n);
 }
 
+void ResidualizedLm::init(const Eigen::VectorXd& y, const Eigen::MatrixXd& cov)
+{
+    if (cov.rows() != y.rows())
+    { throw std::runtime_error("Error: Size mismatch"); }
+    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr(cov);
+    m_rank = qr.rank();
+    m_q = qr.householderQ() * Eigen::MatrixXd::Identity(cov.rows(), m_rank);
+    m_proj.noalias() = m_q.transpose() * y;
+    m_y_resid = y;
+    m_y_resid.noalias() -= m_q * m_proj;
+    // the intercept is always part of the covariates
+    m_tss = (y.array() - y.mean()).square().sum();
+    m_x_resid.resize(y.rows());
+    m_ready = true;
+}
+
+bool ResidualizedLm::run(const Eigen::Ref<const Eigen::VectorXd>& x,
+                         double& p_value, double& r2, double& r2_adjust,
+                         double& coeff, double& standard_error)
+{
+    assert(m_ready);
+    if (x.rows() != m_y_resid.rows())
+    { throw std::runtime_error("Error: Size mismatch"); }
+    m_proj.noalias() = m_q.transpose() * x;
+    m_x_resid = x;
+    m_x_resid.noalias() -= m_q * m_proj;
+    const double sxx = m_x_resid.squaredNorm();
+    // leave the rank decision to the pivoting QR if x is almost explained by
+    // the covariates
+    const double tol = 1e-8;
+    if (!(sxx > tol * tol * x.squaredNorm())) return false;
+    const Eigen::Index n = x.rows();
+    const Eigen::Index df = n - m_rank - 1;
+    if (df <= 0) return false;
+    coeff = m_x_resid.dot(m_y_resid) / sxx;
+    const double rss = (m_y_resid - coeff * m_x_resid).squaredNorm();
+    standard_error =
+        std::sqrt(rss / static_cast<double>(df)) / std::sqrt(sxx);
+    r2 = 1.0 - rss / m_tss;
+    r2_adjust = 1.0 - (1.0 - r2) * (static_cast<double>(n - 1) / df);
+    p_value = misc::calc_tprob(coeff / standard_error, n);
+    return true;
+}
+
+void WarmStartGlm::set_null(const Eigen::VectorXd& null_beta)
+{
+    // null fit is [intercept, covariates], insert 0 for the PRS
+    const Eigen::Index num_cov = null_beta.rows() - 1;
+    m_null_start.resize(null_beta.rows() + 1);
+    m_null_start(0) = null_beta(0);
+    m_null_start(1) = 0.0;
+    m_null_start.tail(num_cov) = null_beta.tail(num_cov);
+    m_start = m_null_start;
+}
+
+void WarmStartGlm::run(double& p_value, double& r2, double& coeff,
+                       double& standard_error, int thread)
+{
+    if (thread != keep_nb_threads) Eigen::setNbThreads(thread);
+    bool solved = false;
+    try
+    {
+        if (m_start.rows() != 0 && m_glm.init_parms(m_start))
+        {
+            m_glm.solve(100, 2);
+            solved = m_glm.has_converged();
+        }
+    }
+    catch (const std::runtime_error&)
+    {
+        solved = false;
+    }
+    if (!solved)
+    {
+        m_glm.init_parms();
+        m_glm.solve();
+    }
+    // only seed the next fit with a converged, full rank fit
+    if (m_glm.has_converged() && m_glm.full_rank())
+    { m_start = m_glm.get_beta(); }
+    r2 = m_glm.get_r2();
+    m_glm.get_stat(1, p_value, coeff, standard_error);
+}
+
+void LogisticScoreTest::init(const Eigen::VectorXd& y,
+                             const Eigen::MatrixXd& cov,
+                             const Eigen::VectorXd& null_beta)
+{
+    if (cov.rows() != y.rows() || cov.cols() != null_beta.rows())
+    { throw std::runtime_error("Error: Size mismatch"); }
+    Binomial family;
+    const Eigen::VectorXd mu = family.linkinv(cov * null_beta);
+    const Eigen::VectorXd weights = Eigen::VectorXd::Ones(y.rows());
+    m_sqrt_w = (mu.array() * (1.0 - mu.array())).sqrt();
+    m_resid = (y - mu).array() / m_sqrt_w.array();
+    Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr(m_sqrt_w.asDiagonal()
+                                                   * cov);
+    m_q = qr.householderQ() * Eigen::MatrixXd::Identity(cov.rows(), qr.rank());
+    m_dev = family.dev_resids_sum(y, mu, weights);
+    m_null_dev = family.dev_resids_sum(
+        y, Eigen::VectorXd::Constant(y.rows(), y.mean()), weights);
+    m_x_w.resize(y.rows());
+    m_ready = true;
+}
+
+double
+LogisticScoreTest::residualize(const Eigen::Ref<const Eigen::VectorXd>& x,
+                               Eigen::VectorXd& x_w) const
+{
+    assert(m_ready);
+    if (x.rows() != m_resid.rows())
+    { throw std::runtime_error("Error: Size mismatch"); }
+    x_w = m_sqrt_w.cwiseProduct(x);
+    const double total = x_w.squaredNorm();
+    x_w.noalias() -= m_q * (m_q.transpose() * x_w);
+    const double v = x_w.squaredNorm();
+    // same tolerance as ResidualizedLm
+    const double tol = 1e-8;
+    return (v > tol * tol * total) ? v : 0.0;
+}
+
+bool LogisticScoreTest::run(const Eigen::Ref<const Eigen::VectorXd>& x,
+                            double& p_value, double& r2, double& coeff,
+                            double& standard_error)
+{
+    const double v = residualize(x, m_x_w);
+    if (!(v > 0.0)) return false;
+    const double u = m_x_w.dot(m_resid);
+    const double chi2 = u * u / v;
+    coeff = u / v;
+    standard_error = 1.0 / std::sqrt(v);
+    p_value = chiprob_p(chi2, 1);
+    // Nagelkerke R2 as in GLM::get_r2, with the score statistic standing in
+    // for the likelihood ratio statistic
+    const double n = static_cast<double>(m_resid.rows());
+    const double dev = std::max(0.0, m_dev - chi2);
+    r2 = (1.0 - std::exp((dev - m_null_dev) / n))
+         / (1.0 - std::exp(-m_null_dev / n));
+    return true;
+}
+
+bool LogisticScoreTest::direction(const Eigen::Ref<const Eigen::VectorXd>& x,
+                                  Eigen::VectorXd& x_w) const
+{
+    const double v = residualize(x, x_w);
+    if (!(v > 0.0)) return false;
+    x_w /= std::sqrt(v);
+    return true;
+}
+
 }
@@ -95,13 +95,13 @@ TEST_CASE("Geno and MAF filtering")
         bool filtered =
             filter_info.maf > exp_maf || filter_info.geno < exp_geno;
         REQUIRE(plink.test_calc_freq_gen_inter(filter_info));
-        auto res = plink.existed_snps();
+        auto&& res = plink.existed_snps();
         if (filtered) { REQUIRE(res.empty()); }
         else
         {
             REQUIRE(res.size() == 1);
             uint32_t ref_ct = 0, het_ct = 0, alt_ct = 0, miss = 0;
-            res.front().get_counts(ref_ct, het_ct, alt_ct, miss, false);
+            res.front()->get_counts(ref_ct, het_ct, alt_ct, miss, false);
             REQUIRE(ref_ct == ref_founder_ct);
             REQUIRE(het_ct == het_founder_ct);
             REQUIRE(alt_ct == alt_founder_ct);
@@ -109,3 +109,110 @@ TEST_CASE("Geno and MAF filtering")
         }
     }
 }
+
+TEST_CASE("Multi-threaded filtering of multiple files")
+{
+    const size_t n_sample = 130, n_file = 3, n_snp_per_file = 120;
+    const size_t sample_ct4 = (n_sample + 3) / 4;
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_real_distribution<double> unif {0.0, 1.0};
+    std::bernoulli_distribution founder_gen {0.7};
+    std::vector<bool> founder(n_sample, true);
+    std::generate(begin(founder), end(founder),
+                  [&]() { return founder_gen(mersenne_engine); });
+    // vary the MAF and missingness of each SNP such that some of them are
+    // removed by each filter
+    std::vector<std::vector<std::vector<size_t>>> genotypes(n_file);
+    for (auto&& file : genotypes)
+    {
+        file.assign(n_snp_per_file, std::vector<size_t>(n_sample, 0));
+        for (auto&& snp : file)
+        {
+            const double maf = 0.15 * unif(mersenne_engine);
+            const double missing = 0.2 * unif(mersenne_engine);
+            for (auto&& g : snp)
+            {
+                if (unif(mersenne_engine) < missing) { g = 3; }
+                else
+                {
+                    g = (unif(mersenne_engine) < maf)
+                        + (unif(mersenne_engine) < maf);
+                }
+            }
+        }
+    }
+    // SNPs are loaded out of their file order
+    std::vector<SNP> input;
+    for (size_t i_file = 0; i_file < n_file; ++i_file)
+    {
+        for (size_t i = 0; i < n_snp_per_file; ++i)
+        {
+            input.emplace_back(
+                "rs" + std::to_string(i_file) + "_" + std::to_string(i), 1,
+                i + 1, "A", "C", i_file,
+                static_cast<std::streampos>(3 + i * sample_ct4));
+        }
+    }
+    std::shuffle(input.begin(), input.end(), mersenne_engine);
+    Reporter reporter("log", 60, true);
+    QCFiltering filter_info;
+    filter_info.maf = 0.05;
+    filter_info.geno = 0.1;
+    auto run_qc = [&](mock_binaryplink& plink, const size_t thread,
+                      const size_t min_snp_per_thread) {
+        plink.set_reporter(&reporter);
+        plink.set_sample(n_sample);
+        plink.test_init_sample_vectors();
+        plink.set_founder_vector(founder);
+        plink.set_sample_vector(n_sample);
+        plink.test_post_sample_read_init();
+        for (size_t i_file = n_file; i_file-- > 0;)
+        {
+            plink.gen_fake_bed(genotypes[i_file],
+                               "qc_thread_" + std::to_string(i_file));
+        }
+        for (size_t i_file = 1; i_file < n_file; ++i_file)
+        { plink.add_file_name("qc_thread_" + std::to_string(i_file)); }
+        plink.existed_snps().clear();
+        for (auto&& snp : input) { plink.manual_load_snp(snp); }
+        plink.set_thread(thread);
+        plink.set_min_qc_snp_per_thread(min_snp_per_thread);
+        REQUIRE(plink.test_perform_freqs_and_inter(filter_info));
+    };
+    mock_binaryplink single, multi;
+    run_qc(single, 1, 256);
+    const size_t thread = GENERATE(2, 3, 8);
+    run_qc(multi, thread, 4);
+    auto&& expected = single.existed_snps();
+    auto&& observed = multi.existed_snps();
+    REQUIRE(!expected.empty());
+    REQUIRE(expected.size() < n_file * n_snp_per_file);
+    REQUIRE(single.num_maf_filter() != 0);
+    REQUIRE(single.num_geno_filter() != 0);
+    REQUIRE(multi.num_maf_filter() == single.num_maf_filter());
+    REQUIRE(multi.num_geno_filter() == single.num_geno_filter());
+    REQUIRE(multi.num_miss_filter() == single.num_miss_filter());
+    REQUIRE(observed.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+    {
+        REQUIRE(observed[i]->rs() == expected[i]->rs());
+        // retained SNPs are sorted by their location in the files
+        if (i != 0)
+        {
+            const auto& prev = observed[i - 1];
+            REQUIRE((prev->get_file_idx() < observed[i]->get_file_idx()
+                     || (prev->get_file_idx() == observed[i]->get_file_idx()
+                         && prev->get_byte_pos()
+                                < observed[i]->get_byte_pos())));
+        }
+        uint32_t exp_ct[4], obs_ct[4];
+        expected[i]->get_counts(exp_ct[0], exp_ct[1], exp_ct[2], exp_ct[3],
+                                false);
+        observed[i]->get_counts(obs_ct[0], obs_ct[1], obs_ct[2], obs_ct[3],
+                                false);
+        for (size_t j = 0; j < 4; ++j) { REQUIRE(obs_ct[j] == exp_ct[j]); }
+    }
+    for (size_t i_file = 0; i_file < n_file; ++i_file)
+    { std::remove(("qc_thread_" + std::to_string(i_file) + ".bed").c_str()); }
+}
@@ -131,13 +131,71 @@ TEST_CASE("plink read_genotype")
         target.load_genotype_to_memory();
         auto&& snps = target.existed_snps();
         // SNP current geno should now point to memory with the genotype
-        REQUIRE_FALSE(snps.front().current_genotype() == nullptr);
+        REQUIRE_FALSE(snps.front()->current_genotype() == nullptr);
         // we know size of cur_snp, which is target_ctv2
-        auto&& snp_memory = snps.front().current_genotype();
+        auto&& snp_memory = snps.front()->current_genotype();
         std::vector<uintptr_t> observed(snp_memory, snp_memory + target_ctv2);
         REQUIRE_THAT(observed, Catch::Equals<uintptr_t>(expected_memory));
     }
 }
+
+TEST_CASE("plink read_score with prefetch")
+{
+    Reporter reporter("log", 60, true);
+    mock_binaryplink geno;
+    geno.set_reporter(&reporter);
+    // enough SNPs for the reads to be handed to the prefetch thread
+    const size_t n_sample = 257, n_snp = 300;
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_int_distribution<size_t> dist {0, 3};
+    std::normal_distribution<double> effect {0, 1};
+    std::vector<std::vector<size_t>> genotypes(n_snp,
+                                               std::vector<size_t>(n_sample));
+    for (auto&& g : genotypes)
+    {
+        std::generate(g.begin(), g.end(),
+                      [&]() { return dist(mersenne_engine); });
+    }
+    geno.set_sample(n_sample);
+    geno.test_init_sample_vectors();
+    geno.set_founder_vector(std::vector<bool>(n_sample, true));
+    geno.set_sample_vector(n_sample);
+    geno.test_post_sample_read_init();
+    geno.gen_fake_bed(genotypes, "prefetch_score");
+    geno.existed_snps().clear();
+    const std::streamoff sample_ct4 = (n_sample + 3) / 4;
+    for (size_t i = 0; i < n_snp; ++i)
+    {
+        const std::streampos byte_pos =
+            3 + static_cast<std::streamoff>(i) * sample_ct4;
+        geno.manual_load_snp(SNP("rs" + std::to_string(i), 1, i + 1, "A", "C",
+                                 0, byte_pos, effect(mersenne_engine), 0.01, 0,
+                                 0));
+    }
+    // skip some SNPs so that the reads are not all contiguous
+    std::vector<size_t> selected;
+    for (size_t i = 0; i < n_snp; ++i)
+    {
+        if (i % 7 != 3) selected.push_back(i);
+    }
+    const auto mid = selected.cbegin() + static_cast<long>(selected.size() / 2);
+    auto score = [&](bool prefetch) {
+        geno.set_min_prefetch_snp(prefetch ? 1 : n_snp + 1);
+        SamplePRS prs(n_sample);
+        // two calls so that the prefetch thread is reused
+        geno.test_read_score(prs, selected.cbegin(), mid, true);
+        geno.test_read_score(prs, mid, selected.cend(), false);
+        return prs;
+    };
+    auto direct = score(false);
+    auto prefetched = score(true);
+    REQUIRE(std::equal(direct.prs.begin(), direct.prs.end(),
+                       prefetched.prs.begin()));
+    REQUIRE(std::equal(direct.num_snp.begin(), direct.num_snp.end(),
+                       prefetched.num_snp.begin()));
+    std::remove("prefetch_score.bed");
+}
 /*
 void generate_expected_prs(const std::vector<size_t>& genotype,
                            const std::vector<bool>& selected,
@@ -145,7 +203,7 @@ void generate_expected_prs(const std::vector<size_t>& genotype,
                            const MISSING_SCORE& missing_score,
                            const SCORING& scoring, const bool flipped,
                            const bool use_ref_maf, Genotype& geno,
-                           std::vector<PRS>& expected_prs,
+                           SamplePRS& expected_prs,
                            misc::RunningStat& rs)
 {
 }
@@ -0,0 +1,124 @@
+#include "block_decoder.hpp"
+#include "catch.hpp"
+#include <mutex>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+TEST_CASE("Block decoder")
+{
+    const size_t num_block = 37;
+    std::mt19937 g(42);
+    std::vector<std::vector<uint8_t>> expected(num_block);
+    BlockDecoder decoder;
+    decoder.set_num_worker(4);
+    REQUIRE(decoder.num_worker() == 4);
+    size_t work = 0;
+    for (size_t i = 0; i < num_block; ++i)
+    {
+        // compressible data of different sizes
+        expected[i].resize(1000 + 997 * i);
+        for (auto&& b : expected[i]) { b = static_cast<uint8_t>(g() % 4); }
+        auto&& block = decoder.block(i);
+        uLongf size = compressBound(expected[i].size());
+        block.compressed.resize(size);
+        REQUIRE(compress(block.compressed.data(), &size, expected[i].data(),
+                         expected[i].size())
+                == Z_OK);
+        block.compressed.resize(size);
+        block.file_idx = i;
+        work += size;
+    }
+    // REQUIRE isn't thread safe, throw on error instead
+    auto decode = [&](BlockDecoder::Block& block, ZlibInflater& inflater) {
+        if (inflater.inflate(block.compressed.data(),
+                             block.compressed.data() + block.compressed.size(),
+                             block.data.data(), block.data.size())
+            != block.data.size())
+        { throw std::runtime_error("Unexpected size"); }
+    };
+    auto prepare = [&]() {
+        for (size_t i = 0; i < num_block; ++i)
+        { decoder.block(i).data.assign(expected[i].size(), 0xFF); }
+    };
+    auto check = [&]() {
+        for (size_t i = 0; i < num_block; ++i)
+        { REQUIRE(decoder.block(i).data == expected[i]); }
+    };
+    prepare();
+    SECTION("multiple workers")
+    {
+        decoder.decode(num_block, 4 * BlockDecoder::min_work_per_worker,
+                       decode);
+        check();
+        // decoding a second time goes through the reset of the inflaters
+        prepare();
+        decoder.decode(num_block, 4 * BlockDecoder::min_work_per_worker,
+                       decode);
+        check();
+    }
+    SECTION("workers are kept between batches")
+    {
+        std::mutex mutex;
+        std::set<std::thread::id> threads;
+        auto record = [&](BlockDecoder::Block& block, ZlibInflater& inflater) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                threads.insert(std::this_thread::get_id());
+            }
+            decode(block, inflater);
+        };
+        decoder.decode(num_block, 4 * BlockDecoder::min_work_per_worker,
+                       record);
+        check();
+        auto first_batch = threads;
+        REQUIRE(first_batch.size() == 4);
+        // a smaller batch only uses some of the workers
+        threads.clear();
+        prepare();
+        decoder.decode(num_block, 2 * BlockDecoder::min_work_per_worker,
+                       record);
+        check();
+        REQUIRE(threads.size() == 2);
+        threads.clear();
+        prepare();
+        decoder.decode(num_block, 4 * BlockDecoder::min_work_per_worker,
+                       record);
+        check();
+        REQUIRE(threads == first_batch);
+    }
+    SECTION("too little work for threads")
+    {
+        decoder.decode(num_block, 1, decode);
+        check();
+    }
+    SECTION("no block") { decoder.decode(0, work, decode); }
+    SECTION("corrupted block")
+    {
+        decoder.block(num_block / 2).compressed[0] ^= 0xFF;
+        REQUIRE_THROWS_AS(decoder.decode(num_block,
+                                         4 * BlockDecoder::min_work_per_worker,
+                                         decode),
+                          std::runtime_error);
+        // the workers are still there for the next batch
+        decoder.block(num_block / 2).compressed[0] ^= 0xFF;
+        prepare();
+        decoder.decode(num_block, 4 * BlockDecoder::min_work_per_worker,
+                       decode);
+        check();
+    }
+    SECTION("destination too small")
+    {
+        ZlibInflater inflater;
+        auto&& block = decoder.block(1);
+        std::vector<uint8_t> dest(expected[1].size() / 2);
+        REQUIRE_THROWS_AS(
+            inflater.inflate(block.compressed.data(),
+                             block.compressed.data() + block.compressed.size(),
+                             dest.data(), dest.size()),
+            std::runtime_error);
+    }
+}
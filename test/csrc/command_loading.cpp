@@ -145,6 +145,12 @@ TEST_CASE("Commander set flag")
         REQUIRE(commander.parse_command_wrapper("--logit-perm"));
         REQUIRE(commander.get_perm().logit_perm);
     }
+    SECTION("score-test")
+    {
+        REQUIRE_FALSE(commander.get_prs_instruction().score_test);
+        REQUIRE(commander.parse_command_wrapper("--score-test"));
+        REQUIRE(commander.get_prs_instruction().score_test);
+    }
     SECTION("full-back")
     {
         REQUIRE_FALSE(commander.get_set().full_as_background);
@@ -674,6 +680,16 @@ TEST_CASE("Clumping parameter loading")
         {
             REQUIRE_FALSE(commander.parse_command_wrapper("--clump-kb -100kb"));
         }
+        SECTION("clump-ld")
+        {
+            REQUIRE(commander.get_clump_info().ld == CLUMP_LD::EM);
+            REQUIRE(commander.parse_command_wrapper("--clump-ld dosage"));
+            REQUIRE(commander.get_clump_info().ld == CLUMP_LD::DOSAGE);
+        }
+        SECTION("Invalid clump-ld")
+        {
+            REQUIRE_FALSE(commander.parse_command_wrapper("--clump-ld corr"));
+        }
     }
 }
 
@@ -814,6 +830,12 @@ TEST_CASE("misc parameter loading")
         REQUIRE(commander.parse_command_wrapper("--chr-id c:l-l-a-b"));
         REQUIRE(commander.chr_id_formula() == "c:l-l-a-b");
     }
+    SECTION("cache-dir")
+    {
+        REQUIRE(commander.cache_dir().empty());
+        REQUIRE(commander.parse_command_wrapper("--cache-dir cache"));
+        REQUIRE(commander.cache_dir() == "cache");
+    }
     SECTION("extract")
     {
         REQUIRE(commander.extract_file().empty());
@@ -855,6 +877,13 @@ TEST_CASE("misc parameter loading")
             REQUIRE(commander.parse_command_wrapper("--memory 10"));
             REQUIRE(commander.memory() == 10485760);
         }
+        SECTION("limit")
+        {
+            REQUIRE(commander.max_memory(2048) == 2048);
+            REQUIRE(commander.parse_command_wrapper("--memory 1k"));
+            REQUIRE(commander.max_memory(2048) == 1024);
+            REQUIRE(commander.max_memory(512) == 512);
+        }
     }
     SECTION("seed")
     {
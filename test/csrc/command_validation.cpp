@@ -444,9 +444,10 @@ TEST_CASE("Misc validation")
         }
         SECTION("with bgen")
         {
+            // dosages are stored in memory too
             REQUIRE(commander.parse_command_wrapper("--type bgen"));
             REQUIRE(commander.misc_check_wrapper());
-            REQUIRE_FALSE(commander.ultra_aggressive());
+            REQUIRE(commander.ultra_aggressive());
         }
     }
     SECTION("snp selection")
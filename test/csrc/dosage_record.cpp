@@ -0,0 +1,56 @@
+#include "binarygen_setters.hpp"
+#include "catch.hpp"
+#include <vector>
+
+TEST_CASE("Dosage record")
+{
+    const size_t num_sample = 70;
+    std::vector<uintptr_t> storage(DosageRecord::num_word(num_sample), ~0ULL);
+    DosageRecord record(storage.data(), num_sample, 0.0, 2.0);
+    record.clear();
+    for (size_t i = 0; i < num_sample; ++i)
+    {
+        if (i % 7 == 0) { record.set_missing(i); }
+        else
+        {
+            const double dosage = 2.0 * static_cast<double>(i)
+                                  / static_cast<double>(num_sample);
+            REQUIRE(record.set_dosage(i, dosage));
+        }
+    }
+    for (size_t i = 0; i < num_sample; ++i)
+    {
+        REQUIRE(record.missing(i) == (i % 7 == 0));
+        if (i % 7 == 0) continue;
+        // rounded to the nearest level
+        REQUIRE(record.dosage(i)
+                == Approx(2.0 * static_cast<double>(i)
+                          / static_cast<double>(num_sample))
+                       .margin(0.5 / DosageRecord::level_per_unit));
+    }
+    // with 8 bits, the dosage of p(het) = a / 255 and p(hom alt) = b / 255 is
+    // (a + 2b) / 255, which is kept exactly for both odd and even numerators
+    for (size_t numerator = 0; numerator <= 2 * 255; ++numerator)
+    {
+        const double dosage = static_cast<double>(numerator) / 255;
+        REQUIRE(record.set_dosage(1, dosage));
+        REQUIRE(record.dosage(1) == Approx(dosage).margin(1e-12));
+    }
+    REQUIRE(DosageRecord::exact(1));
+    REQUIRE(DosageRecord::exact(2));
+    REQUIRE(DosageRecord::exact(4));
+    REQUIRE(DosageRecord::exact(8));
+    // other depths are read from the file instead
+    REQUIRE_FALSE(DosageRecord::exact(3));
+    REQUIRE_FALSE(DosageRecord::exact(10));
+    REQUIRE_FALSE(DosageRecord::exact(16));
+    REQUIRE_FALSE(DosageRecord::exact(32));
+    // values slightly outside of the range due to rounding are clamped
+    REQUIRE(record.set_dosage(1, 2.0 + 1e-12));
+    REQUIRE(record.dosage(1) == 2.0);
+    REQUIRE(record.set_dosage(1, -1e-12));
+    REQUIRE(record.dosage(1) == 0.0);
+    REQUIRE_FALSE(record.set_dosage(1, 2.1));
+    REQUIRE_FALSE(record.set_dosage(1, -0.1));
+    REQUIRE_FALSE(record.set_dosage(1, std::nan("")));
+}
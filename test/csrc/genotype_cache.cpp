@@ -0,0 +1,109 @@
+#include "catch.hpp"
+#include "genotype_cache.hpp"
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+TEST_CASE("Genotype cache")
+{
+    namespace fs = std::filesystem;
+    const std::string dir = "genotype_cache_test";
+    fs::remove_all(dir);
+    {
+        std::ofstream bgen("genotype_cache_test.bgen", std::ios::binary);
+        bgen << "not really a bgen file";
+    }
+    const size_t record = 16;
+    auto make_entry = [](uint64_t byte_pos) {
+        GenotypeCache::Entry entry;
+        entry.byte_pos = byte_pos;
+        for (uint32_t i = 0; i < 4; ++i)
+            entry.count[i] = static_cast<uint32_t>(byte_pos) + i;
+        entry.expected = static_cast<double>(byte_pos) / 2;
+        entry.info[0] = 0.5;
+        entry.info[1] = 0.75;
+        return entry;
+    };
+    auto read_record = [&](const std::string& name, std::streampos pos) {
+        std::ifstream data(name, std::ios::binary);
+        std::vector<char> res(record);
+        data.seekg(pos);
+        data.read(res.data(), static_cast<std::streamsize>(record));
+        return res;
+    };
+    std::vector<GenotypeCache::Entry> entries = {make_entry(100),
+                                                 make_entry(200)};
+    std::vector<char> genotypes(2 * record);
+    for (size_t i = 0; i < genotypes.size(); ++i)
+    { genotypes[i] = static_cast<char>(i); }
+    std::vector<std::streampos> genotype_pos;
+    std::string name;
+    {
+        GenotypeCache cache(dir, "genotype_cache_test.bgen", "hard=0.1\n",
+                            record);
+        name = cache.name();
+        REQUIRE(cache.size() == 0);
+        GenotypeCache::Entry entry;
+        std::streampos pos;
+        REQUIRE_FALSE(cache.find(100, entry, pos));
+        cache.append(entries, genotypes.data(), genotype_pos);
+        REQUIRE(genotype_pos.size() == 2);
+        // SNPs already cached are not appended again
+        std::vector<std::streampos> repeat_pos;
+        cache.append({entries[1]}, genotypes.data() + record, repeat_pos);
+        REQUIRE(repeat_pos.size() == 1);
+        REQUIRE(repeat_pos[0] == genotype_pos[1]);
+    }
+    SECTION("reopen the cache")
+    {
+        GenotypeCache cache(dir, "genotype_cache_test.bgen", "hard=0.1\n",
+                            record);
+        REQUIRE(cache.name() == name);
+        REQUIRE(cache.size() == 2);
+        GenotypeCache::Entry entry;
+        std::streampos pos;
+        REQUIRE(cache.find(200, entry, pos));
+        REQUIRE(pos == genotype_pos[1]);
+        REQUIRE(entry.count[3] == 203);
+        REQUIRE(entry.expected == 100.0);
+        REQUIRE(entry.info[1] == 0.75);
+        auto res = read_record(cache.name(), pos);
+        REQUIRE(std::equal(res.begin(), res.end(), genotypes.begin() + record));
+    }
+    SECTION("different settings use another cache")
+    {
+        GenotypeCache cache(dir, "genotype_cache_test.bgen", "hard=0.2\n",
+                            record);
+        REQUIRE(cache.name() != name);
+        REQUIRE(cache.size() == 0);
+    }
+    SECTION("entries without data are discarded")
+    {
+        // mimic a run that was killed before writing all the genotypes
+        fs::resize_file(name, fs::file_size(name) - 1);
+        GenotypeCache cache(dir, "genotype_cache_test.bgen", "hard=0.1\n",
+                            record);
+        REQUIRE(cache.size() == 1);
+        GenotypeCache::Entry entry;
+        std::streampos pos;
+        REQUIRE_FALSE(cache.find(200, entry, pos));
+        std::vector<std::streampos> new_pos;
+        cache.append({entries[1]}, genotypes.data() + record, new_pos);
+        REQUIRE(new_pos[0] == genotype_pos[1]);
+        REQUIRE(fs::file_size(name + ".idx")
+                == 2 * sizeof(GenotypeCache::Entry));
+    }
+    SECTION("a new cache is used when the bgen file changes")
+    {
+        {
+            std::ofstream bgen("genotype_cache_test.bgen",
+                               std::ios::binary | std::ios::app);
+            bgen << " with more data";
+        }
+        GenotypeCache cache(dir, "genotype_cache_test.bgen", "hard=0.1\n",
+                            record);
+        REQUIRE(cache.size() == 0);
+    }
+    fs::remove_all(dir);
+    fs::remove("genotype_cache_test.bgen");
+}
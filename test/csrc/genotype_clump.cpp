@@ -90,6 +90,35 @@ TEST_CASE("Build Clump window")
     }
 }
 
+TEST_CASE("Clump segments split at window gaps")
+{
+    mockGenotype geno;
+    Reporter reporter("log", 60, true);
+    geno.set_reporter(&reporter);
+    // rs2 -> rs3 and rs4 -> rs5 are further apart than the clump window, so
+    // chromosome 1 is cut into three segments even though it is one chromosome
+    std::vector<SNP> input = {SNP("rs0", 1, 10, "A", "C", 0, 0.5, 0, 0),
+                              SNP("rs1", 1, 15, "A", "C", 0, 0.01, 0, 0),
+                              SNP("rs2", 1, 40, "A", "C", 0, 0.02, 0, 0),
+                              SNP("rs3", 1, 45, "A", "C", 0, 0.3, 0, 0),
+                              SNP("rs4", 1, 100, "A", "C", 0, 0.001, 0, 0),
+                              SNP("rs5", 2, 100, "A", "C", 0, 0.1, 0, 0)};
+    for (auto&& snp : input) { geno.load_snp(snp); }
+    geno.build_clump_windows(10);
+    geno.sort_by_p();
+    auto res = geno.test_get_clump_segments();
+    using range = std::pair<size_t, size_t>;
+    REQUIRE_THAT(res, Catch::Equals<range>({range {0, 2}, range {2, 4},
+                                            range {4, 5}, range {5, 6}}));
+    // SNPs are grouped by segment but stay in p-value order within each
+    auto snps = geno.existed_snps();
+    std::vector<std::string> observed;
+    for (auto&& idx : geno.sorted_p_index())
+    { observed.push_back(snps[idx].rs()); }
+    REQUIRE_THAT(observed, Catch::Equals<std::string>(
+                               {"rs1", "rs0", "rs2", "rs3", "rs4", "rs5"}));
+}
+
 
 // update_index_tot function (might need to use plink and predefined data)
 // get_r2 function (again, might need to use predefined data and reference to
@@ -478,16 +507,19 @@ TEST_CASE("R2 calculation")
                 static_cast<std::streampos>(3 + (i * (unfiltered_sample_ct4)));
             auto chr = i < dummy_input.size() ? 1 : 2;
             auto loc = i < dummy_input.size() ? i : i - dummy_input.size();
-            snps.push_back(SNP("rs" + std::to_string(i), chr, loc, "A", "C",
-                               1.96, p(), 0, 0));
+            snps.push_back(std::make_unique<SNP>("rs" + std::to_string(i), chr,
+                                                 loc, "A", "C", 1.96, p(), 0,
+                                                 0));
             //            snps.push_back(SNP("rs" + std::to_string(i), chr, loc,
             //            "A", "C",
             //                               1.96, loc, 0, 0));
-            snps.back().update_file(0, byte_pos, true);
+            snps.back()->update_file(0, byte_pos, true);
         }
         Clumping clump_info;
+        // r2 of 0.5 leaves boundaries without LD to cut the chromosomes at
         clump_info.r2 = GENERATE(take(2, random(1.45889e-07, 9.90366e-04)),
-                                 take(2, random(1.03383e-03, 1.03383e-03)));
+                                 take(2, random(1.03383e-03, 1.03383e-03)),
+                                 0.5);
         //        clump_info.pvalue = 100000;
         //        clump_info.r2 = 1e-3;
         geno.build_clump_windows(10000000);
@@ -499,11 +531,61 @@ TEST_CASE("R2 calculation")
             REQUIRE_THAT(res,
                          Catch::Equals<range>({range {0, 25}, range {25, 50}}));
         }
+        SECTION("Check get_clump_segments")
+        {
+            // all SNPs within a chromosome are within the same window
+            auto res = geno.test_get_clump_segments();
+            using range = std::pair<size_t, size_t>;
+            REQUIRE_THAT(res,
+                         Catch::Equals<range>({range {0, 25}, range {25, 50}}));
+            auto idx = geno.sorted_p_index();
+            for (size_t i = 0; i < idx.size(); ++i)
+            { REQUIRE((idx[i] < 25) == (i < 25)); }
+        }
+        SECTION("Cut clump segments at boundaries without LD")
+        {
+            auto res = geno.test_get_clump_segments(clump_info, 5, 2);
+            auto idx = geno.sorted_p_index();
+            // each segment covers consecutive SNPs of one chromosome
+            std::vector<size_t> segment(file_output.size());
+            size_t prev_end = 0;
+            for (size_t i = 0; i < res.size(); ++i)
+            {
+                REQUIRE(res[i].first == prev_end);
+                REQUIRE(res[i].second > res[i].first);
+                prev_end = res[i].second;
+                auto first = *std::min_element(idx.begin() + res[i].first,
+                                               idx.begin() + res[i].second);
+                auto last = *std::max_element(idx.begin() + res[i].first,
+                                              idx.begin() + res[i].second);
+                REQUIRE(last - first + 1 == res[i].second - res[i].first);
+                REQUIRE((first < dummy_input.size())
+                        == (last < dummy_input.size()));
+                for (size_t j = res[i].first; j < res[i].second; ++j)
+                { segment[idx[j]] = i; }
+            }
+            REQUIRE(prev_end == file_output.size());
+            // no SNP is in LD with a SNP of another segment
+            for (size_t i = 0; i < file_output.size(); ++i)
+            {
+                for (size_t j = i + 1; j < file_output.size(); ++j)
+                {
+                    if ((i < dummy_input.size()) != (j < dummy_input.size()))
+                        continue;
+                    const size_t offset =
+                        i < dummy_input.size() ? 0 : dummy_input.size();
+                    if (segment[i] != segment[j]
+                        && expected_r2[i - offset][j - i - 1] >= clump_info.r2)
+                    { FAIL("rs" << i << " and rs" << j << " are split"); }
+                }
+            }
+            if (clump_info.r2 == 0.5) { REQUIRE(res.size() > 2); }
+        }
         SECTION("Threaded clumping")
         {
-            size_t threads = GENERATE(1, 2);
+            size_t threads = GENERATE(1, 2, 4);
             std::vector<std::string> expected_remain;
-            auto snp = geno.existed_snps();
+            auto&& snp = geno.existed_snps();
             auto idx = geno.sorted_p_index();
             std::unordered_set<size_t> removed;
             for (auto i : idx)
@@ -534,14 +616,14 @@ TEST_CASE("R2 calculation")
                         if (r2 >= clump_info.r2) { removed.insert(j); }
                     }
                 }
-                expected_remain.push_back(snp[i].rs());
+                expected_remain.push_back(snp[i]->rs());
             }
             Genotype* geno_ptr = &geno;
             geno.clumping(clump_info, *geno_ptr, threads);
-            auto res_snp = geno.existed_snps();
+            auto&& res_snp = geno.existed_snps();
             std::vector<std::string> result;
             result.reserve(res_snp.size());
-            for (auto&& snp : res_snp) { result.push_back(snp.rs()); }
+            for (auto&& snp : res_snp) { result.push_back(snp->rs()); }
             REQUIRE_THAT(result,
                          Catch::UnorderedEquals<std::string>(expected_remain));
         }
@@ -644,3 +726,112 @@ TEST_CASE("R2 calculation")
         }
     }
 }
+
+TEST_CASE("LD kernel joint genotype counts")
+{
+    // enough samples for more than one tile and a partial last vector
+    const uintptr_t n_sample = 16001;
+    const size_t n_window = 5;
+    const uintptr_t founder_ctl2 = QUATERCT_TO_WORDCT(n_sample);
+    const uintptr_t founder_ctv2 = QUATERCT_TO_ALIGNED_WORDCT(n_sample);
+    std::mt19937 g(42);
+    std::uniform_int_distribution<uint32_t> code(0, 3);
+    auto random_genotype = [&]() {
+        std::vector<uintptr_t> geno(founder_ctv2, 0);
+        for (uintptr_t i = 0; i < n_sample; ++i)
+        {
+            geno[i / BITCT2] |= static_cast<uintptr_t>(code(g))
+                                << (2 * (i % BITCT2));
+        }
+        return geno;
+    };
+    auto get_code = [](const std::vector<uintptr_t>& geno, uintptr_t i) {
+        return (geno[i / BITCT2] >> (2 * (i % BITCT2))) & 3;
+    };
+    mockGenotype geno;
+    std::vector<uintptr_t> index_data(3 * founder_ctv2);
+    std::vector<uintptr_t> index_tots(6);
+    std::vector<uintptr_t> founder_include2(founder_ctv2, 0);
+    fill_quatervec_55(static_cast<uint32_t>(n_sample), founder_include2.data());
+    auto index = random_genotype();
+    geno.test_update_index_tot(founder_ctl2, founder_ctv2, n_sample,
+                               index_data, index_tots, founder_include2,
+                               index.data());
+    std::vector<std::vector<uintptr_t>> window;
+    std::vector<const uintptr_t*> window_ptr;
+    for (size_t i = 0; i < n_window; ++i) window.push_back(random_genotype());
+    for (auto&& w : window) window_ptr.push_back(w.data());
+    // count directly from the genotypes
+    const uintptr_t code_idx[4] = {0, 3, 1, 2};
+    std::vector<uint32_t> expected(9 * n_window, 0);
+    for (size_t i = 0; i < n_window; ++i)
+    {
+        for (uintptr_t s = 0; s < n_sample; ++s)
+        {
+            const uintptr_t index_code = get_code(index, s);
+            const uintptr_t window_code = get_code(window[i], s);
+            if (index_code == 1 || window_code == 1) continue;
+            ++expected[9 * i + 3 * code_idx[index_code]
+                       + code_idx[window_code]];
+        }
+    }
+    std::vector<uint32_t> counts(9 * n_window);
+    std::vector<uint64_t> raw(9 * n_window);
+    ld_kernel::joint_genotype_counts(index_data.data(), founder_ctv2,
+                                     index_tots.data(), window_ptr.data(),
+                                     n_window, founder_ctl2, counts.data(),
+                                     raw.data());
+    REQUIRE_THAT(counts, Catch::Equals<uint32_t>(expected));
+    SECTION("All kernels agree")
+    {
+        std::vector<uint64_t> expected_raw(9 * n_window, 0);
+        ld_kernel::accumulate_scalar(index_data.data(), founder_ctv2,
+                                     window_ptr.data(), n_window, 0,
+                                     founder_ctl2, expected_raw.data());
+        for (auto&& kernel : {ld_kernel::get_accumulate_avx2(),
+                              ld_kernel::get_accumulate_avx512()})
+        {
+            if (kernel == nullptr) continue;
+            std::fill(raw.begin(), raw.end(), 0);
+            kernel(index_data.data(), founder_ctv2, window_ptr.data(),
+                   n_window, 0, founder_ctl2, raw.data());
+            REQUIRE_THAT(raw, Catch::Equals<uint64_t>(expected_raw));
+        }
+    }
+}
+
+TEST_CASE("R2 from joint genotype counts")
+{
+    mockGenotype geno;
+    SECTION("EM bound")
+    {
+        std::mt19937 g(42);
+        std::uniform_int_distribution<uint32_t> count(0, 50);
+        for (size_t rep = 0; rep < 1000; ++rep)
+        {
+            uint32_t counts[9];
+            for (auto&& c : counts) c = count(g);
+            const double r2 = geno.test_get_r2(counts);
+            REQUIRE(geno.test_max_r2(counts) >= r2);
+        }
+    }
+    SECTION("dosage r2")
+    {
+        // perfect correlation
+        uint32_t identical[9] = {10, 0, 0, 0, 20, 0, 0, 0, 5};
+        REQUIRE(geno.test_get_dosage_r2(identical) == Approx(1.0));
+        // perfect negative correlation
+        uint32_t flipped[9] = {0, 0, 10, 0, 20, 0, 5, 0, 0};
+        REQUIRE(geno.test_get_dosage_r2(flipped) == Approx(1.0));
+        // independent
+        uint32_t independent[9] = {4, 4, 2, 4, 4, 2, 2, 2, 1};
+        REQUIRE(geno.test_get_dosage_r2(independent) == Approx(0.0));
+        // monomorphic
+        uint32_t monomorphic[9] = {10, 5, 3, 0, 0, 0, 0, 0, 0};
+        REQUIRE(geno.test_get_dosage_r2(monomorphic) == Approx(-1.0));
+        // x = {0, 0, 1, 2}, y = {0, 1, 1, 2}
+        uint32_t mixed[9] = {1, 1, 0, 0, 1, 0, 0, 0, 1};
+        REQUIRE(geno.test_get_dosage_r2(mixed)
+                == Approx(0.25 / (0.6875 * 0.5)));
+    }
+}
@@ -0,0 +1,87 @@
+#include "catch.hpp"
+#include "genotype_pool.hpp"
+#include <set>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Genotype pool")
+{
+    const size_t memory_per_snp = 4;
+    SECTION("alloc and free")
+    {
+        GenotypePool pool(2, memory_per_snp);
+        auto first = pool.alloc();
+        auto second = pool.alloc();
+        REQUIRE(first != second);
+        REQUIRE(pool.num_item() == 2);
+        // the pool grows once the first slab is used up
+        auto third = pool.alloc();
+        REQUIRE(pool.num_item() == 4);
+        std::set<uintptr_t*> storage = {first->get_geno(), second->get_geno(),
+                                        third->get_geno()};
+        REQUIRE(storage.size() == 3);
+        pool.free(second);
+        REQUIRE(pool.alloc() == second);
+        REQUIRE_THROWS(pool.free(nullptr));
+    }
+    SECTION("memory limit")
+    {
+        const size_t byte_per_item =
+            round_up_pow2(memory_per_snp, CACHELINE) * sizeof(uintptr_t);
+        MemoryBudget budget(3 * byte_per_item);
+        {
+            GenotypePool pool(2, memory_per_snp, budget);
+            std::vector<IndividualGenotype*> items;
+            for (size_t i = 0; i < 3; ++i) items.push_back(pool.alloc());
+            REQUIRE(pool.byte_used() == 3 * byte_per_item);
+            REQUIRE(budget.available() == 0);
+            REQUIRE_THROWS(pool.alloc());
+            pool.free(items.back());
+            REQUIRE_NOTHROW(pool.alloc());
+        }
+        // memory is returned to the budget once the pool is destroyed
+        REQUIRE(budget.used() == 0);
+        MemoryBudget small_budget(byte_per_item - 1);
+        REQUIRE_THROWS(GenotypePool(2, memory_per_snp, small_budget));
+    }
+    SECTION("shared by multiple threads")
+    {
+        const size_t num_thread = 4;
+        const size_t num_hold = 100;
+        GenotypePool pool(16, memory_per_snp);
+        std::vector<std::vector<uintptr_t*>> held(num_thread);
+        std::vector<std::thread> workers;
+        for (size_t i_thread = 0; i_thread < num_thread; ++i_thread)
+        {
+            workers.push_back(std::thread([&, i_thread]() {
+                GenotypePool::Cache cache(pool, 8);
+                std::vector<IndividualGenotype*> items;
+                for (size_t round = 0; round < 200; ++round)
+                {
+                    for (size_t i = 0; i < num_hold; ++i)
+                    {
+                        items.push_back(cache.alloc());
+                        items.back()->get_geno()[0] = i_thread;
+                    }
+                    for (auto&& item : items)
+                    {
+                        // no other thread should have been given this item
+                        if (item->get_geno()[0] != i_thread)
+                        { held[i_thread].push_back(item->get_geno()); }
+                        cache.free(item);
+                    }
+                    items.clear();
+                }
+            }));
+        }
+        for (auto&& worker : workers) worker.join();
+        for (auto&& conflict : held) REQUIRE(conflict.empty());
+        // all items are returned once the caches are destroyed
+        std::set<IndividualGenotype*> items;
+        const size_t num_item = pool.num_item();
+        REQUIRE(num_item <= num_thread * (num_hold + 16) + 16);
+        for (size_t i = 0; i < num_item; ++i) items.insert(pool.alloc());
+        REQUIRE(items.size() == num_item);
+        REQUIRE(pool.num_item() == num_item);
+    }
+}
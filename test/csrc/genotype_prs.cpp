@@ -206,7 +206,7 @@ TEST_CASE("Read_PRS")
     }
     std::vector<double> observed_prs(num_selected);
     std::vector<size_t> observed_num(num_selected);
-    std::vector<PRS> observed(num_selected, PRS());
+    SamplePRS observed(num_selected);
     const bool not_first = true;
 
     geno.test_read_prs(genotype_data.data(), observed, ploidy, stat, adj_score,
@@ -214,8 +214,8 @@ TEST_CASE("Read_PRS")
                        homrar_weight, !not_first);
     for (size_t i = 0; i < num_selected; ++i)
     {
-        observed_prs[i] = observed[i].prs;
-        observed_num[i] = observed[i].num_snp;
+        observed_prs[i] = observed.prs[i];
+        observed_num[i] = observed.num_snp[i];
     }
 
     REQUIRE_THAT(observed_prs, Catch::Equals<double>(expected_prs));
@@ -227,8 +227,8 @@ TEST_CASE("Read_PRS")
                            het_weight, homrar_weight, !not_first);
         for (size_t i = 0; i < num_selected; ++i)
         {
-            observed_prs[i] = observed[i].prs;
-            observed_num[i] = observed[i].num_snp;
+            observed_prs[i] = observed.prs[i];
+            observed_num[i] = observed.num_snp[i];
         }
         REQUIRE_THAT(observed_prs, Catch::Equals<double>(expected_prs));
         REQUIRE_THAT(observed_num, Catch::Equals<size_t>(expected_num));
@@ -241,8 +241,8 @@ TEST_CASE("Read_PRS")
                            het_weight, homrar_weight, not_first);
         for (size_t i = 0; i < num_selected; ++i)
         {
-            observed_prs[i] = observed[i].prs;
-            observed_num[i] = observed[i].num_snp;
+            observed_prs[i] = observed.prs[i];
+            observed_num[i] = observed.num_snp[i];
             expected_prs[i] = 2 * expected_prs[i];
             expected_num[i] = 2 * expected_num[i];
         }
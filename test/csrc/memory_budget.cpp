@@ -0,0 +1,54 @@
+#include "catch.hpp"
+#include "memory_budget.hpp"
+#include <utility>
+
+TEST_CASE("Memory budget")
+{
+    MemoryBudget budget(1000);
+    SECTION("default is unlimited")
+    {
+        MemoryBudget unlimited;
+        REQUIRE(unlimited.try_reserve(std::numeric_limits<size_t>::max()));
+        REQUIRE(unlimited.available() == 0);
+    }
+    SECTION("reserve and release")
+    {
+        REQUIRE(budget.try_reserve(600));
+        REQUIRE(budget.used() == 600);
+        REQUIRE(budget.available() == 400);
+        REQUIRE_FALSE(budget.try_reserve(401));
+        REQUIRE(budget.try_reserve(400));
+        REQUIRE_FALSE(budget.try_reserve(1));
+        budget.release(1000);
+        REQUIRE(budget.available() == 1000);
+    }
+    SECTION("reservation")
+    {
+        MemoryBudget::Reservation reservation;
+        REQUIRE(budget.reserve(800, reservation));
+        REQUIRE(reservation.byte() == 800);
+        REQUIRE(budget.used() == 800);
+        // a new reservation replaces the old one
+        REQUIRE(budget.reserve(900, reservation));
+        REQUIRE(budget.used() == 900);
+        REQUIRE_FALSE(budget.reserve(1001, reservation));
+        REQUIRE(reservation.byte() == 0);
+        REQUIRE(budget.used() == 0);
+        {
+            MemoryBudget::Reservation scoped;
+            REQUIRE(budget.reserve(500, scoped));
+            reservation = std::move(scoped);
+            REQUIRE(scoped.byte() == 0);
+        }
+        REQUIRE(budget.used() == 500);
+        reservation.release();
+        REQUIRE(budget.used() == 0);
+    }
+    SECTION("lower limit")
+    {
+        REQUIRE(budget.try_reserve(800));
+        budget.set_limit(500);
+        REQUIRE(budget.available() == 0);
+        REQUIRE_FALSE(budget.try_reserve(1));
+    }
+}
@@ -0,0 +1,51 @@
+#include "catch.hpp"
+#include "memoryread.hpp"
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+TEST_CASE("File read with prefetch")
+{
+    std::vector<char> data(100000);
+    for (size_t i = 0; i < data.size(); ++i)
+    { data[i] = static_cast<char>(i * 7 + 3); }
+    {
+        std::ofstream out("prefetch_test.bin", std::ios::binary);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+    // the ifstream path serves the reads within a span from its own buffer
+    const bool use_map = GENERATE(true, false);
+    FileRead reader(use_map);
+    std::vector<char> result(300);
+    auto matched = [&](size_t pos, size_t size) {
+        reader.read("prefetch_test.bin", static_cast<std::streamoff>(pos),
+                    static_cast<std::streamoff>(size), result.data());
+        return std::equal(result.begin(),
+                          result.begin() + static_cast<std::ptrdiff_t>(size),
+                          data.begin() + static_cast<std::ptrdiff_t>(pos));
+    };
+    REQUIRE(matched(10, 100));
+#ifdef PRSICE_USE_MMAP
+    REQUIRE(reader.mapped() == use_map);
+#else
+    REQUIRE_FALSE(reader.mapped());
+#endif
+    SECTION("reads within and outside of the span")
+    {
+        reader.prefetch("prefetch_test.bin", 1000, 5000);
+        REQUIRE(matched(1000, 200));
+        REQUIRE(matched(5800, 200));
+        // partially outside of the span
+        REQUIRE(matched(5900, 200));
+        REQUIRE(matched(50, 100));
+    }
+    SECTION("span beyond the end of file")
+    {
+        reader.prefetch("prefetch_test.bin", 99000, 5000);
+        REQUIRE(matched(99700, 300));
+        reader.prefetch("prefetch_test.bin", 200000, 100);
+        REQUIRE(matched(0, 300));
+        REQUIRE_THROWS(matched(99900, 200));
+    }
+    std::remove("prefetch_test.bin");
+}
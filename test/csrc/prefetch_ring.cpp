@@ -0,0 +1,101 @@
+#include "catch.hpp"
+#include "prefetch_ring.hpp"
+#include <thread>
+#include <vector>
+
+TEST_CASE("Prefetch ring")
+{
+    SECTION("slots are handed out in order")
+    {
+        PrefetchRing ring(3);
+        size_t slot = 0;
+        for (size_t i = 0; i < 3; ++i)
+        {
+            REQUIRE(ring.acquire(slot));
+            REQUIRE(slot == i);
+            ring.publish();
+        }
+        REQUIRE(ring.next(slot));
+        REQUIRE(slot == 0);
+        REQUIRE(ring.next(slot));
+        REQUIRE(slot == 1);
+        REQUIRE(ring.held() == 2);
+        ring.release();
+        REQUIRE(ring.held() == 0);
+        // released slots are reused
+        REQUIRE(ring.acquire(slot));
+        REQUIRE(slot == 0);
+        ring.publish();
+        REQUIRE(ring.next(slot));
+        REQUIRE(slot == 2);
+        REQUIRE(ring.next(slot));
+        REQUIRE(slot == 0);
+    }
+    SECTION("stop wakes up both sides")
+    {
+        PrefetchRing ring(1);
+        size_t slot = 0;
+        REQUIRE(ring.acquire(slot));
+        ring.publish();
+        bool acquired = true;
+        std::thread producer([&ring, &acquired]() {
+            size_t s = 0;
+            // blocked as the only slot is not released
+            acquired = ring.acquire(s);
+        });
+        ring.stop();
+        producer.join();
+        REQUIRE_FALSE(acquired);
+        // filled slots can still be consumed
+        REQUIRE(ring.next(slot));
+        REQUIRE_FALSE(ring.next(slot));
+    }
+    SECTION("producer and consumer threads")
+    {
+        const size_t num_item = 10000;
+        const size_t num_slot = 4;
+        PrefetchRing ring(num_slot);
+        std::vector<size_t> storage(num_slot);
+        std::vector<size_t> received;
+        std::thread producer([&]() {
+            size_t slot = 0;
+            for (size_t i = 0; i < num_item; ++i)
+            {
+                if (!ring.acquire(slot)) break;
+                storage[slot] = i;
+                ring.publish();
+            }
+        });
+        size_t slot = 0;
+        for (size_t i = 0; i < num_item; ++i)
+        {
+            REQUIRE(ring.next(slot));
+            received.push_back(storage[slot]);
+            // hold on to a few slots before releasing them
+            if (ring.held() == num_slot || i % 3 == 0) ring.release();
+        }
+        producer.join();
+        REQUIRE(received.size() == num_item);
+        for (size_t i = 0; i < num_item; ++i) REQUIRE(received[i] == i);
+    }
+}
+
+TEST_CASE("Prefetch thread")
+{
+    PrefetchThread prefetcher;
+    std::vector<std::thread::id> ids;
+    size_t sum = 0;
+    for (size_t i = 0; i < 5; ++i)
+    {
+        prefetcher.run([&ids, &sum, i]() {
+            ids.push_back(std::this_thread::get_id());
+            sum += i;
+        });
+        prefetcher.wait();
+    }
+    REQUIRE(sum == 10);
+    REQUIRE(ids.size() == 5);
+    // every job ran on the same thread, which is not the caller
+    REQUIRE(ids.front() != std::this_thread::get_id());
+    for (auto&& id : ids) REQUIRE(id == ids.front());
+}
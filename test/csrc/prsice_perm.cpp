@@ -0,0 +1,112 @@
+#include "catch.hpp"
+#include "mock_prsice.hpp"
+#include "regression.hpp"
+#include <Eigen/Dense>
+#include <cmath>
+#include <random>
+
+TEST_CASE("Solve a block of permuted phenotypes")
+{
+    Reporter reporter("log", 60, true);
+    mock_prsice prsice(false, &reporter);
+    const Eigen::Index n = 300, num_cov = 3, num_perm = 17;
+    std::mt19937 g(11);
+    std::normal_distribution<double> norm(0.0, 1.0);
+    auto random_matrix = [&](Eigen::Index row, Eigen::Index col,
+                             const double scale) {
+        Eigen::MatrixXd res(row, col);
+        for (Eigen::Index j = 0; j < col; ++j)
+            for (Eigen::Index i = 0; i < row; ++i) res(i, j) = scale * norm(g);
+        return res;
+    };
+    // intercept, PRS then the covariates
+    auto&& x = prsice.get_independent();
+    x = Eigen::MatrixXd::Ones(n, 2 + num_cov);
+    x.rightCols(num_cov) = random_matrix(n, num_cov, 10.0);
+    Eigen::MatrixXd block = random_matrix(n, num_perm, 1.0);
+    std::vector<double> obs_t;
+    // position of the PRS after column pivoting
+    auto prs_position = [&]() {
+        Eigen::ColPivHouseholderQR<Eigen::MatrixXd> qr(x);
+        const auto& indices = qr.colsPermutation().indices();
+        Eigen::Index idx = 0;
+        while (indices(idx) != 1) ++idx;
+        return std::make_pair(idx, qr.rank());
+    };
+    SECTION("PRS is estimable")
+    {
+        // a tiny PRS is pivoted behind the covariates, and a large one in
+        // front of the intercept
+        const double scale = GENERATE(1e-3, 1.0, 100.0);
+        x.col(1) = random_matrix(n, 1, scale).col(0);
+        // give the PRS some signal on the first few permutations
+        block.leftCols(3) += 0.2 / scale * x.col(1).replicate(1, 3);
+        const auto [idx, rank] = prs_position();
+        REQUIRE(rank == x.cols());
+        if (scale != 1.0) REQUIRE(idx != 1);
+        prsice.test_null_perm_block(block, obs_t);
+        REQUIRE(obs_t.size() == static_cast<size_t>(num_perm));
+        double p, r2, r2_adj, coeff, se;
+        for (Eigen::Index i = 0; i < num_perm; ++i)
+        {
+            Regression::fastLm(block.col(i), x, p, r2, r2_adj, coeff, se, 1,
+                               true);
+            REQUIRE(obs_t[static_cast<size_t>(i)]
+                    == Approx(std::fabs(coeff / se)).epsilon(1e-8));
+        }
+    }
+    SECTION("PRS is not estimable")
+    {
+        // PRS explained by a covariate with larger norm is dropped from the
+        // decomposition
+        x.col(1) = 0.5 * x.col(3);
+        const auto [idx, rank] = prs_position();
+        REQUIRE(rank < x.cols());
+        REQUIRE(idx >= rank);
+        prsice.test_null_perm_block(block, obs_t);
+        REQUIRE(obs_t.size() == static_cast<size_t>(num_perm));
+        for (auto&& t : obs_t) { REQUIRE(std::isnan(t)); }
+    }
+}
+
+TEST_CASE("Permutation with partially cached index")
+{
+    Reporter reporter("log", 60, true);
+    const Eigen::Index n = 60;
+    Permutations perm;
+    perm.num_permutation = 45;
+    perm.seed = 2021;
+    perm.run_perm = true;
+    mock_prsice prsice(CalculatePRS(), PThresholding(), perm, "PRSice", false,
+                       &reporter);
+    std::mt19937 g(5);
+    std::normal_distribution<double> norm(0.0, 1.0);
+    auto&& x = prsice.get_independent();
+    x = Eigen::MatrixXd::Ones(n, 3);
+    auto&& pheno = prsice.phenotype_matrix();
+    pheno.resize(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        x(i, 1) = norm(g);
+        x(i, 2) = norm(g);
+        pheno(i) = 0.3 * x(i, 1) + norm(g);
+    }
+    // every permutation cached within a single block
+    const auto expected = prsice.test_permutation(1);
+    REQUIRE(prsice.num_cached_perm() == perm.num_permutation);
+    REQUIRE(std::all_of(expected.begin(), expected.end(),
+                        [](double t) { return t > 0; }));
+    // only room for the index of 20 permutations, the remaining blocks are
+    // regenerated from their random state
+    const size_t perm_byte = static_cast<size_t>(n) * sizeof(uint32_t);
+    const size_t block_size = GENERATE(1, 4, 7, 16);
+    const int thread = GENERATE(1, 3);
+    prsice.set_perm_limit(block_size, 20 * perm_byte);
+    const auto observed = prsice.test_permutation(thread);
+    REQUIRE(prsice.num_cached_perm() > 0);
+    REQUIRE(prsice.num_cached_perm() < perm.num_permutation);
+    REQUIRE(prsice.num_cached_perm() % block_size == 0);
+    REQUIRE(observed.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+    { REQUIRE(observed[i] == Approx(expected[i]).epsilon(1e-10)); }
+}
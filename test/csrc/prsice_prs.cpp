@@ -1,7 +1,10 @@
 #include "catch.hpp"
+#include "mock_binaryplink.hpp"
 #include "mock_prsice.hpp"
 #include "prsice.hpp"
 #include "storage.hpp"
+#include <fstream>
+#include <sstream>
 
 TEST_CASE("Initialize progress bar")
 {
@@ -57,3 +60,295 @@ TEST_CASE("Initialize progress bar")
     REQUIRE(ad == 0);
     REQUIRE(cd == 0);
 }
+
+// split n_snp SNPs of a mock plink file into three thresholds and random
+// regions, with region 3 left empty
+void load_region_genotype(mock_binaryplink& geno, const size_t n_sample,
+                          const size_t n_snp, const size_t num_regions,
+                          const bool binary,
+                          std::vector<std::vector<size_t>>& region_membership,
+                          std::vector<std::string>& region_names)
+{
+    std::random_device rnd_device;
+    std::mt19937 mersenne_engine {rnd_device()};
+    std::uniform_int_distribution<size_t> dist {0, 2};
+    std::normal_distribution<double> effect {0, 1};
+    std::bernoulli_distribution coin {0.5};
+    std::vector<std::vector<size_t>> genotypes(n_snp,
+                                               std::vector<size_t>(n_sample));
+    for (auto&& g : genotypes)
+    {
+        std::generate(g.begin(), g.end(),
+                      [&]() { return dist(mersenne_engine); });
+    }
+    geno.set_sample(n_sample);
+    geno.test_init_sample_vectors();
+    geno.set_founder_vector(std::vector<bool>(n_sample, true));
+    geno.set_sample_vector(n_sample);
+    geno.test_post_sample_read_init();
+    for (size_t i = 0; i < n_sample; ++i)
+    {
+        const std::string id = "ID" + std::to_string(i);
+        const std::string pheno =
+            binary ? std::to_string(coin(mersenne_engine))
+                   : std::to_string(effect(mersenne_engine));
+        geno.add_sample(Sample_ID(id, id, pheno, true));
+    }
+    geno.gen_fake_bed(genotypes, "region_score");
+    geno.existed_snps().clear();
+    region_names = {"Base", "Background"};
+    for (size_t i = 2; i < num_regions; ++i)
+    { region_names.push_back("Set" + std::to_string(i)); }
+    const std::streamoff sample_ct4 = (n_sample + 3) / 4;
+    for (size_t i = 0; i < n_snp; ++i)
+    {
+        const unsigned long long category = i % 3;
+        SNP snp("rs" + std::to_string(i), 1, i + 1, "A", "C", 0,
+                3 + static_cast<std::streamoff>(i) * sample_ct4,
+                effect(mersenne_engine), 0.01, category,
+                0.1 * static_cast<double>(category + 1));
+        auto&& flags = snp.get_flag();
+        flags.assign(BITCT_TO_WORDCT(num_regions), 0);
+        SET_BIT(0, flags.data());
+        SET_BIT(1, flags.data());
+        for (size_t i_region = 2; i_region < num_regions; ++i_region)
+        {
+            if (i_region != 3 && coin(mersenne_engine))
+                SET_BIT(i_region, flags.data());
+        }
+        geno.manual_load_snp(std::move(snp));
+    }
+    geno.prepare_prsice();
+    std::ostringstream snp_out;
+    region_membership = geno.build_membership_matrix(num_regions, region_names,
+                                                     false, snp_out);
+}
+
+TEST_CASE("Score regions held by the score matrix")
+{
+    Reporter reporter("log", 60, true);
+    mock_binaryplink geno;
+    geno.set_reporter(&reporter);
+    const size_t n_sample = 200, n_snp = 90, num_regions = 8;
+    std::vector<std::vector<size_t>> region_membership;
+    std::vector<std::string> region_names;
+    load_region_genotype(geno, n_sample, n_snp, num_regions, false,
+                         region_membership, region_names);
+    REQUIRE(region_membership[3].empty());
+    // PRS of every threshold, read directly from the genotypes
+    std::vector<std::vector<std::vector<double>>> expected(num_regions);
+    for (size_t i_region = 0; i_region < num_regions; ++i_region)
+    {
+        if (i_region == 1) continue;
+        auto start = region_membership[i_region].cbegin();
+        double threshold = 0.0;
+        uint32_t num_snp = 0;
+        bool first_run = true;
+        while (geno.get_score(start, region_membership[i_region].cend(),
+                              threshold, num_snp, first_run, i_region))
+        {
+            first_run = false;
+            expected[i_region].emplace_back();
+            for (size_t s = 0; s < n_sample; ++s)
+            { expected[i_region].back().push_back(geno.calculate_score(s)); }
+        }
+    }
+    // room for two regions per chunk, such that there are several chunks
+    const size_t col_byte = n_sample * (sizeof(double) + sizeof(uint32_t));
+    geno.set_max_score_matrix_byte(7 * col_byte);
+    REQUIRE(geno.prepare_score_matrix(num_regions));
+    SECTION("thread safe get_score")
+    {
+        const mock_binaryplink& const_geno = geno;
+        SamplePRS prs(n_sample);
+        for (size_t i_region = 0; i_region < num_regions; ++i_region)
+        {
+            if (i_region == 1 || region_membership[i_region].empty()) continue;
+            REQUIRE(geno.load_score_region(i_region));
+            REQUIRE(geno.score_loaded(i_region));
+            auto start = region_membership[i_region].cbegin();
+            double threshold = 0.0, mean_score = 0.0, score_sd = 0.0;
+            uint32_t num_snp = 0;
+            size_t i_thres = 0;
+            while (const_geno.get_score(prs, mean_score, score_sd, start,
+                                        region_membership[i_region].cend(),
+                                        threshold, num_snp, i_thres == 0,
+                                        i_region))
+            {
+                REQUIRE(i_thres < expected[i_region].size());
+                for (size_t s = 0; s < n_sample; ++s)
+                {
+                    REQUIRE(const_geno.calculate_score(prs, s, mean_score,
+                                                       score_sd)
+                            == Approx(expected[i_region][i_thres][s]));
+                }
+                ++i_thres;
+            }
+            REQUIRE(i_thres == expected[i_region].size());
+        }
+        // the base region is held by the first chunk only
+        REQUIRE_FALSE(geno.score_loaded(0));
+        auto start = region_membership[0].cbegin();
+        double threshold = 0.0, mean_score = 0.0, score_sd = 0.0;
+        uint32_t num_snp = 0;
+        REQUIRE_THROWS(const_geno.get_score(
+            prs, mean_score, score_sd, start, region_membership[0].cend(),
+            threshold, num_snp, true, 0));
+    }
+    SECTION("load score column")
+    {
+        REQUIRE(geno.load_score_region(0));
+        SamplePRS column(n_sample), twice(n_sample);
+        geno.test_load_score_column(column, 0, true);
+        geno.test_load_score_column(twice, 0, true);
+        geno.test_load_score_column(twice, 0, false);
+        for (size_t s = 0; s < n_sample; ++s)
+        {
+            REQUIRE(column.num_snp[s] != 0);
+            REQUIRE(twice.prs[s] == Approx(2 * column.prs[s]));
+            REQUIRE(twice.num_snp[s] == 2 * column.num_snp[s]);
+        }
+    }
+    std::remove("region_score.bed");
+}
+
+TEST_CASE("Build the score matrix on multiple threads")
+{
+    Reporter reporter("log", 60, true);
+    mock_binaryplink geno;
+    geno.set_reporter(&reporter);
+    const size_t n_sample = 200, n_snp = 90, num_regions = 8;
+    std::vector<std::vector<size_t>> region_membership;
+    std::vector<std::string> region_names;
+    load_region_genotype(geno, n_sample, n_snp, num_regions, false,
+                         region_membership, region_names);
+    const size_t col_byte = n_sample * (sizeof(double) + sizeof(uint32_t));
+    geno.set_max_score_matrix_byte(7 * col_byte);
+    geno.set_min_score_snp_per_thread(1);
+    // return the score and count matrix of every chunk
+    auto build = [&](const int thread) {
+        CalculatePRS prs_info;
+        prs_info.thread = thread;
+        geno.set_prs_instruction(prs_info);
+        REQUIRE(geno.prepare_score_matrix(num_regions));
+        std::vector<std::pair<
+            Eigen::MatrixXd,
+            Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic>>>
+            chunks;
+        for (size_t i_region = 0; i_region < num_regions; ++i_region)
+        {
+            if (i_region == 1 || region_membership[i_region].empty()) continue;
+            if (geno.score_loaded(i_region)) continue;
+            REQUIRE(geno.load_score_region(i_region));
+            chunks.emplace_back(geno.score_matrix(), geno.count_matrix());
+        }
+        return chunks;
+    };
+    const auto single = build(1);
+    const int thread = GENERATE(2, 3, 7);
+    const auto multi = build(thread);
+    REQUIRE(single.size() > 1);
+    REQUIRE(multi.size() == single.size());
+    for (size_t i = 0; i < single.size(); ++i)
+    {
+        auto&& [score, count] = single[i];
+        auto&& [multi_score, multi_count] = multi[i];
+        REQUIRE(multi_score.rows() == score.rows());
+        REQUIRE(multi_score.cols() == score.cols());
+        REQUIRE(multi_count == count);
+        // each thread sums its own SNPs, so the order of addition differs
+        for (Eigen::Index col = 0; col < score.cols(); ++col)
+        {
+            for (Eigen::Index row = 0; row < score.rows(); ++row)
+            { REQUIRE(multi_score(row, col) == Approx(score(row, col))); }
+        }
+    }
+    std::remove("region_score.bed");
+}
+
+TEST_CASE("Regress regions held by the score matrix")
+{
+    Reporter reporter("log", 60, true);
+    mock_binaryplink geno;
+    geno.set_reporter(&reporter);
+    const size_t n_sample = 200, n_snp = 90, num_regions = 8;
+    const bool binary = GENERATE(true, false);
+    std::vector<std::vector<size_t>> region_membership;
+    std::vector<std::string> region_names;
+    load_region_genotype(geno, n_sample, n_snp, num_regions, binary,
+                         region_membership, region_names);
+    // room for two regions per chunk, such that there are several chunks
+    const size_t col_byte = n_sample * (sizeof(double) + sizeof(uint32_t));
+    geno.set_max_score_matrix_byte(7 * col_byte);
+    REQUIRE(geno.prepare_score_matrix(num_regions));
+    Phenotype pheno_info;
+    pheno_info.pheno_col = {"Phenotype"};
+    pheno_info.pheno_col_idx = {2};
+    pheno_info.binary = {binary};
+    pheno_info.skip_pheno = {false};
+    // return the prsice and summary output, and the best file
+    auto regress = [&](const bool parallel, std::string& best) {
+        CalculatePRS prs_info;
+        prs_info.thread = parallel ? 3 : 1;
+        mock_prsice prsice(prs_info, PThresholding(), Permutations(), "PRSice",
+                           binary, &reporter);
+        prsice.init_progress_count(geno.get_set_thresholds());
+        prsice.init_matrix(pheno_info, " ", 0, geno);
+        const std::string best_name = "region_score.best";
+        auto best_file = misc::load_ostream(best_name);
+        const auto [max_fid, max_iid] = geno.get_max_id_length();
+        prsice.prep_best_output(geno, region_membership, region_names, max_fid,
+                                max_iid, best_file);
+        std::unique_ptr<std::ostream> prsice_out =
+            std::make_unique<std::ostringstream>();
+        std::unique_ptr<std::ostream> summary_file =
+            std::make_unique<std::ostringstream>();
+        std::unique_ptr<std::ostream> all_score_file = nullptr;
+        if (parallel)
+        {
+            prsice.run_regions(region_membership, region_names, "-", 2, 0,
+                               false, false, prsice_out, best_file,
+                               all_score_file, geno);
+        }
+        else
+        {
+            for (size_t i_region = 0; i_region < num_regions; ++i_region)
+            {
+                if (i_region == 1 || region_membership[i_region].empty())
+                    continue;
+                prsice.run_prsice(region_membership[i_region], region_names,
+                                  "-", 2, 0, i_region, false, false,
+                                  prsice_out, best_file, all_score_file, geno);
+            }
+        }
+        prsice.print_best(region_membership, std::move(best_file), geno);
+        std::vector<size_t> significant_count = {0, 0, 0};
+        prsice.print_summary("-", 2, false, significant_count, summary_file);
+        std::ifstream best_in(best_name);
+        std::stringstream best_str;
+        best_str << best_in.rdbuf();
+        best_in.close();
+        std::remove(best_name.c_str());
+        best = best_str.str();
+        return static_cast<std::ostringstream&>(*prsice_out).str()
+               + static_cast<std::ostringstream&>(*summary_file).str();
+    };
+    std::string sequential_best, parallel_best;
+    const auto sequential = regress(false, sequential_best);
+    const auto parallel = regress(true, parallel_best);
+    // the regions are written in order
+    size_t prev_pos = 0;
+    for (size_t i_region = 0; i_region < num_regions; ++i_region)
+    {
+        if (i_region == 1 || region_membership[i_region].empty()) continue;
+        const size_t pos =
+            sequential.find("\t" + region_names[i_region] + "\t");
+        REQUIRE(pos != std::string::npos);
+        REQUIRE(pos >= prev_pos);
+        prev_pos = pos;
+    }
+    REQUIRE(parallel == sequential);
+    REQUIRE(!sequential_best.empty());
+    REQUIRE(parallel_best == sequential_best);
+    std::remove("region_score.bed");
+}
@@ -0,0 +1,218 @@
+#include "catch.hpp"
+#include "regression.hpp"
+#include <Eigen/Dense>
+#include <cmath>
+#include <random>
+
+TEST_CASE("Residualized linear regression")
+{
+    const Eigen::Index n = 500;
+    std::mt19937 g(7);
+    std::normal_distribution<double> norm(0.0, 1.0);
+    auto random_matrix = [&](Eigen::Index row, Eigen::Index col) {
+        Eigen::MatrixXd res(row, col);
+        for (Eigen::Index j = 0; j < col; ++j)
+            for (Eigen::Index i = 0; i < row; ++i) res(i, j) = norm(g);
+        return res;
+    };
+    const Eigen::Index num_cov = GENERATE(0, 1, 5);
+    // intercept, PRS then the covariates
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, 2 + num_cov);
+    x.rightCols(num_cov) = random_matrix(n, num_cov);
+    const bool collinear_cov = GENERATE(false, true);
+    if (collinear_cov && num_cov > 1)
+    { x.col(3) = 2.0 * x.col(2) - x.col(0); }
+    Eigen::VectorXd y = random_matrix(n, 1).col(0);
+    y += x.rightCols(num_cov) * Eigen::VectorXd::Ones(num_cov);
+    Eigen::MatrixXd cov(n, num_cov + 1);
+    cov.col(0) = x.col(0);
+    cov.rightCols(num_cov) = x.rightCols(num_cov);
+    Regression::ResidualizedLm lm;
+    REQUIRE_FALSE(lm.ready());
+    lm.init(y, cov);
+    REQUIRE(lm.ready());
+    double p, r2, r2_adj, coeff, se;
+    double exp_p, exp_r2, exp_r2_adj, exp_coeff, exp_se;
+    for (size_t iter = 0; iter < 3; ++iter)
+    {
+        // the covariate are only factorized once, x changes between calls
+        x.col(1) = random_matrix(n, 1).col(0) + 0.3 * y;
+        Regression::fastLm(y, x, exp_p, exp_r2, exp_r2_adj, exp_coeff, exp_se,
+                           1, true);
+        REQUIRE(lm.run(x.col(1), p, r2, r2_adj, coeff, se));
+        REQUIRE(coeff == Approx(exp_coeff).epsilon(1e-10));
+        REQUIRE(se == Approx(exp_se).epsilon(1e-10));
+        REQUIRE(r2 == Approx(exp_r2).epsilon(1e-10));
+        REQUIRE(r2_adj == Approx(exp_r2_adj).epsilon(1e-10));
+        REQUIRE(p == Approx(exp_p).epsilon(1e-8));
+    }
+    // PRS that is fully explained by the covariates is left to fastLm
+    x.col(1) = cov * Eigen::VectorXd::Constant(num_cov + 1, 0.5);
+    REQUIRE_FALSE(lm.run(x.col(1), p, r2, r2_adj, coeff, se));
+    x.col(1).setZero();
+    REQUIRE_FALSE(lm.run(x.col(1), p, r2, r2_adj, coeff, se));
+    lm.reset();
+    REQUIRE_FALSE(lm.ready());
+}
+
+TEST_CASE("Warm started logistic regression")
+{
+    const Eigen::Index n = 800;
+    std::mt19937 g(11);
+    std::normal_distribution<double> norm(0.0, 1.0);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    const Eigen::Index num_cov = GENERATE(0, 3);
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, 2 + num_cov);
+    for (Eigen::Index j = 2; j < x.cols(); ++j)
+        for (Eigen::Index i = 0; i < n; ++i) x(i, j) = norm(g);
+    Eigen::VectorXd prs(n);
+    for (Eigen::Index i = 0; i < n; ++i) prs(i) = norm(g);
+    Eigen::VectorXd y(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        const double eta = 0.5 * prs(i) + x.row(i).tail(num_cov).sum() * 0.3;
+        y(i) = unif(g) < 1.0 / (1.0 + std::exp(-eta)) ? 1.0 : 0.0;
+    }
+    Regression::WarmStartGlm glm(y, x);
+    const bool null_start = GENERATE(false, true);
+    if (null_start)
+    {
+        Eigen::MatrixXd cov(n, num_cov + 1);
+        cov.col(0) = x.col(0);
+        cov.rightCols(num_cov) = x.rightCols(num_cov);
+        Eigen::VectorXd null_beta;
+        double p, r2, coeff, se;
+        if (num_cov == 0)
+        {
+            null_beta = Eigen::VectorXd::Constant(
+                1, std::log(y.mean() / (1.0 - y.mean())));
+        }
+        else
+        {
+            // the PRS column is a second intercept before it is filled
+            Regression::glm(y, x.rightCols(num_cov + 1), p, r2, coeff, se, 1,
+                            &null_beta);
+        }
+        glm.set_null(null_beta);
+    }
+    double p, r2, coeff, se;
+    double exp_p, exp_r2, exp_coeff, exp_se;
+    for (size_t iter = 0; iter < 4; ++iter)
+    {
+        // PRS of consecutive thresholds are correlated
+        for (Eigen::Index i = 0; i < n; ++i)
+        { x(i, 1) = prs(i) + 0.3 * static_cast<double>(iter) * norm(g); }
+        Regression::glm(y, x, exp_p, exp_r2, exp_coeff, exp_se, 1);
+        glm.run(p, r2, coeff, se, 1);
+        REQUIRE(coeff == Approx(exp_coeff).epsilon(1e-6));
+        REQUIRE(se == Approx(exp_se).epsilon(1e-6));
+        REQUIRE(r2 == Approx(exp_r2).epsilon(1e-6));
+        // p-values are tiny, compare their magnitude
+        REQUIRE(std::log(p) == Approx(std::log(exp_p)).epsilon(1e-5));
+        if (iter == 1) glm.reset();
+    }
+}
+
+TEST_CASE("Logistic score test")
+{
+    const Eigen::Index n = 800;
+    std::mt19937 g(13);
+    std::normal_distribution<double> norm(0.0, 1.0);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    const Eigen::Index num_cov = GENERATE(0, 3);
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, 2 + num_cov);
+    for (Eigen::Index j = 2; j < x.cols(); ++j)
+        for (Eigen::Index i = 0; i < n; ++i) x(i, j) = norm(g);
+    for (Eigen::Index i = 0; i < n; ++i) x(i, 1) = norm(g);
+    Eigen::VectorXd y(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        const double eta = 0.1 * x(i, 1) + x.row(i).tail(num_cov).sum() * 0.3;
+        y(i) = unif(g) < 1.0 / (1.0 + std::exp(-eta)) ? 1.0 : 0.0;
+    }
+    Eigen::MatrixXd cov(n, num_cov + 1);
+    cov.col(0) = x.col(0);
+    cov.rightCols(num_cov) = x.rightCols(num_cov);
+    double p, r2, coeff, se;
+    double exp_p, exp_r2, exp_coeff, exp_se;
+    Eigen::VectorXd null_beta = Eigen::VectorXd::Constant(
+        1, std::log(y.mean() / (1.0 - y.mean())));
+    if (num_cov != 0)
+    {
+        Regression::glm(y, cov, p, r2, coeff, se, 1, &null_beta);
+    }
+    Regression::LogisticScoreTest score;
+    REQUIRE_FALSE(score.ready());
+    score.init(y, cov, null_beta);
+    REQUIRE(score.ready());
+    REQUIRE(score.run(x.col(1), p, r2, coeff, se));
+    // U = x'(y - mu) and V = x'Wx - x'WZ(Z'WZ)^-1 Z'Wx of the null model
+    const Eigen::VectorXd mu =
+        (1.0 + (-(cov * null_beta).array()).exp()).inverse().matrix();
+    const Eigen::VectorXd w = mu.array() * (1.0 - mu.array());
+    const Eigen::VectorXd zwx = cov.transpose() * w.cwiseProduct(x.col(1));
+    const Eigen::MatrixXd zwz = cov.transpose() * w.asDiagonal() * cov;
+    const double u = x.col(1).dot(y - mu);
+    const double v = x.col(1).dot(w.cwiseProduct(x.col(1)))
+                     - zwx.dot(zwz.ldlt().solve(zwx));
+    REQUIRE(coeff == Approx(u / v).epsilon(1e-8));
+    REQUIRE(se == Approx(1.0 / std::sqrt(v)).epsilon(1e-8));
+    // the score and Wald test agree for small effects
+    Regression::glm(y, x, exp_p, exp_r2, exp_coeff, exp_se, 1);
+    REQUIRE(coeff / se == Approx(exp_coeff / exp_se).epsilon(0.02));
+    REQUIRE(p == Approx(exp_p).epsilon(0.05));
+    REQUIRE(r2 == Approx(exp_r2).epsilon(0.05));
+    // the z-value of the observed residuals is that of the score test
+    Eigen::VectorXd x_w;
+    REQUIRE(score.direction(x.col(1), x_w));
+    REQUIRE(x_w.norm() == Approx(1.0));
+    REQUIRE(x_w.dot(score.residual()) == Approx(coeff / se).epsilon(1e-6));
+    REQUIRE(score.z_value(x.col(1), x_w) == Approx(coeff / se).epsilon(1e-6));
+    // PRS that is fully explained by the covariates is left to the GLM
+    x.col(1) = cov * Eigen::VectorXd::Constant(num_cov + 1, 0.5);
+    REQUIRE_FALSE(score.run(x.col(1), p, r2, coeff, se));
+    REQUIRE_FALSE(score.direction(x.col(1), x_w));
+    REQUIRE(score.z_value(x.col(1), x_w) == 0.0);
+    score.reset();
+    REQUIRE_FALSE(score.ready());
+}
+
+TEST_CASE("GLM Cholesky with QR fallback")
+{
+    const Eigen::Index n = 600;
+    std::mt19937 g(17);
+    std::normal_distribution<double> norm(0.0, 1.0);
+    std::uniform_real_distribution<double> unif(0.0, 1.0);
+    Eigen::MatrixXd x = Eigen::MatrixXd::Ones(n, 5);
+    for (Eigen::Index j = 1; j < x.cols(); ++j)
+        for (Eigen::Index i = 0; i < n; ++i) x(i, j) = norm(g);
+    // PRS are usually tiny, the rank check shouldn't depend on the scale
+    x.col(1) *= 1e-5;
+    Eigen::VectorXd y(n);
+    for (Eigen::Index i = 0; i < n; ++i)
+    {
+        const double eta = 3e4 * x(i, 1) + 0.3 * x(i, 2);
+        y(i) = unif(g) < 1.0 / (1.0 + std::exp(-eta)) ? 1.0 : 0.0;
+    }
+    const bool collinear = GENERATE(false, true);
+    if (collinear) x.col(4) = x.col(2) - 2.0 * x.col(3);
+    Binomial family;
+    GLM<Binomial> llt(x, y, family), qr(x, y, family);
+    qr.set_llt_first(false);
+    llt.init_parms();
+    llt.solve();
+    qr.init_parms();
+    qr.solve();
+    REQUIRE(llt.has_converged());
+    REQUIRE(llt.full_rank() == !collinear);
+    REQUIRE(qr.full_rank() == !collinear);
+    REQUIRE(llt.deviance() == Approx(qr.deviance()).epsilon(1e-10));
+    for (Eigen::Index i = 0; i < 3; ++i)
+    {
+        double p, coeff, se, exp_p, exp_coeff, exp_se;
+        llt.get_stat(i, p, coeff, se);
+        qr.get_stat(i, exp_p, exp_coeff, exp_se);
+        REQUIRE(coeff == Approx(exp_coeff).epsilon(1e-8));
+        REQUIRE(se == Approx(exp_se).epsilon(1e-8));
+    }
+}
@@ -26,18 +26,68 @@ public:
     {
         return calc_freq_gen_inter(filter_info, "", this);
     }
+    bool test_perform_freqs_and_inter(const QCFiltering& filter_info)
+    {
+        return perform_freqs_and_inter(filter_info, "", this);
+    }
+    void set_thread(size_t thread) { m_thread = thread; }
+    void set_min_qc_snp_per_thread(size_t num_snp)
+    {
+        m_min_qc_snp_per_thread = num_snp;
+    }
+    size_t num_geno_filter() const { return m_num_geno_filter; }
+    size_t num_maf_filter() const { return m_num_maf_filter; }
+    size_t num_miss_filter() const { return m_num_miss_filter; }
     void manual_load_snp(SNP cur)
     {
         m_existed_snps_index[cur.rs()] = m_existed_snps.size();
-        m_existed_snps.emplace_back(cur);
+        m_existed_snps.emplace_back(std::make_unique<SNP>(std::move(cur)));
     }
     std::vector<std::pair<size_t, size_t>> test_get_chrom_boundary()
     {
         return get_chrom_boundary();
     }
+    std::vector<std::pair<size_t, size_t>> test_get_clump_segments()
+    {
+        return get_clump_segments(Clumping(), *this, 0, 1);
+    }
+    std::vector<std::pair<size_t, size_t>>
+    test_get_clump_segments(const Clumping& clump_info, size_t max_segment_snp,
+                            size_t threads)
+    {
+        return get_clump_segments(clump_info, *this, max_segment_snp, threads);
+    }
     std::vector<size_t> sorted_p_index() { return m_sort_by_p_index; }
-    std::vector<SNP>& existed_snps() { return m_existed_snps; }
+    std::vector<std::unique_ptr<SNP>>& existed_snps() { return m_existed_snps; }
     void set_sample(uintptr_t n_sample) { m_unfiltered_sample_ct = n_sample; }
+    void set_min_prefetch_snp(size_t num_snp) { m_min_prefetch_snp = num_snp; }
+    void test_read_score(SamplePRS& prs,
+                         const std::vector<size_t>::const_iterator& start,
+                         const std::vector<size_t>::const_iterator& end,
+                         bool reset_zero)
+    {
+        read_score(prs, start, end, reset_zero, *m_score_buffer.front());
+    }
+    void test_load_score_column(SamplePRS& prs, const Eigen::Index col,
+                                const bool reset) const
+    {
+        load_score_column(prs, col, reset);
+    }
+    void set_max_score_matrix_byte(size_t byte)
+    {
+        m_max_score_matrix_byte = byte;
+    }
+    void set_min_score_snp_per_thread(size_t num_snp)
+    {
+        m_min_score_snp_per_thread = num_snp;
+    }
+    const Eigen::MatrixXd& score_matrix() const { return m_score_matrix; }
+    const Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic>&
+    count_matrix() const
+    {
+        return m_count_matrix;
+    }
+    void add_sample(const Sample_ID& sample) { m_sample_id.push_back(sample); }
     void set_reporter(Reporter* reporter) { m_reporter = reporter; }
     void test_post_sample_read_init() { post_sample_read_init(); }
     void test_init_sample_vectors() { init_sample_vectors(); }
@@ -58,13 +108,15 @@ public:
     }
     void test_read_genotype(const SNP& snp, uintptr_t* genotype, bool is_ref)
     {
-        read_genotype(snp, m_founder_ct, m_genotype_file, m_tmp_genotype.data(),
-                      genotype, m_sample_for_ld.data(), is_ref);
+        read_genotype(std::make_unique<SNP>(snp), m_founder_ct, m_genotype_file,
+                      m_tmp_genotype.data(), genotype,
+                      m_sample_for_ld.data(), is_ref);
     }
     void test_read_genotype(uintptr_t* genotype, SNP& snp)
     {
-        read_genotype(snp, m_founder_ct, m_genotype_file, m_tmp_genotype.data(),
-                      genotype, m_sample_for_ld.data());
+        read_genotype(std::make_unique<SNP>(snp), m_founder_ct, m_genotype_file,
+                      m_tmp_genotype.data(), genotype,
+                      m_sample_for_ld.data());
     }
     void gen_fake_bed_from_int(const std::vector<std::vector<uintptr_t>>& geno,
                                const std::string& name,
@@ -73,6 +125,7 @@ public:
         std::ofstream plink(name + ".bed", std::ios::binary);
         m_genotype_file_names.clear();
         m_genotype_file_names.push_back(name);
+        m_bed_names.assign(1, name + ".bed");
         std::bitset<8> b;
         char ch[1];
         // generate header so we can use plink to validate our file
@@ -125,6 +178,7 @@ public:
     void add_file_name(const std::string& in)
     {
         m_genotype_file_names.push_back(in);
+        m_bed_names.push_back(in + ".bed");
     }
     void set_founder_vector(const size_t n_sample)
     {
@@ -137,9 +191,11 @@ public:
     { // it is a real bed file, but without the header
         std::ofstream plink(name + ".bed", std::ios::binary);
         m_existed_snps.clear();
-        m_existed_snps.push_back(SNP("rs", 1, 1, "A", "T", 0, 3));
+        m_existed_snps.push_back(
+            std::make_unique<SNP>("rs", 1, 1, "A", "T", 0, 3));
         m_genotype_file_names.clear();
         m_genotype_file_names.push_back(name);
+        m_bed_names.assign(1, name + ".bed");
         std::bitset<8> b;
         char ch[1];
         // generate header so we can use plink to validate our file
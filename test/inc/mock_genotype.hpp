@@ -109,6 +109,10 @@ public:
     {
         return get_chrom_boundary();
     }
+    std::vector<std::pair<size_t, size_t>> test_get_clump_segments()
+    {
+        return get_clump_segments(Clumping(), *this, 0, 1);
+    }
     void test_post_sample_read_init() { post_sample_read_init(); }
     bool test_parse_rs_id(const std::vector<std::string_view>& token,
                           const BaseFile& base_file,
@@ -116,8 +120,9 @@ public:
                           std::unordered_set<std::string>& dup_index,
                           std::vector<size_t>& filter_count, std::string& rs_id)
     {
+        std::string chr_id;
         return parse_rs_id(token, base_file, processed_rs, dup_index,
-                           filter_count, rs_id);
+                           filter_count, rs_id, chr_id);
     }
     unsigned long long
     test_cal_bar_category(const double& pvalue,
@@ -173,16 +178,21 @@ public:
         std::unordered_set<std::string>& duplicated_snps,
         std::vector<bool>& retain_snp, Genotype* genotype)
     {
-        return process_snp(exclusion_regions, mismatch_snp_record_name,
-                           mismatch_source, snpid, snp, processed_snps,
-                           duplicated_snps, retain_snp, genotype);
+        auto ptr = std::make_unique<SNP>(snp);
+        const bool res = process_snp(exclusion_regions,
+                                     mismatch_snp_record_name, mismatch_source,
+                                     snpid, ptr, processed_snps,
+                                     duplicated_snps, retain_snp, genotype);
+        snp = *ptr;
+        return res;
     }
 
     bool test_not_in_xregion(
         const std::vector<IITree<size_t, size_t>>& exclusion_regions,
         const SNP& base, const SNP& target)
     {
-        return not_in_xregion(exclusion_regions, base, target);
+        return not_in_xregion(exclusion_regions, std::make_unique<SNP>(base),
+                              std::make_unique<SNP>(target));
     }
     void add_select_sample(const std::string& in)
     {
@@ -207,14 +217,18 @@ public:
     void load_snp(const std::string& rs)
     {
         m_existed_snps_index[rs] = m_existed_snps.size();
-        m_existed_snps.emplace_back(SNP(rs, 1, 1, "A", "C", 0, 0, 1, 1));
+        m_existed_snps.emplace_back(
+            std::make_unique<SNP>(rs, 1, 1, "A", "C", 0, 0, 1, 1));
     }
     void load_snp(SNP snp)
     {
         m_existed_snps_index[snp.rs()] = m_existed_snps.size();
-        m_existed_snps.emplace_back(snp);
+        m_existed_snps.emplace_back(std::make_unique<SNP>(std::move(snp)));
+    }
+    std::vector<std::unique_ptr<SNP>>& modify_existed_snps()
+    {
+        return m_existed_snps;
     }
-    std::vector<SNP>& modify_existed_snps() { return m_existed_snps; }
     uint32_t num_auto() const { return m_autosome_ct; }
     std::vector<int32_t> xymt_codes() const { return m_xymt_codes; }
     std::vector<uintptr_t> haploid_mask() const { return m_haploid_mask; }
@@ -227,7 +241,12 @@ public:
     {
         m_genotype_file_names.push_back(in);
     }
-    std::vector<SNP> existed_snps() const { return m_existed_snps; }
+    std::vector<SNP> existed_snps() const
+    {
+        std::vector<SNP> res;
+        for (auto&& snp : m_existed_snps) res.push_back(*snp);
+        return res;
+    }
     std::unordered_map<std::string, size_t> existed_snps_idx() const
     {
         return m_existed_snps_index;
@@ -273,6 +292,12 @@ public:
         return get_r2(founder_ctl2, founder_ctv2, window_data_ptr, index_data,
                       index_tots);
     }
+    double test_get_r2(uint32_t* counts) { return get_r2(counts); }
+    double test_max_r2(const uint32_t* counts) { return max_r2(counts); }
+    double test_get_dosage_r2(const uint32_t* counts)
+    {
+        return get_dosage_r2(counts);
+    }
     void set_sample_vector(const std::vector<bool>& selected_samples)
     {
         m_unfiltered_sample_ct = selected_samples.size();
@@ -323,7 +348,7 @@ public:
     }
     void set_very_small_thresholds() { m_very_small_thresholds = true; }
     std::vector<uintptr_t>& std_exclusion_flag() { return m_exclude_from_std; }
-    void test_read_prs(uintptr_t* genotype, std::vector<PRS>& prs_list,
+    void test_read_prs(uintptr_t* genotype, SamplePRS& prs_list,
                        const size_t ploidy, const double stat,
                        const double adj_score, const double miss_score,
                        const size_t miss_count, const double homcom_weight,
@@ -339,11 +364,11 @@ public:
     bool has_chr_formula() { return m_has_chr_id_formula; }
     std::string test_chr_id_from_genotype(const SNP& snp) const
     {
-        return chr_id_from_genotype(snp);
+        return chr_id_from_genotype(std::make_unique<SNP>(snp));
     }
     std::string
     test_get_chr_id_from_base(const BaseFile& base_file,
-                              const std::vector<std::string_view>& token) const
+                              const std::vector<std::string_view>& token)
     {
         return get_chr_id_from_base(base_file, token);
     }
@@ -160,6 +160,31 @@ public:
                                      std::move(cov_file));
     }
     Eigen::MatrixXd& get_independent() { return m_independent_variables; }
+    void set_perm_limit(const size_t max_block, const size_t max_index_byte)
+    {
+        m_max_perm_block = max_block;
+        m_max_perm_index_byte = max_index_byte;
+    }
+    size_t num_cached_perm() const { return m_num_cached_perm; }
+    std::vector<double> test_permutation(const int n_thread)
+    {
+        m_perm_result.assign(m_perm_info.num_permutation, 0);
+        gen_perm_index();
+        permutation(n_thread);
+        return m_perm_result;
+    }
+    // absolute T-value of every column of block, solved with the projector
+    // of the linear permutation
+    void test_null_perm_block(const Eigen::MatrixXd& block,
+                              std::vector<double>& obs_t)
+    {
+        Regress decomposed;
+        pre_decompose_matrix(m_independent_variables, decomposed);
+        Eigen::MatrixXd projector;
+        get_perm_projector(decomposed, projector);
+        null_perm_block(block, projector, decomposed.se(1), PERM_MODEL::LINEAR,
+                        obs_t);
+    }
     void init_independent(size_t sample, size_t col)
     {
         m_independent_variables = Eigen::MatrixXd::Zero(